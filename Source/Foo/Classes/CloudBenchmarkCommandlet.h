@@ -0,0 +1,36 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "CloudBenchmarkCommandlet.generated.h"
+
+/**
+ * Benchmarks the CPU side of the clouds and checks the CPU reference against golden images, without a GPU.
+ *
+ *   UnrealEditor-Cmd <Project> -run=CloudBenchmark -nullrhi -unattended
+ *     -threads=1,2,4,8   thread counts of the math benchmarks, default 1 up to every core in powers of two
+ *     -mintime=0.25      seconds to run every benchmark for at least
+ *     -csv=<Path>        also write the results as CSV
+ *     -json=<Path>       also write the results as JSON
+ *     -baseline=<Path>   results to compare against, default Saved/Clouds/Benchmark/Baseline.json
+ *     -updatebaseline    writes the baseline instead of checking it
+ *     -regression=0.2    fraction a benchmark may be slower than its baseline
+ *     -golden=<Dir>      golden images, default Resources/Golden of the plugin
+ *     -updategolden      writes the golden images instead of checking them, after an intended change
+ *     -tolerance=0.002   maximum RMS error against the golden images
+ *     -nobenchmark / -nogolden
+ *
+ * The render thread cost of FCloudSceneViewExtension is covered by the Plugins.Foo.Clouds.Perf
+ * automation tests instead, see CloudExtensionPerfTests.cpp.
+ *
+ * Returns non-zero if a benchmark regressed past its baseline, or a golden image is missing or differs.
+ */
+UCLASS()
+class UCloudBenchmarkCommandlet : public UCommandlet
+{
+	GENERATED_UCLASS_BODY()
+
+	//~ Begin UCommandlet Interface
+	virtual int32 Main(const FString& Params) override;
+	//~ End UCommandlet Interface
+};
@@ -0,0 +1,26 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "CloudBrickImportCommandlet.generated.h"
+
+/**
+ * Converts authored cloud density to a sparse brick volume file (.cbv) for UCloudVolumeComponent::BrickVolumePath.
+ *
+ *   UnrealEditor-Cmd <Project> -run=CloudBrickImport -nullrhi -unattended -out=<Path>
+ *     -raw=<Path>        dense 8 bit volume, X major, as exported by most voxel tools
+ *     -size=X,Y,Z        voxels of the raw volume
+ *     -procedural        writes a cluster of cumulus shapes instead, for trying the streaming out
+ *     -bricksize=8       voxels per brick axis, must match the other volumes of the scene
+ *
+ * Returns non-zero if the input could not be read or the file could not be written.
+ */
+UCLASS()
+class UCloudBrickImportCommandlet : public UCommandlet
+{
+	GENERATED_UCLASS_BODY()
+
+	//~ Begin UCommandlet Interface
+	virtual int32 Main(const FString& Params) override;
+	//~ End UCommandlet Interface
+};
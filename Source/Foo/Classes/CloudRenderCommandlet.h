@@ -0,0 +1,38 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "CloudRenderCommandlet.generated.h"
+
+/**
+ * Renders the clouds on the CPU to an EXR, without a GPU, see FCloudOfflineRenderer.
+ *
+ *   UnrealEditor-Cmd <Project> -run=CloudRender -nullrhi -unattended -out=<Path>.exr
+ *     -size=1920x1080        image size
+ *     -camera=X,Y,Z          camera position, default below the volume of the golden images
+ *     -rotation=P,Y,R        camera rotation in degrees
+ *     -fov=90                horizontal field of view in degrees
+ *     -volumes=<Boxes>       volumes as MinX,MinY,MinZ,MaxX,MaxY,MaxZ[,Coverage[,DensityScale]] separated
+ *                            by ';', default the volume of the golden images
+ *     -brick=<Path>          authored density of every volume from a brick volume file (.cbv)
+ *     -weather=<Path>        weather map (.cwm), sampled at the resolution of its overview
+ *     -time=0                game time in seconds, moves the clouds with the wind
+ *     -steps=128             march steps per volume, -lightsteps=8 towards the sun
+ *     -passes=16             samples per pixel
+ *     -progressive           rewrites the EXR after every pass
+ *     -threads=0             workers, 0 for one per core
+ *     -tilesize=32           pixels per tile axis
+ *     -scaling               also renders a pass with 1 worker up to every core and logs the speedup
+ *
+ * The EXR holds premultiplied luminance and the cloud opacity in alpha.
+ * Returns non-zero if the arguments are invalid or the image could not be written.
+ */
+UCLASS()
+class UCloudRenderCommandlet : public UCommandlet
+{
+	GENERATED_UCLASS_BODY()
+
+	//~ Begin UCommandlet Interface
+	virtual int32 Main(const FString& Params) override;
+	//~ End UCommandlet Interface
+};
@@ -0,0 +1,33 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Commandlets/Commandlet.h"
+#include "CloudReplayCommandlet.generated.h"
+
+/**
+ * Replays a trace recorded with r.Clouds.Trace without a GPU and reports the time every frame took, so
+ * spikes seen in the field can be reproduced and profiled offline, see FCloudTraceReader.
+ *
+ *   UnrealEditor-Cmd <Project> -run=CloudReplay -nullrhi -unattended -trace=<Path>.ctr
+ *     -frames=0              frames to replay, 0 for all
+ *     -nomarch               only replays the volume updates and culling
+ *     -scale=0.25            fraction of the recorded march resolution the views are marched at on the CPU
+ *     -threads=0             workers of the march, 0 for one per core
+ *     -worst=10              slowest frames to list
+ *     -csv=<Path>            also write the per frame timings as CSV
+ *
+ * Every frame applies its volume changes to an FCloudVolumeRegistry, culls every view like
+ * FCloudSceneViewExtension does and marches the visible volumes with the CPU reference. Weather and
+ * authored brick volumes are not part of the trace, so the march uses neutral weather and no bricks.
+ *
+ * Returns non-zero if the trace cannot be read or the CSV could not be written.
+ */
+UCLASS()
+class UCloudReplayCommandlet : public UCommandlet
+{
+	GENERATED_UCLASS_BODY()
+
+	//~ Begin UCommandlet Interface
+	virtual int32 Main(const FString& Params) override;
+	//~ End UCommandlet Interface
+};
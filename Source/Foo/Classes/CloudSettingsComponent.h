@@ -0,0 +1,71 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/ObjectMacros.h"
+#include "Components/ActorComponent.h"
+#include "CloudSettingsComponent.generated.h"
+
+struct FCloudSettings;
+
+/**
+ * Wind and lighting of the clouds rendered by FCloudSceneViewExtension. Changes are picked up once per
+ * frame, so setting several properties costs no more than setting one. With several registered
+ * components the last one changed wins; the defaults return once none is registered.
+ */
+UCLASS(MinimalAPI, ClassGroup = Rendering, meta = (BlueprintSpawnableComponent))
+class UCloudSettingsComponent : public UActorComponent
+{
+	GENERATED_UCLASS_BODY()
+
+	/** Wind velocity in world units per second. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Clouds")
+	FVector WindVelocity = FVector(100.0, 30.0, 0.0);
+
+	/** World size of one tile of the shape and detail noise. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Clouds", meta = (ClampMin = "1"))
+	float ShapeTileSize = 800.0f;
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Clouds", meta = (ClampMin = "1"))
+	float DetailTileSize = 150.0f;
+
+	/** How much the detail noise erodes the edges of the shape. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Clouds", meta = (ClampMin = "0", ClampMax = "1"))
+	float DetailStrength = 0.35f;
+
+	/** Extinction per world unit at density 1. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Clouds", meta = (ClampMin = "0"))
+	float Extinction = 0.02f;
+
+	/** Direction towards the sun. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Clouds|Lighting")
+	FVector SunDirection = FVector(0.5, 0.3, 0.8);
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Clouds|Lighting")
+	FLinearColor SunIlluminance = FLinearColor(3.0f, 2.85f, 2.7f);
+
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Clouds|Lighting")
+	FLinearColor AmbientIlluminance = FLinearColor(0.25f, 0.3f, 0.4f);
+
+	/** Henyey-Greenstein asymmetry of the scattering, from backward (-1) to forward (1). */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Clouds|Lighting", meta = (ClampMin = "-0.99", ClampMax = "0.99"))
+	float PhaseG = 0.5f;
+
+	/** Pushes the properties to the renderer after they were changed at runtime. */
+	UFUNCTION(BlueprintCallable, Category = "Clouds")
+	void MarkCloudSettingsDirty();
+
+protected:
+	//~ Begin UActorComponent Interface
+	virtual void OnRegister() override;
+	virtual void OnUnregister() override;
+	//~ End UActorComponent Interface
+
+#if WITH_EDITOR
+	virtual void PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent) override;
+#endif
+
+private:
+	FCloudSettings GetCloudSettings() const;
+
+	bool bRegisteredSettings = false;
+};
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "UObject/ObjectMacros.h"
+#include "Components/SceneComponent.h"
+#include "CloudVolumeComponent.generated.h"
+
+struct FCloudVolume;
+
+/** An axis aligned box of clouds rendered by FCloudSceneViewExtension. Rotation of the component is ignored. */
+UCLASS(MinimalAPI, ClassGroup = Rendering, meta = (BlueprintSpawnableComponent))
+class UCloudVolumeComponent : public USceneComponent
+{
+	GENERATED_UCLASS_BODY()
+
+	/** Half size of the volume before the component scale is applied. */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Clouds")
+	FVector Extent = FVector(5000.0, 5000.0, 1000.0);
+
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Clouds", meta = (ClampMin = "0"))
+	float DensityScale = 1.0f;
+
+	/** Fraction of the volume covered by clouds. */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Clouds", meta = (ClampMin = "0", ClampMax = "1"))
+	float Coverage = 0.6f;
+
+	/**
+	 * Brick volume file (.cbv, see UCloudBrickImportCommandlet) relative to the project directory. Its
+	 * authored density, scaled by DensityScale, replaces the procedural clouds; Coverage is ignored.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadOnly, Category = "Clouds")
+	FString BrickVolumePath;
+
+	/** Pushes Extent, DensityScale and Coverage to the renderer after they were changed at runtime. */
+	UFUNCTION(BlueprintCallable, Category = "Clouds")
+	void MarkCloudVolumeDirty();
+
+	//~ Begin USceneComponent Interface
+	virtual FBoxSphereBounds CalcBounds(const FTransform& LocalToWorld) const override;
+	//~ End USceneComponent Interface
+
+protected:
+	//~ Begin UActorComponent Interface
+	virtual void OnRegister() override;
+	virtual void OnUnregister() override;
+	virtual void OnUpdateTransform(EUpdateTransformFlags UpdateTransformFlags, ETeleportType Teleport = ETeleportType::None) override;
+	//~ End UActorComponent Interface
+
+#if WITH_EDITOR
+	virtual void PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent) override;
+#endif
+
+private:
+	FCloudVolume GetCloudVolume() const;
+
+	void AddBrickVolume();
+	void RemoveBrickVolume();
+
+	// Id in FCloudSceneViewExtension, 0 while not registered.
+	uint32 CloudVolumeId = 0;
+
+	// Id of BrickVolumePath in FCloudSceneViewExtension, 0 without one.
+	uint32 BrickVolumeId = 0;
+};
@@ -23,18 +23,42 @@ struct FDrawToTargetParams
 	UPROPERTY(Interp, EditAnywhere, BlueprintReadWrite, Category = "Foo")
 	FVector2D Scale;
 
+	/** Whether the pattern animates with game time. Static draws can be skipped when their parameters did not change. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Foo")
+	bool bAnimated = true;
+
 	void DrawToRenderTarget(
 		class UWorld* World,
 		class UTextureRenderTarget2D* OutputRenderTarget) const;
 
+	/**
+	 * Draws every target with its params in a single render command. Params may hold a single entry shared by all targets.
+	 * With bSkipUnchanged, targets whose params, game time and size are the same as on their last draw are not redrawn.
+	 */
+	static void DrawToRenderTargets(
+		class UWorld* World,
+		TArrayView<const FDrawToTargetParams> Params,
+		TArrayView<class UTextureRenderTarget2D* const> OutputRenderTargets,
+		bool bSkipUnchanged);
+
 	bool operator == (const FDrawToTargetParams& Other) const
 	{
 		return (
-			Blah == Other.Blah);
+			Blah == Other.Blah &&
+			Scale == Other.Scale &&
+			bAnimated == Other.bAnimated);
 	}
 
 	bool operator != (const FDrawToTargetParams& Other) const
 	{
 		return !(*this == Other);
 	}
+
+	friend uint32 GetTypeHash(const FDrawToTargetParams& Params)
+	{
+		uint32 Hash = GetTypeHash(Params.Blah);
+		Hash = HashCombine(Hash, GetTypeHash(Params.Scale));
+		Hash = HashCombine(Hash, GetTypeHash(Params.bAnimated));
+		return Hash;
+	}
 };
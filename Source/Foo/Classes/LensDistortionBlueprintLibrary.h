@@ -21,6 +21,18 @@ class UFooBlueprintLibrary : public UBlueprintFunctionLibrary
 		class UTextureRenderTarget2D* OutputRenderTarget
 		);
 
+	/**
+	 * Draws many render targets in a single render command. Params holds one entry per target, or a single entry shared by all.
+	 * With bSkipUnchanged, targets are only redrawn when their params, size or (for animated params) game time changed.
+	 */
+	UFUNCTION(BlueprintCallable, Category = "Foo", meta = (WorldContext = "WorldContextObject", AdvancedDisplay = "bSkipUnchanged"))
+	static void DrawToRenderTargets(
+		const UObject* WorldContextObject,
+		const TArray<FDrawToTargetParams>& Params,
+		const TArray<class UTextureRenderTarget2D*>& OutputRenderTargets,
+		bool bSkipUnchanged = true
+		);
+
 	/* Returns true if A is equal to B (A == B) */
 	UFUNCTION(BlueprintPure, meta=(DisplayName = "Equal (DrawToTargetControl)", CompactNodeTitle = "==", Keywords = "== equal"), Category = "Foo")
 	static bool EqualEqual_CompareLensDistortionModels(
@@ -40,6 +40,8 @@ public class Foo : ModuleRules
 				"Engine",
 				"Renderer",
 				"Projects",
+				"ImageCore",
+				"Json",
 				// ... add private dependencies that you statically link with here ...	
 			}
 			);
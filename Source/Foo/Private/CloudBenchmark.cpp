@@ -0,0 +1,180 @@
+#include "CloudBenchmark.h"
+#include "CloudStats.h"
+
+#include "Async/ParallelFor.h"
+#include "Dom/JsonObject.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+#include "Serialization/JsonReader.h"
+#include "Serialization/JsonSerializer.h"
+
+namespace CloudBenchmark
+{
+
+FResult Run(const TCHAR* Name, int32 NumThreads, int32 BatchSize, double MinTime, TFunctionRef<float(int32 Begin, int32 End)> Work)
+{
+	TArray<float> Sinks;
+	Sinks.SetNumZeroed(NumThreads);
+
+	FResult Result;
+	Result.Name = Name;
+	Result.NumThreads = NumThreads;
+
+	const double StartTime = FPlatformTime::Seconds();
+	do
+	{
+		ParallelFor(NumThreads, [&](int32 Chunk)
+		{
+			const int32 Begin = int32(int64(BatchSize) * Chunk / NumThreads);
+			const int32 End = int32(int64(BatchSize) * (Chunk + 1) / NumThreads);
+			Sinks[Chunk] += Work(Begin, End);
+		}, NumThreads == 1 ? EParallelForFlags::ForceSingleThread : EParallelForFlags::Unbalanced);
+
+		Result.NumSamples += BatchSize;
+		Result.Seconds = FPlatformTime::Seconds() - StartTime;
+	}
+	while (Result.Seconds < MinTime);
+
+	float Sink = 0.0f;
+	for (float Value : Sinks)
+	{
+		Sink += Value;
+	}
+	UE_LOG(LogClouds, Verbose, TEXT("%s sink %f"), Name, Sink);
+
+	return Result;
+}
+
+// ================================================================================================
+
+FString WriteResultsJson(TConstArrayView<FResult> Results)
+{
+	TArray<TSharedPtr<FJsonValue>> Entries;
+	for (const FResult& Result : Results)
+	{
+		TSharedRef<FJsonObject> Entry = MakeShared<FJsonObject>();
+		Entry->SetStringField(TEXT("Name"), Result.Name);
+		Entry->SetNumberField(TEXT("Threads"), Result.NumThreads);
+		Entry->SetNumberField(TEXT("Samples"), double(Result.NumSamples));
+		Entry->SetNumberField(TEXT("Seconds"), Result.Seconds);
+		Entry->SetNumberField(TEXT("NsPerSample"), Result.GetNsPerSample());
+		Entry->SetNumberField(TEXT("SamplesPerSecond"), Result.GetSamplesPerSecond());
+		Entries.Add(MakeShared<FJsonValueObject>(Entry));
+	}
+
+	TSharedRef<FJsonObject> Root = MakeShared<FJsonObject>();
+	Root->SetStringField(TEXT("Platform"), FPlatformProperties::IniPlatformName());
+	Root->SetStringField(TEXT("Cpu"), FPlatformMisc::GetCPUBrand());
+	Root->SetArrayField(TEXT("Benchmarks"), Entries);
+
+	FString Json;
+	FJsonSerializer::Serialize(Root, TJsonWriterFactory<>::Create(&Json));
+	return Json;
+}
+
+FString WriteResultsCsv(TConstArrayView<FResult> Results)
+{
+	FString Csv = TEXT("Benchmark,Threads,Samples,Seconds,NsPerSample,SamplesPerSecond\n");
+	for (const FResult& Result : Results)
+	{
+		Csv += FString::Printf(TEXT("%s,%d,%lld,%f,%f,%f\n"), *Result.Name, Result.NumThreads, Result.NumSamples, Result.Seconds, Result.GetNsPerSample(), Result.GetSamplesPerSecond());
+	}
+	return Csv;
+}
+
+bool LoadResultsJson(const FString& Path, TArray<FResult>& OutResults)
+{
+	OutResults.Reset();
+
+	FString Json;
+	TSharedPtr<FJsonObject> Root;
+	const TArray<TSharedPtr<FJsonValue>>* Entries = nullptr;
+	if (!FFileHelper::LoadFileToString(Json, *Path) || !FJsonSerializer::Deserialize(TJsonReaderFactory<>::Create(Json), Root) || !Root.IsValid()
+		|| !Root->TryGetArrayField(TEXT("Benchmarks"), Entries))
+	{
+		return false;
+	}
+
+	for (const TSharedPtr<FJsonValue>& Value : *Entries)
+	{
+		const TSharedPtr<FJsonObject>& Entry = Value->AsObject();
+		if (Entry.IsValid())
+		{
+			FResult& Result = OutResults.AddDefaulted_GetRef();
+			Result.Name = Entry->GetStringField(TEXT("Name"));
+			Result.NumThreads = int32(Entry->GetNumberField(TEXT("Threads")));
+			Result.NumSamples = int64(Entry->GetNumberField(TEXT("Samples")));
+			Result.Seconds = Entry->GetNumberField(TEXT("Seconds"));
+		}
+	}
+	return true;
+}
+
+bool MergeResults(const FString& Path, TConstArrayView<FResult> Results)
+{
+	TArray<FResult> Merged;
+	LoadResultsJson(Path, Merged);
+
+	for (const FResult& Result : Results)
+	{
+		FResult* Existing = Merged.FindByPredicate([Key = Result.GetKey()](const FResult& Other) { return Other.GetKey() == Key; });
+		if (Existing)
+		{
+			*Existing = Result;
+		}
+		else
+		{
+			Merged.Add(Result);
+		}
+	}
+
+	const FString CsvPath = FPaths::ChangeExtension(Path, TEXT("csv"));
+	if (!FFileHelper::SaveStringToFile(WriteResultsJson(Merged), *Path) || !FFileHelper::SaveStringToFile(WriteResultsCsv(Merged), *CsvPath))
+	{
+		UE_LOG(LogClouds, Error, TEXT("Failed to write %s"), *Path);
+		return false;
+	}
+	return true;
+}
+
+FString GetDefaultPath(const TCHAR* Name)
+{
+	return FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("Clouds"), TEXT("Benchmark"), FString(Name) + TEXT(".json"));
+}
+
+bool CheckBaseline(TConstArrayView<FResult> Results, const FString& BaselinePath, float MaxRegression, TArray<FString>& OutErrors, TArray<FString>& OutWarnings)
+{
+	TArray<FResult> Baselines;
+	if (!LoadResultsJson(BaselinePath, Baselines))
+	{
+		OutErrors.Add(FString::Printf(TEXT("No benchmark baseline at %s, write one on this machine first"), *BaselinePath));
+		return false;
+	}
+
+	TMap<FString, double> BaselineNs;
+	for (const FResult& Baseline : Baselines)
+	{
+		BaselineNs.Add(Baseline.GetKey(), Baseline.GetNsPerSample());
+	}
+
+	bool bPassed = true;
+	for (const FResult& Result : Results)
+	{
+		const double* Baseline = BaselineNs.Find(Result.GetKey());
+		if (!Baseline)
+		{
+			OutWarnings.Add(FString::Printf(TEXT("%s has no baseline"), *Result.GetKey()));
+			continue;
+		}
+
+		if (Result.GetNsPerSample() > *Baseline * (1.0 + MaxRegression))
+		{
+			OutErrors.Add(FString::Printf(TEXT("%s regressed: %.1f ns/sample, baseline %.1f"), *Result.GetKey(), Result.GetNsPerSample(), *Baseline));
+			bPassed = false;
+		}
+	}
+
+	return bPassed;
+}
+
+} // namespace CloudBenchmark
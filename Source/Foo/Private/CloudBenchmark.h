@@ -0,0 +1,55 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+/**
+ * Timing and baselines shared by UCloudBenchmarkCommandlet and the render thread performance tests.
+ * Results are kept as JSON, one file per set of benchmarks, and a baseline is a results file written
+ * on the same machine.
+ */
+namespace CloudBenchmark
+{
+
+struct FResult
+{
+	FString Name;
+	int32 NumThreads = 0;
+	int64 NumSamples = 0;
+	double Seconds = 0.0;
+
+	double GetNsPerSample() const { return Seconds * 1e9 / double(FMath::Max<int64>(NumSamples, 1)); }
+	double GetSamplesPerSecond() const { return double(NumSamples) / FMath::Max(Seconds, 1e-9); }
+
+	/** Identifies the result in the baseline file. */
+	FString GetKey() const { return FString::Printf(TEXT("%s@%d"), *Name, NumThreads); }
+};
+
+/**
+ * Runs Work over BatchSize samples split into NumThreads chunks, repeating until MinTime passed.
+ * Work returns a value derived from its results, so the compiler cannot drop the evaluation.
+ */
+FResult Run(const TCHAR* Name, int32 NumThreads, int32 BatchSize, double MinTime, TFunctionRef<float(int32 Begin, int32 End)> Work);
+
+FString WriteResultsJson(TConstArrayView<FResult> Results);
+FString WriteResultsCsv(TConstArrayView<FResult> Results);
+
+/** Results of a file written by WriteResultsJson. Returns false if it is missing or not a results file. */
+bool LoadResultsJson(const FString& Path, TArray<FResult>& OutResults);
+
+/**
+ * Adds Results to the JSON file at Path, replacing those with the same key and keeping the others, so
+ * benchmarks run one at a time build up a single file. Also writes it as CSV next to it.
+ */
+bool MergeResults(const FString& Path, TConstArrayView<FResult> Results);
+
+/** Saved/Clouds/Benchmark/<Name>.json */
+FString GetDefaultPath(const TCHAR* Name);
+
+/**
+ * Returns false if the baseline file is missing or a result is slower than its baseline by more than
+ * MaxRegression, a fraction of the baseline, with the reasons in OutErrors. Results the file has no
+ * entry for, such as new benchmarks, only add to OutWarnings.
+ */
+bool CheckBaseline(TConstArrayView<FResult> Results, const FString& BaselinePath, float MaxRegression, TArray<FString>& OutErrors, TArray<FString>& OutWarnings);
+
+} // namespace CloudBenchmark
@@ -0,0 +1,343 @@
+#include "CloudBenchmarkCommandlet.h"
+#include "CloudBenchmark.h"
+#include "CloudNoiseBaker.h"
+#include "CloudOccupancy.h"
+#include "CloudRaymarch.h"
+#include "CloudStats.h"
+
+#include "ImageCore.h"
+#include "ImageUtils.h"
+#include "Interfaces/IPluginManager.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+namespace CloudBenchmark
+{
+
+/** The scene every benchmark and golden image uses. Changing it invalidates the golden images. */
+static FCloudMarchSettings MakeSettings()
+{
+	FCloudMarchSettings Settings;
+	Settings.ShapeNoise = CloudNoise::BakeOrLoadCached(FCloudNoiseBakeSettings::Shape());
+	Settings.DetailNoise = CloudNoise::BakeOrLoadCached(FCloudNoiseBakeSettings::Detail());
+	Settings.Occupancy = FCloudOccupancyPyramid::Build(*Settings.ShapeNoise);
+	return Settings;
+}
+
+static FCloudVolume MakeVolume()
+{
+	FCloudVolume Volume;
+	Volume.BoundsMin = FVector3f(-5000.0f, -5000.0f, 2000.0f);
+	Volume.BoundsMax = FVector3f(5000.0f, 5000.0f, 4000.0f);
+	return Volume;
+}
+
+static TArray<FResult> RunMathBenchmarks(const FCloudMarchSettings& Settings, TConstArrayView<int32> ThreadCounts, double MinTime)
+{
+	const FCloudVolume Volume = MakeVolume();
+
+	// Inputs are generated up front, so only the cloud math is timed.
+	static constexpr int32 BatchSize = 16384;
+	FRandomStream Random(0x436c6f75);
+
+	TArray<FVector3f> Points;
+	TArray<FVector3f> Directions;
+	TArray<float> CosThetas;
+	for (int32 Index = 0; Index < BatchSize; ++Index)
+	{
+		Points.Add(FVector3f(
+			Random.FRandRange(Volume.BoundsMin.X, Volume.BoundsMax.X),
+			Random.FRandRange(Volume.BoundsMin.Y, Volume.BoundsMax.Y),
+			Random.FRandRange(Volume.BoundsMin.Z, Volume.BoundsMax.Z)));
+		Directions.Add(FVector3f(Random.GetUnitVector()));
+		CosThetas.Add(Random.FRandRange(-1.0f, 1.0f));
+	}
+
+	// Primary rays start below the volume and look up through it.
+	TArray<FVector3f> RayOrigins;
+	for (const FVector3f& Point : Points)
+	{
+		RayOrigins.Add(FVector3f(Point.X, Point.Y, 0.0f));
+	}
+
+	TArray<FResult> Results;
+	for (int32 NumThreads : ThreadCounts)
+	{
+		Results.Add(Run(TEXT("SampleCloudDensity"), NumThreads, BatchSize, MinTime, [&](int32 Begin, int32 End)
+		{
+			float Sum = 0.0f;
+			for (int32 Index = Begin; Index < End; ++Index)
+			{
+				Sum += CloudRaymarch::SampleCloudDensity(Settings, Volume, Points[Index]);
+			}
+			return Sum;
+		}));
+
+		Results.Add(Run(TEXT("HenyeyGreenstein"), NumThreads, BatchSize, MinTime, [&](int32 Begin, int32 End)
+		{
+			float Sum = 0.0f;
+			for (int32 Index = Begin; Index < End; ++Index)
+			{
+				Sum += CloudRaymarch::HenyeyGreenstein(CosThetas[Index], Settings.PhaseG);
+			}
+			return Sum;
+		}));
+
+		Results.Add(Run(TEXT("MarchLightTransmittance"), NumThreads, BatchSize / 16, MinTime, [&](int32 Begin, int32 End)
+		{
+			float Sum = 0.0f;
+			for (int32 Index = Begin; Index < End; ++Index)
+			{
+				Sum += CloudRaymarch::MarchLightTransmittance(Settings, Volume, Points[Index]);
+			}
+			return Sum;
+		}));
+
+		Results.Add(Run(TEXT("MarchCloud"), NumThreads, BatchSize / 256, MinTime, [&](int32 Begin, int32 End)
+		{
+			float Sum = 0.0f;
+			for (int32 Index = Begin; Index < End; ++Index)
+			{
+				const FVector3f Dir = (Points[Index] - RayOrigins[Index] + Directions[Index] * 1000.0f).GetSafeNormal();
+				Sum += CloudRaymarch::MarchCloud(Settings, Volume, RayOrigins[Index], Dir, MAX_flt, 0.5f).Transmittance;
+			}
+			return Sum;
+		}));
+	}
+
+	return Results;
+}
+
+// ================================================================================================
+
+struct FGoldenView
+{
+	const TCHAR* Name;
+	FCloudReferenceCamera Camera;
+};
+
+static TArray<FGoldenView> GetGoldenViews()
+{
+	TArray<FGoldenView> Views;
+
+	FGoldenView& Below = Views.Add_GetRef({ TEXT("Below") });
+	Below.Camera.Origin = FVector3f(-8000.0f, 0.0f, 0.0f);
+	Below.Camera.Rotation = FRotator3f(20.0f, 0.0f, 0.0f);
+
+	FGoldenView& Inside = Views.Add_GetRef({ TEXT("Inside") });
+	Inside.Camera.Origin = FVector3f(0.0f, 0.0f, 3000.0f);
+	Inside.Camera.Rotation = FRotator3f(0.0f, 45.0f, 0.0f);
+
+	FGoldenView& Above = Views.Add_GetRef({ TEXT("Above") });
+	Above.Camera.Origin = FVector3f(0.0f, -9000.0f, 7000.0f);
+	Above.Camera.Rotation = FRotator3f(-30.0f, 90.0f, 0.0f);
+
+	return Views;
+}
+
+/**
+ * Golden images are versioned with the plugin, so build agents check the code under test against
+ * images rendered by a known good version of it rather than by itself. Returns false if the plugin
+ * is not loaded.
+ */
+static bool GetDefaultGoldenDir(FString& OutDir)
+{
+	const TSharedPtr<IPlugin> Plugin = IPluginManager::Get().FindPlugin(TEXT("Foo"));
+	if (!Plugin.IsValid())
+	{
+		UE_LOG(LogClouds, Error, TEXT("The Foo plugin is not loaded, pass the golden image directory with -golden="));
+		return false;
+	}
+
+	OutDir = FPaths::Combine(Plugin->GetBaseDir(), TEXT("Resources"), TEXT("Golden"));
+	return true;
+}
+
+/** Returns false if the golden image of a view is missing or differs by more than Tolerance RMS. */
+static bool CheckGoldenImages(const FCloudMarchSettings& Settings, const FString& GoldenDir, bool bUpdate, float Tolerance)
+{
+	const FCloudVolume Volume = MakeVolume();
+	bool bPassed = true;
+
+	for (const FGoldenView& View : GetGoldenViews())
+	{
+		const FCloudReferenceCamera& Camera = View.Camera;
+
+		FImage Image(Camera.Size.X, Camera.Size.Y, ERawImageFormat::RGBA32F, EGammaSpace::Linear);
+		const TArrayView64<FLinearColor> ImagePixels = Image.AsRGBA32F();
+		CloudRaymarch::RenderCloudImage(Settings, MakeArrayView(&Volume, 1), Camera, MakeArrayView(ImagePixels.GetData(), int32(ImagePixels.Num())));
+
+		const FString Path = FPaths::Combine(GoldenDir, FString(View.Name) + TEXT(".exr"));
+		if (bUpdate)
+		{
+			if (!FImageUtils::SaveImageByExtension(*Path, Image))
+			{
+				UE_LOG(LogClouds, Error, TEXT("Failed to write golden image %s"), *Path);
+				bPassed = false;
+			}
+			continue;
+		}
+
+		FImage Golden;
+		if (!FImageUtils::LoadImage(*Path, Golden))
+		{
+			UE_LOG(LogClouds, Error, TEXT("Golden image %s is missing. Render it with -updategolden from a known good version and submit it"), *Path);
+			bPassed = false;
+			continue;
+		}
+		Golden.ChangeFormat(ERawImageFormat::RGBA32F, EGammaSpace::Linear);
+
+		if (Golden.SizeX != Image.SizeX || Golden.SizeY != Image.SizeY)
+		{
+			UE_LOG(LogClouds, Error, TEXT("Golden image %s is %dx%d, expected %dx%d"), *Path, Golden.SizeX, Golden.SizeY, Image.SizeX, Image.SizeY);
+			bPassed = false;
+			continue;
+		}
+
+		const TArrayView64<FLinearColor> Pixels = Image.AsRGBA32F();
+		const TArrayView64<FLinearColor> GoldenPixels = Golden.AsRGBA32F();
+
+		double SquaredError = 0.0;
+		float MaxError = 0.0f;
+		for (int64 Index = 0; Index < Pixels.Num(); ++Index)
+		{
+			const FLinearColor Delta = Pixels[Index] - GoldenPixels[Index];
+			SquaredError += Delta.R * Delta.R + Delta.G * Delta.G + Delta.B * Delta.B + Delta.A * Delta.A;
+			MaxError = FMath::Max(MaxError, FMath::Max(FMath::Max(FMath::Abs(Delta.R), FMath::Abs(Delta.G)), FMath::Max(FMath::Abs(Delta.B), FMath::Abs(Delta.A))));
+		}
+		const float RmsError = float(FMath::Sqrt(SquaredError / double(Pixels.Num() * 4)));
+
+		const bool bViewPassed = RmsError <= Tolerance;
+		UE_LOG(LogClouds, Display, TEXT("Golden %-8s RMS %.5f max %.5f %s"), View.Name, RmsError, MaxError, bViewPassed ? TEXT("passed") : TEXT("FAILED"));
+		bPassed &= bViewPassed;
+	}
+
+	return bPassed;
+}
+
+} // namespace CloudBenchmark
+
+// ================================================================================================
+
+UCloudBenchmarkCommandlet::UCloudBenchmarkCommandlet(const FObjectInitializer& ObjectInitializer)
+	: Super(ObjectInitializer)
+{
+	IsClient = false;
+	IsEditor = false;
+	IsServer = false;
+	LogToConsole = true;
+}
+
+int32 UCloudBenchmarkCommandlet::Main(const FString& Params)
+{
+	using namespace CloudBenchmark;
+
+	const FCloudMarchSettings Settings = MakeSettings();
+	int32 ExitCode = 0;
+
+	double MinTime = 0.25;
+	FParse::Value(*Params, TEXT("mintime="), MinTime);
+
+	TArray<FResult> Results;
+
+	if (!FParse::Param(*Params, TEXT("nobenchmark")))
+	{
+		TArray<int32> ThreadCounts;
+		FString ThreadsParam;
+		if (FParse::Value(*Params, TEXT("threads="), ThreadsParam, false))
+		{
+			TArray<FString> Values;
+			ThreadsParam.ParseIntoArray(Values, TEXT(","));
+			for (const FString& Value : Values)
+			{
+				ThreadCounts.Add(FMath::Max(FCString::Atoi(*Value), 1));
+			}
+		}
+		else
+		{
+			const int32 NumCores = FPlatformMisc::NumberOfCoresIncludingHyperthreads();
+			for (int32 NumThreads = 1; NumThreads < NumCores; NumThreads *= 2)
+			{
+				ThreadCounts.Add(NumThreads);
+			}
+			ThreadCounts.Add(NumCores);
+		}
+
+		Results.Append(RunMathBenchmarks(Settings, ThreadCounts, MinTime));
+	}
+
+	if (Results.Num() > 0)
+	{
+		UE_LOG(LogClouds, Display, TEXT("%-34s %8s %14s %16s"), TEXT("Benchmark"), TEXT("Threads"), TEXT("ns/sample"), TEXT("samples/s"));
+		for (const FResult& Result : Results)
+		{
+			UE_LOG(LogClouds, Display, TEXT("%-34s %8d %14.1f %16.0f"), *Result.Name, Result.NumThreads, Result.GetNsPerSample(), Result.GetSamplesPerSecond());
+		}
+
+		FString CsvPath;
+		if (FParse::Value(*Params, TEXT("csv="), CsvPath) && !FFileHelper::SaveStringToFile(WriteResultsCsv(Results), *CsvPath))
+		{
+			UE_LOG(LogClouds, Error, TEXT("Failed to write %s"), *CsvPath);
+			ExitCode = 1;
+		}
+
+		const FString Json = WriteResultsJson(Results);
+
+		FString JsonPath;
+		if (FParse::Value(*Params, TEXT("json="), JsonPath) && !FFileHelper::SaveStringToFile(Json, *JsonPath))
+		{
+			UE_LOG(LogClouds, Error, TEXT("Failed to write %s"), *JsonPath);
+			ExitCode = 1;
+		}
+
+		FString BaselinePath = GetDefaultPath(TEXT("Baseline"));
+		FParse::Value(*Params, TEXT("baseline="), BaselinePath);
+
+		float MaxRegression = 0.2f;
+		FParse::Value(*Params, TEXT("regression="), MaxRegression);
+
+		if (FParse::Param(*Params, TEXT("updatebaseline")))
+		{
+			if (!FFileHelper::SaveStringToFile(Json, *BaselinePath))
+			{
+				UE_LOG(LogClouds, Error, TEXT("Failed to write %s"), *BaselinePath);
+				ExitCode = 1;
+			}
+		}
+		else
+		{
+			TArray<FString> Errors;
+			TArray<FString> Warnings;
+			if (!CheckBaseline(Results, BaselinePath, MaxRegression, Errors, Warnings))
+			{
+				ExitCode = 1;
+			}
+			for (const FString& Warning : Warnings)
+			{
+				UE_LOG(LogClouds, Warning, TEXT("%s"), *Warning);
+			}
+			for (const FString& Error : Errors)
+			{
+				UE_LOG(LogClouds, Error, TEXT("%s"), *Error);
+			}
+		}
+	}
+
+	if (!FParse::Param(*Params, TEXT("nogolden")))
+	{
+		float Tolerance = 0.002f;
+		FParse::Value(*Params, TEXT("tolerance="), Tolerance);
+
+		FString GoldenDir;
+		if (!FParse::Value(*Params, TEXT("golden="), GoldenDir) && !GetDefaultGoldenDir(GoldenDir))
+		{
+			ExitCode = 1;
+		}
+		else if (!CheckGoldenImages(Settings, GoldenDir, FParse::Param(*Params, TEXT("updategolden")), Tolerance))
+		{
+			ExitCode = 1;
+		}
+	}
+
+	return ExitCode;
+}
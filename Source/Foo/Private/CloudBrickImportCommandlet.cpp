@@ -0,0 +1,78 @@
+#include "CloudBrickImportCommandlet.h"
+#include "CloudBrickVolume.h"
+#include "CloudStats.h"
+
+namespace CloudBrickImport
+{
+
+/** A few overlapping spheres with soft edges and a flat base, most of the bounds left empty. */
+static uint8 GetProceduralVoxel(const FIntVector& Resolution, int32 X, int32 Y, int32 Z)
+{
+	static const FVector4f Puffs[] = {
+		FVector4f(0.50f, 0.50f, 0.35f, 0.25f),
+		FVector4f(0.32f, 0.45f, 0.30f, 0.17f),
+		FVector4f(0.68f, 0.55f, 0.30f, 0.18f),
+		FVector4f(0.50f, 0.40f, 0.55f, 0.15f),
+	};
+
+	const FVector3f Pos = (FVector3f(X, Y, Z) + 0.5f) / FVector3f(Resolution);
+	if (Pos.Z < 0.15f)
+	{
+		return 0;
+	}
+
+	float Density = 0.0f;
+	for (const FVector4f& Puff : Puffs)
+	{
+		const float Distance = FVector3f::Dist(Pos, FVector3f(Puff.X, Puff.Y, Puff.Z));
+		Density = FMath::Max(Density, FMath::Clamp((Puff.W - Distance) / (0.3f * Puff.W), 0.0f, 1.0f));
+	}
+	return uint8(FMath::RoundToInt(Density * 255.0f));
+}
+
+} // namespace CloudBrickImport
+
+// ================================================================================================
+
+UCloudBrickImportCommandlet::UCloudBrickImportCommandlet(const FObjectInitializer& ObjectInitializer)
+	: Super(ObjectInitializer)
+{
+	IsClient = false;
+	IsEditor = false;
+	IsServer = false;
+	LogToConsole = true;
+}
+
+int32 UCloudBrickImportCommandlet::Main(const FString& Params)
+{
+	FString OutPath;
+	if (!FParse::Value(*Params, TEXT("out="), OutPath))
+	{
+		UE_LOG(LogClouds, Error, TEXT("Missing -out=<Path> of the brick volume file"));
+		return 1;
+	}
+
+	int32 BrickSize = 8;
+	FParse::Value(*Params, TEXT("bricksize="), BrickSize);
+
+	if (FParse::Param(*Params, TEXT("procedural")))
+	{
+		const FIntVector Resolution(128);
+		return CloudBricks::WriteBrickVolume(OutPath, Resolution, BrickSize, [&Resolution](int32 X, int32 Y, int32 Z)
+		{
+			return CloudBrickImport::GetProceduralVoxel(Resolution, X, Y, Z);
+		}) ? 0 : 1;
+	}
+
+	FString RawPath;
+	FString SizeParam;
+	TArray<FString> Sizes;
+	if (!FParse::Value(*Params, TEXT("raw="), RawPath) || !FParse::Value(*Params, TEXT("size="), SizeParam, false) || SizeParam.ParseIntoArray(Sizes, TEXT(",")) != 3)
+	{
+		UE_LOG(LogClouds, Error, TEXT("Missing -raw=<Path> -size=X,Y,Z of the volume to import, or -procedural"));
+		return 1;
+	}
+
+	const FIntVector Resolution(FCString::Atoi(*Sizes[0]), FCString::Atoi(*Sizes[1]), FCString::Atoi(*Sizes[2]));
+	return CloudBricks::ImportRawVolume(RawPath, Resolution, OutPath, BrickSize) ? 0 : 1;
+}
@@ -0,0 +1,393 @@
+#include "CloudBrickPool.h"
+#include "CloudStats.h"
+
+#include "RenderUtils.h"
+#include "RHIGPUReadback.h"
+#include "RHIStaticStates.h"
+
+/** Feedback that has not arrived after this many families is dropped rather than queued. */
+static constexpr int32 MaxPendingBrickFeedback = 4;
+
+/** Largest size of a volume texture on every RHI. */
+static constexpr int32 MaxBrickPoolTextureSize = 2048;
+
+// ================================================================================================
+
+FCloudBrickPool::FCloudBrickPool() = default;
+
+FCloudBrickPool::~FCloudBrickPool()
+{
+	DEC_MEMORY_STAT_BY(STAT_CloudsBrickPoolMemory, GetPoolBytes());
+}
+
+void FCloudBrickPool::Initialize(int32 InSlotsPerAxis)
+{
+	check(!PoolTexture.IsValid());
+	SlotsPerAxis = FMath::Max(InSlotsPerAxis, 1);
+}
+
+FCloudBrickPool::FBrickVolume* FCloudBrickPool::FindVolume(uint32 Id)
+{
+	return Id > 0 && Volumes.IsValidIndex(Id - 1) ? Volumes[Id - 1].Get() : nullptr;
+}
+
+int64 FCloudBrickPool::GetPoolBytes() const
+{
+	const int64 Size = PoolTexture.IsValid() ? PoolTexture->GetSizeXYZ().X : 0;
+	return Size * Size * Size;
+}
+
+// ================================================================================================
+
+bool FCloudBrickPool::AddVolume(uint32 Id, const FString& Path, const FString& OwnerName)
+{
+	check(Id > 0 && !FindVolume(Id));
+
+	// The volume table of the march covers every id in use, including those whose file failed below.
+	if (Volumes.Num() < int32(Id))
+	{
+		Volumes.SetNum(Id);
+	}
+
+	TUniquePtr<FBrickVolume> Volume = MakeUnique<FBrickVolume>();
+	if (!Volume->File.Open(Path))
+	{
+		UE_LOG(LogClouds, Error, TEXT("%s: cannot stream cloud brick volume %s, it renders without authored density"), *OwnerName, *Path);
+		return false;
+	}
+
+	// All bricks share the slots of one texture, so they must have the same size.
+	const FCloudBrickVolumeDesc& Desc = Volume->File.GetDesc();
+	if (BrickSize != 0 && Desc.BrickSize != BrickSize)
+	{
+		UE_LOG(LogClouds, Error, TEXT("%s: ignoring cloud brick volume %s, bricks of %d^3 voxels, the pool holds bricks of %d^3"), *OwnerName, *Path, Desc.BrickSize, BrickSize);
+		return false;
+	}
+
+	if (!PoolTexture.IsValid())
+	{
+		BrickSize = Desc.BrickSize;
+
+		const int32 StoredSize = Desc.GetStoredBrickSize();
+		SlotsPerAxis = FMath::Clamp(SlotsPerAxis, 1, MaxBrickPoolTextureSize / StoredSize);
+		const int32 PoolSize = SlotsPerAxis * StoredSize;
+
+		PoolTexture = RHICreateTexture(FRHITextureCreateDesc::Create3D(TEXT("Clouds.BrickPool"), PoolSize, PoolSize, PoolSize, PF_G8)
+			.SetFlags(ETextureCreateFlags::ShaderResource)
+			.SetInitialState(ERHIAccess::SRVMask));
+
+		// Popped from the back, so slot 0 is used first.
+		const int32 NumSlots = SlotsPerAxis * SlotsPerAxis * SlotsPerAxis;
+		FreeSlots.Reset(NumSlots);
+		for (int32 Slot = NumSlots - 1; Slot >= 0; --Slot)
+		{
+			FreeSlots.Add(Slot);
+		}
+		ResidentBricks.Empty(NumSlots);
+
+		INC_MEMORY_STAT_BY(STAT_CloudsBrickPoolMemory, GetPoolBytes());
+		UE_LOG(LogClouds, Log, TEXT("Created cloud brick pool of %d bricks of %d^3 voxels, %lld KB"), NumSlots, BrickSize, GetPoolBytes() / 1024);
+	}
+
+	UE_LOG(LogClouds, Log, TEXT("Streaming cloud brick volume %u from %s: %s voxels, %d of %d bricks stored, %lld KB file, %lld KB dense"),
+		Id, *Path, *Desc.Resolution.ToString(), Desc.NumStoredBricks, Desc.GetNumPages(), Desc.GetFileSize() / 1024, Desc.GetDenseBytes() / 1024);
+
+	Volumes[Id - 1] = MoveTemp(Volume);
+	++NumMappedVolumes;
+
+	RebuildLayout();
+	return true;
+}
+
+void FCloudBrickPool::RemoveVolume(uint32 Id)
+{
+	FBrickVolume* Volume = FindVolume(Id);
+	if (!Volume)
+	{
+		return;
+	}
+
+	// The page table knows the slots of the resident bricks of the volume.
+	const int32 NumPages = Volume->File.GetDesc().GetNumPages();
+	for (int32 BrickIndex = 0; BrickIndex < NumPages; ++BrickIndex)
+	{
+		const uint32 Page = PageTable[Volume->PageTableOffset + BrickIndex];
+		if (CloudBrickPage::HasIndex(Page))
+		{
+			ResidentBricks.Remove(GetBrickKey(Id, BrickIndex));
+			FreeSlots.Add(CloudBrickPage::GetIndex(Page));
+		}
+	}
+
+	Volumes[Id - 1].Reset();
+	--NumMappedVolumes;
+
+	RebuildLayout();
+}
+
+void FCloudBrickPool::RebuildLayout()
+{
+	// Volumes keep the pages of their resident bricks, new ones start with the average densities.
+	TArray<uint32> NewPageTable;
+	for (const TUniquePtr<FBrickVolume>& Volume : Volumes)
+	{
+		if (!Volume)
+		{
+			continue;
+		}
+
+		const int32 NumPages = Volume->File.GetDesc().GetNumPages();
+		const int32 Offset = NewPageTable.AddUninitialized(NumPages);
+		if (Volume->PageTableOffset != INDEX_NONE)
+		{
+			FMemory::Memcpy(&NewPageTable[Offset], &PageTable[Volume->PageTableOffset], NumPages * sizeof(uint32));
+		}
+		else
+		{
+			for (int32 BrickIndex = 0; BrickIndex < NumPages; ++BrickIndex)
+			{
+				NewPageTable[Offset + BrickIndex] = CloudBrickPage::GetAverageDensity(Volume->File.GetPage(BrickIndex));
+			}
+		}
+		Volume->PageTableOffset = Offset;
+	}
+
+	PageTable = MoveTemp(NewPageTable);
+	DirtyPages.Reset();
+	bLayoutDirty = true;
+	++LayoutGeneration;
+}
+
+void FCloudBrickPool::SetPage(int32 PageIndex, uint32 Page)
+{
+	PageTable[PageIndex] = Page;
+
+	// A changed layout uploads the whole table anyway.
+	if (!bLayoutDirty)
+	{
+		DirtyPages.Add(PageIndex);
+	}
+}
+
+// ================================================================================================
+
+void FCloudBrickPool::Update(FRHICommandListImmediate& RHICmdList, int32 MaxUploads)
+{
+	if (!PoolTexture.IsValid())
+	{
+		return;
+	}
+
+	int32 NumUploads = 0;
+	TSet<uint64> MissingBricks;
+
+	while (PendingFeedback.Num() > 0 && PendingFeedback[0].Readback->IsReady())
+	{
+		FPendingFeedback Feedback = MoveTemp(PendingFeedback[0]);
+		PendingFeedback.RemoveAt(0);
+
+		// Pages of an older layout may belong to other bricks now.
+		if (Feedback.LayoutGeneration == LayoutGeneration && Feedback.NumPages == PageTable.Num())
+		{
+			// Touch every resident brick that was read before evicting anything for the missing ones.
+			const uint32* Requested = static_cast<const uint32*>(Feedback.Readback->Lock(Feedback.NumPages * sizeof(uint32)));
+			for (int32 VolumeIndex = 0; VolumeIndex < Volumes.Num(); ++VolumeIndex)
+			{
+				const FBrickVolume* Volume = Volumes[VolumeIndex].Get();
+				if (!Volume)
+				{
+					continue;
+				}
+
+				const int32 NumPages = Volume->File.GetDesc().GetNumPages();
+				for (int32 BrickIndex = 0; BrickIndex < NumPages; ++BrickIndex)
+				{
+					const int32 PageIndex = Volume->PageTableOffset + BrickIndex;
+					const uint32 Page = PageTable[PageIndex];
+					if (Requested[PageIndex] == 0 || CloudBrickPage::IsEmpty(Page))
+					{
+						continue;
+					}
+
+					const uint64 Key = GetBrickKey(VolumeIndex + 1, BrickIndex);
+					if (CloudBrickPage::HasIndex(Page))
+					{
+						ResidentBricks.FindAndTouch(Key);
+					}
+					else
+					{
+						MissingBricks.Add(Key);
+					}
+				}
+			}
+			Feedback.Readback->Unlock();
+		}
+
+		FreeReadbacks.Add(MoveTemp(Feedback.Readback));
+	}
+
+	// Bricks over the limit are still missing in the next feedback and uploaded then.
+	for (uint64 Key : MissingBricks)
+	{
+		if (NumUploads >= MaxUploads)
+		{
+			break;
+		}
+
+		const uint32 Id = uint32(Key >> 32);
+		const int32 BrickIndex = int32(Key & MAX_uint32);
+		FBrickVolume* Volume = FindVolume(Id);
+
+		if (FreeSlots.Num() == 0)
+		{
+			const uint64 EvictedKey = ResidentBricks.GetLeastRecentKey();
+			EvictBrick(EvictedKey, ResidentBricks.RemoveLeastRecent());
+		}
+
+		const int32 Slot = FreeSlots.Pop(false);
+		const uint32 FilePage = Volume->File.GetPage(BrickIndex);
+		UploadBrick(RHICmdList, *Volume, CloudBrickPage::GetIndex(FilePage), Slot);
+
+		ResidentBricks.Add(Key, Slot);
+		SetPage(Volume->PageTableOffset + BrickIndex, CloudBrickPage::Make(Slot, CloudBrickPage::GetAverageDensity(FilePage)));
+		++Volume->NumResidentBricks;
+		++NumUploads;
+	}
+
+	INC_DWORD_STAT_BY(STAT_CloudsBrickUploads, NumUploads);
+	SET_DWORD_STAT(STAT_CloudsBrickResident, ResidentBricks.Num());
+	CSV_CUSTOM_STAT(Clouds, BrickUploads, NumUploads, ECsvCustomStatOp::Accumulate);
+}
+
+void FCloudBrickPool::EvictBrick(uint64 Key, int32 Slot)
+{
+	const uint32 Id = uint32(Key >> 32);
+	const int32 BrickIndex = int32(Key & MAX_uint32);
+
+	if (FBrickVolume* Volume = FindVolume(Id))
+	{
+		const int32 PageIndex = Volume->PageTableOffset + BrickIndex;
+		SetPage(PageIndex, CloudBrickPage::GetAverageDensity(PageTable[PageIndex]));
+		--Volume->NumResidentBricks;
+	}
+
+	FreeSlots.Add(Slot);
+}
+
+void FCloudBrickPool::UploadBrick(FRHICommandListImmediate& RHICmdList, const FBrickVolume& Volume, int32 StoredIndex, int32 Slot)
+{
+	const int32 StoredSize = BrickSize + 2;
+	const FIntVector SlotCoord(Slot % SlotsPerAxis, (Slot / SlotsPerAxis) % SlotsPerAxis, Slot / (SlotsPerAxis * SlotsPerAxis));
+	const FIntVector Dest = SlotCoord * StoredSize;
+
+	// Reading the brick pages it in from the mapped file.
+	RHICmdList.UpdateTexture3D(
+		PoolTexture,
+		0,
+		FUpdateTextureRegion3D(Dest.X, Dest.Y, Dest.Z, 0, 0, 0, StoredSize, StoredSize, StoredSize),
+		StoredSize,
+		StoredSize * StoredSize,
+		Volume.File.GetStoredBrick(StoredIndex));
+}
+
+// ================================================================================================
+
+void FCloudBrickPool::SetupParameters(FRDGBuilder& GraphBuilder, FCloudBrickShaderParameters& OutParameters)
+{
+	// The whole table is uploaded when the layout changed, otherwise only the pages that did.
+	FRDGBufferRef PageTableRDG = nullptr;
+	if (bLayoutDirty || !PageTableBuffer.IsValid())
+	{
+		PageTableRDG = CreateStructuredBuffer(GraphBuilder, TEXT("Clouds.BrickPageTable"), PageTable.Num() > 0 ? PageTable : TArray<uint32>({ 0u }));
+		GraphBuilder.QueueBufferExtraction(PageTableRDG, &PageTableBuffer);
+		bLayoutDirty = false;
+	}
+	else
+	{
+		PageTableRDG = GraphBuilder.RegisterExternalBuffer(PageTableBuffer);
+		if (DirtyPages.Num() > 0)
+		{
+			PageTableUploader.Init(GraphBuilder, DirtyPages.Num(), sizeof(uint32), false, TEXT("Clouds.BrickPageTableUpload"));
+			for (int32 PageIndex : DirtyPages)
+			{
+				PageTableUploader.Add(PageIndex, &PageTable[PageIndex]);
+			}
+			PageTableUploader.ResourceUploadTo(GraphBuilder, PageTableRDG);
+		}
+	}
+	DirtyPages.Reset();
+
+	// Two entries per volume id: (Resolution, PageTableOffset), (NumBricks, 0). Unused ids have no bricks.
+	TArray<FUintVector4> VolumeData;
+	VolumeData.SetNumZeroed(FMath::Max(Volumes.Num(), 1) * 2);
+	for (int32 VolumeIndex = 0; VolumeIndex < Volumes.Num(); ++VolumeIndex)
+	{
+		if (const FBrickVolume* Volume = Volumes[VolumeIndex].Get())
+		{
+			const FCloudBrickVolumeDesc& Desc = Volume->File.GetDesc();
+			const FIntVector NumBricks = Desc.GetNumBricks();
+			VolumeData[VolumeIndex * 2 + 0] = FUintVector4(Desc.Resolution.X, Desc.Resolution.Y, Desc.Resolution.Z, Volume->PageTableOffset);
+			VolumeData[VolumeIndex * 2 + 1] = FUintVector4(NumBricks.X, NumBricks.Y, NumBricks.Z, 0);
+		}
+	}
+
+	// Every pass of the graph marks the pages it reads; the order of the writes does not matter.
+	FeedbackNumPages = FMath::Max(PageTable.Num(), 1);
+	FeedbackBuffer = GraphBuilder.CreateBuffer(FRDGBufferDesc::CreateStructuredDesc(sizeof(uint32), FeedbackNumPages), TEXT("Clouds.BrickFeedback"));
+	FeedbackGraphBuilder = &GraphBuilder;
+	AddClearUAVPass(GraphBuilder, GraphBuilder.CreateUAV(FeedbackBuffer), 0u);
+
+	const int32 PoolSize = FMath::Max(SlotsPerAxis * (BrickSize + 2), 1);
+	OutParameters.CloudBrickPool = PoolTexture.IsValid() ? PoolTexture.GetReference() : GBlackVolumeTexture->TextureRHI.GetReference();
+	OutParameters.CloudBrickPoolSampler = TStaticSamplerState<SF_Bilinear, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+	OutParameters.CloudBrickPageTable = GraphBuilder.CreateSRV(PageTableRDG);
+	OutParameters.CloudBrickVolumes = GraphBuilder.CreateSRV(CreateStructuredBuffer(GraphBuilder, TEXT("Clouds.BrickVolumes"), VolumeData));
+	OutParameters.CloudBrickFeedback = GraphBuilder.CreateUAV(FRDGBufferUAVDesc(FeedbackBuffer), ERDGUnorderedAccessViewFlags::SkipBarrier);
+	OutParameters.CloudBrickPoolInvSize = FVector3f(1.0f / PoolSize);
+	OutParameters.CloudBrickPoolSlotsPerAxis = FMath::Max(SlotsPerAxis, 1);
+	OutParameters.CloudBrickSize = FMath::Max(BrickSize, 1);
+}
+
+void FCloudBrickPool::EnqueueFeedbackReadback(FRDGBuilder& GraphBuilder)
+{
+	const bool bHasFeedback = FeedbackGraphBuilder == &GraphBuilder && FeedbackBuffer && FeedbackNumPages == PageTable.Num();
+	FeedbackGraphBuilder = nullptr;
+	FeedbackBuffer = nullptr;
+
+	// Without volumes there is nothing to stream. A full queue means the GPU is far behind; the
+	// next family asks again.
+	if (!bHasFeedback || NumMappedVolumes == 0 || PendingFeedback.Num() >= MaxPendingBrickFeedback)
+	{
+		return;
+	}
+
+	FPendingFeedback& Feedback = PendingFeedback.AddDefaulted_GetRef();
+	Feedback.Readback = FreeReadbacks.Num() > 0 ? FreeReadbacks.Pop(false) : MakeUnique<FRHIGPUBufferReadback>(TEXT("Clouds.BrickFeedbackReadback"));
+	Feedback.LayoutGeneration = LayoutGeneration;
+	Feedback.NumPages = PageTable.Num();
+
+	AddEnqueueCopyPass(GraphBuilder, Feedback.Readback.Get(), FeedbackBuffer, Feedback.NumPages * sizeof(uint32));
+}
+
+// ================================================================================================
+
+void FCloudBrickPool::GetVolumeStats(TArray<FCloudBrickVolumeStats>& OutStats) const
+{
+	for (int32 VolumeIndex = 0; VolumeIndex < Volumes.Num(); ++VolumeIndex)
+	{
+		if (const FBrickVolume* Volume = Volumes[VolumeIndex].Get())
+		{
+			const FCloudBrickVolumeDesc& Desc = Volume->File.GetDesc();
+
+			FCloudBrickVolumeStats& Stats = OutStats.AddDefaulted_GetRef();
+			Stats.Id = VolumeIndex + 1;
+			Stats.Resolution = Desc.Resolution;
+			Stats.NumBricks = Desc.GetNumPages();
+			Stats.NumStoredBricks = Desc.NumStoredBricks;
+			Stats.NumResidentBricks = Volume->NumResidentBricks;
+			Stats.FileBytes = Desc.GetFileSize();
+			Stats.ResidentBytes = Volume->NumResidentBricks * Desc.GetStoredBrickBytes();
+			Stats.DenseBytes = Desc.GetDenseBytes();
+		}
+	}
+}
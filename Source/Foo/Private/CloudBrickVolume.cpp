@@ -0,0 +1,322 @@
+#include "CloudBrickVolume.h"
+#include "CloudStats.h"
+
+#include "Async/ParallelFor.h"
+#include "Async/MappedFileHandle.h"
+#include "HAL/FileManager.h"
+#include "HAL/PlatformFileManager.h"
+#include "Misc/FileHelper.h"
+
+/** Bump whenever the file layout changes. */
+static constexpr uint32 CloudBrickVolumeVersion = 1;
+static constexpr uint32 CloudBrickVolumeMagic = 0x4B524243; // "CBRK"
+
+/** Header, padded so the page table starts at a fixed offset. */
+static constexpr int64 CloudBrickHeaderBytes = 64;
+
+/** Bricks start on a page boundary. */
+static constexpr int64 CloudBrickDataAlignment = 4096;
+
+struct FCloudBrickVolumeHeader
+{
+	uint32 Magic;
+	uint32 Version;
+	int32 ResolutionX;
+	int32 ResolutionY;
+	int32 ResolutionZ;
+	int32 BrickSize;
+	int32 NumStoredBricks;
+};
+
+static_assert(sizeof(FCloudBrickVolumeHeader) <= CloudBrickHeaderBytes, "Brick volume header does not fit.");
+
+// ================================================================================================
+
+int64 FCloudBrickVolumeDesc::GetPageTableOffset() const
+{
+	return CloudBrickHeaderBytes;
+}
+
+int64 FCloudBrickVolumeDesc::GetBrickOffset(int32 StoredIndex) const
+{
+	const int64 BrickDataOffset = Align(GetPageTableOffset() + int64(GetNumPages()) * sizeof(uint32), CloudBrickDataAlignment);
+	return BrickDataOffset + StoredIndex * GetStoredBrickBytes();
+}
+
+// ================================================================================================
+
+FCloudBrickVolumeFile::FCloudBrickVolumeFile() = default;
+
+FCloudBrickVolumeFile::~FCloudBrickVolumeFile()
+{
+	Close();
+}
+
+bool FCloudBrickVolumeFile::Open(const FString& Path)
+{
+	Close();
+
+	FileHandle.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenMapped(*Path));
+	if (!FileHandle || FileHandle->GetFileSize() < CloudBrickHeaderBytes)
+	{
+		UE_LOG(LogClouds, Warning, TEXT("Failed to memory map cloud brick volume %s"), *Path);
+		Close();
+		return false;
+	}
+
+	Region.Reset(FileHandle->MapRegion(0, FileHandle->GetFileSize()));
+	if (!Region)
+	{
+		Close();
+		return false;
+	}
+
+	FCloudBrickVolumeHeader Header;
+	FMemory::Memcpy(&Header, Region->GetMappedPtr(), sizeof(Header));
+
+	Desc.Resolution = FIntVector(Header.ResolutionX, Header.ResolutionY, Header.ResolutionZ);
+	Desc.BrickSize = Header.BrickSize;
+	Desc.NumStoredBricks = Header.NumStoredBricks;
+
+	const bool bValid = Header.Magic == CloudBrickVolumeMagic
+		&& Header.Version == CloudBrickVolumeVersion
+		&& Desc.Resolution.GetMin() > 0 && Desc.BrickSize > 0 && Desc.NumStoredBricks >= 0
+		&& Desc.NumStoredBricks <= Desc.GetNumPages()
+		&& FileHandle->GetFileSize() >= Desc.GetFileSize();
+
+	if (!bValid)
+	{
+		UE_LOG(LogClouds, Warning, TEXT("Ignoring invalid or outdated cloud brick volume %s"), *Path);
+		Close();
+		return false;
+	}
+
+	// Pages index the stored bricks without further checks when sampled or streamed, so a corrupt page
+	// table is rejected here rather than read past the end of the mapping.
+	const int32 NumPages = Desc.GetNumPages();
+	for (int32 BrickIndex = 0; BrickIndex < NumPages; ++BrickIndex)
+	{
+		const uint32 Page = GetPage(BrickIndex);
+		if (CloudBrickPage::HasIndex(Page) && CloudBrickPage::GetIndex(Page) >= uint32(Desc.NumStoredBricks))
+		{
+			UE_LOG(LogClouds, Warning, TEXT("Ignoring cloud brick volume %s: brick %d points at stored brick %u of %d"), *Path, BrickIndex, CloudBrickPage::GetIndex(Page), Desc.NumStoredBricks);
+			Close();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void FCloudBrickVolumeFile::Close()
+{
+	// Regions must be unmapped before the file is closed.
+	Region.Reset();
+	FileHandle.Reset();
+	Desc = FCloudBrickVolumeDesc();
+}
+
+uint32 FCloudBrickVolumeFile::GetPage(int32 BrickIndex) const
+{
+	check(IsOpen() && BrickIndex >= 0 && BrickIndex < Desc.GetNumPages());
+	uint32 Page;
+	FMemory::Memcpy(&Page, Region->GetMappedPtr() + Desc.GetPageTableOffset() + int64(BrickIndex) * sizeof(uint32), sizeof(Page));
+	return Page;
+}
+
+const uint8* FCloudBrickVolumeFile::GetStoredBrick(int32 StoredIndex) const
+{
+	check(IsOpen() && StoredIndex >= 0 && StoredIndex < Desc.NumStoredBricks);
+	return Region->GetMappedPtr() + Desc.GetBrickOffset(StoredIndex);
+}
+
+float FCloudBrickVolumeFile::SampleDensity(const FVector3f& Local) const
+{
+	if (!IsOpen())
+	{
+		return 0.0f;
+	}
+
+	const FIntVector NumBricks = Desc.GetNumBricks();
+	const FVector3f VoxelPos = FVector3f::Min(FVector3f::Max(Local, FVector3f::ZeroVector), FVector3f::OneVector) * FVector3f(Desc.Resolution);
+	const FIntVector Brick(
+		FMath::Min(FMath::FloorToInt(VoxelPos.X / Desc.BrickSize), NumBricks.X - 1),
+		FMath::Min(FMath::FloorToInt(VoxelPos.Y / Desc.BrickSize), NumBricks.Y - 1),
+		FMath::Min(FMath::FloorToInt(VoxelPos.Z / Desc.BrickSize), NumBricks.Z - 1));
+
+	const uint32 Page = GetPage((Brick.Z * NumBricks.Y + Brick.Y) * NumBricks.X + Brick.X);
+	if (CloudBrickPage::IsEmpty(Page) || !CloudBrickPage::HasIndex(Page))
+	{
+		return 0.0f;
+	}
+
+	// Voxel centers sit at integer + 0.5 positions; the apron shifts the brick by one voxel.
+	const uint8* Voxels = GetStoredBrick(CloudBrickPage::GetIndex(Page));
+	const int32 StoredSize = Desc.GetStoredBrickSize();
+	const FVector3f BrickPos = VoxelPos - FVector3f(Brick * Desc.BrickSize) + 0.5f;
+	const FIntVector Base(FMath::FloorToInt(BrickPos.X), FMath::FloorToInt(BrickPos.Y), FMath::FloorToInt(BrickPos.Z));
+	const FVector3f Frac = BrickPos - FVector3f(Base);
+
+	auto Load = [Voxels, StoredSize](int32 X, int32 Y, int32 Z)
+	{
+		X = FMath::Clamp(X, 0, StoredSize - 1);
+		Y = FMath::Clamp(Y, 0, StoredSize - 1);
+		Z = FMath::Clamp(Z, 0, StoredSize - 1);
+		return Voxels[(Z * StoredSize + Y) * StoredSize + X] / 255.0f;
+	};
+
+	float Density = 0.0f;
+	for (int32 Corner = 0; Corner < 8; ++Corner)
+	{
+		const FIntVector Offset(Corner & 1, (Corner >> 1) & 1, Corner >> 2);
+		const float Weight =
+			(Offset.X ? Frac.X : 1.0f - Frac.X) *
+			(Offset.Y ? Frac.Y : 1.0f - Frac.Y) *
+			(Offset.Z ? Frac.Z : 1.0f - Frac.Z);
+		Density += Load(Base.X + Offset.X, Base.Y + Offset.Y, Base.Z + Offset.Z) * Weight;
+	}
+	return Density;
+}
+
+// ================================================================================================
+
+namespace CloudBricks
+{
+
+bool WriteBrickVolume(const FString& Path, const FIntVector& Resolution, int32 BrickSize, TFunctionRef<uint8(int32 X, int32 Y, int32 Z)> Voxel)
+{
+	FCloudBrickVolumeDesc Desc;
+	Desc.Resolution = Resolution;
+	Desc.BrickSize = FMath::Max(BrickSize, 1);
+
+	const FIntVector NumBricks = Desc.GetNumBricks();
+	const int32 StoredSize = Desc.GetStoredBrickSize();
+	const int64 StoredBytes = Desc.GetStoredBrickBytes();
+
+	// Bricks are gathered one Z layer at a time to bound the memory use on large volumes. The apron
+	// clamps to the volume, matching the clamped lookups at its border.
+	TArray<uint32> Pages;
+	Pages.SetNumZeroed(Desc.GetNumPages());
+	TArray<uint8> LayerVoxels;
+	LayerVoxels.SetNumUninitialized(NumBricks.X * NumBricks.Y * StoredBytes);
+	TArray<uint8> BrickData;
+
+	for (int32 BrickZ = 0; BrickZ < NumBricks.Z; ++BrickZ)
+	{
+		TArray<uint32> LayerAverages;
+		LayerAverages.SetNumZeroed(NumBricks.X * NumBricks.Y);
+
+		ParallelFor(NumBricks.X * NumBricks.Y, [&](int32 LayerIndex)
+		{
+			const FIntVector Brick(LayerIndex % NumBricks.X, LayerIndex / NumBricks.X, BrickZ);
+			uint8* Voxels = &LayerVoxels[LayerIndex * StoredBytes];
+
+			bool bAnyDensity = false;
+			uint64 CoreSum = 0;
+			for (int32 Z = 0; Z < StoredSize; ++Z)
+			{
+				for (int32 Y = 0; Y < StoredSize; ++Y)
+				{
+					for (int32 X = 0; X < StoredSize; ++X)
+					{
+						const FIntVector VolumePos = Brick * Desc.BrickSize + FIntVector(X - 1, Y - 1, Z - 1);
+						const uint8 Value = Voxel(
+							FMath::Clamp(VolumePos.X, 0, Resolution.X - 1),
+							FMath::Clamp(VolumePos.Y, 0, Resolution.Y - 1),
+							FMath::Clamp(VolumePos.Z, 0, Resolution.Z - 1));
+						Voxels[(Z * StoredSize + Y) * StoredSize + X] = Value;
+						bAnyDensity |= Value != 0;
+
+						if (X > 0 && Y > 0 && Z > 0 && X <= Desc.BrickSize && Y <= Desc.BrickSize && Z <= Desc.BrickSize)
+						{
+							CoreSum += Value;
+						}
+					}
+				}
+			}
+
+			// Non-empty bricks keep an average of at least 1, so they are never mistaken for empty ones.
+			const uint32 NumCoreVoxels = Desc.BrickSize * Desc.BrickSize * Desc.BrickSize;
+			LayerAverages[LayerIndex] = bAnyDensity ? FMath::Clamp<uint32>(uint32((CoreSum + NumCoreVoxels / 2) / NumCoreVoxels), 1, 255) : 0;
+		});
+
+		for (int32 LayerIndex = 0; LayerIndex < LayerAverages.Num(); ++LayerIndex)
+		{
+			if (LayerAverages[LayerIndex] != 0)
+			{
+				Pages[BrickZ * NumBricks.X * NumBricks.Y + LayerIndex] = CloudBrickPage::Make(Desc.NumStoredBricks++, LayerAverages[LayerIndex]);
+				BrickData.Append(&LayerVoxels[LayerIndex * StoredBytes], StoredBytes);
+			}
+		}
+	}
+
+	const FString TempPath = Path + TEXT(".tmp");
+	{
+		TUniquePtr<FArchive> Writer(IFileManager::Get().CreateFileWriter(*TempPath));
+		if (!Writer)
+		{
+			UE_LOG(LogClouds, Warning, TEXT("Failed to write cloud brick volume %s"), *TempPath);
+			return false;
+		}
+
+		auto PadTo = [&Writer](int64 Offset)
+		{
+			static const uint8 Zeros[4096] = {};
+			while (Writer->Tell() < Offset)
+			{
+				Writer->Serialize(const_cast<uint8*>(Zeros), FMath::Min<int64>(Offset - Writer->Tell(), sizeof(Zeros)));
+			}
+		};
+
+		FCloudBrickVolumeHeader Header;
+		Header.Magic = CloudBrickVolumeMagic;
+		Header.Version = CloudBrickVolumeVersion;
+		Header.ResolutionX = Resolution.X;
+		Header.ResolutionY = Resolution.Y;
+		Header.ResolutionZ = Resolution.Z;
+		Header.BrickSize = Desc.BrickSize;
+		Header.NumStoredBricks = Desc.NumStoredBricks;
+		Writer->Serialize(&Header, sizeof(Header));
+
+		PadTo(Desc.GetPageTableOffset());
+		Writer->Serialize(Pages.GetData(), Pages.Num() * sizeof(uint32));
+
+		PadTo(Desc.GetBrickOffset(0));
+		Writer->Serialize(BrickData.GetData(), BrickData.Num());
+
+		if (Writer->IsError())
+		{
+			UE_LOG(LogClouds, Warning, TEXT("Failed to write cloud brick volume %s"), *TempPath);
+			return false;
+		}
+	}
+
+	UE_LOG(LogClouds, Log, TEXT("Wrote cloud brick volume %s: %s voxels, %d of %d bricks stored, %lld KB instead of %lld KB dense"),
+		*Path, *Resolution.ToString(), Desc.NumStoredBricks, Desc.GetNumPages(), Desc.GetFileSize() / 1024, Desc.GetDenseBytes() / 1024);
+
+	return IFileManager::Get().Move(*Path, *TempPath);
+}
+
+bool ImportRawVolume(const FString& RawPath, const FIntVector& Resolution, const FString& Path, int32 BrickSize)
+{
+	TArray64<uint8> Voxels;
+	if (!FFileHelper::LoadFileToArray(Voxels, *RawPath))
+	{
+		UE_LOG(LogClouds, Warning, TEXT("Failed to read raw volume %s"), *RawPath);
+		return false;
+	}
+
+	const int64 NumVoxels = int64(Resolution.X) * Resolution.Y * Resolution.Z;
+	if (Resolution.GetMin() <= 0 || Voxels.Num() != NumVoxels)
+	{
+		UE_LOG(LogClouds, Warning, TEXT("Raw volume %s holds %lld bytes, expected %lld for %s voxels"), *RawPath, Voxels.Num(), NumVoxels, *Resolution.ToString());
+		return false;
+	}
+
+	return WriteBrickVolume(Path, Resolution, BrickSize, [&Voxels, &Resolution](int32 X, int32 Y, int32 Z)
+	{
+		return Voxels[(int64(Z) * Resolution.Y + Y) * Resolution.X + X];
+	});
+}
+
+} // namespace CloudBricks
@@ -0,0 +1,94 @@
+#include "CloudBudgetController.h"
+
+// ================================================================================================
+
+TArray<FCloudQualityLevel> FCloudBudgetController::GetDefaultLevels()
+{
+	// The march cost scales with the steps per marched pixel, and the pixels with 1 / Divisor^2.
+	TArray<FCloudQualityLevel> Levels;
+	auto AddLevel = [&Levels](int32 ResolutionDivisor, int32 NumSteps)
+	{
+		FCloudQualityLevel& Quality = Levels.AddDefaulted_GetRef();
+		Quality.ResolutionDivisor = ResolutionDivisor;
+		Quality.NumSteps = NumSteps;
+		Quality.RelativeCost = float(NumSteps) / float(ResolutionDivisor * ResolutionDivisor);
+	};
+
+	AddLevel(1, 128);
+	AddLevel(1, 64);
+	AddLevel(2, 128);
+	AddLevel(2, 64);
+	AddLevel(2, 32);
+	AddLevel(4, 64);
+	AddLevel(4, 32);
+	return Levels;
+}
+
+FCloudBudgetController::FCloudBudgetController()
+	: FCloudBudgetController(GetDefaultLevels())
+{
+}
+
+FCloudBudgetController::FCloudBudgetController(TArray<FCloudQualityLevel> InLevels)
+	: Levels(MoveTemp(InLevels))
+{
+	check(Levels.Num() > 0);
+	Reset();
+}
+
+void FCloudBudgetController::Reset(int32 InLevel)
+{
+	Level = FMath::Clamp(InLevel, 0, Levels.Num() - 1);
+	SmoothedMs = 0.0f;
+	FramesAtLevel = 0;
+}
+
+// ================================================================================================
+
+float FCloudBudgetController::PredictMs(int32 NewLevel) const
+{
+	return SmoothedMs * Levels[NewLevel].RelativeCost / FMath::Max(Levels[Level].RelativeCost, UE_SMALL_NUMBER);
+}
+
+void FCloudBudgetController::SetLevel(int32 NewLevel)
+{
+	// Start the average at the prediction, so the new level is judged by its own frames sooner.
+	SmoothedMs = PredictMs(NewLevel);
+	Level = NewLevel;
+	FramesAtLevel = 0;
+}
+
+int32 FCloudBudgetController::AddFrameTime(float GpuMs)
+{
+	GpuMs = FMath::Max(GpuMs, 0.0f);
+	SmoothedMs = FramesAtLevel == 0 && SmoothedMs <= 0.0f ? GpuMs : FMath::Lerp(SmoothedMs, GpuMs, FMath::Clamp(Settings.Smoothing, 0.0f, 1.0f));
+	++FramesAtLevel;
+
+	if (FramesAtLevel < FMath::Max(Settings.SettleFrames, 1) || Settings.BudgetMs <= 0.0f)
+	{
+		return Level;
+	}
+
+	const float Hysteresis = FMath::Clamp(Settings.Hysteresis, 0.0f, 0.9f);
+	const float UpperMs = Settings.BudgetMs * (1.0f + Hysteresis);
+	const float LowerMs = Settings.BudgetMs * (1.0f - Hysteresis);
+
+	if (SmoothedMs > UpperMs)
+	{
+		int32 NewLevel = Level + 1;
+		while (NewLevel < Levels.Num() - 1 && PredictMs(NewLevel) > Settings.BudgetMs)
+		{
+			++NewLevel;
+		}
+		if (NewLevel < Levels.Num())
+		{
+			SetLevel(NewLevel);
+		}
+	}
+	else if (Level > 0 && PredictMs(Level - 1) < LowerMs)
+	{
+		SetLevel(Level - 1);
+	}
+
+	return Level;
+}
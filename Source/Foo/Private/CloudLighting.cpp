@@ -0,0 +1,281 @@
+#include "CloudLighting.h"
+#include "CloudSceneViewExtension.h"
+#include "CloudStats.h"
+
+#include "RHIStaticStates.h"
+#include "SystemTextures.h"
+
+// ================================================================================================
+
+void FCloudLightingCache::Update(
+	FRDGBuilder& GraphBuilder,
+	const FGlobalShaderMap* ShaderMap,
+	const FCloudLightingSettings& Settings,
+	const FVector& CameraOrigin,
+	TConstArrayView<FCloudVolume> Volumes,
+	const FCloudMarchShaderParameters& March)
+{
+	SCOPE_CYCLE_COUNTER(STAT_CloudsLightingUpdate);
+
+	// Captures and split screen families render the same clouds, so only the first family of a frame
+	// advances the bake.
+	if (Volumes.Num() == 0 || LastUpdateFrame == GFrameCounterRenderThread)
+	{
+		return;
+	}
+	LastUpdateFrame = GFrameCounterRenderThread;
+
+	const FIntVector VolumeResolution(FMath::Clamp(Settings.VolumeResolution, 8, 512), FMath::Clamp(Settings.VolumeResolution, 8, 512), FMath::Clamp(Settings.VolumeSlices, 1, 256));
+	const int32 ShadowMapResolution = FMath::Clamp(Settings.ShadowMapResolution, 8, 4096);
+	const int32 NumSlices = VolumeResolution.Z;
+	const int32 ShadowRowsPerSlice = FMath::DivideAndRoundUp(ShadowMapResolution, NumSlices);
+
+	FRDGTextureRef LightVolume = nullptr;
+	FRDGTextureRef ShadowMap = nullptr;
+
+	if (NextSlice == 0)
+	{
+		// Freeze the placement for the whole bake: XY around the camera, snapped to whole texels so
+		// consecutive bakes line up, and Z over all volumes.
+		float MinZ = MAX_flt;
+		float MaxZ = -MAX_flt;
+		for (const FCloudVolume& Volume : Volumes)
+		{
+			MinZ = FMath::Min(MinZ, Volume.BoundsMin.Z);
+			MaxZ = FMath::Max(MaxZ, Volume.BoundsMax.Z);
+		}
+
+		const float Extent = FMath::Max(Settings.Extent, 1.0f);
+		const float TexelSize = Extent / VolumeResolution.X;
+		Pending.Min = FVector3f(
+			FMath::GridSnap(float(CameraOrigin.X) - Extent * 0.5f, TexelSize),
+			FMath::GridSnap(float(CameraOrigin.Y) - Extent * 0.5f, TexelSize),
+			MinZ);
+		Pending.Size = FVector3f(Extent, Extent, FMath::Max(MaxZ - MinZ, 1.0f));
+
+		// Reuse the textures of the pending copy unless the resolution changed.
+		if (!Pending.LightVolume.IsValid() || Pending.LightVolume->GetDesc().GetSize() != VolumeResolution)
+		{
+			LightVolume = GraphBuilder.CreateTexture(
+				FRDGTextureDesc::Create3D(VolumeResolution, PF_R16F, FClearValueBinding::White, TexCreate_ShaderResource | TexCreate_UAV),
+				TEXT("Clouds.LightVolume"));
+			Pending.LightVolume = GraphBuilder.ConvertToExternalTexture(LightVolume);
+		}
+		if (!Pending.ShadowMap.IsValid() || Pending.ShadowMap->GetDesc().Extent != FIntPoint(ShadowMapResolution))
+		{
+			ShadowMap = GraphBuilder.CreateTexture(
+				FRDGTextureDesc::Create2D(FIntPoint(ShadowMapResolution), PF_R16F, FClearValueBinding::White, TexCreate_ShaderResource | TexCreate_UAV),
+				TEXT("Clouds.ShadowMap"));
+			Pending.ShadowMap = GraphBuilder.ConvertToExternalTexture(ShadowMap);
+		}
+	}
+	else if (Pending.LightVolume->GetDesc().GetSize() != VolumeResolution || Pending.ShadowMap->GetDesc().Extent != FIntPoint(ShadowMapResolution))
+	{
+		// The resolution changed during the bake, start over next frame.
+		NextSlice = 0;
+		return;
+	}
+
+	if (!LightVolume)
+	{
+		LightVolume = GraphBuilder.RegisterExternalTexture(Pending.LightVolume);
+	}
+	if (!ShadowMap)
+	{
+		ShadowMap = GraphBuilder.RegisterExternalTexture(Pending.ShadowMap);
+	}
+
+	const int32 FirstSlice = NextSlice;
+	const int32 NumBakeSlices = FMath::Min(FMath::Max(Settings.SlicesPerFrame, 1), NumSlices - FirstSlice);
+
+	RDG_EVENT_SCOPE(GraphBuilder, "CloudLighting %d-%d of %d", FirstSlice, FirstSlice + NumBakeSlices - 1, NumSlices);
+
+	// Volumes may change during a bake, so they are binned again for every slice range.
+	TArray<FUintVector2> TileRanges;
+	TArray<uint32> TileVolumes;
+	BinVolumes(Volumes, March.CloudSunDirection, Pending.Min, Pending.Size, TileRanges, TileVolumes);
+	if (TileVolumes.Num() == 0)
+	{
+		TileVolumes.Add(0);
+	}
+
+	FRDGBufferSRVRef TileRangesSRV = GraphBuilder.CreateSRV(CreateStructuredBuffer(GraphBuilder, TEXT("Clouds.LightingTileRanges"), TileRanges));
+	FRDGBufferSRVRef TileVolumesSRV = GraphBuilder.CreateSRV(CreateStructuredBuffer(GraphBuilder, TEXT("Clouds.LightingTileVolumes"), TileVolumes));
+
+	{
+		FCloudLightVolumeCS::FParameters* PassParameters = GraphBuilder.AllocParameters<FCloudLightVolumeCS::FParameters>();
+		PassParameters->Bake.March = March;
+		SetupDisabledParameters(GraphBuilder, PassParameters->Bake.March.Lighting);
+		PassParameters->Bake.BakeVolumeMin = Pending.Min;
+		PassParameters->Bake.BakeVolumeSize = Pending.Size;
+		PassParameters->Bake.BakeResolution = FUintVector3(VolumeResolution.X, VolumeResolution.Y, VolumeResolution.Z);
+		PassParameters->Bake.BakeFirstSlice = FirstSlice;
+		PassParameters->Bake.BakeNumSlices = NumBakeSlices;
+		PassParameters->Bake.BakeTileRanges = TileRangesSRV;
+		PassParameters->Bake.BakeTileVolumes = TileVolumesSRV;
+		PassParameters->Bake.BakeTilesPerAxis = BakeTilesPerAxis;
+		PassParameters->Bake.BakeNumSteps = FMath::Max(Settings.NumSteps, 1);
+		PassParameters->LightVolumeOutput = GraphBuilder.CreateUAV(LightVolume);
+
+		TShaderMapRef<FCloudLightVolumeCS> ComputeShader(ShaderMap);
+		FComputeShaderUtils::AddPass(
+			GraphBuilder,
+			RDG_EVENT_NAME("CloudLightVolume %dx%dx%d", VolumeResolution.X, VolumeResolution.Y, NumBakeSlices),
+			ComputeShader,
+			PassParameters,
+			FComputeShaderUtils::GetGroupCount(FIntVector(VolumeResolution.X, VolumeResolution.Y, NumBakeSlices), FIntVector(FCloudLightVolumeCS::ThreadGroupSize, FCloudLightVolumeCS::ThreadGroupSize, 1)));
+	}
+
+	const int32 FirstRow = FirstSlice * ShadowRowsPerSlice;
+	const int32 NumRows = FMath::Min(NumBakeSlices * ShadowRowsPerSlice, ShadowMapResolution - FirstRow);
+	if (NumRows > 0)
+	{
+		FCloudShadowMapCS::FParameters* PassParameters = GraphBuilder.AllocParameters<FCloudShadowMapCS::FParameters>();
+		PassParameters->Bake.March = March;
+		SetupDisabledParameters(GraphBuilder, PassParameters->Bake.March.Lighting);
+		PassParameters->Bake.BakeVolumeMin = Pending.Min;
+		PassParameters->Bake.BakeVolumeSize = Pending.Size;
+		PassParameters->Bake.BakeResolution = FUintVector3(ShadowMapResolution, ShadowMapResolution, 1);
+		PassParameters->Bake.BakeFirstSlice = FirstRow;
+		PassParameters->Bake.BakeNumSlices = NumRows;
+		PassParameters->Bake.BakeTileRanges = TileRangesSRV;
+		PassParameters->Bake.BakeTileVolumes = TileVolumesSRV;
+		PassParameters->Bake.BakeTilesPerAxis = BakeTilesPerAxis;
+		PassParameters->Bake.BakeNumSteps = FMath::Max(Settings.NumSteps, 1);
+		PassParameters->ShadowMapOutput = GraphBuilder.CreateUAV(ShadowMap);
+
+		TShaderMapRef<FCloudShadowMapCS> ComputeShader(ShaderMap);
+		FComputeShaderUtils::AddPass(
+			GraphBuilder,
+			RDG_EVENT_NAME("CloudShadowMap %dx%d", ShadowMapResolution, NumRows),
+			ComputeShader,
+			PassParameters,
+			FComputeShaderUtils::GetGroupCount(FIntPoint(ShadowMapResolution, NumRows), FCloudShadowMapCS::ThreadGroupSize));
+	}
+
+	INC_DWORD_STAT_BY(STAT_CloudsLightingSlices, NumBakeSlices);
+	CSV_CUSTOM_STAT(Clouds, LightingSlices, NumBakeSlices, ECsvCustomStatOp::Accumulate);
+
+	NextSlice += NumBakeSlices;
+	if (NextSlice >= NumSlices)
+	{
+		Swap(Visible, Pending);
+		NextSlice = 0;
+		++NumBakes;
+	}
+}
+
+uint64 FCloudLightingCache::GetGpuMemorySize() const
+{
+	return GetCloudPooledTargetSize(Visible.LightVolume) + GetCloudPooledTargetSize(Visible.ShadowMap)
+		+ GetCloudPooledTargetSize(Pending.LightVolume) + GetCloudPooledTargetSize(Pending.ShadowMap);
+}
+
+void FCloudLightingCache::BinVolumes(
+	TConstArrayView<FCloudVolume> Volumes,
+	const FVector3f& SunDirection,
+	const FVector3f& BakeMin,
+	const FVector3f& BakeSize,
+	TArray<FUintVector2>& OutTileRanges,
+	TArray<uint32>& OutTileVolumes)
+{
+	const FVector2f TileSize = FVector2f(BakeSize.X, BakeSize.Y) / float(BakeTilesPerAxis);
+	const float BakeMaxZ = BakeMin.Z + BakeSize.Z;
+
+	// A ray towards the sun moves this far in XY per unit it rises.
+	const bool bSunAbove = SunDirection.Z > UE_KINDA_SMALL_NUMBER;
+	const FVector2f SunDrift = bSunAbove ? FVector2f(SunDirection.X, SunDirection.Y) / SunDirection.Z : FVector2f::ZeroVector;
+
+	TArray<FIntRect> Rects;
+	Rects.SetNumUninitialized(Volumes.Num());
+
+	TArray<uint32> Counts;
+	Counts.SetNumZeroed(BakeTilesPerAxis * BakeTilesPerAxis);
+
+	for (int32 Index = 0; Index < Volumes.Num(); ++Index)
+	{
+		const FCloudVolume& Volume = Volumes[Index];
+		FIntRect& Rect = Rects[Index];
+
+		if (!bSunAbove)
+		{
+			Rect = FIntRect(0, 0, BakeTilesPerAxis, BakeTilesPerAxis);
+		}
+		else
+		{
+			// Texels between the bottom and the top of the bake rise this far before they leave the volume.
+			const FVector2f NearDrift = SunDrift * FMath::Max(Volume.BoundsMin.Z - BakeMaxZ, 0.0f);
+			const FVector2f FarDrift = SunDrift * FMath::Max(Volume.BoundsMax.Z - BakeMin.Z, 0.0f);
+			const FVector2f Min = FVector2f(Volume.BoundsMin.X, Volume.BoundsMin.Y) - FVector2f::Max(NearDrift, FarDrift) - FVector2f(BakeMin.X, BakeMin.Y);
+			const FVector2f Max = FVector2f(Volume.BoundsMax.X, Volume.BoundsMax.Y) - FVector2f::Min(NearDrift, FarDrift) - FVector2f(BakeMin.X, BakeMin.Y);
+
+			Rect.Min.X = FMath::Clamp(FMath::FloorToInt(Min.X / TileSize.X), 0, BakeTilesPerAxis);
+			Rect.Min.Y = FMath::Clamp(FMath::FloorToInt(Min.Y / TileSize.Y), 0, BakeTilesPerAxis);
+			Rect.Max.X = FMath::Clamp(FMath::FloorToInt(Max.X / TileSize.X) + 1, 0, BakeTilesPerAxis);
+			Rect.Max.Y = FMath::Clamp(FMath::FloorToInt(Max.Y / TileSize.Y) + 1, 0, BakeTilesPerAxis);
+		}
+
+		for (int32 Y = Rect.Min.Y; Y < Rect.Max.Y; ++Y)
+		{
+			for (int32 X = Rect.Min.X; X < Rect.Max.X; ++X)
+			{
+				++Counts[Y * BakeTilesPerAxis + X];
+			}
+		}
+	}
+
+	OutTileRanges.SetNumUninitialized(Counts.Num());
+	uint32 Offset = 0;
+	for (int32 Tile = 0; Tile < Counts.Num(); ++Tile)
+	{
+		OutTileRanges[Tile] = FUintVector2(Offset, 0);
+		Offset += Counts[Tile];
+	}
+
+	// Volumes keep their order within a column, so the march adds them up like the unbinned one.
+	OutTileVolumes.SetNumUninitialized(Offset);
+	for (int32 Index = 0; Index < Volumes.Num(); ++Index)
+	{
+		const FIntRect& Rect = Rects[Index];
+		for (int32 Y = Rect.Min.Y; Y < Rect.Max.Y; ++Y)
+		{
+			for (int32 X = Rect.Min.X; X < Rect.Max.X; ++X)
+			{
+				FUintVector2& Range = OutTileRanges[Y * BakeTilesPerAxis + X];
+				OutTileVolumes[Range.X + Range.Y++] = Index;
+			}
+		}
+	}
+}
+
+// ================================================================================================
+
+void FCloudLightingCache::SetupParameters(FRDGBuilder& GraphBuilder, FCloudLightingShaderParameters& OutParameters, bool bUseLightVolume, bool bUseShadowMap) const
+{
+	if (!IsValid())
+	{
+		SetupDisabledParameters(GraphBuilder, OutParameters);
+		return;
+	}
+
+	OutParameters.CloudLightVolume = GraphBuilder.RegisterExternalTexture(Visible.LightVolume);
+	OutParameters.CloudShadowMap = GraphBuilder.RegisterExternalTexture(Visible.ShadowMap);
+	OutParameters.CloudLightingSampler = TStaticSamplerState<SF_Bilinear, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+	OutParameters.CloudLightVolumeMin = Visible.Min;
+	OutParameters.CloudLightVolumeInvSize = FVector3f(1.0f) / Visible.Size;
+	OutParameters.CloudShadowMapHeight = Visible.Min.Z;
+	OutParameters.CloudLightVolumeEnabled = bUseLightVolume ? 1 : 0;
+	OutParameters.CloudShadowMapEnabled = bUseShadowMap ? 1 : 0;
+}
+
+void FCloudLightingCache::SetupDisabledParameters(FRDGBuilder& GraphBuilder, FCloudLightingShaderParameters& OutParameters)
+{
+	OutParameters.CloudLightVolume = GSystemTextures.GetVolumetricBlackDummy(GraphBuilder);
+	OutParameters.CloudShadowMap = GSystemTextures.GetWhiteDummy(GraphBuilder);
+	OutParameters.CloudLightingSampler = TStaticSamplerState<SF_Bilinear, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+	OutParameters.CloudLightVolumeMin = FVector3f::ZeroVector;
+	OutParameters.CloudLightVolumeInvSize = FVector3f::OneVector;
+	OutParameters.CloudShadowMapHeight = 0.0f;
+	OutParameters.CloudLightVolumeEnabled = 0;
+	OutParameters.CloudShadowMapEnabled = 0;
+}
@@ -0,0 +1,413 @@
+#include "CloudNoiseBaker.h"
+#include "CloudStats.h"
+
+#include "Async/ParallelFor.h"
+#include "HAL/FileManager.h"
+#include "Math/VectorRegister.h"
+#include "Misc/Paths.h"
+
+/** Bump whenever the generated noise changes, to invalidate the on-disk cache. */
+static constexpr uint32 CloudNoiseBakerVersion = 1;
+static constexpr uint32 CloudNoiseCacheMagic = 0x494F4E43; // "CNOI"
+
+/** Number of channels of a baked volume, each at twice the Worley frequency of the previous one. */
+static constexpr int32 NumCloudNoiseChannels = 4;
+
+/** Octaves of every Worley FBM channel, each at twice the frequency of the previous one. */
+static constexpr int32 NumWorleyOctaves = 3;
+static constexpr float WorleyOctaveWeights[NumWorleyOctaves] = { 0.625f, 0.25f, 0.125f };
+
+// ================================================================================================
+
+FCloudNoiseBakeSettings FCloudNoiseBakeSettings::Shape()
+{
+	FCloudNoiseBakeSettings Settings;
+	Settings.Resolution = 128;
+	Settings.WorleyFrequency = 4;
+	Settings.PerlinFrequency = 4;
+	Settings.PerlinOctaves = 4;
+	Settings.bPerlinWorley = true;
+	return Settings;
+}
+
+FCloudNoiseBakeSettings FCloudNoiseBakeSettings::Detail()
+{
+	FCloudNoiseBakeSettings Settings;
+	Settings.Resolution = 32;
+	Settings.WorleyFrequency = 2;
+	Settings.bPerlinWorley = false;
+	return Settings;
+}
+
+uint32 FCloudNoiseBakeSettings::GetHash() const
+{
+	uint32 Hash = GetTypeHash(CloudNoiseBakerVersion);
+	Hash = HashCombine(Hash, GetTypeHash(Resolution));
+	Hash = HashCombine(Hash, GetTypeHash(WorleyFrequency));
+	Hash = HashCombine(Hash, GetTypeHash(PerlinFrequency));
+	Hash = HashCombine(Hash, GetTypeHash(PerlinOctaves));
+	Hash = HashCombine(Hash, GetTypeHash(bPerlinWorley));
+	Hash = HashCombine(Hash, GetTypeHash(Seed));
+	return Hash;
+}
+
+// ================================================================================================
+
+FVector4f FCloudNoiseVolume::SampleTrilinear(const FVector3f& UVW) const
+{
+	check(Resolution > 0 && Texels.Num() == Resolution * Resolution * Resolution);
+
+	int32 I0[3];
+	int32 I1[3];
+	float Alpha[3];
+	for (int32 Axis = 0; Axis < 3; ++Axis)
+	{
+		// Texel centers sit at (i + 0.5) / Resolution, as with hardware filtering.
+		const float X = UVW[Axis] * float(Resolution) - 0.5f;
+		const float Floor = FMath::FloorToFloat(X);
+		Alpha[Axis] = X - Floor;
+		I0[Axis] = ((int32(Floor) % Resolution) + Resolution) % Resolution;
+		I1[Axis] = (I0[Axis] + 1) % Resolution;
+	}
+
+	auto Fetch = [this](int32 X, int32 Y, int32 Z)
+	{
+		const FColor& Texel = Texels[X + Resolution * (Y + Resolution * Z)];
+		return FVector4f(Texel.R, Texel.G, Texel.B, Texel.A) * (1.0f / 255.0f);
+	};
+
+	const FVector4f C00 = FMath::Lerp(Fetch(I0[0], I0[1], I0[2]), Fetch(I1[0], I0[1], I0[2]), Alpha[0]);
+	const FVector4f C10 = FMath::Lerp(Fetch(I0[0], I1[1], I0[2]), Fetch(I1[0], I1[1], I0[2]), Alpha[0]);
+	const FVector4f C01 = FMath::Lerp(Fetch(I0[0], I0[1], I1[2]), Fetch(I1[0], I0[1], I1[2]), Alpha[0]);
+	const FVector4f C11 = FMath::Lerp(Fetch(I0[0], I1[1], I1[2]), Fetch(I1[0], I1[1], I1[2]), Alpha[0]);
+
+	return FMath::Lerp(FMath::Lerp(C00, C10, Alpha[1]), FMath::Lerp(C01, C11, Alpha[1]), Alpha[2]);
+}
+
+// ================================================================================================
+
+namespace CloudNoise
+{
+
+static uint32 Hash(int32 X, int32 Y, int32 Z, uint32 Seed)
+{
+	uint32 H = (uint32(X) * 1597334673u) ^ (uint32(Y) * 3812015801u) ^ (uint32(Z) * 2798796415u) ^ (Seed * 2654435761u);
+	H ^= H >> 16;
+	H *= 2246822519u;
+	H ^= H >> 13;
+	return H;
+}
+
+static float HashToFloat(uint32 H)
+{
+	return float(H >> 8) * (1.0f / 16777216.0f);
+}
+
+static int32 Wrap(int32 I, int32 Period)
+{
+	return ((I % Period) + Period) % Period;
+}
+
+// ================================================================================================
+
+static float PerlinGradientDot(uint32 H, float X, float Y, float Z)
+{
+	// The 12 edge directions of a cube.
+	switch (H % 12)
+	{
+	case 0:  return  X + Y;
+	case 1:  return -X + Y;
+	case 2:  return  X - Y;
+	case 3:  return -X - Y;
+	case 4:  return  X + Z;
+	case 5:  return -X + Z;
+	case 6:  return  X - Z;
+	case 7:  return -X - Z;
+	case 8:  return  Y + Z;
+	case 9:  return -Y + Z;
+	case 10: return  Y - Z;
+	default: return -Y - Z;
+	}
+}
+
+/** Gradient noise in [-1, 1] that tiles every Period lattice cells. */
+static float TileablePerlin(const FVector3f& P, int32 Period, uint32 Seed)
+{
+	const int32 CX = FMath::FloorToInt32(P.X);
+	const int32 CY = FMath::FloorToInt32(P.Y);
+	const int32 CZ = FMath::FloorToInt32(P.Z);
+	const FVector3f F(P.X - CX, P.Y - CY, P.Z - CZ);
+	const FVector3f U = F * F * F * (F * (F * 6.0f - FVector3f(15.0f)) + FVector3f(10.0f));
+
+	float Corners[8];
+	for (int32 Corner = 0; Corner < 8; ++Corner)
+	{
+		const int32 DX = Corner & 1;
+		const int32 DY = (Corner >> 1) & 1;
+		const int32 DZ = (Corner >> 2) & 1;
+		const uint32 H = Hash(Wrap(CX + DX, Period), Wrap(CY + DY, Period), Wrap(CZ + DZ, Period), Seed);
+		Corners[Corner] = PerlinGradientDot(H, F.X - DX, F.Y - DY, F.Z - DZ);
+	}
+
+	const float X00 = FMath::Lerp(Corners[0], Corners[1], U.X);
+	const float X10 = FMath::Lerp(Corners[2], Corners[3], U.X);
+	const float X01 = FMath::Lerp(Corners[4], Corners[5], U.X);
+	const float X11 = FMath::Lerp(Corners[6], Corners[7], U.X);
+
+	return FMath::Lerp(FMath::Lerp(X00, X10, U.Y), FMath::Lerp(X01, X11, U.Y), U.Z);
+}
+
+/** Perlin FBM in [0, 1] of a point in the unit cube. */
+static float TileablePerlinFbm(const FVector3f& UVW, int32 Frequency, int32 Octaves, uint32 Seed)
+{
+	float Sum = 0.0f;
+	float Amplitude = 1.0f;
+	float AmplitudeSum = 0.0f;
+	for (int32 Octave = 0; Octave < Octaves; ++Octave)
+	{
+		Sum += TileablePerlin(UVW * float(Frequency), Frequency, Seed + Octave) * Amplitude;
+		AmplitudeSum += Amplitude;
+		Frequency *= 2;
+		Amplitude *= 0.5f;
+	}
+	return FMath::Clamp(Sum / FMath::Max(AmplitudeSum, UE_SMALL_NUMBER) * 0.5f + 0.5f, 0.0f, 1.0f);
+}
+
+// ================================================================================================
+
+/** One random feature point per lattice cell of a tileable Worley noise. */
+struct FWorleyGrid
+{
+	int32 Frequency = 0;
+	TArray<FVector3f> Points;
+
+	FWorleyGrid(int32 InFrequency, uint32 Seed)
+		: Frequency(InFrequency)
+	{
+		Points.SetNumUninitialized(Frequency * Frequency * Frequency);
+		for (int32 Index = 0; Index < Points.Num(); ++Index)
+		{
+			const int32 X = Index % Frequency;
+			const int32 Y = (Index / Frequency) % Frequency;
+			const int32 Z = Index / (Frequency * Frequency);
+			Points[Index] = FVector3f(
+				HashToFloat(Hash(X, Y, Z, Seed)),
+				HashToFloat(Hash(X, Y, Z, Seed + 1)),
+				HashToFloat(Hash(X, Y, Z, Seed + 2)));
+		}
+	}
+
+	const FVector3f& GetPoint(int32 X, int32 Y, int32 Z) const
+	{
+		return Points[Wrap(X, Frequency) + Frequency * (Wrap(Y, Frequency) + Frequency * Wrap(Z, Frequency))];
+	}
+};
+
+/**
+ * Writes inverted Worley noise (1 - distance to the closest feature point, in cells) for one row of voxels.
+ * The 27 candidate points are gathered once per lattice cell in SoA layout and tested four at a time.
+ */
+static void WorleyRow(const FWorleyGrid& Grid, int32 Resolution, int32 Y, int32 Z, float* OutRow)
+{
+	static constexpr int32 NumCandidates = 28; // 27 neighbors padded to a multiple of 4
+
+	alignas(16) float CandidateX[NumCandidates];
+	alignas(16) float CandidateY[NumCandidates];
+	alignas(16) float CandidateZ[NumCandidates];
+	alignas(16) float Distances[4];
+
+	// Padding candidate that never wins.
+	CandidateX[NumCandidates - 1] = CandidateY[NumCandidates - 1] = CandidateZ[NumCandidates - 1] = 1e6f;
+
+	const float Scale = float(Grid.Frequency) / float(Resolution);
+	const float PY = (float(Y) + 0.5f) * Scale;
+	const float PZ = (float(Z) + 0.5f) * Scale;
+	const int32 CY = FMath::FloorToInt32(PY);
+	const int32 CZ = FMath::FloorToInt32(PZ);
+	const VectorRegister4Float VY = VectorSetFloat1(PY);
+	const VectorRegister4Float VZ = VectorSetFloat1(PZ);
+
+	int32 CachedCX = INDEX_NONE;
+	for (int32 X = 0; X < Resolution; ++X)
+	{
+		const float PX = (float(X) + 0.5f) * Scale;
+		const int32 CX = FMath::FloorToInt32(PX);
+
+		if (CX != CachedCX)
+		{
+			// Candidates are kept in unwrapped lattice space so distances across the tile border are correct.
+			int32 Candidate = 0;
+			for (int32 DZ = -1; DZ <= 1; ++DZ)
+			{
+				for (int32 DY = -1; DY <= 1; ++DY)
+				{
+					for (int32 DX = -1; DX <= 1; ++DX)
+					{
+						const FVector3f& Point = Grid.GetPoint(CX + DX, CY + DY, CZ + DZ);
+						CandidateX[Candidate] = float(CX + DX) + Point.X;
+						CandidateY[Candidate] = float(CY + DY) + Point.Y;
+						CandidateZ[Candidate] = float(CZ + DZ) + Point.Z;
+						++Candidate;
+					}
+				}
+			}
+			CachedCX = CX;
+		}
+
+		const VectorRegister4Float VX = VectorSetFloat1(PX);
+		VectorRegister4Float MinDistanceSq = VectorSetFloat1(BIG_NUMBER);
+		for (int32 Candidate = 0; Candidate < NumCandidates; Candidate += 4)
+		{
+			const VectorRegister4Float DX = VectorSubtract(VectorLoadAligned(CandidateX + Candidate), VX);
+			const VectorRegister4Float DY = VectorSubtract(VectorLoadAligned(CandidateY + Candidate), VY);
+			const VectorRegister4Float DZ = VectorSubtract(VectorLoadAligned(CandidateZ + Candidate), VZ);
+			const VectorRegister4Float DistanceSq = VectorMultiplyAdd(DX, DX, VectorMultiplyAdd(DY, DY, VectorMultiply(DZ, DZ)));
+			MinDistanceSq = VectorMin(MinDistanceSq, DistanceSq);
+		}
+
+		VectorStoreAligned(MinDistanceSq, Distances);
+		const float MinDistance = FMath::Sqrt(FMath::Min(FMath::Min(Distances[0], Distances[1]), FMath::Min(Distances[2], Distances[3])));
+		OutRow[X] = 1.0f - FMath::Min(MinDistance, 1.0f);
+	}
+}
+
+// ================================================================================================
+
+TSharedRef<FCloudNoiseVolume> Bake(const FCloudNoiseBakeSettings& Settings)
+{
+	const double StartTime = FPlatformTime::Seconds();
+	const int32 Resolution = FMath::Max(Settings.Resolution, 1);
+
+	// Channel C, octave O uses frequency WorleyFrequency * 2^(C + O), so the channels share most grids.
+	static constexpr int32 NumWorleyGrids = NumCloudNoiseChannels + NumWorleyOctaves - 1;
+	TArray<FWorleyGrid> WorleyGrids;
+	for (int32 Grid = 0; Grid < NumWorleyGrids; ++Grid)
+	{
+		WorleyGrids.Emplace(FMath::Max(Settings.WorleyFrequency, 1) << Grid, Settings.Seed + 0x100 * Grid);
+	}
+
+	TSharedRef<FCloudNoiseVolume> Volume = MakeShared<FCloudNoiseVolume>();
+	Volume->Resolution = Resolution;
+	Volume->Texels.SetNumUninitialized(Resolution * Resolution * Resolution);
+
+	ParallelFor(Resolution, [&Settings, &WorleyGrids, &Volume, Resolution](int32 Z)
+	{
+		TArray<float> Rows;
+		Rows.SetNumUninitialized(Resolution * NumWorleyGrids);
+
+		for (int32 Y = 0; Y < Resolution; ++Y)
+		{
+			for (int32 Grid = 0; Grid < NumWorleyGrids; ++Grid)
+			{
+				WorleyRow(WorleyGrids[Grid], Resolution, Y, Z, Rows.GetData() + Grid * Resolution);
+			}
+
+			FColor* OutTexels = Volume->Texels.GetData() + Resolution * (Y + Resolution * Z);
+			for (int32 X = 0; X < Resolution; ++X)
+			{
+				float Channels[NumCloudNoiseChannels];
+				for (int32 Channel = 0; Channel < NumCloudNoiseChannels; ++Channel)
+				{
+					float Fbm = 0.0f;
+					for (int32 Octave = 0; Octave < NumWorleyOctaves; ++Octave)
+					{
+						Fbm += Rows[(Channel + Octave) * Resolution + X] * WorleyOctaveWeights[Octave];
+					}
+					Channels[Channel] = Fbm;
+				}
+
+				if (Settings.bPerlinWorley)
+				{
+					const FVector3f UVW = (FVector3f(float(X), float(Y), float(Z)) + FVector3f(0.5f)) / float(Resolution);
+					const float Perlin = TileablePerlinFbm(UVW, FMath::Max(Settings.PerlinFrequency, 1), Settings.PerlinOctaves, Settings.Seed);
+
+					// Remap the Perlin FBM into [Worley, 1] to get billowy, connected shapes.
+					Channels[0] = Channels[0] + Perlin * (1.0f - Channels[0]);
+				}
+
+				OutTexels[X] = FColor(
+					uint8(FMath::RoundToInt32(FMath::Clamp(Channels[0], 0.0f, 1.0f) * 255.0f)),
+					uint8(FMath::RoundToInt32(FMath::Clamp(Channels[1], 0.0f, 1.0f) * 255.0f)),
+					uint8(FMath::RoundToInt32(FMath::Clamp(Channels[2], 0.0f, 1.0f) * 255.0f)),
+					uint8(FMath::RoundToInt32(FMath::Clamp(Channels[3], 0.0f, 1.0f) * 255.0f)));
+			}
+		}
+	});
+
+	UE_LOG(LogClouds, Log, TEXT("Baked %d^3 cloud noise volume in %.2f s"), Resolution, FPlatformTime::Seconds() - StartTime);
+	return Volume;
+}
+
+// ================================================================================================
+
+FString GetCachePath(const FCloudNoiseBakeSettings& Settings)
+{
+	return FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("Clouds"), TEXT("NoiseCache"), FString::Printf(TEXT("%08x.bin"), Settings.GetHash()));
+}
+
+static TSharedPtr<FCloudNoiseVolume> LoadCached(const FString& Path, const FCloudNoiseBakeSettings& Settings)
+{
+	TUniquePtr<FArchive> Reader(IFileManager::Get().CreateFileReader(*Path, FILEREAD_Silent));
+	if (!Reader)
+	{
+		return nullptr;
+	}
+
+	uint32 Magic = 0;
+	uint32 Hash = 0;
+	int32 Resolution = 0;
+	*Reader << Magic << Hash << Resolution;
+
+	const int64 NumTexels = int64(Resolution) * Resolution * Resolution;
+	if (Magic != CloudNoiseCacheMagic || Hash != Settings.GetHash() || Resolution != Settings.Resolution
+		|| Reader->TotalSize() - Reader->Tell() != NumTexels * int64(sizeof(FColor)))
+	{
+		UE_LOG(LogClouds, Warning, TEXT("Ignoring stale cloud noise cache %s"), *Path);
+		return nullptr;
+	}
+
+	TSharedPtr<FCloudNoiseVolume> Volume = MakeShared<FCloudNoiseVolume>();
+	Volume->Resolution = Resolution;
+	Volume->Texels.SetNumUninitialized(NumTexels);
+	Reader->Serialize(Volume->Texels.GetData(), NumTexels * sizeof(FColor));
+
+	return Reader->IsError() ? nullptr : Volume;
+}
+
+static void SaveCached(const FString& Path, const FCloudNoiseBakeSettings& Settings, const FCloudNoiseVolume& Volume)
+{
+	// Write to a temporary file first so a crash never leaves a truncated cache entry behind.
+	const FString TempPath = Path + TEXT(".tmp");
+	{
+		TUniquePtr<FArchive> Writer(IFileManager::Get().CreateFileWriter(*TempPath));
+		if (!Writer)
+		{
+			UE_LOG(LogClouds, Warning, TEXT("Failed to write cloud noise cache %s"), *TempPath);
+			return;
+		}
+
+		uint32 Magic = CloudNoiseCacheMagic;
+		uint32 Hash = Settings.GetHash();
+		int32 Resolution = Volume.Resolution;
+		*Writer << Magic << Hash << Resolution;
+		Writer->Serialize(const_cast<FColor*>(Volume.Texels.GetData()), Volume.Texels.Num() * sizeof(FColor));
+	}
+
+	IFileManager::Get().Move(*Path, *TempPath);
+}
+
+TSharedRef<FCloudNoiseVolume> BakeOrLoadCached(const FCloudNoiseBakeSettings& Settings)
+{
+	const FString Path = GetCachePath(Settings);
+
+	if (TSharedPtr<FCloudNoiseVolume> Cached = LoadCached(Path, Settings))
+	{
+		return Cached.ToSharedRef();
+	}
+
+	TSharedRef<FCloudNoiseVolume> Volume = Bake(Settings);
+	SaveCached(Path, Settings, *Volume);
+	return Volume;
+}
+
+} // namespace CloudNoise
@@ -0,0 +1,104 @@
+#include "CloudOccupancy.h"
+#include "CloudNoiseBaker.h"
+#include "CloudRaymarch.h"
+
+#include "Async/ParallelFor.h"
+
+// ================================================================================================
+
+static int32 WrapCloudCell(int32 Value, int32 Size)
+{
+	return (Value % Size + Size) % Size;
+}
+
+FVector2f FCloudOccupancyPyramid::Load(const FIntVector& Cell, int32 Level) const
+{
+	const int32 Size = Resolution >> Level;
+	const int32 X = WrapCloudCell(Cell.X, Size);
+	const int32 Y = WrapCloudCell(Cell.Y, Size);
+	const int32 Z = WrapCloudCell(Cell.Z, Size);
+	return Levels[Level][(Z * Size + Y) * Size + X];
+}
+
+TSharedRef<FCloudOccupancyPyramid> FCloudOccupancyPyramid::Build(const FCloudNoiseVolume& ShapeNoise)
+{
+	TSharedRef<FCloudOccupancyPyramid> Pyramid = MakeShared<FCloudOccupancyPyramid>();
+
+	const int32 Resolution = ShapeNoise.Resolution;
+	Pyramid->Resolution = Resolution;
+
+	const int32 NumLevels = FMath::FloorLog2(FMath::Max(Resolution, 1)) + 1;
+	Pyramid->Levels.SetNum(NumLevels);
+
+	// Trilinear lookups in a cell blend its texel with the neighbors on either side. The shape term
+	// grows with R and shrinks with the FBM, so its bounds come from the opposite extremes of both.
+	TArray<FVector2f>& Level0 = Pyramid->Levels[0];
+	Level0.SetNumUninitialized(Resolution * Resolution * Resolution);
+	ParallelFor(Resolution, [&ShapeNoise, &Level0, Resolution](int32 Z)
+	{
+		for (int32 Y = 0; Y < Resolution; ++Y)
+		{
+			for (int32 X = 0; X < Resolution; ++X)
+			{
+				float MinR = 1.0f;
+				float MaxR = 0.0f;
+				float MinFbm = 1.0f;
+				float MaxFbm = 0.0f;
+
+				for (int32 DZ = -1; DZ <= 1; ++DZ)
+				{
+					for (int32 DY = -1; DY <= 1; ++DY)
+					{
+						for (int32 DX = -1; DX <= 1; ++DX)
+						{
+							const int32 SX = WrapCloudCell(X + DX, Resolution);
+							const int32 SY = WrapCloudCell(Y + DY, Resolution);
+							const int32 SZ = WrapCloudCell(Z + DZ, Resolution);
+							const FColor Texel = ShapeNoise.Texels[(SZ * Resolution + SY) * Resolution + SX];
+
+							const float R = Texel.R / 255.0f;
+							const float Fbm = (Texel.G * 0.625f + Texel.B * 0.25f + Texel.A * 0.125f) / 255.0f;
+							MinR = FMath::Min(MinR, R);
+							MaxR = FMath::Max(MaxR, R);
+							MinFbm = FMath::Min(MinFbm, Fbm);
+							MaxFbm = FMath::Max(MaxFbm, Fbm);
+						}
+					}
+				}
+
+				Level0[(Z * Resolution + Y) * Resolution + X] = FVector2f(
+					CloudRaymarch::CloudRemap(MinR, MaxFbm - 1.0f, 1.0f, 0.0f, 1.0f),
+					CloudRaymarch::CloudRemap(MaxR, MinFbm - 1.0f, 1.0f, 0.0f, 1.0f));
+			}
+		}
+	});
+
+	for (int32 Level = 1; Level < NumLevels; ++Level)
+	{
+		const int32 Size = Resolution >> Level;
+		const TArray<FVector2f>& Parent = Pyramid->Levels[Level - 1];
+		TArray<FVector2f>& Cells = Pyramid->Levels[Level];
+		Cells.SetNumUninitialized(Size * Size * Size);
+
+		for (int32 Z = 0; Z < Size; ++Z)
+		{
+			for (int32 Y = 0; Y < Size; ++Y)
+			{
+				for (int32 X = 0; X < Size; ++X)
+				{
+					FVector2f MinMax(MAX_flt, -MAX_flt);
+					for (int32 Child = 0; Child < 8; ++Child)
+					{
+						const FIntVector ParentCell(X * 2 + (Child & 1), Y * 2 + ((Child >> 1) & 1), Z * 2 + (Child >> 2));
+						const FVector2f ParentMinMax = Parent[(ParentCell.Z * Size * 2 + ParentCell.Y) * Size * 2 + ParentCell.X];
+						MinMax.X = FMath::Min(MinMax.X, ParentMinMax.X);
+						MinMax.Y = FMath::Max(MinMax.Y, ParentMinMax.Y);
+					}
+					Cells[(Z * Size + Y) * Size + X] = MinMax;
+				}
+			}
+		}
+	}
+
+	return Pyramid;
+}
@@ -0,0 +1,207 @@
+#include "CloudOfflineRenderer.h"
+
+#include "Async/ParallelFor.h"
+#include <atomic>
+
+namespace CloudOfflineRender
+{
+
+/**
+ * Tiles of a worker as a [Begin, End) range in a single word, so the owner taking from the front and
+ * thieves taking from the back never hand out the same tile. Both sides only compare and swap the
+ * whole range; ranges on their own cache line keep the workers from invalidating each other.
+ */
+struct alignas(PLATFORM_CACHE_LINE_SIZE) FTileQueue
+{
+	std::atomic<uint64> Range { 0 };
+
+	static uint64 Pack(uint32 Begin, uint32 End) { return (uint64(End) << 32) | Begin; }
+
+	void Reset(uint32 Begin, uint32 End)
+	{
+		Range.store(Pack(Begin, End), std::memory_order_release);
+	}
+
+	bool PopFront(int32& OutTile)
+	{
+		uint64 Old = Range.load(std::memory_order_acquire);
+		for (;;)
+		{
+			const uint32 Begin = uint32(Old);
+			const uint32 End = uint32(Old >> 32);
+			if (Begin >= End)
+			{
+				return false;
+			}
+			if (Range.compare_exchange_weak(Old, Pack(Begin + 1, End), std::memory_order_acq_rel))
+			{
+				OutTile = int32(Begin);
+				return true;
+			}
+		}
+	}
+
+	/** Takes the back half of the tiles left, at least one. */
+	bool StealBack(uint32& OutBegin, uint32& OutEnd)
+	{
+		uint64 Old = Range.load(std::memory_order_acquire);
+		for (;;)
+		{
+			const uint32 Begin = uint32(Old);
+			const uint32 End = uint32(Old >> 32);
+			if (Begin >= End)
+			{
+				return false;
+			}
+			const uint32 Split = End - FMath::Max((End - Begin) / 2, 1u);
+			if (Range.compare_exchange_weak(Old, Pack(Begin, Split), std::memory_order_acq_rel))
+			{
+				OutBegin = Split;
+				OutEnd = End;
+				return true;
+			}
+		}
+	}
+};
+
+/** Point of the R2 sequence, (0.5, 0.5) for Index 0. */
+static FVector2f GetR2(int32 Index)
+{
+	return FVector2f(
+		FMath::Frac(0.5f + 0.7548776662f * float(Index)),
+		FMath::Frac(0.5f + 0.5698402909f * float(Index)));
+}
+
+/** Interleaved gradient noise, decorrelates the march jitter of neighbouring pixels. */
+static float GetPixelNoise(int32 X, int32 Y)
+{
+	return FMath::Frac(52.9829189f * FMath::Frac(0.06711056f * float(X) + 0.00583715f * float(Y)));
+}
+
+} // namespace CloudOfflineRender
+
+// ================================================================================================
+
+FCloudOfflineRenderer::FCloudOfflineRenderer(const FCloudMarchSettings& InSettings, TArray<FCloudVolume> InVolumes, const FCloudReferenceCamera& InCamera, int32 InTileSize)
+	: Settings(InSettings)
+	, Volumes(MoveTemp(InVolumes))
+	, Camera(InCamera)
+	, TileSize(FMath::Max(InTileSize, 1))
+{
+	NumTiles = FIntPoint(FMath::DivideAndRoundUp(Camera.Size.X, TileSize), FMath::DivideAndRoundUp(Camera.Size.Y, TileSize));
+	Reset();
+}
+
+void FCloudOfflineRenderer::Reset()
+{
+	Accumulation.Reset();
+	Accumulation.SetNumZeroed(Camera.Size.X * Camera.Size.Y);
+	NumPasses = 0;
+}
+
+FCloudOfflinePassStats FCloudOfflineRenderer::RenderPass(int32 NumThreads)
+{
+	using namespace CloudOfflineRender;
+
+	FCloudOfflinePassStats Stats;
+	Stats.NumThreads = NumThreads > 0 ? NumThreads : FPlatformMisc::NumberOfCoresIncludingHyperthreads();
+	Stats.NumThreads = FMath::Clamp(Stats.NumThreads, 1, FMath::Max(GetNumTiles(), 1));
+
+	// Contiguous ranges keep the tiles of a worker next to each other in the image.
+	TArray<FTileQueue> Queues;
+	Queues.SetNum(Stats.NumThreads);
+	for (int32 Worker = 0; Worker < Stats.NumThreads; ++Worker)
+	{
+		Queues[Worker].Reset(uint32(int64(GetNumTiles()) * Worker / Stats.NumThreads), uint32(int64(GetNumTiles()) * (Worker + 1) / Stats.NumThreads));
+	}
+
+	TArray<int32> WorkerTiles;
+	TArray<int32> WorkerSteals;
+	WorkerTiles.SetNumZeroed(Stats.NumThreads);
+	WorkerSteals.SetNumZeroed(Stats.NumThreads);
+
+	const double StartTime = FPlatformTime::Seconds();
+
+	// A worker that starts late only finds its tiles stolen, so all of them stay busy until the end.
+	ParallelFor(Stats.NumThreads, [this, &Queues, &WorkerTiles, &WorkerSteals](int32 Worker)
+	{
+		const int32 NumWorkers = Queues.Num();
+		for (;;)
+		{
+			int32 Tile;
+			while (Queues[Worker].PopFront(Tile))
+			{
+				RenderTile(Tile);
+				++WorkerTiles[Worker];
+			}
+
+			bool bStole = false;
+			for (int32 Offset = 1; Offset < NumWorkers && !bStole; ++Offset)
+			{
+				uint32 Begin;
+				uint32 End;
+				if (Queues[(Worker + Offset) % NumWorkers].StealBack(Begin, End))
+				{
+					// Only the owner refills its empty queue, and thieves skip empty queues.
+					Queues[Worker].Reset(Begin, End);
+					WorkerSteals[Worker] += int32(End - Begin);
+					bStole = true;
+				}
+			}
+
+			if (!bStole)
+			{
+				break;
+			}
+		}
+	}, Stats.NumThreads == 1 ? EParallelForFlags::ForceSingleThread : EParallelForFlags::Unbalanced);
+
+	Stats.Seconds = FPlatformTime::Seconds() - StartTime;
+	Stats.MinWorkerTiles = MAX_int32;
+	for (int32 Worker = 0; Worker < Stats.NumThreads; ++Worker)
+	{
+		Stats.NumStolenTiles += WorkerSteals[Worker];
+		Stats.MaxWorkerTiles = FMath::Max(Stats.MaxWorkerTiles, WorkerTiles[Worker]);
+		Stats.MinWorkerTiles = FMath::Min(Stats.MinWorkerTiles, WorkerTiles[Worker]);
+	}
+
+	++NumPasses;
+	return Stats;
+}
+
+void FCloudOfflineRenderer::RenderTile(int32 TileIndex)
+{
+	using namespace CloudOfflineRender;
+
+	const FIntPoint TileMin(TileIndex % NumTiles.X * TileSize, TileIndex / NumTiles.X * TileSize);
+	const FIntPoint TileMax = FIntPoint::ComponentMin(TileMin + TileSize, Camera.Size);
+
+	// Pass 0 samples pixel centers with the march jitter of RenderCloudImage.
+	const FVector2f PixelOffset = GetR2(NumPasses);
+	const float PassJitter = FMath::Frac(0.5f + 0.6180339887f * float(NumPasses));
+
+	for (int32 Y = TileMin.Y; Y < TileMax.Y; ++Y)
+	{
+		for (int32 X = TileMin.X; X < TileMax.X; ++X)
+		{
+			const float Jitter = NumPasses > 0 ? FMath::Frac(PassJitter + GetPixelNoise(X, Y)) : PassJitter;
+			const FVector3f Dir = Camera.GetRayDirection(FVector2f(float(X) + PixelOffset.X, float(Y) + PixelOffset.Y));
+			const FCloudMarchResult Result = CloudRaymarch::MarchCloudVolumes(Settings, Volumes, Camera.Origin, Dir, MAX_flt, Jitter);
+
+			FLinearColor& Sum = Accumulation[Y * Camera.Size.X + X];
+			Sum += FLinearColor(Result.Luminance.X, Result.Luminance.Y, Result.Luminance.Z, Result.Transmittance);
+		}
+	}
+}
+
+void FCloudOfflineRenderer::Resolve(TArrayView<FLinearColor> OutPixels) const
+{
+	check(OutPixels.Num() == Accumulation.Num());
+
+	const float Scale = 1.0f / float(FMath::Max(NumPasses, 1));
+	for (int32 Index = 0; Index < Accumulation.Num(); ++Index)
+	{
+		const FLinearColor Average = Accumulation[Index] * Scale;
+		OutPixels[Index] = FLinearColor(Average.R, Average.G, Average.B, NumPasses > 0 ? 1.0f - Average.A : 0.0f);
+	}
+}
@@ -0,0 +1,161 @@
+#include "CloudPanorama.h"
+#include "CloudSceneViewExtension.h"
+#include "CloudStats.h"
+
+#include "RHIStaticStates.h"
+#include "SystemTextures.h"
+
+// ================================================================================================
+
+void FCloudPanoramaCache::Update(
+	FRDGBuilder& GraphBuilder,
+	const FGlobalShaderMap* ShaderMap,
+	const FCloudPanoramaSettings& Settings,
+	const FVector& CameraOrigin,
+	TConstArrayView<FCloudVolume> Volumes,
+	const FCloudMarchShaderParameters& March)
+{
+	SCOPE_CYCLE_COUNTER(STAT_CloudsPanoramaUpdate);
+
+	// Nothing to bake, and the last bake shows volumes that are gone.
+	if (Volumes.Num() == 0)
+	{
+		Reset();
+		return;
+	}
+
+	const int32 Resolution = FMath::Clamp(Settings.Resolution, 8, 1024);
+	const int32 TilesPerFace = FMath::Clamp(Settings.TilesPerFace, 1, Resolution);
+	const int32 RowsPerTile = FMath::DivideAndRoundUp(Resolution, TilesPerFace);
+	const int32 NumTiles = 6 * TilesPerFace;
+
+	FRDGTextureRef Texture = nullptr;
+	FRDGTextureRef DepthTexture = nullptr;
+
+	if (NextTile == 0)
+	{
+		// Freeze the placement for the whole bake.
+		Pending.Origin = FVector3f(CameraOrigin);
+		Pending.NearDistance = FMath::Max(Settings.NearDistance, 0.0f);
+
+		// Reuse the texture of the pending copy unless the resolution changed.
+		if (!Pending.Texture.IsValid() || Pending.Texture->GetDesc().Extent != FIntPoint(Resolution))
+		{
+			Texture = GraphBuilder.CreateTexture(
+				FRDGTextureDesc::CreateCube(Resolution, PF_FloatRGBA, FClearValueBinding::Black, TexCreate_ShaderResource | TexCreate_UAV),
+				TEXT("Clouds.Panorama"));
+			Pending.Texture = GraphBuilder.ConvertToExternalTexture(Texture);
+
+			DepthTexture = GraphBuilder.CreateTexture(
+				FRDGTextureDesc::CreateCube(Resolution, PF_R32_FLOAT, FClearValueBinding::Black, TexCreate_ShaderResource | TexCreate_UAV),
+				TEXT("Clouds.PanoramaDepth"));
+			Pending.DepthTexture = GraphBuilder.ConvertToExternalTexture(DepthTexture);
+		}
+	}
+	else if (Pending.Texture->GetDesc().Extent != FIntPoint(Resolution) || NextTile >= NumTiles)
+	{
+		// The resolution or tiling changed during the bake, start over next frame.
+		NextTile = 0;
+		return;
+	}
+
+	if (!Texture)
+	{
+		Texture = GraphBuilder.RegisterExternalTexture(Pending.Texture);
+		DepthTexture = GraphBuilder.RegisterExternalTexture(Pending.DepthTexture);
+	}
+
+	// Volumes are composited back to front as seen from the origin, like the per view draw list.
+	TArray<uint32> DrawList;
+	DrawList.SetNumUninitialized(Volumes.Num());
+	for (int32 Index = 0; Index < Volumes.Num(); ++Index)
+	{
+		DrawList[Index] = Index;
+	}
+	const FVector3f Origin = Pending.Origin;
+	DrawList.Sort([&Volumes, &Origin](uint32 A, uint32 B)
+	{
+		return FVector3f::DistSquared(Volumes[A].GetCenter(), Origin) > FVector3f::DistSquared(Volumes[B].GetCenter(), Origin);
+	});
+
+	const int32 FirstTile = NextTile;
+	const int32 NumBakeTiles = FMath::Min(FMath::Max(Settings.TilesPerFrame, 1), NumTiles - FirstTile);
+
+	{
+		RDG_EVENT_SCOPE(GraphBuilder, "CloudPanorama %d-%d of %d", FirstTile, FirstTile + NumBakeTiles - 1, NumTiles);
+
+		FCloudPanoramaCS::FParameters* PassParameters = GraphBuilder.AllocParameters<FCloudPanoramaCS::FParameters>();
+		PassParameters->March = March;
+		PassParameters->PanoramaDrawList = GraphBuilder.CreateSRV(CreateStructuredBuffer(GraphBuilder, TEXT("Clouds.PanoramaDrawList"), DrawList));
+		PassParameters->PanoramaOrigin = Pending.Origin;
+		PassParameters->PanoramaNearDistance = Pending.NearDistance;
+		PassParameters->PanoramaResolution = Resolution;
+		PassParameters->PanoramaRowsPerTile = RowsPerTile;
+		PassParameters->PanoramaTilesPerFace = TilesPerFace;
+		PassParameters->PanoramaFirstTile = FirstTile;
+		PassParameters->PanoramaNumTiles = NumBakeTiles;
+		PassParameters->PanoramaNumVolumes = DrawList.Num();
+		PassParameters->PanoramaOutput = GraphBuilder.CreateUAV(Texture);
+		PassParameters->PanoramaDepthOutput = GraphBuilder.CreateUAV(DepthTexture);
+
+		TShaderMapRef<FCloudPanoramaCS> ComputeShader(ShaderMap);
+		FComputeShaderUtils::AddPass(
+			GraphBuilder,
+			RDG_EVENT_NAME("CloudPanorama %dx%dx%d", Resolution, RowsPerTile, NumBakeTiles),
+			ComputeShader,
+			PassParameters,
+			FComputeShaderUtils::GetGroupCount(FIntVector(Resolution, RowsPerTile, NumBakeTiles), FIntVector(FCloudPanoramaCS::ThreadGroupSize, FCloudPanoramaCS::ThreadGroupSize, 1)));
+	}
+
+	INC_DWORD_STAT_BY(STAT_CloudsPanoramaTiles, NumBakeTiles);
+	CSV_CUSTOM_STAT(Clouds, PanoramaTiles, NumBakeTiles, ECsvCustomStatOp::Accumulate);
+
+	NextTile += NumBakeTiles;
+	if (NextTile >= NumTiles)
+	{
+		Swap(Visible, Pending);
+		NextTile = 0;
+		++NumBakes;
+	}
+}
+
+void FCloudPanoramaCache::Reset()
+{
+	Visible = FCloudPanoramaBake();
+	Pending = FCloudPanoramaBake();
+	NextTile = 0;
+}
+
+uint64 FCloudPanoramaCache::GetGpuMemorySize() const
+{
+	return GetCloudPooledTargetSize(Visible.Texture) + GetCloudPooledTargetSize(Visible.DepthTexture)
+		+ GetCloudPooledTargetSize(Pending.Texture) + GetCloudPooledTargetSize(Pending.DepthTexture);
+}
+
+// ================================================================================================
+
+void FCloudPanoramaCache::SetupParameters(FRDGBuilder& GraphBuilder, FCloudPanoramaShaderParameters& OutParameters) const
+{
+	if (!IsValid())
+	{
+		SetupDisabledParameters(GraphBuilder, OutParameters);
+		return;
+	}
+
+	OutParameters.CloudPanorama = GraphBuilder.RegisterExternalTexture(Visible.Texture);
+	OutParameters.CloudPanoramaDepth = GraphBuilder.RegisterExternalTexture(Visible.DepthTexture);
+	OutParameters.CloudPanoramaSampler = TStaticSamplerState<SF_Bilinear, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+	OutParameters.CloudPanoramaOrigin = Visible.Origin;
+	OutParameters.CloudPanoramaNearDistance = Visible.NearDistance;
+	OutParameters.CloudPanoramaEnabled = 1;
+}
+
+void FCloudPanoramaCache::SetupDisabledParameters(FRDGBuilder& GraphBuilder, FCloudPanoramaShaderParameters& OutParameters)
+{
+	OutParameters.CloudPanorama = GSystemTextures.GetCubeBlackDummy(GraphBuilder);
+	OutParameters.CloudPanoramaDepth = GSystemTextures.GetCubeBlackDummy(GraphBuilder);
+	OutParameters.CloudPanoramaSampler = TStaticSamplerState<SF_Bilinear, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+	OutParameters.CloudPanoramaOrigin = FVector3f::ZeroVector;
+	OutParameters.CloudPanoramaNearDistance = 0.0f;
+	OutParameters.CloudPanoramaEnabled = 0;
+}
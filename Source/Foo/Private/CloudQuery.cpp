@@ -0,0 +1,179 @@
+#include "CloudQuery.h"
+#include "CloudStats.h"
+
+#include "Async/ParallelFor.h"
+#include "Math/VectorRegister.h"
+
+// Queries per task. Smaller batches cost more to schedule than to evaluate.
+static constexpr int32 CloudQueryBatchSize = 256;
+
+/** Calls Packet(First, Num) for packets of up to four queries, with the batches spread over the task graph. */
+template <typename PacketFunctionType>
+static void ForEachQueryPacket(int32 NumQueries, PacketFunctionType Packet)
+{
+	const int32 NumBatches = FMath::DivideAndRoundUp(NumQueries, CloudQueryBatchSize);
+	ParallelFor(NumBatches, [NumQueries, &Packet](int32 Batch)
+	{
+		const int32 BatchEnd = FMath::Min((Batch + 1) * CloudQueryBatchSize, NumQueries);
+		for (int32 First = Batch * CloudQueryBatchSize; First < BatchEnd; First += 4)
+		{
+			Packet(First, FMath::Min(BatchEnd - First, 4));
+		}
+	}, NumBatches == 1 ? EParallelForFlags::ForceSingleThread : EParallelForFlags::None);
+}
+
+// ================================================================================================
+
+FCloudQuerySegmentPacket::FCloudQuerySegmentPacket(const FCloudQuerySegment* Segments, int32 Num)
+{
+	for (int32 Lane = 0; Lane < 4; ++Lane)
+	{
+		const FCloudQuerySegment& Segment = Segments[FMath::Min(Lane, Num - 1)];
+		for (int32 Axis = 0; Axis < 3; ++Axis)
+		{
+			Origin[Axis][Lane] = float(Segment.Start[Axis]);
+			Delta[Axis][Lane] = float(Segment.End[Axis] - Segment.Start[Axis]);
+			InvDelta[Axis][Lane] = Delta[Axis][Lane] != 0.0f ? 1.0f / Delta[Axis][Lane] : BIG_NUMBER;
+		}
+	}
+}
+
+uint32 FCloudQuerySegmentPacket::IntersectBounds(const FCloudVolume& Volume, float OutNear[4], float OutFar[4]) const
+{
+	VectorRegister4Float Near = VectorSetFloat1(-MAX_flt);
+	VectorRegister4Float Far = VectorSetFloat1(MAX_flt);
+	for (int32 Axis = 0; Axis < 3; ++Axis)
+	{
+		const VectorRegister4Float O = VectorLoadAligned(Origin[Axis]);
+		const VectorRegister4Float InvD = VectorLoadAligned(InvDelta[Axis]);
+		const VectorRegister4Float T0 = VectorMultiply(VectorSubtract(VectorSetFloat1(Volume.BoundsMin[Axis]), O), InvD);
+		const VectorRegister4Float T1 = VectorMultiply(VectorSubtract(VectorSetFloat1(Volume.BoundsMax[Axis]), O), InvD);
+		Near = VectorMax(Near, VectorMin(T0, T1));
+		Far = VectorMin(Far, VectorMax(T0, T1));
+	}
+
+	const VectorRegister4Float Zero = VectorZeroFloat();
+	const VectorRegister4Float One = VectorOneFloat();
+	const VectorRegister4Float Hit = VectorBitwiseAnd(VectorCompareGT(Far, VectorMax(Near, Zero)), VectorCompareLT(Near, One));
+
+	alignas(16) float ClippedNear[4];
+	alignas(16) float ClippedFar[4];
+	VectorStoreAligned(VectorMax(Near, Zero), ClippedNear);
+	VectorStoreAligned(VectorMin(Far, One), ClippedFar);
+	for (int32 Lane = 0; Lane < 4; ++Lane)
+	{
+		OutNear[Lane] = ClippedNear[Lane];
+		OutFar[Lane] = ClippedFar[Lane];
+	}
+	return uint32(VectorMaskBits(Hit));
+}
+
+// ================================================================================================
+
+FCloudQueryScene::FCloudQueryScene(const FCloudMarchSettings& InSettings, TArray<FCloudVolume> InVolumes)
+	: Settings(InSettings)
+	, Volumes(MoveTemp(InVolumes))
+{
+}
+
+void FCloudQueryScene::QueryDensity(TConstArrayView<FVector> Points, TArrayView<float> OutDensity) const
+{
+	check(Points.Num() == OutDensity.Num());
+	SCOPE_CYCLE_COUNTER(STAT_CloudsQueries);
+	INC_DWORD_STAT_BY(STAT_CloudsQueryCount, Points.Num());
+
+	ForEachQueryPacket(Points.Num(), [this, Points, OutDensity](int32 First, int32 Num)
+	{
+		QueryDensityPacket(Points.GetData() + First, OutDensity.GetData() + First, Num);
+	});
+}
+
+void FCloudQueryScene::QueryTransmittance(TConstArrayView<FCloudQuerySegment> Segments, TArrayView<float> OutTransmittance, int32 NumSteps) const
+{
+	check(Segments.Num() == OutTransmittance.Num());
+	SCOPE_CYCLE_COUNTER(STAT_CloudsQueries);
+	INC_DWORD_STAT_BY(STAT_CloudsQueryCount, Segments.Num());
+
+	NumSteps = FMath::Max(NumSteps, 1);
+	ForEachQueryPacket(Segments.Num(), [this, Segments, OutTransmittance, NumSteps](int32 First, int32 Num)
+	{
+		QueryTransmittancePacket(Segments.GetData() + First, OutTransmittance.GetData() + First, Num, NumSteps);
+	});
+}
+
+// ================================================================================================
+
+void FCloudQueryScene::QueryDensityPacket(const FVector* Points, float* OutDensity, int32 Num) const
+{
+	// Lanes past Num repeat the last point and are masked out.
+	alignas(16) float X[4];
+	alignas(16) float Y[4];
+	alignas(16) float Z[4];
+	for (int32 Lane = 0; Lane < 4; ++Lane)
+	{
+		const FVector& Point = Points[FMath::Min(Lane, Num - 1)];
+		X[Lane] = float(Point.X);
+		Y[Lane] = float(Point.Y);
+		Z[Lane] = float(Point.Z);
+	}
+
+	const VectorRegister4Float PX = VectorLoadAligned(X);
+	const VectorRegister4Float PY = VectorLoadAligned(Y);
+	const VectorRegister4Float PZ = VectorLoadAligned(Z);
+	const uint32 LaneMask = (1u << Num) - 1;
+
+	float Density[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	for (const FCloudVolume& Volume : Volumes)
+	{
+		const VectorRegister4Float Inside = VectorBitwiseAnd(
+			VectorBitwiseAnd(
+				VectorBitwiseAnd(VectorCompareGE(PX, VectorSetFloat1(Volume.BoundsMin.X)), VectorCompareLE(PX, VectorSetFloat1(Volume.BoundsMax.X))),
+				VectorBitwiseAnd(VectorCompareGE(PY, VectorSetFloat1(Volume.BoundsMin.Y)), VectorCompareLE(PY, VectorSetFloat1(Volume.BoundsMax.Y)))),
+			VectorBitwiseAnd(VectorCompareGE(PZ, VectorSetFloat1(Volume.BoundsMin.Z)), VectorCompareLE(PZ, VectorSetFloat1(Volume.BoundsMax.Z))));
+
+		for (uint32 Mask = uint32(VectorMaskBits(Inside)) & LaneMask; Mask != 0; Mask &= Mask - 1)
+		{
+			const uint32 Lane = FMath::CountTrailingZeros(Mask);
+			Density[Lane] += CloudRaymarch::SampleCloudDensity(Settings, Volume, FVector3f(X[Lane], Y[Lane], Z[Lane]));
+		}
+	}
+
+	for (int32 Lane = 0; Lane < Num; ++Lane)
+	{
+		OutDensity[Lane] = Density[Lane];
+	}
+}
+
+void FCloudQueryScene::QueryTransmittancePacket(const FCloudQuerySegment* Segments, float* OutTransmittance, int32 Num, int32 NumSteps) const
+{
+	const FCloudQuerySegmentPacket Packet(Segments, Num);
+	const uint32 LaneMask = (1u << Num) - 1;
+
+	float OpticalDepth[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+	for (const FCloudVolume& Volume : Volumes)
+	{
+		float TNear[4];
+		float TFar[4];
+		uint32 Mask = Packet.IntersectBounds(Volume, TNear, TFar) & LaneMask;
+
+		for (; Mask != 0; Mask &= Mask - 1)
+		{
+			const uint32 Lane = FMath::CountTrailingZeros(Mask);
+			const FVector3f Start(Packet.Origin[0][Lane], Packet.Origin[1][Lane], Packet.Origin[2][Lane]);
+			const FVector3f Step(Packet.Delta[0][Lane], Packet.Delta[1][Lane], Packet.Delta[2][Lane]);
+			const float StepT = (TFar[Lane] - TNear[Lane]) / float(NumSteps);
+
+			float Sum = 0.0f;
+			for (int32 StepIndex = 0; StepIndex < NumSteps; ++StepIndex)
+			{
+				Sum += CloudRaymarch::SampleCloudDensity(Settings, Volume, Start + Step * (TNear[Lane] + StepT * (float(StepIndex) + 0.5f)));
+			}
+			OpticalDepth[Lane] += Sum * StepT * Step.Size();
+		}
+	}
+
+	for (int32 Lane = 0; Lane < Num; ++Lane)
+	{
+		OutTransmittance[Lane] = FMath::Exp(-OpticalDepth[Lane] * Settings.Extinction);
+	}
+}
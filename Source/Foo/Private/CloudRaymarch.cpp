@@ -0,0 +1,337 @@
+#include "CloudRaymarch.h"
+#include "CloudNoiseBaker.h"
+#include "CloudOccupancy.h"
+
+#include "Async/ParallelFor.h"
+
+// ================================================================================================
+
+FVector3f FCloudReferenceCamera::GetRayDirection(const FVector2f& PixelPos) const
+{
+	const float TanHalfFov = FMath::Tan(FMath::DegreesToRadians(FieldOfView) * 0.5f);
+	const float AspectRatio = float(Size.X) / float(FMath::Max(Size.Y, 1));
+
+	// Screen X maps to the camera's right (Y axis), screen Y down to the camera's down (-Z axis).
+	const FVector2f NDC = PixelPos / FVector2f(Size) * 2.0f - 1.0f;
+	const FVector3f LocalDir(1.0f, NDC.X * TanHalfFov, -NDC.Y * TanHalfFov / AspectRatio);
+	return Rotation.RotateVector(LocalDir).GetSafeNormal();
+}
+
+namespace CloudRaymarch
+{
+
+// ================================================================================================
+
+float CloudRemap(float Value, float OldMin, float OldMax, float NewMin, float NewMax)
+{
+	return NewMin + (Value - OldMin) / (OldMax - OldMin) * (NewMax - NewMin);
+}
+
+float CloudHeightGradient(float Height, float Type)
+{
+	const float Top = FMath::Lerp(0.3f, 1.0f, Type);
+	return FMath::Clamp(Height / 0.15f, 0.0f, 1.0f) * FMath::Clamp((Top - Height) / (0.35f * Top), 0.0f, 1.0f);
+}
+
+FCloudWeatherSample SampleCloudWeather(const FCloudMarchSettings& Settings, const FVector3f& WorldPos)
+{
+	return Settings.SampleWeather ? Settings.SampleWeather(FVector2f(WorldPos.X, WorldPos.Y)) : FCloudWeatherSample();
+}
+
+// ================================================================================================
+
+float SampleCloudDensity(const FCloudMarchSettings& Settings, const FCloudVolume& Volume, const FVector3f& WorldPos)
+{
+	if (!Settings.ShapeNoise.IsValid() || !Settings.DetailNoise.IsValid())
+	{
+		return 0.0f;
+	}
+
+	const FVector3f Local = (WorldPos - Volume.BoundsMin) / (Volume.BoundsMax - Volume.BoundsMin);
+	if (Local.X < 0.0f || Local.Y < 0.0f || Local.Z < 0.0f || Local.X > 1.0f || Local.Y > 1.0f || Local.Z > 1.0f)
+	{
+		return 0.0f;
+	}
+
+	// Authored volumes replace the procedural shape, weather and noise.
+	if (Volume.BrickVolume != 0)
+	{
+		return Settings.SampleBrickDensity ? Settings.SampleBrickDensity(Volume.BrickVolume, Local) * Volume.DensityScale : 0.0f;
+	}
+
+	const float Edge = FMath::Min(FMath::Min(Local.X, 1.0f - Local.X), FMath::Min(Local.Y, 1.0f - Local.Y));
+	const float EdgeFalloff = FMath::Clamp(Edge / 0.1f, 0.0f, 1.0f);
+
+	const FCloudWeatherSample Weather = SampleCloudWeather(Settings, WorldPos);
+	const FVector3f NoisePos = WorldPos + Settings.WindOffset;
+
+	const FVector4f Shape = Settings.ShapeNoise->SampleTrilinear(NoisePos * Settings.ShapeFrequency);
+	const float ShapeFbm = Shape.Y * 0.625f + Shape.Z * 0.25f + Shape.W * 0.125f;
+	float Base = CloudRemap(Shape.X, ShapeFbm - 1.0f, 1.0f, 0.0f, 1.0f) * CloudHeightGradient(Local.Z, Weather.Type) * EdgeFalloff;
+	Base = FMath::Clamp(CloudRemap(Base, 1.0f - Volume.Coverage * Weather.Coverage, 1.0f, 0.0f, 1.0f), 0.0f, 1.0f);
+	if (Base <= 0.0f)
+	{
+		return 0.0f;
+	}
+
+	const FVector4f Detail = Settings.DetailNoise->SampleTrilinear(NoisePos * Settings.DetailFrequency);
+	const float DetailFbm = Detail.X * 0.625f + Detail.Y * 0.25f + Detail.Z * 0.125f;
+	Base = FMath::Clamp(CloudRemap(Base, DetailFbm * Settings.DetailStrength, 1.0f, 0.0f, 1.0f), 0.0f, 1.0f);
+
+	return Base * Volume.DensityScale * (1.0f + Weather.Precipitation);
+}
+
+float HenyeyGreenstein(float CosTheta, float G)
+{
+	const float G2 = G * G;
+	return (1.0f - G2) / (4.0f * PI * FMath::Pow(FMath::Max(1.0f + G2 - 2.0f * G * CosTheta, 1e-4f), 1.5f));
+}
+
+bool IntersectCloudBounds(const FCloudVolume& Volume, const FVector3f& Origin, const FVector3f& Dir, float& OutNear, float& OutFar)
+{
+	// Matches the IEEE behavior of 1 / 0 in HLSL for axis aligned rays.
+	const FVector3f InvDir(
+		Dir.X != 0.0f ? 1.0f / Dir.X : BIG_NUMBER,
+		Dir.Y != 0.0f ? 1.0f / Dir.Y : BIG_NUMBER,
+		Dir.Z != 0.0f ? 1.0f / Dir.Z : BIG_NUMBER);
+
+	const FVector3f T0 = (Volume.BoundsMin - Origin) * InvDir;
+	const FVector3f T1 = (Volume.BoundsMax - Origin) * InvDir;
+	const FVector3f TMin = FVector3f::Min(T0, T1);
+	const FVector3f TMax = FVector3f::Max(T0, T1);
+
+	OutNear = TMin.GetMax();
+	OutFar = TMax.GetMin();
+	return OutFar > FMath::Max(OutNear, 0.0f);
+}
+
+// ================================================================================================
+
+float CloudMaxHeightGradient(float MinHeight, float MaxHeight, float Type)
+{
+	// Both ramps of the gradient are monotonic and at most 1, so their product is bounded by either.
+	const float Top = FMath::Lerp(0.3f, 1.0f, Type);
+	return FMath::Min(FMath::Clamp(MaxHeight / 0.15f, 0.0f, 1.0f), FMath::Clamp((Top - MinHeight) / (0.35f * Top), 0.0f, 1.0f));
+}
+
+bool IsCloudCellEmpty(const FCloudMarchSettings& Settings, const FCloudVolume& Volume, const FVector3f& WorldPos, const FIntVector& Cell, int32 Level, float CellWorldSize)
+{
+	const float MaxShape = Settings.Occupancy->Load(Cell, Level).Y;
+
+	const FCloudWeatherSample Weather = SampleCloudWeather(Settings, WorldPos);
+	const float Height = (WorldPos.Z - Volume.BoundsMin.Z) / (Volume.BoundsMax.Z - Volume.BoundsMin.Z);
+	const float HeightRange = CellWorldSize / (Volume.BoundsMax.Z - Volume.BoundsMin.Z);
+	const float MaxHeightGradient = CloudMaxHeightGradient(Height - HeightRange, Height + HeightRange, Weather.Type);
+
+	// The coverage remap zeroes every base value below 1 - coverage. The margin covers the 16 bit storage on the GPU.
+	return MaxShape * MaxHeightGradient + 1e-3f <= 1.0f - Volume.Coverage * Weather.Coverage;
+}
+
+float CloudCellExitDistance(const FVector3f& NoisePos, const FVector3f& NoiseDir, const FVector3f& CellMin, float CellSize)
+{
+	float Exit = BIG_NUMBER;
+	for (int32 Axis = 0; Axis < 3; ++Axis)
+	{
+		if (NoiseDir[Axis] != 0.0f)
+		{
+			const float Boundary = CellMin[Axis] + (NoiseDir[Axis] > 0.0f ? CellSize : 0.0f);
+			Exit = FMath::Min(Exit, (Boundary - NoisePos[Axis]) / NoiseDir[Axis]);
+		}
+	}
+	return FMath::Max(Exit, 0.0f) + 1e-3f;
+}
+
+// ================================================================================================
+
+float MarchLightTransmittance(const FCloudMarchSettings& Settings, const FCloudVolume& Volume, const FVector3f& WorldPos)
+{
+	float TNear;
+	float TFar;
+	IntersectCloudBounds(Volume, WorldPos, Settings.SunDirection, TNear, TFar);
+
+	const int32 NumLightSteps = FMath::Max(Settings.NumLightSteps, 0);
+	const float StepSize = FMath::Max(TFar, 0.0f) / float(FMath::Max(NumLightSteps, 1));
+	float OpticalDepth = 0.0f;
+
+	for (int32 Step = 0; Step < NumLightSteps; ++Step)
+	{
+		const FVector3f P = WorldPos + Settings.SunDirection * (StepSize * (float(Step) + 0.5f));
+		OpticalDepth += SampleCloudDensity(Settings, Volume, P) * StepSize;
+	}
+
+	return FMath::Exp(-OpticalDepth * Settings.Extinction);
+}
+
+float MarchCloudSunOpticalDepth(const FCloudMarchSettings& Settings, const FCloudVolume& Volume, const FVector3f& WorldPos, int32 NumSteps)
+{
+	float TNear;
+	float TFar;
+	if (!IntersectCloudBounds(Volume, WorldPos, Settings.SunDirection, TNear, TFar))
+	{
+		return 0.0f;
+	}
+
+	NumSteps = FMath::Max(NumSteps, 1);
+	TNear = FMath::Max(TNear, 0.0f);
+	const float StepSize = (TFar - TNear) / float(NumSteps);
+	float OpticalDepth = 0.0f;
+
+	for (int32 Step = 0; Step < NumSteps; ++Step)
+	{
+		const FVector3f P = WorldPos + Settings.SunDirection * (TNear + StepSize * (float(Step) + 0.5f));
+		OpticalDepth += SampleCloudDensity(Settings, Volume, P) * StepSize;
+	}
+
+	return OpticalDepth;
+}
+
+float MarchCloudSunTransmittance(const FCloudMarchSettings& Settings, TConstArrayView<FCloudVolume> Volumes, const FVector3f& WorldPos, int32 NumSteps)
+{
+	float OpticalDepth = 0.0f;
+	for (const FCloudVolume& Volume : Volumes)
+	{
+		OpticalDepth += MarchCloudSunOpticalDepth(Settings, Volume, WorldPos, NumSteps);
+	}
+
+	return FMath::Exp(-OpticalDepth * Settings.Extinction);
+}
+
+FCloudMarchResult MarchCloud(const FCloudMarchSettings& Settings, const FCloudVolume& Volume, const FVector3f& Origin, const FVector3f& Dir, float MaxDistance, float Jitter)
+{
+	FCloudMarchResult Result;
+
+	float TNear;
+	float TFar;
+	if (!IntersectCloudBounds(Volume, Origin, Dir, TNear, TFar))
+	{
+		return Result;
+	}
+
+	TNear = FMath::Max(TNear, 0.0f);
+	TFar = FMath::Min(TFar, MaxDistance);
+	if (TFar <= TNear)
+	{
+		return Result;
+	}
+
+	const int32 NumSteps = FMath::Max(Settings.NumSteps, 0);
+	const float StepSize = (TFar - TNear) / float(FMath::Max(NumSteps, 1));
+	const float Phase = HenyeyGreenstein(FVector3f::DotProduct(Dir, Settings.SunDirection), Settings.PhaseG);
+	float T = TNear + StepSize * Jitter;
+
+	float DepthSum = 0.0f;
+	float DepthWeightSum = 0.0f;
+
+	const bool bSkipEmptySpace = Settings.Occupancy.IsValid() && Settings.Occupancy->GetNumLevels() > 0;
+	const int32 MaxLevel = bSkipEmptySpace ? FMath::Clamp(Settings.MaxOccupancyLevel, 0, Settings.Occupancy->GetNumLevels() - 1) : 0;
+	int32 Level = MaxLevel;
+
+	for (int32 Iteration = 0; Iteration < NumSteps * 4 && Result.NumDensitySteps < NumSteps && T < TFar; ++Iteration)
+	{
+		const FVector3f P = Origin + Dir * T;
+
+		// Hierarchical empty space skipping: leave empty cells at their exit, snapped to the step grid
+		// so the samples stay where the plain march takes them, and try a coarser level next. Refine
+		// occupied cells until they are no larger than a step. The pyramid bounds the procedural noise,
+		// not authored volumes.
+		if (bSkipEmptySpace && Volume.BrickVolume == 0)
+		{
+			const float CellSize = float(1 << Level) / float(Settings.Occupancy->Resolution);
+			const float CellWorldSize = CellSize / Settings.ShapeFrequency;
+			const FVector3f NoisePos = (P + Settings.WindOffset) * Settings.ShapeFrequency;
+			const FIntVector Cell(FMath::FloorToInt(NoisePos.X / CellSize), FMath::FloorToInt(NoisePos.Y / CellSize), FMath::FloorToInt(NoisePos.Z / CellSize));
+
+			if (IsCloudCellEmpty(Settings, Volume, P, Cell, Level, CellWorldSize))
+			{
+				const float TExit = T + CloudCellExitDistance(NoisePos, Dir * Settings.ShapeFrequency, FVector3f(Cell) * CellSize, CellSize);
+				T = TNear + StepSize * (FMath::CeilToFloat((TExit - TNear) / StepSize - Jitter) + Jitter);
+				Level = FMath::Min(Level + 1, MaxLevel);
+				++Result.NumSkippedCells;
+				continue;
+			}
+
+			if (Level > 0 && CellWorldSize > StepSize)
+			{
+				--Level;
+				continue;
+			}
+		}
+
+		++Result.NumDensitySteps;
+		const float Density = SampleCloudDensity(Settings, Volume, P);
+
+		if (Density > 0.0f)
+		{
+			const float SigmaT = Density * Settings.Extinction;
+			const FVector3f Scattered = (Settings.SunIlluminance * (MarchLightTransmittance(Settings, Volume, P) * Phase) + Settings.AmbientIlluminance) * SigmaT;
+			const float StepTransmittance = FMath::Exp(-SigmaT * StepSize);
+
+			// Energy conserving integration of the in-scattering over the step.
+			Result.Luminance += (Scattered - Scattered * StepTransmittance) * (Result.Transmittance / FMath::Max(SigmaT, 1e-5f));
+
+			const float Weight = Result.Transmittance * (1.0f - StepTransmittance);
+			DepthSum += T * Weight;
+			DepthWeightSum += Weight;
+
+			Result.Transmittance *= StepTransmittance;
+			if (Result.Transmittance < Settings.TransmittanceThreshold)
+			{
+				break;
+			}
+		}
+
+		T += StepSize;
+	}
+
+	Result.Depth = DepthWeightSum > 0.0f ? DepthSum / DepthWeightSum : 0.0f;
+	return Result;
+}
+
+FCloudMarchResult MarchCloudVolumes(const FCloudMarchSettings& Settings, TConstArrayView<FCloudVolume> Volumes, const FVector3f& Origin, const FVector3f& Dir, float MaxDistance, float Jitter)
+{
+	TArray<int32, TInlineAllocator<16>> Order;
+	Order.Reserve(Volumes.Num());
+	for (int32 Index = 0; Index < Volumes.Num(); ++Index)
+	{
+		Order.Add(Index);
+	}
+	Order.Sort([&Volumes, &Origin](int32 A, int32 B)
+	{
+		return FVector3f::DistSquared(Volumes[A].GetCenter(), Origin) > FVector3f::DistSquared(Volumes[B].GetCenter(), Origin);
+	});
+
+	// Same as the march pass blend state: Luminance = Src + Dst * SrcT, T = Dst * SrcT, and the
+	// depth is accumulated weighted by opacity and normalized at the end.
+	FCloudMarchResult Result;
+	float WeightedDepth = 0.0f;
+	for (int32 Index : Order)
+	{
+		const FCloudMarchResult Volume = MarchCloud(Settings, Volumes[Index], Origin, Dir, MaxDistance, Jitter);
+		Result.Luminance = Volume.Luminance + Result.Luminance * Volume.Transmittance;
+		WeightedDepth = Volume.Depth * (1.0f - Volume.Transmittance) + WeightedDepth * Volume.Transmittance;
+		Result.Transmittance *= Volume.Transmittance;
+		Result.NumDensitySteps += Volume.NumDensitySteps;
+		Result.NumSkippedCells += Volume.NumSkippedCells;
+	}
+
+	const float Opacity = 1.0f - Result.Transmittance;
+	Result.Depth = Opacity > 1e-3f ? WeightedDepth / Opacity : 0.0f;
+	return Result;
+}
+
+void RenderCloudImage(const FCloudMarchSettings& Settings, TConstArrayView<FCloudVolume> Volumes, const FCloudReferenceCamera& Camera, TArrayView<FLinearColor> OutPixels, float Jitter)
+{
+	check(OutPixels.Num() == Camera.Size.X * Camera.Size.Y);
+
+	ParallelFor(Camera.Size.Y, [&](int32 Y)
+	{
+		for (int32 X = 0; X < Camera.Size.X; ++X)
+		{
+			const FVector3f Dir = Camera.GetRayDirection(FVector2f(X + 0.5f, Y + 0.5f));
+			const FCloudMarchResult Result = MarchCloudVolumes(Settings, Volumes, Camera.Origin, Dir, MAX_flt, Jitter);
+			OutPixels[Y * Camera.Size.X + X] = FLinearColor(Result.Luminance.X, Result.Luminance.Y, Result.Luminance.Z, Result.Transmittance);
+		}
+	});
+}
+
+} // namespace CloudRaymarch
@@ -0,0 +1,256 @@
+#include "CloudRenderCommandlet.h"
+#include "CloudBrickVolume.h"
+#include "CloudNoiseBaker.h"
+#include "CloudOccupancy.h"
+#include "CloudOfflineRenderer.h"
+#include "CloudStats.h"
+#include "CloudWeatherMap.h"
+
+#include "ImageCore.h"
+#include "ImageUtils.h"
+
+namespace CloudRender
+{
+
+/**
+ * Comma separated numbers of a parameter. Returns false if it is missing or does not have Num of them,
+ * up to NumOptional more are allowed.
+ */
+static bool ParseFloats(const FString& Params, const TCHAR* Name, int32 Num, int32 NumOptional, TArray<float>& OutValues)
+{
+	FString Value;
+	if (!FParse::Value(*Params, Name, Value, false))
+	{
+		return false;
+	}
+
+	TArray<FString> Values;
+	Value.ParseIntoArray(Values, TEXT(","));
+	if (Values.Num() < Num || Values.Num() > Num + NumOptional)
+	{
+		UE_LOG(LogClouds, Warning, TEXT("-%s%s needs %d numbers, ignored"), Name, *Value, Num);
+		return false;
+	}
+
+	OutValues.Reset();
+	for (const FString& Number : Values)
+	{
+		OutValues.Add(FCString::Atof(*Number));
+	}
+	return true;
+}
+
+/** MinX,MinY,MinZ,MaxX,MaxY,MaxZ[,Coverage[,DensityScale]] per volume, separated by ';'. */
+static bool ParseVolumes(const FString& Value, TArray<FCloudVolume>& OutVolumes)
+{
+	TArray<FString> Boxes;
+	Value.ParseIntoArray(Boxes, TEXT(";"));
+	for (const FString& Box : Boxes)
+	{
+		TArray<FString> Numbers;
+		Box.ParseIntoArray(Numbers, TEXT(","));
+		if (Numbers.Num() < 6 || Numbers.Num() > 8)
+		{
+			UE_LOG(LogClouds, Error, TEXT("Volume %s needs MinX,MinY,MinZ,MaxX,MaxY,MaxZ[,Coverage[,DensityScale]]"), *Box);
+			return false;
+		}
+
+		FCloudVolume& Volume = OutVolumes.AddDefaulted_GetRef();
+		Volume.BoundsMin = FVector3f(FCString::Atof(*Numbers[0]), FCString::Atof(*Numbers[1]), FCString::Atof(*Numbers[2]));
+		Volume.BoundsMax = FVector3f(FCString::Atof(*Numbers[3]), FCString::Atof(*Numbers[4]), FCString::Atof(*Numbers[5]));
+		Volume.Coverage = Numbers.Num() > 6 ? FCString::Atof(*Numbers[6]) : Volume.Coverage;
+		Volume.DensityScale = Numbers.Num() > 7 ? FCString::Atof(*Numbers[7]) : Volume.DensityScale;
+	}
+	return OutVolumes.Num() > 0;
+}
+
+static bool WriteImage(const FCloudOfflineRenderer& Renderer, const FString& Path)
+{
+	const FIntPoint Size = Renderer.GetCamera().Size;
+	FImage Image(Size.X, Size.Y, ERawImageFormat::RGBA32F, EGammaSpace::Linear);
+	const TArrayView64<FLinearColor> Pixels = Image.AsRGBA32F();
+	Renderer.Resolve(MakeArrayView(Pixels.GetData(), int32(Pixels.Num())));
+
+	if (!FImageUtils::SaveImageByExtension(*Path, Image))
+	{
+		UE_LOG(LogClouds, Error, TEXT("Failed to write %s"), *Path);
+		return false;
+	}
+	return true;
+}
+
+/** Renders a pass with 1 worker up to every core in powers of two, into a renderer of its own. */
+static void LogScaling(const FCloudMarchSettings& Settings, const TArray<FCloudVolume>& Volumes, const FCloudReferenceCamera& Camera, int32 TileSize)
+{
+	const int32 NumCores = FPlatformMisc::NumberOfCoresIncludingHyperthreads();
+	TArray<int32> ThreadCounts;
+	for (int32 NumThreads = 1; NumThreads < NumCores; NumThreads *= 2)
+	{
+		ThreadCounts.Add(NumThreads);
+	}
+	ThreadCounts.Add(NumCores);
+
+	UE_LOG(LogClouds, Display, TEXT("%8s %10s %9s %11s %7s"), TEXT("Threads"), TEXT("Seconds"), TEXT("Speedup"), TEXT("Efficiency"), TEXT("Stolen"));
+
+	double SingleThreadSeconds = 0.0;
+	for (int32 NumThreads : ThreadCounts)
+	{
+		FCloudOfflineRenderer Renderer(Settings, Volumes, Camera, TileSize);
+		const FCloudOfflinePassStats Stats = Renderer.RenderPass(NumThreads);
+		SingleThreadSeconds = NumThreads == 1 ? Stats.Seconds : SingleThreadSeconds;
+
+		const double Speedup = SingleThreadSeconds / FMath::Max(Stats.Seconds, 1e-9);
+		UE_LOG(LogClouds, Display, TEXT("%8d %10.3f %8.2fx %10.0f%% %7d"), Stats.NumThreads, Stats.Seconds, Speedup, Speedup / Stats.NumThreads * 100.0, Stats.NumStolenTiles);
+	}
+}
+
+} // namespace CloudRender
+
+// ================================================================================================
+
+UCloudRenderCommandlet::UCloudRenderCommandlet(const FObjectInitializer& ObjectInitializer)
+	: Super(ObjectInitializer)
+{
+	IsClient = false;
+	IsEditor = false;
+	IsServer = false;
+	LogToConsole = true;
+}
+
+int32 UCloudRenderCommandlet::Main(const FString& Params)
+{
+	using namespace CloudRender;
+
+	FString OutPath;
+	if (!FParse::Value(*Params, TEXT("out="), OutPath))
+	{
+		UE_LOG(LogClouds, Error, TEXT("Missing -out=<Path>.exr of the image"));
+		return 1;
+	}
+
+	FCloudReferenceCamera Camera;
+	Camera.Size = FIntPoint(1920, 1080);
+	Camera.Origin = FVector3f(-8000.0f, 0.0f, 0.0f);
+	Camera.Rotation = FRotator3f(20.0f, 0.0f, 0.0f);
+
+	FString SizeParam;
+	if (FParse::Value(*Params, TEXT("size="), SizeParam))
+	{
+		FString Width;
+		FString Height;
+		if (!SizeParam.Split(TEXT("x"), &Width, &Height) || FCString::Atoi(*Width) <= 0 || FCString::Atoi(*Height) <= 0)
+		{
+			UE_LOG(LogClouds, Error, TEXT("-size=%s needs WidthxHeight"), *SizeParam);
+			return 1;
+		}
+		Camera.Size = FIntPoint(FCString::Atoi(*Width), FCString::Atoi(*Height));
+	}
+
+	TArray<float> Values;
+	if (ParseFloats(Params, TEXT("camera="), 3, 0, Values))
+	{
+		Camera.Origin = FVector3f(Values[0], Values[1], Values[2]);
+	}
+	if (ParseFloats(Params, TEXT("rotation="), 3, 0, Values))
+	{
+		Camera.Rotation = FRotator3f(Values[0], Values[1], Values[2]);
+	}
+	FParse::Value(*Params, TEXT("fov="), Camera.FieldOfView);
+
+	TArray<FCloudVolume> Volumes;
+	FString VolumesParam;
+	if (FParse::Value(*Params, TEXT("volumes="), VolumesParam, false))
+	{
+		if (!ParseVolumes(VolumesParam, Volumes))
+		{
+			return 1;
+		}
+	}
+	else
+	{
+		FCloudVolume& Volume = Volumes.AddDefaulted_GetRef();
+		Volume.BoundsMin = FVector3f(-5000.0f, -5000.0f, 2000.0f);
+		Volume.BoundsMax = FVector3f(5000.0f, 5000.0f, 4000.0f);
+	}
+
+	FCloudMarchSettings Settings;
+	Settings.ShapeNoise = CloudNoise::BakeOrLoadCached(FCloudNoiseBakeSettings::Shape());
+	Settings.DetailNoise = CloudNoise::BakeOrLoadCached(FCloudNoiseBakeSettings::Detail());
+	Settings.Occupancy = FCloudOccupancyPyramid::Build(*Settings.ShapeNoise);
+	Settings.NumSteps = 128;
+	Settings.NumLightSteps = 8;
+	FParse::Value(*Params, TEXT("steps="), Settings.NumSteps);
+	FParse::Value(*Params, TEXT("lightsteps="), Settings.NumLightSteps);
+
+	float Time = 0.0f;
+	FParse::Value(*Params, TEXT("time="), Time);
+	Settings.WindOffset = Settings.WindVelocity * Time;
+
+	// Workers sample these concurrently, which only the overview lookup of the weather map allows.
+	FString WeatherPath;
+	if (FParse::Value(*Params, TEXT("weather="), WeatherPath))
+	{
+		TSharedRef<FCloudWeatherTileCache> WeatherMap = MakeShared<FCloudWeatherTileCache>();
+		if (!WeatherMap->Open(WeatherPath, 1))
+		{
+			UE_LOG(LogClouds, Error, TEXT("Failed to open weather map %s"), *WeatherPath);
+			return 1;
+		}
+		Settings.SampleWeather = [WeatherMap](const FVector2f& WorldXY)
+		{
+			return WeatherMap->SampleOverview(WorldXY);
+		};
+	}
+
+	FString BrickPath;
+	if (FParse::Value(*Params, TEXT("brick="), BrickPath))
+	{
+		TSharedRef<FCloudBrickVolumeFile> BrickVolume = MakeShared<FCloudBrickVolumeFile>();
+		if (!BrickVolume->Open(BrickPath))
+		{
+			UE_LOG(LogClouds, Error, TEXT("Failed to open brick volume %s"), *BrickPath);
+			return 1;
+		}
+		Settings.SampleBrickDensity = [BrickVolume](uint32, const FVector3f& Local)
+		{
+			return BrickVolume->SampleDensity(Local);
+		};
+		for (FCloudVolume& Volume : Volumes)
+		{
+			Volume.BrickVolume = 1;
+		}
+	}
+
+	int32 NumPasses = 16;
+	int32 NumThreads = 0;
+	int32 TileSize = 32;
+	FParse::Value(*Params, TEXT("passes="), NumPasses);
+	FParse::Value(*Params, TEXT("threads="), NumThreads);
+	FParse::Value(*Params, TEXT("tilesize="), TileSize);
+	const bool bProgressive = FParse::Param(*Params, TEXT("progressive"));
+
+	if (FParse::Param(*Params, TEXT("scaling")))
+	{
+		LogScaling(Settings, Volumes, Camera, TileSize);
+	}
+
+	FCloudOfflineRenderer Renderer(Settings, Volumes, Camera, TileSize);
+	UE_LOG(LogClouds, Display, TEXT("Rendering %dx%d, %d volumes, %d tiles, %d passes"), Camera.Size.X, Camera.Size.Y, Volumes.Num(), Renderer.GetNumTiles(), NumPasses);
+
+	double TotalSeconds = 0.0;
+	for (int32 Pass = 0; Pass < FMath::Max(NumPasses, 1); ++Pass)
+	{
+		const FCloudOfflinePassStats Stats = Renderer.RenderPass(NumThreads);
+		TotalSeconds += Stats.Seconds;
+		UE_LOG(LogClouds, Display, TEXT("Pass %3d: %.3f s, %d workers, %d tiles stolen, %d-%d tiles per worker"),
+			Pass + 1, Stats.Seconds, Stats.NumThreads, Stats.NumStolenTiles, Stats.MinWorkerTiles, Stats.MaxWorkerTiles);
+
+		if (bProgressive && !WriteImage(Renderer, OutPath))
+		{
+			return 1;
+		}
+	}
+
+	UE_LOG(LogClouds, Display, TEXT("Rendered %s in %.2f s"), *OutPath, TotalSeconds);
+	return bProgressive || WriteImage(Renderer, OutPath) ? 0 : 1;
+}
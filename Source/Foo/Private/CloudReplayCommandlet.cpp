@@ -0,0 +1,251 @@
+#include "CloudReplayCommandlet.h"
+#include "CloudNoiseBaker.h"
+#include "CloudOccupancy.h"
+#include "CloudOfflineRenderer.h"
+#include "CloudSceneViewExtension.h"
+#include "CloudSettings.h"
+#include "CloudStats.h"
+#include "CloudTrace.h"
+#include "CloudVolumes.h"
+
+#include "ConvexVolume.h"
+#include "Misc/FileHelper.h"
+
+namespace CloudReplay
+{
+
+/** Time a frame of the trace took to replay, per stage. */
+struct FFrameTiming
+{
+	int32 Frame = 0;
+	uint64 FrameNumber = 0;
+	int32 NumViews = 0;
+	int32 NumVolumes = 0;
+	int32 NumVisibleVolumes = 0;
+	int64 NumMarchedPixels = 0;
+
+	double UpdateMs = 0.0;
+	double CullMs = 0.0;
+	double MarchMs = 0.0;
+
+	double GetTotalMs() const { return UpdateMs + CullMs + MarchMs; }
+};
+
+/** Applies the volume changes of a frame, like the render commands of FCloudSceneViewExtension. */
+static void ApplyVolumeChanges(const FCloudTraceFrame& Frame, TSet<uint32>& Ids, FCloudVolumeRegistry& Registry)
+{
+	for (const TPair<uint32, FCloudVolume>& Entry : Frame.ChangedVolumes)
+	{
+		bool bExists = false;
+		Ids.Add(Entry.Key, &bExists);
+		if (bExists)
+		{
+			Registry.Update(Entry.Key, Entry.Value);
+		}
+		else
+		{
+			Registry.Add(Entry.Key, Entry.Value);
+		}
+	}
+
+	for (uint32 Id : Frame.RemovedVolumes)
+	{
+		if (Ids.Remove(Id) > 0)
+		{
+			Registry.Remove(Id);
+		}
+	}
+}
+
+/** Indices of the volumes a view marches, see FCloudSceneViewExtension::CullVolumes. */
+static void CullView(const FCloudTraceFrame& Frame, const FCloudTraceView& View, FCloudVolumeRegistry& Registry, TArray<uint32>& OutVisible)
+{
+	OutVisible.Reset();
+	if (View.bIsCapture)
+	{
+		return;
+	}
+
+	FConvexVolume Frustum;
+	View.GetViewFrustum(Frustum);
+	FCloudSceneViewExtension::CullVolumes(Registry, Frustum, View.Origin, Frame.PanoramaNearDistance, OutVisible);
+}
+
+static double GetPercentile(TArray<double> Values, float Percentile)
+{
+	if (Values.Num() == 0)
+	{
+		return 0.0;
+	}
+	Values.Sort();
+	return Values[FMath::Clamp(FMath::CeilToInt(Percentile * Values.Num()) - 1, 0, Values.Num() - 1)];
+}
+
+static void LogStage(const TCHAR* Name, TConstArrayView<FFrameTiming> Timings, double FFrameTiming::*Stage)
+{
+	TArray<double> Values;
+	double Sum = 0.0;
+	for (const FFrameTiming& Timing : Timings)
+	{
+		const double Value = Stage ? Timing.*Stage : Timing.GetTotalMs();
+		Values.Add(Value);
+		Sum += Value;
+	}
+
+	UE_LOG(LogClouds, Display, TEXT("%-8s %10.3f %10.3f %10.3f %10.3f"),
+		Name, Sum / FMath::Max(Values.Num(), 1), GetPercentile(Values, 0.5f), GetPercentile(Values, 0.95f), GetPercentile(Values, 1.0f));
+}
+
+} // namespace CloudReplay
+
+// ================================================================================================
+
+UCloudReplayCommandlet::UCloudReplayCommandlet(const FObjectInitializer& ObjectInitializer)
+	: Super(ObjectInitializer)
+{
+	IsClient = false;
+	IsEditor = false;
+	IsServer = false;
+	LogToConsole = true;
+}
+
+int32 UCloudReplayCommandlet::Main(const FString& Params)
+{
+	using namespace CloudReplay;
+
+	FString TracePath;
+	if (!FParse::Value(*Params, TEXT("trace="), TracePath))
+	{
+		UE_LOG(LogClouds, Error, TEXT("Missing -trace=<Path>.ctr of a trace recorded with r.Clouds.Trace"));
+		return 1;
+	}
+
+	FCloudTraceReader Reader;
+	if (!Reader.Open(TracePath))
+	{
+		return 1;
+	}
+
+	int32 MaxFrames = 0;
+	float Scale = 0.25f;
+	int32 NumThreads = 0;
+	int32 NumWorst = 10;
+	FParse::Value(*Params, TEXT("frames="), MaxFrames);
+	FParse::Value(*Params, TEXT("scale="), Scale);
+	FParse::Value(*Params, TEXT("threads="), NumThreads);
+	FParse::Value(*Params, TEXT("worst="), NumWorst);
+	const bool bMarch = !FParse::Param(*Params, TEXT("nomarch"));
+
+	FCloudMarchSettings MarchSettings;
+	if (bMarch)
+	{
+		MarchSettings.ShapeNoise = CloudNoise::BakeOrLoadCached(FCloudNoiseBakeSettings::Shape());
+		MarchSettings.DetailNoise = CloudNoise::BakeOrLoadCached(FCloudNoiseBakeSettings::Detail());
+		MarchSettings.Occupancy = FCloudOccupancyPyramid::Build(*MarchSettings.ShapeNoise);
+	}
+
+	FCloudSettingsMailbox SettingsMailbox;
+	FCloudVolumeRegistry Registry;
+	TSet<uint32> Ids;
+
+	TArray<FFrameTiming> Timings;
+	TArray<uint32> VisibleVolumes;
+	TArray<FCloudVolume> MarchedVolumes;
+
+	FCloudTraceFrame Frame;
+	while ((MaxFrames <= 0 || Timings.Num() < MaxFrames) && Reader.ReadFrame(Frame))
+	{
+		FFrameTiming& Timing = Timings.AddDefaulted_GetRef();
+		Timing.Frame = Timings.Num() - 1;
+		Timing.FrameNumber = Frame.Snapshot.FrameNumber;
+		Timing.NumViews = Frame.Views.Num();
+
+		double StartTime = FPlatformTime::Seconds();
+		{
+			// The settings take the same path from the game thread as in the recording.
+			SettingsMailbox.Publish(uint32(Timing.Frame), Frame.Snapshot);
+			const FCloudFrameSnapshot& Snapshot = SettingsMailbox.Consume(uint32(Timing.Frame));
+			Snapshot.Settings.ApplyTo(MarchSettings);
+			MarchSettings.WindOffset = MarchSettings.WindVelocity * float(Snapshot.GameTime);
+			MarchSettings.NumSteps = Frame.NumSteps;
+			MarchSettings.NumLightSteps = Frame.NumLightSteps;
+
+			ApplyVolumeChanges(Frame, Ids, Registry);
+		}
+		Timing.UpdateMs = (FPlatformTime::Seconds() - StartTime) * 1000.0;
+		Timing.NumVolumes = Registry.Num();
+
+		for (const FCloudTraceView& View : Frame.Views)
+		{
+			StartTime = FPlatformTime::Seconds();
+			CullView(Frame, View, Registry, VisibleVolumes);
+			Timing.CullMs += (FPlatformTime::Seconds() - StartTime) * 1000.0;
+			Timing.NumVisibleVolumes += VisibleVolumes.Num();
+
+			if (!bMarch || VisibleVolumes.Num() == 0)
+			{
+				continue;
+			}
+
+			FCloudReferenceCamera Camera = View.GetReferenceCamera(Frame.ResolutionDivisor);
+			Camera.Size = FIntPoint(FMath::Max(FMath::RoundToInt(Camera.Size.X * Scale), 1), FMath::Max(FMath::RoundToInt(Camera.Size.Y * Scale), 1));
+
+			MarchedVolumes.Reset();
+			for (uint32 Index : VisibleVolumes)
+			{
+				MarchedVolumes.Add(Registry.GetVolumes()[Index]);
+			}
+
+			FCloudOfflineRenderer Renderer(MarchSettings, MarchedVolumes, Camera);
+			Timing.MarchMs += Renderer.RenderPass(NumThreads).Seconds * 1000.0;
+			Timing.NumMarchedPixels += int64(Camera.Size.X) * Camera.Size.Y;
+		}
+
+		UE_LOG(LogClouds, Log, TEXT("Frame %5d (%llu): %d views, %d volumes, %d visible, update %.3f ms, cull %.3f ms, march %.3f ms"),
+			Timing.Frame, Timing.FrameNumber, Timing.NumViews, Timing.NumVolumes, Timing.NumVisibleVolumes, Timing.UpdateMs, Timing.CullMs, Timing.MarchMs);
+	}
+
+	if (Timings.Num() == 0)
+	{
+		UE_LOG(LogClouds, Error, TEXT("Trace %s holds no frames"), *TracePath);
+		return 1;
+	}
+
+	UE_LOG(LogClouds, Display, TEXT("Replayed %d frames of %s"), Timings.Num(), *TracePath);
+	UE_LOG(LogClouds, Display, TEXT("%-8s %10s %10s %10s %10s"), TEXT("ms"), TEXT("avg"), TEXT("p50"), TEXT("p95"), TEXT("max"));
+	LogStage(TEXT("Update"), Timings, &FFrameTiming::UpdateMs);
+	LogStage(TEXT("Cull"), Timings, &FFrameTiming::CullMs);
+	if (bMarch)
+	{
+		LogStage(TEXT("March"), Timings, &FFrameTiming::MarchMs);
+	}
+	LogStage(TEXT("Total"), Timings, nullptr);
+
+	// Frame numbers point back at the recording, e.g. a CSV profile captured alongside it.
+	TArray<FFrameTiming> Worst = Timings;
+	Worst.Sort([](const FFrameTiming& A, const FFrameTiming& B) { return A.GetTotalMs() > B.GetTotalMs(); });
+	for (int32 Index = 0; Index < FMath::Min(NumWorst, Worst.Num()); ++Index)
+	{
+		UE_LOG(LogClouds, Display, TEXT("Worst %2d: frame %d (%llu), %.3f ms, %d views, %d visible volumes"),
+			Index + 1, Worst[Index].Frame, Worst[Index].FrameNumber, Worst[Index].GetTotalMs(), Worst[Index].NumViews, Worst[Index].NumVisibleVolumes);
+	}
+
+	FString CsvPath;
+	if (FParse::Value(*Params, TEXT("csv="), CsvPath))
+	{
+		FString Csv = TEXT("Frame,FrameNumber,Views,Volumes,VisibleVolumes,MarchedPixels,UpdateMs,CullMs,MarchMs,TotalMs\n");
+		for (const FFrameTiming& Timing : Timings)
+		{
+			Csv += FString::Printf(TEXT("%d,%llu,%d,%d,%d,%lld,%f,%f,%f,%f\n"), Timing.Frame, Timing.FrameNumber, Timing.NumViews, Timing.NumVolumes,
+				Timing.NumVisibleVolumes, Timing.NumMarchedPixels, Timing.UpdateMs, Timing.CullMs, Timing.MarchMs, Timing.GetTotalMs());
+		}
+
+		if (!FFileHelper::SaveStringToFile(Csv, *CsvPath))
+		{
+			UE_LOG(LogClouds, Error, TEXT("Failed to write %s"), *CsvPath);
+			return 1;
+		}
+	}
+
+	return 0;
+}
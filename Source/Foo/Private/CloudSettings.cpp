@@ -0,0 +1,17 @@
+#include "CloudSettings.h"
+#include "CloudRaymarch.h"
+
+// ================================================================================================
+
+void FCloudSettings::ApplyTo(FCloudMarchSettings& OutSettings) const
+{
+	OutSettings.WindVelocity = WindVelocity;
+	OutSettings.ShapeFrequency = ShapeFrequency;
+	OutSettings.DetailFrequency = DetailFrequency;
+	OutSettings.DetailStrength = DetailStrength;
+	OutSettings.Extinction = Extinction;
+	OutSettings.SunDirection = SunDirection.GetSafeNormal(UE_SMALL_NUMBER, FVector3f::UpVector);
+	OutSettings.PhaseG = FMath::Clamp(PhaseG, -0.99f, 0.99f);
+	OutSettings.SunIlluminance = SunIlluminance;
+	OutSettings.AmbientIlluminance = AmbientIlluminance;
+}
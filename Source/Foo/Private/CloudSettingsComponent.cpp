@@ -0,0 +1,73 @@
+#include "CloudSettingsComponent.h"
+#include "CloudSceneViewExtension.h"
+#include "CloudSettings.h"
+#include "Foo.h"
+#include "Engine/World.h"
+
+
+UCloudSettingsComponent::UCloudSettingsComponent(const FObjectInitializer& ObjectInitializer)
+	: Super(ObjectInitializer)
+{
+}
+
+FCloudSettings UCloudSettingsComponent::GetCloudSettings() const
+{
+	FCloudSettings Settings;
+	Settings.WindVelocity = FVector3f(WindVelocity);
+	Settings.ShapeFrequency = 1.0f / FMath::Max(ShapeTileSize, 1.0f);
+	Settings.DetailFrequency = 1.0f / FMath::Max(DetailTileSize, 1.0f);
+	Settings.DetailStrength = DetailStrength;
+	Settings.Extinction = Extinction;
+	Settings.SunDirection = FVector3f(SunDirection);
+	Settings.PhaseG = PhaseG;
+	Settings.SunIlluminance = FVector3f(SunIlluminance.R, SunIlluminance.G, SunIlluminance.B);
+	Settings.AmbientIlluminance = FVector3f(AmbientIlluminance.R, AmbientIlluminance.G, AmbientIlluminance.B);
+	return Settings;
+}
+
+// ================================================================================================
+
+void UCloudSettingsComponent::OnRegister()
+{
+	Super::OnRegister();
+
+	// Worlds without a scene (e.g. dedicated servers) never render clouds.
+	if (GetWorld() && GetWorld()->Scene)
+	{
+		bRegisteredSettings = true;
+		MarkCloudSettingsDirty();
+	}
+}
+
+void UCloudSettingsComponent::OnUnregister()
+{
+	if (bRegisteredSettings)
+	{
+		if (FCloudSceneViewExtension* Extension = FFooModule::Get().GetCloudSceneViewExtension())
+		{
+			Extension->ResetCloudSettings_GameThread(this);
+		}
+		bRegisteredSettings = false;
+	}
+
+	Super::OnUnregister();
+}
+
+void UCloudSettingsComponent::MarkCloudSettingsDirty()
+{
+	if (bRegisteredSettings)
+	{
+		if (FCloudSceneViewExtension* Extension = FFooModule::Get().GetCloudSceneViewExtension())
+		{
+			Extension->SetCloudSettings_GameThread(this, GetCloudSettings());
+		}
+	}
+}
+
+#if WITH_EDITOR
+void UCloudSettingsComponent::PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent)
+{
+	Super::PostEditChangeProperty(PropertyChangedEvent);
+	MarkCloudSettingsDirty();
+}
+#endif
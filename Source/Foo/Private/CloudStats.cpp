@@ -0,0 +1,53 @@
+#include "CloudStats.h"
+
+DEFINE_LOG_CATEGORY(LogClouds);
+
+DEFINE_STAT(STAT_CloudsPostProcessPass);
+DEFINE_STAT(STAT_CloudsFamilySetup);
+DEFINE_STAT(STAT_CloudsPassSetup);
+DEFINE_STAT(STAT_CloudsLightingUpdate);
+DEFINE_STAT(STAT_CloudsPanoramaUpdate);
+DEFINE_STAT(STAT_CloudsVolumeCulling);
+DEFINE_STAT(STAT_CloudsDrawToRenderTarget);
+DEFINE_STAT(STAT_CloudsQueries);
+
+DEFINE_STAT(STAT_CloudsViews);
+DEFINE_STAT(STAT_CloudsSharedFamilySetups);
+DEFINE_STAT(STAT_CloudsFamilySetupSavedMs);
+DEFINE_STAT(STAT_CloudsMeasuredGpuMs);
+DEFINE_STAT(STAT_CloudsBudgetLevel);
+DEFINE_STAT(STAT_CloudsMarchedPixels);
+DEFINE_STAT(STAT_CloudsVisibleVolumes);
+DEFINE_STAT(STAT_CloudsLightingSlices);
+DEFINE_STAT(STAT_CloudsPanoramaTiles);
+DEFINE_STAT(STAT_CloudsWeatherTileHits);
+DEFINE_STAT(STAT_CloudsWeatherTileMisses);
+DEFINE_STAT(STAT_CloudsWeatherTileEvictions);
+DEFINE_STAT(STAT_CloudsWeatherTileUploads);
+DEFINE_STAT(STAT_CloudsWeatherResidentTiles);
+DEFINE_STAT(STAT_CloudsBrickUploads);
+DEFINE_STAT(STAT_CloudsBrickResident);
+DEFINE_STAT(STAT_CloudsBrickPoolMemory);
+DEFINE_STAT(STAT_CloudsViewHistoryMemory);
+DEFINE_STAT(STAT_CloudsLightingMemory);
+DEFINE_STAT(STAT_CloudsPanoramaMemory);
+DEFINE_STAT(STAT_CloudsViewHistories);
+DEFINE_STAT(STAT_CloudsQueryCount);
+
+CSV_DEFINE_CATEGORY(Clouds, true);
+
+DECLARE_LLM_MEMORY_STAT(TEXT("Clouds"), STAT_CloudsLLM, STATGROUP_LLMFULL);
+DECLARE_LLM_MEMORY_STAT(TEXT("Clouds"), STAT_CloudsSummaryLLM, STATGROUP_LLM);
+LLM_DEFINE_TAG(Clouds, NAME_None, NAME_None, GET_STATFNAME(STAT_CloudsLLM), GET_STATFNAME(STAT_CloudsSummaryLLM));
+
+DEFINE_GPU_STAT(Clouds);
+DEFINE_GPU_STAT(CloudsDrawToRenderTarget);
+
+TAutoConsoleVariable<int32> CVarCloudsDebug(
+	TEXT("r.Clouds.Debug"),
+	0,
+	TEXT("Enables diagnostic dumps of the cloud rendering to LogClouds. Costly, for debugging only.\n")
+	TEXT(" 0: off (default)\n")
+	TEXT(" 1: view matrices and pass sizes of every cloud view\n")
+	TEXT(" 2: also parameters of every DrawToRenderTarget call"),
+	ECVF_Cheat | ECVF_RenderThreadSafe);
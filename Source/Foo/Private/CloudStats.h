@@ -0,0 +1,70 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/IConsoleManager.h"
+#include "HAL/LowLevelMemTracker.h"
+#include "RendererInterface.h"
+#include "ProfilingDebugging/CsvProfiler.h"
+#include "ProfilingDebugging/RealtimeGPUProfiler.h"
+#include "Stats/Stats.h"
+
+// Instrumentation shared by all cloud rendering code.
+//   stat Clouds          render thread and gameplay query cycle stats and counters
+//   stat GPU             GPU time of the cloud passes
+//   csvprofile start     per frame CSV timings and counters in the Clouds category
+//   r.Clouds.Debug 1     per view diagnostic dumps to LogClouds
+//   stat LLM             persistent CPU and GPU allocations of the clouds under the Clouds tag
+
+DECLARE_LOG_CATEGORY_EXTERN(LogClouds, Log, All);
+
+DECLARE_STATS_GROUP(TEXT("Clouds"), STATGROUP_Clouds, STATCAT_Advanced);
+
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Cloud Post Process Pass"), STAT_CloudsPostProcessPass, STATGROUP_Clouds, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Cloud Family Setup"), STAT_CloudsFamilySetup, STATGROUP_Clouds, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Cloud Pass Setup"), STAT_CloudsPassSetup, STATGROUP_Clouds, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Cloud Lighting Update"), STAT_CloudsLightingUpdate, STATGROUP_Clouds, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Cloud Panorama Update"), STAT_CloudsPanoramaUpdate, STATGROUP_Clouds, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Cloud Volume Culling"), STAT_CloudsVolumeCulling, STATGROUP_Clouds, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Draw To Render Target"), STAT_CloudsDrawToRenderTarget, STATGROUP_Clouds, );
+DECLARE_CYCLE_STAT_EXTERN(TEXT("Gameplay Queries"), STAT_CloudsQueries, STATGROUP_Clouds, );
+
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Views"), STAT_CloudsViews, STATGROUP_Clouds, );
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Shared Family Setups"), STAT_CloudsSharedFamilySetups, STATGROUP_Clouds, );
+DECLARE_FLOAT_COUNTER_STAT_EXTERN(TEXT("Family Setup Saved (ms)"), STAT_CloudsFamilySetupSavedMs, STATGROUP_Clouds, );
+DECLARE_FLOAT_COUNTER_STAT_EXTERN(TEXT("Measured GPU Time (ms)"), STAT_CloudsMeasuredGpuMs, STATGROUP_Clouds, );
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Budget Quality Level"), STAT_CloudsBudgetLevel, STATGROUP_Clouds, );
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Marched Pixels"), STAT_CloudsMarchedPixels, STATGROUP_Clouds, );
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Visible Volumes"), STAT_CloudsVisibleVolumes, STATGROUP_Clouds, );
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Lighting Slices Baked"), STAT_CloudsLightingSlices, STATGROUP_Clouds, );
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Panorama Tiles Baked"), STAT_CloudsPanoramaTiles, STATGROUP_Clouds, );
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Weather Tile Cache Hits"), STAT_CloudsWeatherTileHits, STATGROUP_Clouds, );
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Weather Tile Cache Misses"), STAT_CloudsWeatherTileMisses, STATGROUP_Clouds, );
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Weather Tile Cache Evictions"), STAT_CloudsWeatherTileEvictions, STATGROUP_Clouds, );
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Weather Tile Uploads"), STAT_CloudsWeatherTileUploads, STATGROUP_Clouds, );
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Weather Resident Tiles"), STAT_CloudsWeatherResidentTiles, STATGROUP_Clouds, );
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Brick Uploads"), STAT_CloudsBrickUploads, STATGROUP_Clouds, );
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("Resident Bricks"), STAT_CloudsBrickResident, STATGROUP_Clouds, );
+DECLARE_MEMORY_STAT_EXTERN(TEXT("Brick Pool Memory"), STAT_CloudsBrickPoolMemory, STATGROUP_Clouds, );
+DECLARE_MEMORY_STAT_EXTERN(TEXT("View History Memory"), STAT_CloudsViewHistoryMemory, STATGROUP_Clouds, );
+DECLARE_MEMORY_STAT_EXTERN(TEXT("Lighting Cache Memory"), STAT_CloudsLightingMemory, STATGROUP_Clouds, );
+DECLARE_MEMORY_STAT_EXTERN(TEXT("Panorama Memory"), STAT_CloudsPanoramaMemory, STATGROUP_Clouds, );
+DECLARE_DWORD_ACCUMULATOR_STAT_EXTERN(TEXT("View Histories"), STAT_CloudsViewHistories, STATGROUP_Clouds, );
+DECLARE_DWORD_COUNTER_STAT_EXTERN(TEXT("Gameplay Query Count"), STAT_CloudsQueryCount, STATGROUP_Clouds, );
+
+CSV_DECLARE_CATEGORY_EXTERN(Clouds);
+
+// CPU and GPU allocations the clouds keep across frames, see stat LLM. Transient render graph
+// resources are allocated when the graph executes and are not tagged.
+LLM_DECLARE_TAG(Clouds);
+
+DECLARE_GPU_STAT_NAMED_EXTERN(Clouds, TEXT("Clouds"));
+DECLARE_GPU_STAT_NAMED_EXTERN(CloudsDrawToRenderTarget, TEXT("Clouds DrawToRenderTarget"));
+
+/** Size of a persistent target for the memory stats, 0 if it is not allocated. */
+inline uint64 GetCloudPooledTargetSize(const TRefCountPtr<IPooledRenderTarget>& Target)
+{
+	return Target.IsValid() ? Target->ComputeMemorySize() : 0;
+}
+
+/** r.Clouds.Debug: 0 off, 1 per view diagnostics, 2 also per draw diagnostics. */
+extern TAutoConsoleVariable<int32> CVarCloudsDebug;
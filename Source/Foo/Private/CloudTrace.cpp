@@ -0,0 +1,294 @@
+#include "CloudTrace.h"
+#include "CloudStats.h"
+
+#include "ConvexVolume.h"
+#include "HAL/FileManager.h"
+#include "SceneManagement.h"
+#include "Serialization/MemoryReader.h"
+#include "Serialization/MemoryWriter.h"
+
+/** Bump whenever the frame layout changes. */
+static constexpr uint32 CloudTraceVersion = 1;
+static constexpr uint32 CloudTraceMagic = 0x43525443; // "CTRC"
+
+struct FCloudTraceHeader
+{
+	uint32 Magic;
+	uint32 Version;
+};
+
+namespace CloudTrace
+{
+
+static void Serialize(FArchive& Ar, FCloudSettings& Settings)
+{
+	Ar << Settings.WindVelocity;
+	Ar << Settings.ShapeFrequency;
+	Ar << Settings.DetailFrequency;
+	Ar << Settings.DetailStrength;
+	Ar << Settings.Extinction;
+	Ar << Settings.SunDirection;
+	Ar << Settings.PhaseG;
+	Ar << Settings.SunIlluminance;
+	Ar << Settings.AmbientIlluminance;
+}
+
+static void Serialize(FArchive& Ar, FCloudVolume& Volume)
+{
+	Ar << Volume.BoundsMin;
+	Ar << Volume.BoundsMax;
+	Ar << Volume.DensityScale;
+	Ar << Volume.Coverage;
+	Ar << Volume.BrickVolume;
+}
+
+static void Serialize(FArchive& Ar, FCloudTraceView& View)
+{
+	Ar << View.ViewKey;
+	Ar << View.Origin;
+	Ar << View.Rotation;
+	Ar << View.ProjectionMatrix;
+	Ar << View.ViewRect;
+	Ar << View.CloudViewSize;
+	Ar << View.bIsCapture;
+}
+
+/** Bytes a view takes in a frame, the bound on the views a frame of a given size can hold. */
+static int64 GetSerializedViewSize()
+{
+	TArray<uint8> Bytes;
+	FMemoryWriter Ar(Bytes);
+	FCloudTraceView View;
+	Serialize(Ar, View);
+	return Bytes.Num();
+}
+
+/** Everything but the volume deltas, which the writer and reader handle themselves. */
+static void SerializeFrame(FArchive& Ar, FCloudTraceFrame& Frame)
+{
+	Serialize(Ar, Frame.Snapshot.Settings);
+	Ar << Frame.Snapshot.GameTime;
+	Ar << Frame.Snapshot.FrameNumber;
+	Ar << Frame.ResolutionDivisor;
+	Ar << Frame.NumSteps;
+	Ar << Frame.NumLightSteps;
+	Ar << Frame.PanoramaNearDistance;
+
+	int32 NumViews = Frame.Views.Num();
+	Ar << NumViews;
+	if (Ar.IsLoading())
+	{
+		// A corrupt count must not allocate more views than the rest of the frame can hold.
+		static const int64 ViewSize = GetSerializedViewSize();
+		if (NumViews < 0 || int64(NumViews) * ViewSize > Ar.TotalSize() - Ar.Tell())
+		{
+			Ar.SetError();
+			Frame.Views.Reset();
+			return;
+		}
+		Frame.Views.SetNum(NumViews);
+	}
+	for (FCloudTraceView& View : Frame.Views)
+	{
+		Serialize(Ar, View);
+	}
+}
+
+} // namespace CloudTrace
+
+// ================================================================================================
+
+FMatrix FCloudTraceView::GetWorldToClip() const
+{
+	// Same axes as FSceneView: X forward, Y right, Z up in world space.
+	const FMatrix ViewMatrix = FTranslationMatrix(-Origin) * FInverseRotationMatrix(FRotator(Rotation)) * FMatrix(
+		FPlane(0.0, 0.0, 1.0, 0.0),
+		FPlane(1.0, 0.0, 0.0, 0.0),
+		FPlane(0.0, 1.0, 0.0, 0.0),
+		FPlane(0.0, 0.0, 0.0, 1.0));
+	return ViewMatrix * FMatrix(ProjectionMatrix);
+}
+
+void FCloudTraceView::GetViewFrustum(FConvexVolume& OutFrustum) const
+{
+	GetViewFrustumBounds(OutFrustum, GetWorldToClip(), false);
+}
+
+FCloudReferenceCamera FCloudTraceView::GetReferenceCamera(uint32 ResolutionDivisor) const
+{
+	FCloudReferenceCamera Camera;
+	Camera.Origin = FVector3f(Origin);
+	Camera.Rotation = Rotation;
+	Camera.FieldOfView = FMath::RadiansToDegrees(2.0f * FMath::Atan(1.0f / FMath::Max(ProjectionMatrix.M[0][0], 1e-4f)));
+	Camera.Size = FIntPoint::DivideAndRoundUp(CloudViewSize, int32(FMath::Max(ResolutionDivisor, 1u)));
+	return Camera;
+}
+
+// ================================================================================================
+
+FCloudTraceWriter::~FCloudTraceWriter()
+{
+	if (Writer)
+	{
+		Writer->Close();
+		UE_LOG(LogClouds, Log, TEXT("Wrote cloud trace %s: %d frames, %lld KB"), *Path, NumFrames, IFileManager::Get().FileSize(*Path) / 1024);
+	}
+}
+
+bool FCloudTraceWriter::Open(const FString& InPath)
+{
+	Path = InPath;
+	Writer.Reset(IFileManager::Get().CreateFileWriter(*Path));
+	if (!Writer)
+	{
+		UE_LOG(LogClouds, Warning, TEXT("Failed to write cloud trace %s"), *Path);
+		return false;
+	}
+
+	FCloudTraceHeader Header;
+	Header.Magic = CloudTraceMagic;
+	Header.Version = CloudTraceVersion;
+	Writer->Serialize(&Header, sizeof(Header));
+
+	UE_LOG(LogClouds, Log, TEXT("Recording cloud trace %s"), *Path);
+	return !Writer->IsError();
+}
+
+void FCloudTraceWriter::WriteFrame(const FCloudTraceFrame& Frame, TConstArrayView<uint32> Ids, TConstArrayView<FCloudVolume> Volumes)
+{
+	check(Writer && Ids.Num() == Volumes.Num());
+
+	// Frames are written whole behind their size, so a reader can tell a truncated one.
+	TArray<uint8> Bytes;
+	FMemoryWriter Ar(Bytes);
+	CloudTrace::SerializeFrame(Ar, const_cast<FCloudTraceFrame&>(Frame));
+
+	TArray<int32> Changed;
+	for (int32 Index = 0; Index < Ids.Num(); ++Index)
+	{
+		const FCloudVolume* Last = LastVolumes.Find(Ids[Index]);
+		if (!Last || !(*Last == Volumes[Index]))
+		{
+			Changed.Add(Index);
+		}
+	}
+
+	TArray<uint32> Removed;
+	if (LastVolumes.Num() + Changed.Num() > Ids.Num())
+	{
+		TSet<uint32> Current(Ids);
+		for (const TPair<uint32, FCloudVolume>& Last : LastVolumes)
+		{
+			if (!Current.Contains(Last.Key))
+			{
+				Removed.Add(Last.Key);
+			}
+		}
+	}
+
+	int32 NumChanged = Changed.Num();
+	Ar << NumChanged;
+	for (int32 Index : Changed)
+	{
+		uint32 Id = Ids[Index];
+		FCloudVolume Volume = Volumes[Index];
+		Ar << Id;
+		CloudTrace::Serialize(Ar, Volume);
+		LastVolumes.Add(Id, Volume);
+	}
+
+	Ar << Removed;
+	for (uint32 Id : Removed)
+	{
+		LastVolumes.Remove(Id);
+	}
+
+	int32 NumBytes = Bytes.Num();
+	*Writer << NumBytes;
+	Writer->Serialize(Bytes.GetData(), NumBytes);
+	++NumFrames;
+}
+
+// ================================================================================================
+
+bool FCloudTraceReader::Open(const FString& Path)
+{
+	Volumes.Reset();
+
+	Reader.Reset(IFileManager::Get().CreateFileReader(*Path));
+	if (!Reader || Reader->TotalSize() < int64(sizeof(FCloudTraceHeader)))
+	{
+		UE_LOG(LogClouds, Warning, TEXT("Failed to read cloud trace %s"), *Path);
+		Reader.Reset();
+		return false;
+	}
+
+	FCloudTraceHeader Header;
+	Reader->Serialize(&Header, sizeof(Header));
+	if (Reader->IsError() || Header.Magic != CloudTraceMagic || Header.Version != CloudTraceVersion)
+	{
+		UE_LOG(LogClouds, Warning, TEXT("%s is not a cloud trace of version %u"), *Path, CloudTraceVersion);
+		Reader.Reset();
+		return false;
+	}
+
+	return true;
+}
+
+bool FCloudTraceReader::ReadFrame(FCloudTraceFrame& OutFrame)
+{
+	if (!Reader || Reader->Tell() + int64(sizeof(int32)) > Reader->TotalSize())
+	{
+		return false;
+	}
+
+	// The size prefix of the writer tells a truncated frame before any of it is read.
+	int32 NumBytes = 0;
+	*Reader << NumBytes;
+	if (Reader->IsError() || NumBytes < 0 || Reader->Tell() + NumBytes > Reader->TotalSize())
+	{
+		UE_LOG(LogClouds, Warning, TEXT("Cloud trace ends in a truncated frame"));
+		Reader.Reset();
+		return false;
+	}
+
+	FrameBytes.SetNumUninitialized(NumBytes, false);
+	Reader->Serialize(FrameBytes.GetData(), NumBytes);
+	if (Reader->IsError())
+	{
+		UE_LOG(LogClouds, Warning, TEXT("Failed to read a frame of the cloud trace"));
+		Reader.Reset();
+		return false;
+	}
+
+	FMemoryReaderView Ar(FrameBytes);
+
+	CloudTrace::SerializeFrame(Ar, OutFrame);
+
+	int32 NumChanged = 0;
+	Ar << NumChanged;
+	OutFrame.ChangedVolumes.Reset();
+	for (int32 Index = 0; Index < NumChanged && !Ar.IsError(); ++Index)
+	{
+		TPair<uint32, FCloudVolume>& Entry = OutFrame.ChangedVolumes.AddDefaulted_GetRef();
+		Ar << Entry.Key;
+		CloudTrace::Serialize(Ar, Entry.Value);
+	}
+	Ar << OutFrame.RemovedVolumes;
+
+	if (Ar.IsError())
+	{
+		UE_LOG(LogClouds, Warning, TEXT("Cloud trace holds a corrupt frame"));
+		return false;
+	}
+
+	for (const TPair<uint32, FCloudVolume>& Entry : OutFrame.ChangedVolumes)
+	{
+		Volumes.Add(Entry.Key, Entry.Value);
+	}
+	for (uint32 Id : OutFrame.RemovedVolumes)
+	{
+		Volumes.Remove(Id);
+	}
+	return true;
+}
@@ -1,30 +1,663 @@
 #include "CloudSceneViewExtension.h"
+#include "CloudNoiseBaker.h"
+#include "CloudOccupancy.h"
+#include "CloudStats.h"
 #include "RenderGraphUtils.h"
 #include "RenderTargetPool.h"
+#include "Async/Async.h"
 #include "PixelShaderUtils.h"
+#include "Misc/Paths.h"
 #include "PostProcess/PostProcessing.h"
 #include "PostProcess/PostProcessMaterial.h"
 #include "SceneTextureParameters.h"
 #include "ShaderParameterStruct.h"
+#include "SystemTextures.h"
 
+IMPLEMENT_GLOBAL_SHADER_PARAMETER_STRUCT(FCloudViewUniformParameters, "CloudView");
 IMPLEMENT_SHADER_TYPE(, FCloudVS, TEXT("/Plugin/Foo/Private/CloudShader.usf"), TEXT("MainVS"), SF_Vertex)
 IMPLEMENT_SHADER_TYPE(, FCloudPS, TEXT("/Plugin/Foo/Private/CloudShader.usf"), TEXT("MainPS"), SF_Pixel)
+IMPLEMENT_GLOBAL_SHADER(FCloudTileClassifyCS, "/Plugin/Foo/Private/CloudTiles.usf", "ClassifyCS", SF_Compute);
+IMPLEMENT_GLOBAL_SHADER(FCloudTileMarchCS, "/Plugin/Foo/Private/CloudTiles.usf", "MarchCS", SF_Compute);
+IMPLEMENT_GLOBAL_SHADER(FCloudReprojectCS, "/Plugin/Foo/Private/CloudTemporal.usf", "ReprojectCS", SF_Compute);
+IMPLEMENT_GLOBAL_SHADER(FCloudOccupancyInitCS, "/Plugin/Foo/Private/CloudOccupancy.usf", "InitCS", SF_Compute);
+IMPLEMENT_GLOBAL_SHADER(FCloudOccupancyDownsampleCS, "/Plugin/Foo/Private/CloudOccupancy.usf", "DownsampleCS", SF_Compute);
+IMPLEMENT_GLOBAL_SHADER(FCloudLightVolumeCS, "/Plugin/Foo/Private/CloudLighting.usf", "LightVolumeCS", SF_Compute);
+IMPLEMENT_GLOBAL_SHADER(FCloudShadowMapCS, "/Plugin/Foo/Private/CloudLighting.usf", "ShadowMapCS", SF_Compute);
+IMPLEMENT_GLOBAL_SHADER(FCloudPanoramaCS, "/Plugin/Foo/Private/CloudPanorama.usf", "PanoramaCS", SF_Compute);
+IMPLEMENT_GLOBAL_SHADER(FCloudCompositePS, "/Plugin/Foo/Private/CloudTemporal.usf", "CompositePS", SF_Pixel);
 
 TGlobalResource<FTriangleVertexBuffer> GCloudVertexBuffer;
 TGlobalResource<FTriangleIndexBuffer> GCloudIndexBuffer;
 TGlobalResource<FTriangleVertexDeclaration> GCloudVertexDeclaration;
 
+static TAutoConsoleVariable<int32> CVarCloudsResolutionDivisor(
+	TEXT("r.Clouds.ResolutionDivisor"),
+	2,
+	TEXT("Divisor of the view resolution the clouds are marched at. Each frame marches one pixel of every\n")
+	TEXT("Divisor x Divisor block and the temporal reprojection reconstructs the others.\n")
+	TEXT(" 1: full resolution\n")
+	TEXT(" 2: half resolution (default)\n")
+	TEXT(" 4: quarter resolution"),
+	ECVF_Scalability | ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<float> CVarCloudsBudgetMs(
+	TEXT("r.Clouds.BudgetMs"),
+	0.0f,
+	TEXT("GPU time budget of the clouds in milliseconds. When set, the resolution divisor and step count\n")
+	TEXT("are picked from the measured GPU time of previous frames and r.Clouds.ResolutionDivisor and\n")
+	TEXT("r.Clouds.StepCount are ignored. 0 disables the budget (default)."),
+	ECVF_Scalability | ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<float> CVarCloudsBudgetHysteresis(
+	TEXT("r.Clouds.Budget.Hysteresis"),
+	0.15f,
+	TEXT("Fraction of r.Clouds.BudgetMs around the budget within which the quality is not changed."),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarCloudsBudgetSettleFrames(
+	TEXT("r.Clouds.Budget.SettleFrames"),
+	8,
+	TEXT("Frames measured at a quality level before the budget changes it again."),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarCloudsStepCount(
+	TEXT("r.Clouds.StepCount"),
+	64,
+	TEXT("Number of raymarch steps through the cloud volume, rounded up to a shader permutation: 32, 64 or 128."),
+	ECVF_Scalability | ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarCloudsLightStepCount(
+	TEXT("r.Clouds.LightStepCount"),
+	4,
+	TEXT("Number of steps of the secondary march towards the sun, per primary step. 0 leaves the sun light unshadowed."),
+	ECVF_Scalability | ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarCloudsDetailNoise(
+	TEXT("r.Clouds.DetailNoise"),
+	1,
+	TEXT("Whether the detail noise erodes the cloud shapes."),
+	ECVF_Scalability | ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<float> CVarCloudsTransmittanceThreshold(
+	TEXT("r.Clouds.TransmittanceThreshold"),
+	0.01f,
+	TEXT("The march along a ray stops once the transmittance falls below this, 0-1."),
+	ECVF_Scalability | ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarCloudsEmptySpaceSkipping(
+	TEXT("r.Clouds.EmptySpaceSkipping"),
+	1,
+	TEXT("Whether the march skips cells of the occupancy pyramid that cannot hold clouds."),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarCloudsEmptySpaceSkippingMaxLevel(
+	TEXT("r.Clouds.EmptySpaceSkipping.MaxLevel"),
+	5,
+	TEXT("Coarsest level of the occupancy pyramid the march tests, a cell of 2^Level shape noise texels."),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarCloudsTileClassification(
+	TEXT("r.Clouds.TileClassification"),
+	1,
+	TEXT("Classifies the screen tiles of the reduced resolution march before marching, so tiles without clouds\n")
+	TEXT("in front of the opaque scene cost nothing and tiles that only see the sky skip the scene depth.\n")
+	TEXT(" 0: rasterize the volume proxies\n")
+	TEXT(" 1: march the classified tiles with indirect dispatches (default)"),
+	ECVF_Scalability | ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarCloudsTemporalReprojection(
+	TEXT("r.Clouds.TemporalReprojection"),
+	1,
+	TEXT("Whether to reproject the cloud history of the previous frames to reconstruct full resolution."),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarCloudsViewStateIdleFrames(
+	TEXT("r.Clouds.ViewState.IdleFrames"),
+	60,
+	TEXT("Frames after which the history targets of a view that stopped rendering clouds are released,\n")
+	TEXT("e.g. closed editor viewports or scene captures that no longer update."),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<float> CVarCloudsHistoryWeight(
+	TEXT("r.Clouds.HistoryWeight"),
+	0.5f,
+	TEXT("Weight of the history for pixels that were marched this frame, 0-1."),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<float> CVarCloudsUpsampleDepthTolerance(
+	TEXT("r.Clouds.Upsample.DepthTolerance"),
+	0.05f,
+	TEXT("Relative scene depth difference at which a reduced resolution sample loses most of its weight in\n")
+	TEXT("the upsample. Smaller values keep geometry edges sharper but upsample noisier."),
+	ECVF_Scalability | ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarCloudsLightVolume(
+	TEXT("r.Clouds.Lighting.LightVolume"),
+	1,
+	TEXT("Whether the march looks up the precomputed light volume instead of marching towards the sun."),
+	ECVF_Scalability | ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarCloudsShadowMap(
+	TEXT("r.Clouds.Lighting.ShadowMap"),
+	1,
+	TEXT("Whether the cloud shadow map is bound for GetCloudShadow()."),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarCloudsLightingSlicesPerFrame(
+	TEXT("r.Clouds.Lighting.SlicesPerFrame"),
+	4,
+	TEXT("Light volume slices, and shadow map row bands, baked per frame. Bounds the per frame cost of\n")
+	TEXT("the cloud lighting; a full bake takes VolumeSlices / SlicesPerFrame frames."),
+	ECVF_Scalability | ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarCloudsLightVolumeResolution(
+	TEXT("r.Clouds.Lighting.VolumeResolution"),
+	128,
+	TEXT("Texels of the light volume in X and Y."),
+	ECVF_Scalability | ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarCloudsLightVolumeSlices(
+	TEXT("r.Clouds.Lighting.VolumeSlices"),
+	32,
+	TEXT("Slices of the light volume in Z, over the height of all cloud volumes."),
+	ECVF_Scalability | ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarCloudsShadowMapResolution(
+	TEXT("r.Clouds.Lighting.ShadowMapResolution"),
+	512,
+	TEXT("Resolution of the cloud shadow map."),
+	ECVF_Scalability | ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<float> CVarCloudsLightingExtent(
+	TEXT("r.Clouds.Lighting.Extent"),
+	200000.0f,
+	TEXT("World size in X and Y of the light volume and shadow map around the camera."),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarCloudsLightingStepCount(
+	TEXT("r.Clouds.Lighting.StepCount"),
+	16,
+	TEXT("Steps towards the sun per cloud volume when baking the light volume and shadow map."),
+	ECVF_Scalability | ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarCloudsPanorama(
+	TEXT("r.Clouds.Panorama"),
+	1,
+	TEXT("Whether the clouds beyond r.Clouds.Panorama.NearDistance are baked into a cubemap around the camera\n")
+	TEXT("over several frames and composited from it, instead of being marched by every view."),
+	ECVF_Scalability | ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarCloudsPanoramaResolution(
+	TEXT("r.Clouds.Panorama.Resolution"),
+	128,
+	TEXT("Texels of every face of the distant cloud cubemap in X and Y."),
+	ECVF_Scalability | ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<float> CVarCloudsPanoramaNearDistance(
+	TEXT("r.Clouds.Panorama.NearDistance"),
+	100000.0f,
+	TEXT("Distance from the camera up to which views march the clouds; the cubemap covers everything beyond."),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarCloudsPanoramaTilesPerFace(
+	TEXT("r.Clouds.Panorama.TilesPerFace"),
+	4,
+	TEXT("Bands of rows every face of the distant cloud cubemap is baked in."),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarCloudsPanoramaTilesPerFrame(
+	TEXT("r.Clouds.Panorama.TilesPerFrame"),
+	2,
+	TEXT("Bands of the distant cloud cubemap baked per frame. Bounds the per frame cost of the cubemap;\n")
+	TEXT("a full bake takes 6 * TilesPerFace / TilesPerFrame frames."),
+	ECVF_Scalability | ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarCloudsPanoramaCaptures(
+	TEXT("r.Clouds.Panorama.Captures"),
+	1,
+	TEXT("Whether scene captures and planar reflections composite only the distant cloud cubemap and march\n")
+	TEXT("no clouds of their own, once the cubemap is baked."),
+	ECVF_Scalability | ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<FString> CVarCloudsWeatherMap(
+	TEXT("r.Clouds.Weather.Map"),
+	TEXT(""),
+	TEXT("Path of the tiled weather map file (.cwm) the clouds stream their coverage, type and precipitation from.\n")
+	TEXT("Empty uses a procedural map baked to Saved/Clouds/Weather on first launch. Read at startup."),
+	ECVF_ReadOnly);
+
+static TAutoConsoleVariable<int32> CVarCloudsWeatherClipmapTiles(
+	TEXT("r.Clouds.Weather.ClipmapTiles"),
+	8,
+	TEXT("Width in tiles of the window of weather map tiles kept on the GPU around the camera. Read at startup."),
+	ECVF_ReadOnly);
+
+static TAutoConsoleVariable<int32> CVarCloudsWeatherCacheTiles(
+	TEXT("r.Clouds.Weather.CacheTiles"),
+	128,
+	TEXT("Number of weather map tiles kept memory mapped, at least the clipmap window.\n")
+	TEXT("Size it with the weather tile cache counters of stat Clouds."),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarCloudsWeatherMaxTileUploads(
+	TEXT("r.Clouds.Weather.MaxTileUploadsPerFrame"),
+	8,
+	TEXT("Maximum number of weather map tiles uploaded to the clipmap per frame."),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<int32> CVarCloudsBricksPoolSize(
+	TEXT("r.Clouds.Bricks.PoolSize"),
+	16,
+	TEXT("Bricks per axis of the pool texture authored cloud volumes are streamed into, so the pool holds\n")
+	TEXT("PoolSize^3 bricks. Size it with the resident brick counter of stat Clouds. Read at startup."),
+	ECVF_ReadOnly);
+
+static TAutoConsoleVariable<int32> CVarCloudsBricksMaxUploads(
+	TEXT("r.Clouds.Bricks.MaxUploadsPerFrame"),
+	64,
+	TEXT("Maximum number of bricks of authored cloud volumes uploaded to the pool per frame."),
+	ECVF_RenderThreadSafe);
+
+static TAutoConsoleVariable<FString> CVarCloudsTrace(
+	TEXT("r.Clouds.Trace"),
+	TEXT(""),
+	TEXT("Path of a trace (.ctr) the inputs of every cloud view family are recorded to, for replay with the\n")
+	TEXT("CloudReplay commandlet. Relative paths are in Saved/Clouds/Traces. Empty stops the recording (default)."),
+	ECVF_RenderThreadSafe);
+
+// ================================================================================================
+
+int32 CloudPermutation::GetStepCountTier(int32 NumSteps)
+{
+	return NumSteps <= 32 ? 32 : (NumSteps <= 64 ? 64 : 128);
+}
+
+void SetupCloudMarchParameters(FCloudMarchShaderParameters& OutParameters, const FCloudMarchSettings& Settings, const FCloudNoiseTextures& NoiseTextures)
+{
+	OutParameters.CloudWindOffset = Settings.WindOffset;
+	OutParameters.CloudShapeFrequency = Settings.ShapeFrequency;
+	OutParameters.CloudDetailFrequency = Settings.DetailFrequency;
+	OutParameters.CloudDetailStrength = Settings.DetailStrength;
+	OutParameters.CloudExtinction = Settings.Extinction;
+	OutParameters.CloudSunDirection = Settings.SunDirection;
+	OutParameters.CloudPhaseG = Settings.PhaseG;
+	OutParameters.CloudSunIlluminance = Settings.SunIlluminance;
+	OutParameters.CloudAmbientIlluminance = Settings.AmbientIlluminance;
+	OutParameters.CloudNumSteps = FMath::Max(Settings.NumSteps, 1);
+	OutParameters.CloudNumLightSteps = FMath::Max(Settings.NumLightSteps, 0);
+	OutParameters.CloudTransmittanceThreshold = FMath::Clamp(Settings.TransmittanceThreshold, 0.0f, 1.0f);
+	OutParameters.CloudShapeNoiseTexture = NoiseTextures.ShapeTexture;
+	OutParameters.CloudDetailNoiseTexture = NoiseTextures.DetailTexture;
+	OutParameters.CloudNoiseSampler = TStaticSamplerState<SF_Trilinear, AM_Wrap, AM_Wrap, AM_Wrap>::GetRHI();
+
+	// The occupancy texture itself is an RDG resource and bound by the caller.
+	const int32 OccupancyResolution = NoiseTextures.ShapeTexture.IsValid() ? int32(NoiseTextures.ShapeTexture->GetSizeX()) : 1;
+	OutParameters.CloudOccupancyResolution = OccupancyResolution;
+	OutParameters.CloudOccupancyMaxLevel = FMath::Clamp(Settings.MaxOccupancyLevel, 0, int32(FMath::FloorLog2(OccupancyResolution)));
+	OutParameters.CloudEmptySpaceSkipping = Settings.Occupancy.IsValid() ? 1 : 0;
+}
+
+static FTextureRHIRef CreateCloudNoiseTexture(FRHICommandListImmediate& RHICmdList, const FCloudNoiseVolume& Volume, const TCHAR* Name)
+{
+	const int32 Resolution = Volume.Resolution;
+
+	// FColor is laid out as BGRA in memory.
+	const FRHITextureCreateDesc Desc = FRHITextureCreateDesc::Create3D(Name, Resolution, Resolution, Resolution, PF_B8G8R8A8)
+		.SetFlags(ETextureCreateFlags::ShaderResource)
+		.SetInitialState(ERHIAccess::SRVMask);
+
+	FTextureRHIRef Texture = RHICreateTexture(Desc);
+
+	const uint32 RowPitch = Resolution * sizeof(FColor);
+	RHICmdList.UpdateTexture3D(
+		Texture,
+		0,
+		FUpdateTextureRegion3D(0, 0, 0, 0, 0, 0, Resolution, Resolution, Resolution),
+		RowPitch,
+		RowPitch * Resolution,
+		reinterpret_cast<const uint8*>(Volume.Texels.GetData()));
+
+	return Texture;
+}
+
+static uint32 GetCloudResolutionDivisor()
+{
+	return FMath::RoundUpToPowerOfTwo(FMath::Clamp(CVarCloudsResolutionDivisor.GetValueOnRenderThread(), 1, 4));
+}
+
+/** Returns which pixel of each Divisor x Divisor block is marched this frame, visited in Bayer order. */
+static FUintVector2 GetCloudSampleOffset(uint32 FrameIndex, uint32 Divisor)
+{
+	static const uint32 Bayer2x2[4][2] = { { 0, 0 }, { 1, 1 }, { 1, 0 }, { 0, 1 } };
+
+	FUintVector2 Offset(0, 0);
+	uint32 Index = FrameIndex % (Divisor * Divisor);
+	for (uint32 Scale = Divisor / 2; Scale > 0; Scale /= 2)
+	{
+		Offset.X += Bayer2x2[Index & 3][0] * Scale;
+		Offset.Y += Bayer2x2[Index & 3][1] * Scale;
+		Index >>= 2;
+	}
+	return Offset;
+}
+
+/** Scene depth of the view for a cloud view rect of ViewSize, disabled if the scene textures are unavailable. */
+static FCloudSceneDepthParameters GetCloudSceneDepthParameters(FRDGBuilder& GraphBuilder, const FSceneView& View, const FPostProcessMaterialInputs& Inputs, const FIntPoint& ViewSize)
+{
+	// After the upscaler the clouds cover the output rect while depth still has the render resolution.
+	const FIntRect DepthViewRect = static_cast<const FViewInfo&>(View).ViewRect;
+
+	FCloudSceneDepthParameters Parameters;
+	Parameters.CloudSceneDepthTexture = GSystemTextures.GetBlackDummy(GraphBuilder);
+	Parameters.CloudSceneDepthViewMin = DepthViewRect.Min;
+	Parameters.CloudSceneDepthViewMax = DepthViewRect.Max;
+	Parameters.CloudSceneDepthScale = FVector2f(DepthViewRect.Size()) / FVector2f(FMath::Max(ViewSize, FIntPoint(1, 1)));
+	Parameters.CloudInvDeviceZToWorldZ = View.InvDeviceZToWorldZTransform;
+	Parameters.CloudViewForward = FVector3f(View.GetViewDirection());
+	Parameters.CloudSceneDepthEnabled = 0;
+
+	if (Inputs.SceneTextures.SceneTextures)
+	{
+		if (FRDGTextureRef SceneDepth = Inputs.SceneTextures.SceneTextures->GetParameters()->SceneDepthTexture)
+		{
+			Parameters.CloudSceneDepthTexture = SceneDepth;
+			Parameters.CloudSceneDepthEnabled = 1;
+		}
+	}
+
+	return Parameters;
+}
+
 // ================================================================================================
 
 FCloudSceneViewExtension::FCloudSceneViewExtension(const FAutoRegister& AutoRegister)
 	: FSceneViewExtensionBase(AutoRegister)
 {
+	LLM_SCOPE_BYTAG(Clouds);
+
+	// Noise is baked once on the CPU and cached on disk, so the march only samples textures. A cold
+	// cache takes seconds to bake, so it never blocks the game thread; see FinishBakes_GameThread.
+	NoiseBake = Async(EAsyncExecution::ThreadPool, []()
+	{
+		LLM_SCOPE_BYTAG(Clouds);
+
+		FCloudNoiseBake Bake;
+		TSharedRef<const FCloudNoiseVolume> ShapeNoise = CloudNoise::BakeOrLoadCached(FCloudNoiseBakeSettings::Shape());
+		Bake.ShapeNoise = ShapeNoise;
+		Bake.DetailNoise = CloudNoise::BakeOrLoadCached(FCloudNoiseBakeSettings::Detail());
+		Bake.Occupancy = FCloudOccupancyPyramid::Build(*ShapeNoise);
+		return Bake;
+	});
+
+	// The procedural map is baked like the noise, and the weather is neutral until it is done.
+	const FString WeatherMapPath = CVarCloudsWeatherMap.GetValueOnGameThread();
+	if (WeatherMapPath.IsEmpty())
+	{
+		WeatherMapBake = Async(EAsyncExecution::ThreadPool, []()
+		{
+			LLM_SCOPE_BYTAG(Clouds);
+			return CloudWeather::BakeOrFindProceduralWeatherMap();
+		});
+	}
+	else
+	{
+		OpenWeatherMap_GameThread(WeatherMapPath);
+	}
+
+	ENQUEUE_RENDER_COMMAND(CreateCloudBrickPool)(
+		[this, PoolSize = CVarCloudsBricksPoolSize.GetValueOnGameThread()](FRHICommandListImmediate&)
+		{
+			LLM_SCOPE_BYTAG(Clouds);
+			BrickPool.Initialize(PoolSize);
+		});
 }
 
 // ================================================================================================
 
 FCloudSceneViewExtension::~FCloudSceneViewExtension()
 {
+	// The bakes only reference what they return, but may still be writing their caches.
+	if (NoiseBake.IsValid())
+	{
+		NoiseBake.Wait();
+	}
+	if (WeatherMapBake.IsValid())
+	{
+		WeatherMapBake.Wait();
+	}
+}
+
+void FCloudSceneViewExtension::FinishBakes_GameThread(bool bWait)
+{
+	check(IsInGameThread());
+	LLM_SCOPE_BYTAG(Clouds);
+
+	if (NoiseBake.IsValid() && (bWait || NoiseBake.IsReady()))
+	{
+		const FCloudNoiseBake Bake = NoiseBake.Get();
+		NoiseBake.Reset();
+
+		GameMarchSettings.ShapeNoise = Bake.ShapeNoise;
+		GameMarchSettings.DetailNoise = Bake.DetailNoise;
+		GameMarchSettings.Occupancy = Bake.Occupancy;
+		QueryScene.Reset();
+
+		ENQUEUE_RENDER_COMMAND(CreateCloudNoiseTextures)(
+			[this, Bake](FRHICommandListImmediate& RHICmdList)
+			{
+				LLM_SCOPE_BYTAG(Clouds);
+				MarchSettings.ShapeNoise = Bake.ShapeNoise;
+				MarchSettings.DetailNoise = Bake.DetailNoise;
+				MarchSettings.Occupancy = Bake.Occupancy;
+				NoiseTextures.ShapeTexture = CreateCloudNoiseTexture(RHICmdList, *Bake.ShapeNoise, TEXT("Clouds.ShapeNoise"));
+				NoiseTextures.DetailTexture = CreateCloudNoiseTexture(RHICmdList, *Bake.DetailNoise, TEXT("Clouds.DetailNoise"));
+			});
+	}
+
+	if (WeatherMapBake.IsValid() && (bWait || WeatherMapBake.IsReady()))
+	{
+		const FString Path = WeatherMapBake.Get();
+		WeatherMapBake.Reset();
+		OpenWeatherMap_GameThread(Path);
+	}
+}
+
+void FCloudSceneViewExtension::OpenWeatherMap_GameThread(const FString& Path)
+{
+	check(IsInGameThread());
+	LLM_SCOPE_BYTAG(Clouds);
+
+	// Gameplay queries only read the overview, so the game thread maps no tiles.
+	TSharedRef<FCloudWeatherTileCache> GameWeather = MakeShared<FCloudWeatherTileCache>();
+	if (GameWeather->Open(Path, 1))
+	{
+		GameWeatherMap = GameWeather;
+		QueryScene.Reset();
+	}
+
+	ENQUEUE_RENDER_COMMAND(CreateCloudWeatherClipmap)(
+		[this, Path, ClipmapTiles = CVarCloudsWeatherClipmapTiles.GetValueOnGameThread()](FRHICommandListImmediate& RHICmdList)
+		{
+			LLM_SCOPE_BYTAG(Clouds);
+			WeatherClipmap.Initialize(RHICmdList, Path, ClipmapTiles, CVarCloudsWeatherCacheTiles.GetValueOnRenderThread());
+		});
+}
+
+// ================================================================================================
+
+uint32 FCloudSceneViewExtension::AddCloudVolume_GameThread(const FCloudVolume& Volume)
+{
+	check(IsInGameThread());
+	LLM_SCOPE_BYTAG(Clouds);
+
+	const uint32 VolumeId = NextCloudVolumeId++;
+	GameVolumes.Add(VolumeId, Volume);
+	QueryScene.Reset();
+
+	ENQUEUE_RENDER_COMMAND(AddCloudVolume)(
+		[this, VolumeId, Volume](FRHICommandListImmediate&)
+		{
+			LLM_SCOPE_BYTAG(Clouds);
+			CloudVolumes.Add(VolumeId, Volume);
+		});
+	return VolumeId;
+}
+
+void FCloudSceneViewExtension::UpdateCloudVolume_GameThread(uint32 VolumeId, const FCloudVolume& Volume)
+{
+	check(IsInGameThread());
+
+	GameVolumes.Add(VolumeId, Volume);
+	QueryScene.Reset();
+
+	ENQUEUE_RENDER_COMMAND(UpdateCloudVolume)(
+		[this, VolumeId, Volume](FRHICommandListImmediate&)
+		{
+			CloudVolumes.Update(VolumeId, Volume);
+		});
+}
+
+void FCloudSceneViewExtension::RemoveCloudVolume_GameThread(uint32 VolumeId)
+{
+	check(IsInGameThread());
+
+	GameVolumes.Remove(VolumeId);
+	QueryScene.Reset();
+
+	ENQUEUE_RENDER_COMMAND(RemoveCloudVolume)(
+		[this, VolumeId](FRHICommandListImmediate&)
+		{
+			CloudVolumes.Remove(VolumeId);
+		});
+}
+
+uint32 FCloudSceneViewExtension::AddBrickVolume_GameThread(const FString& Path, const UObject* Owner)
+{
+	check(IsInGameThread());
+	LLM_SCOPE_BYTAG(Clouds);
+
+	int32 Index = BrickVolumeIds.FindAndSetFirstZeroBit();
+	if (Index == INDEX_NONE)
+	{
+		Index = BrickVolumeIds.Add(true);
+	}
+
+	const uint32 BrickVolumeId = Index + 1;
+
+	// Mapped separately for the queries, so they never touch the pool of the render thread.
+	TSharedRef<FCloudBrickVolumeFile> File = MakeShared<FCloudBrickVolumeFile>();
+	if (File->Open(Path))
+	{
+		GameBrickVolumes.Add(BrickVolumeId, File);
+	}
+	QueryScene.Reset();
+
+	ENQUEUE_RENDER_COMMAND(AddCloudBrickVolume)(
+		[this, BrickVolumeId, Path, OwnerName = GetPathNameSafe(Owner)](FRHICommandListImmediate&)
+		{
+			LLM_SCOPE_BYTAG(Clouds);
+			BrickPool.AddVolume(BrickVolumeId, Path, OwnerName);
+		});
+	return BrickVolumeId;
+}
+
+void FCloudSceneViewExtension::RemoveBrickVolume_GameThread(uint32 BrickVolumeId)
+{
+	check(IsInGameThread() && BrickVolumeId > 0 && BrickVolumeIds[BrickVolumeId - 1]);
+
+	BrickVolumeIds[BrickVolumeId - 1] = false;
+	GameBrickVolumes.Remove(BrickVolumeId);
+	QueryScene.Reset();
+
+	ENQUEUE_RENDER_COMMAND(RemoveCloudBrickVolume)(
+		[this, BrickVolumeId](FRHICommandListImmediate&)
+		{
+			BrickPool.RemoveVolume(BrickVolumeId);
+		});
+}
+
+void FCloudSceneViewExtension::SetCloudSettings_GameThread(const UObject* Owner, const FCloudSettings& Settings)
+{
+	check(IsInGameThread());
+
+	GameSettings = Settings;
+	GameSettingsOwner = Owner;
+	QueryScene.Reset();
+}
+
+void FCloudSceneViewExtension::ResetCloudSettings_GameThread(const UObject* Owner)
+{
+	check(IsInGameThread());
+
+	if (GameSettingsOwner == Owner)
+	{
+		GameSettings = FCloudSettings();
+		GameSettingsOwner = nullptr;
+		QueryScene.Reset();
+	}
+}
+
+TSharedRef<const FCloudQueryScene> FCloudSceneViewExtension::GetQueryScene_GameThread()
+{
+	check(IsInGameThread());
+	LLM_SCOPE_BYTAG(Clouds);
+
+	// The wind moves the clouds every frame.
+	if (QueryScene.IsValid() && QuerySceneFrame == GFrameCounter)
+	{
+		return QueryScene.ToSharedRef();
+	}
+
+	// Same as the render thread does with the snapshot of this frame.
+	FCloudMarchSettings Settings = GameMarchSettings;
+	GameSettings.ApplyTo(Settings);
+	Settings.WindOffset = Settings.WindVelocity * float(FApp::GetGameTime());
+
+	// The functions keep the files they sample alive as long as the scene.
+	if (GameWeatherMap.IsValid())
+	{
+		Settings.SampleWeather = [WeatherMap = GameWeatherMap](const FVector2f& WorldXY)
+		{
+			return WeatherMap->SampleOverview(WorldXY);
+		};
+	}
+	Settings.SampleBrickDensity = [BrickVolumes = GameBrickVolumes](uint32 BrickVolume, const FVector3f& Local)
+	{
+		const TSharedPtr<const FCloudBrickVolumeFile>* File = BrickVolumes.Find(BrickVolume);
+		return File ? (*File)->SampleDensity(Local) : 0.0f;
+	};
+
+	TArray<FCloudVolume> Volumes;
+	GameVolumes.GenerateValueArray(Volumes);
+
+	TSharedRef<const FCloudQueryScene> Scene = MakeShared<const FCloudQueryScene>(Settings, MoveTemp(Volumes));
+	QueryScene = Scene;
+	QuerySceneFrame = GFrameCounter;
+	return Scene;
+}
+
+void FCloudSceneViewExtension::BeginRenderViewFamily(FSceneViewFamily& InViewFamily)
+{
+	FinishBakes_GameThread(false);
+
+	// Every family of a frame renders with the same snapshot, so settings changed in between apply
+	// to all views at once and the wind of all views uses the same time.
+	const bool bNewFrame = LastSnapshotFrame != GFrameCounter;
+	if (bNewFrame)
+	{
+		LastSnapshotFrame = GFrameCounter;
+
+		GameSnapshot.Settings = GameSettings;
+		GameSnapshot.GameTime = FApp::GetGameTime();
+		GameSnapshot.FrameNumber = GFrameCounter;
+	}
+
+	// Published under the frame number of every family, which the render thread consumes it by.
+	if (bNewFrame || LastPublishedFamilyFrame != InViewFamily.FrameNumber)
+	{
+		LastPublishedFamilyFrame = InViewFamily.FrameNumber;
+		SettingsMailbox.Publish(InViewFamily.FrameNumber, GameSnapshot);
+	}
 }
 
 // ================================================================================================
@@ -35,8 +668,345 @@ void FCloudSceneViewExtension::PrePostProcessPass_RenderThread(FRDGBuilder& Grap
 
 // ================================================================================================
 
+void FCloudSceneViewExtension::PreRenderViewFamily_RenderThread(FRDGBuilder& GraphBuilder, FSceneViewFamily& InViewFamily)
+{
+	LLM_SCOPE_BYTAG(Clouds);
+
+	ViewStates.Reset();
+	FamilyState = FCloudFamilyState();
+	ReleaseIdleViewHistories();
+
+	if (InViewFamily.Views.Num() == 0)
+	{
+		return;
+	}
+
+	// The weather streams around the first view of the family.
+	WeatherClipmap.Update(
+		GraphBuilder.RHICmdList,
+		InViewFamily.Views[0]->ViewMatrices.GetViewOrigin(),
+		FMath::Max(CVarCloudsWeatherMaxTileUploads.GetValueOnRenderThread(), 0),
+		CVarCloudsWeatherCacheTiles.GetValueOnRenderThread());
+
+	// Bricks come from the feedback of earlier frames, so they do not depend on the views.
+	BrickPool.Update(GraphBuilder.RHICmdList, FMath::Max(CVarCloudsBricksMaxUploads.GetValueOnRenderThread(), 0));
+
+	SetupFamilyState(GraphBuilder, GetGlobalShaderMap(InViewFamily.GetFeatureLevel()), InViewFamily.Views[0]->ViewMatrices.GetViewOrigin(), InViewFamily.Views.Num(), InViewFamily.FrameNumber);
+
+	RecordTraceFrame(InViewFamily);
+}
+
+void FCloudSceneViewExtension::RecordTraceFrame(const FSceneViewFamily& ViewFamily)
+{
+	FString Path = CVarCloudsTrace.GetValueOnRenderThread();
+	if (!Path.IsEmpty() && FPaths::IsRelative(Path))
+	{
+		Path = FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("Clouds"), TEXT("Traces"), Path);
+	}
+
+	if (Path != TracePath)
+	{
+		TracePath = Path;
+		TraceWriter.Reset();
+		if (!Path.IsEmpty())
+		{
+			TraceWriter = MakeUnique<FCloudTraceWriter>();
+			if (!TraceWriter->Open(Path))
+			{
+				TraceWriter.Reset();
+			}
+		}
+	}
+
+	// Families without clouds (e.g. before the noise is baked) have nothing to replay.
+	if (!TraceWriter || FamilyState.GraphBuilder == nullptr)
+	{
+		return;
+	}
+
+	FCloudTraceFrame Frame;
+	Frame.Snapshot = FamilyState.Snapshot;
+	Frame.ResolutionDivisor = FamilyState.ResolutionDivisor;
+	Frame.NumSteps = MarchSettings.NumSteps;
+	Frame.NumLightSteps = MarchSettings.NumLightSteps;
+	Frame.PanoramaNearDistance = FamilyState.Panorama.CloudPanoramaEnabled != 0 ? FamilyState.Panorama.CloudPanoramaNearDistance : 0.0f;
+
+	const bool bPanoramaCaptures = FamilyState.Panorama.CloudPanoramaEnabled != 0 && CVarCloudsPanoramaCaptures.GetValueOnRenderThread() != 0;
+	for (const FSceneView* View : ViewFamily.Views)
+	{
+		FCloudTraceView& TraceView = Frame.Views.AddDefaulted_GetRef();
+		TraceView.ViewKey = View->GetViewKey();
+		TraceView.Origin = View->ViewMatrices.GetViewOrigin();
+		TraceView.Rotation = FRotator3f(View->ViewRotation);
+		TraceView.ProjectionMatrix = FMatrix44f(View->ViewMatrices.GetProjectionMatrix());
+		TraceView.ViewRect = View->UnscaledViewRect;
+		TraceView.CloudViewSize = static_cast<const FViewInfo*>(View)->GetSecondaryViewRectSize();
+		TraceView.bIsCapture = bPanoramaCaptures && (View->bIsSceneCapture || View->bIsPlanarReflection || View->bIsReflectionCapture);
+	}
+
+	TraceWriter->WriteFrame(Frame, CloudVolumes.GetVolumeIds(), CloudVolumes.GetVolumes());
+}
+
+// ================================================================================================
+
+void FCloudSceneViewExtension::PostRenderViewFamily_RenderThread(FRDGBuilder& GraphBuilder, FSceneViewFamily& InViewFamily)
+{
+	LLM_SCOPE_BYTAG(Clouds);
+
+	// Every pass that could read bricks ran by now.
+	BrickPool.EnqueueFeedbackReadback(GraphBuilder);
+
+	// The shared resources die with the graph; never let a later family see them.
+	FamilyState = FCloudFamilyState();
+}
+
+// ================================================================================================
+
+void FCloudSceneViewExtension::SetupFamilyState(FRDGBuilder& GraphBuilder, const FGlobalShaderMap* ShaderMap, const FVector& CameraOrigin, int32 NumViews, uint32 FamilyFrameNumber)
+{
+	if (!NoiseTextures.IsValid())
+	{
+		return;
+	}
+
+	float SharedSetupMs = 0.0f;
+	{
+		SCOPE_CYCLE_COUNTER(STAT_CloudsFamilySetup);
+
+		// Time and settings only come from the game thread snapshot, never from globals it writes.
+		const FCloudFrameSnapshot& Snapshot = SettingsMailbox.Consume(FamilyFrameNumber);
+		Snapshot.Settings.ApplyTo(MarchSettings);
+		FamilyState.Snapshot = Snapshot;
+
+		int32 NumSteps = CVarCloudsStepCount.GetValueOnRenderThread();
+		uint32 ResolutionDivisor = GetCloudResolutionDivisor();
+
+		const float BudgetMs = CVarCloudsBudgetMs.GetValueOnRenderThread();
+		if (BudgetMs > 0.0f)
+		{
+			FCloudBudgetSettings BudgetSettings;
+			BudgetSettings.BudgetMs = BudgetMs;
+			BudgetSettings.Hysteresis = CVarCloudsBudgetHysteresis.GetValueOnRenderThread();
+			BudgetSettings.SettleFrames = CVarCloudsBudgetSettleFrames.GetValueOnRenderThread();
+			BudgetController.SetSettings(BudgetSettings);
+
+			// Every family of a frame adds to the same timing, so captures and the main view make up
+			// one measurement and the controller sees whole frames.
+			ReadGpuTimings();
+			if (PendingGpuTimings.Num() == 0 || PendingGpuTimings.Last().Frame != GFrameCounterRenderThread)
+			{
+				PendingGpuTimings.AddDefaulted_GetRef().Frame = GFrameCounterRenderThread;
+			}
+
+			NumSteps = BudgetController.GetQuality().NumSteps;
+			ResolutionDivisor = FMath::RoundUpToPowerOfTwo(FMath::Clamp(BudgetController.GetQuality().ResolutionDivisor, 1, 4));
+			SET_DWORD_STAT(STAT_CloudsBudgetLevel, BudgetController.GetLevel());
+		}
+		else if (PendingGpuTimings.Num() > 0 || BudgetController.GetSmoothedMs() > 0.0f)
+		{
+			PendingGpuTimings.Reset();
+			BudgetController.Reset();
+		}
+
+		// Only the work from here on ran in every view before the family shared it. The budget above,
+		// the lighting and the panorama below always ran once per family.
+		const uint32 SharedStartCycles = FPlatformTime::Cycles();
+
+		MarchSettings.NumSteps = CloudPermutation::GetStepCountTier(NumSteps);
+		FamilyState.ResolutionDivisor = ResolutionDivisor;
+		MarchSettings.NumLightSteps = FMath::Max(CVarCloudsLightStepCount.GetValueOnRenderThread(), 0);
+		MarchSettings.TransmittanceThreshold = CVarCloudsTransmittanceThreshold.GetValueOnRenderThread();
+		MarchSettings.MaxOccupancyLevel = CVarCloudsEmptySpaceSkippingMaxLevel.GetValueOnRenderThread();
+		MarchSettings.WindOffset = MarchSettings.WindVelocity * float(Snapshot.GameTime);
+
+		FamilyState.GraphBuilder = &GraphBuilder;
+		FamilyState.NumViews = NumViews;
+
+		// Without detail noise the march matches a detail strength of 0, unshadowed matches 0 light steps.
+		FamilyState.MarchPermutation.Set<CloudPermutation::FStepCountDim>(MarchSettings.NumSteps);
+		FamilyState.MarchPermutation.Set<CloudPermutation::FDetailNoiseDim>(CVarCloudsDetailNoise.GetValueOnRenderThread() != 0 && MarchSettings.DetailStrength > 0.0f);
+		FamilyState.MarchPermutation.Set<CloudPermutation::FLightingModeDim>(
+			MarchSettings.NumLightSteps == 0 ? ECloudLightingMode::Unshadowed :
+			CVarCloudsLightVolume.GetValueOnRenderThread() != 0 ? ECloudLightingMode::LightVolume :
+			ECloudLightingMode::SecondaryMarch);
+
+		SetupCloudMarchParameters(FamilyState.March, MarchSettings, NoiseTextures);
+		FamilyState.March.CloudInstances = GraphBuilder.CreateSRV(CloudVolumes.UpdateInstanceBuffer(GraphBuilder));
+		FamilyState.March.CloudOccupancyTexture = GetOrBuildOccupancyTexture(GraphBuilder, ShaderMap);
+		FamilyState.March.CloudEmptySpaceSkipping = CVarCloudsEmptySpaceSkipping.GetValueOnRenderThread() != 0 ? 1 : 0;
+		WeatherClipmap.SetupParameters(GraphBuilder, FamilyState.March.Weather);
+		BrickPool.SetupParameters(GraphBuilder, FamilyState.March.Bricks);
+
+		SharedSetupMs = FPlatformTime::ToMilliseconds(FPlatformTime::Cycles() - SharedStartCycles);
+	}
+
+	{
+		FCloudLightingSettings LightingSettings;
+		LightingSettings.VolumeResolution = CVarCloudsLightVolumeResolution.GetValueOnRenderThread();
+		LightingSettings.VolumeSlices = CVarCloudsLightVolumeSlices.GetValueOnRenderThread();
+		LightingSettings.ShadowMapResolution = CVarCloudsShadowMapResolution.GetValueOnRenderThread();
+		LightingSettings.Extent = CVarCloudsLightingExtent.GetValueOnRenderThread();
+		LightingSettings.NumSteps = CVarCloudsLightingStepCount.GetValueOnRenderThread();
+		LightingSettings.SlicesPerFrame = CVarCloudsLightingSlicesPerFrame.GetValueOnRenderThread();
+
+		RDG_GPU_STAT_SCOPE(GraphBuilder, Clouds);
+		FCloudLightingCache::SetupDisabledParameters(GraphBuilder, FamilyState.March.Lighting);
+		AddGpuTimestamp(GraphBuilder);
+		AddCloudPasses([&]
+		{
+			LightingCache.Update(GraphBuilder, ShaderMap, LightingSettings, CameraOrigin, CloudVolumes.GetVolumes(), FamilyState.March);
+		});
+		LightingCache.SetupParameters(
+			GraphBuilder,
+			FamilyState.March.Lighting,
+			CVarCloudsLightVolume.GetValueOnRenderThread() != 0,
+			CVarCloudsShadowMap.GetValueOnRenderThread() != 0);
+
+		// The panorama is lit by the bake above, so it goes after it.
+		if (CVarCloudsPanorama.GetValueOnRenderThread() != 0)
+		{
+			FCloudPanoramaSettings PanoramaSettings;
+			PanoramaSettings.Resolution = CVarCloudsPanoramaResolution.GetValueOnRenderThread();
+			PanoramaSettings.NearDistance = CVarCloudsPanoramaNearDistance.GetValueOnRenderThread();
+			PanoramaSettings.TilesPerFace = CVarCloudsPanoramaTilesPerFace.GetValueOnRenderThread();
+			PanoramaSettings.TilesPerFrame = CVarCloudsPanoramaTilesPerFrame.GetValueOnRenderThread();
+
+			AddCloudPasses([&]
+			{
+				PanoramaCache.Update(GraphBuilder, ShaderMap, PanoramaSettings, CameraOrigin, CloudVolumes.GetVolumes(), FamilyState.March);
+			});
+		}
+		else if (PanoramaCache.IsValid())
+		{
+			PanoramaCache.Reset();
+		}
+		AddGpuTimestamp(GraphBuilder);
+
+		PanoramaCache.SetupParameters(GraphBuilder, FamilyState.Panorama);
+	}
+
+	// Every view after the first would have repeated the shared march setup, and only that.
+	INC_DWORD_STAT(STAT_CloudsSharedFamilySetups);
+	INC_FLOAT_STAT_BY(STAT_CloudsFamilySetupSavedMs, SharedSetupMs * (NumViews - 1));
+	CSV_CUSTOM_STAT(Clouds, FamilySetupSavedMs, SharedSetupMs * (NumViews - 1), ECsvCustomStatOp::Accumulate);
+}
+
+// ================================================================================================
+
 void FCloudSceneViewExtension::PreRenderView_RenderThread(FRDGBuilder& GraphBuilder, FSceneView& InView)
 {
+	LLM_SCOPE_BYTAG(Clouds);
+
+	FCloudViewState& State = ViewStates.Add(&InView);
+
+	const bool bPanorama = FamilyState.Panorama.CloudPanoramaEnabled != 0;
+
+	// Captures only composite the panorama, so they never march the clouds.
+	const bool bPanoramaOnly = bPanorama
+		&& CVarCloudsPanoramaCaptures.GetValueOnRenderThread() != 0
+		&& (InView.bIsSceneCapture || InView.bIsPlanarReflection || InView.bIsReflectionCapture);
+
+	if (!bPanoramaOnly)
+	{
+		SCOPE_CYCLE_COUNTER(STAT_CloudsVolumeCulling);
+		CullVolumes(CloudVolumes, InView.ViewFrustum, InView.ViewMatrices.GetViewOrigin(), bPanorama ? FamilyState.Panorama.CloudPanoramaNearDistance : 0.0f, State.VisibleVolumes);
+		INC_DWORD_STAT_BY(STAT_CloudsVisibleVolumes, State.VisibleVolumes.Num());
+	}
+
+	// The clouds are rendered after the tonemapper, which runs at the secondary view rect.
+	if (State.VisibleVolumes.Num() > 0 || bPanorama)
+	{
+		SetupViewState(GraphBuilder, InView, static_cast<const FViewInfo&>(InView).GetSecondaryViewRectSize(), State);
+	}
+}
+
+void FCloudSceneViewExtension::CullVolumes(FCloudVolumeRegistry& Registry, const FConvexVolume& Frustum, const FVector& CameraOrigin, float PanoramaNearDistance, TArray<uint32>& OutVisible)
+{
+	OutVisible.Reset();
+	Registry.Cull(Frustum, OutVisible);
+
+	// Volumes entirely beyond the near distance are covered by the panorama.
+	if (PanoramaNearDistance > 0.0f)
+	{
+		TConstArrayView<FCloudVolume> Volumes = Registry.GetVolumes();
+		const FVector3f Origin(CameraOrigin);
+		const float NearDistanceSquared = FMath::Square(PanoramaNearDistance);
+		OutVisible.RemoveAllSwap([&Volumes, &Origin, NearDistanceSquared](uint32 Index)
+		{
+			return FBox3f(Volumes[Index].BoundsMin, Volumes[Index].BoundsMax).ComputeSquaredDistanceToPoint(Origin) > NearDistanceSquared;
+		});
+	}
+}
+
+void FCloudSceneViewExtension::SetupViewState(FRDGBuilder& GraphBuilder, const FSceneView& View, const FIntPoint& ViewSize, FCloudViewState& State)
+{
+	// Views without a persistent state (e.g. scene captures) have a key of 0 and get no history.
+	const uint32 ViewKey = View.GetViewKey();
+	State.HistoryKey = CVarCloudsTemporalReprojection.GetValueOnRenderThread() != 0 ? ViewKey : 0;
+	State.FrameIndex = 0;
+	if (State.HistoryKey != 0)
+	{
+		FCloudViewHistory& History = ViewHistories.FindOrAdd(ViewKey);
+		History.LastUsedFrame = GFrameCounterRenderThread;
+		State.FrameIndex = History.FrameIndex++;
+	}
+
+	CreateViewUniformBuffer(GraphBuilder, View, ViewSize, State);
+}
+
+void FCloudSceneViewExtension::CreateViewUniformBuffer(FRDGBuilder& GraphBuilder, const FSceneView& View, const FIntPoint& ViewSize, FCloudViewState& State)
+{
+	const uint32 Divisor = FamilyState.ResolutionDivisor;
+	const FIntPoint LowResSize = FIntPoint::DivideAndRoundUp(ViewSize, int32(Divisor));
+	const FMatrix WorldToClip = View.ViewMatrices.GetViewProjectionMatrix();
+
+	const FCloudViewHistory* History = ViewHistories.Find(State.HistoryKey);
+	State.bHistoryValid = History
+		&& History->Texture.IsValid()
+		&& History->Texture->GetDesc().Extent == ViewSize
+		&& History->ResolutionDivisor == Divisor;
+
+	FCloudViewUniformParameters* Parameters = GraphBuilder.AllocParameters<FCloudViewUniformParameters>();
+	Parameters->WorldToClip = FMatrix44f(WorldToClip);
+	Parameters->ClipToWorld = FMatrix44f(WorldToClip.Inverse());
+	Parameters->PrevWorldToClip = State.bHistoryValid ? History->WorldToClip : FMatrix44f(WorldToClip);
+	Parameters->CameraOrigin = FVector3f(View.ViewMatrices.GetViewOrigin());
+	Parameters->ViewSize = FVector2f(ViewSize);
+	Parameters->LowResSize = FUintVector2(LowResSize.X, LowResSize.Y);
+	Parameters->SampleOffset = GetCloudSampleOffset(State.FrameIndex, Divisor);
+	Parameters->ResolutionDivisor = Divisor;
+	Parameters->FrameIndex = State.FrameIndex;
+	Parameters->bHistoryValid = State.bHistoryValid ? 1 : 0;
+
+	State.GraphBuilder = &GraphBuilder;
+	State.UniformBuffer = GraphBuilder.CreateUniformBuffer(Parameters);
+	State.ViewSize = ViewSize;
+}
+
+uint64 FCloudSceneViewExtension::FCloudViewHistory::GetGpuMemorySize() const
+{
+	return GetCloudPooledTargetSize(Texture) + GetCloudPooledTargetSize(NextTexture);
+}
+
+void FCloudSceneViewExtension::ReleaseIdleViewHistories()
+{
+	const uint64 IdleFrames = uint64(FMath::Max(CVarCloudsViewStateIdleFrames.GetValueOnRenderThread(), 1));
+
+	uint64 HistoryMemory = 0;
+	for (auto It = ViewHistories.CreateIterator(); It; ++It)
+	{
+		if (GFrameCounterRenderThread - It.Value().LastUsedFrame > IdleFrames)
+		{
+			It.RemoveCurrent();
+			continue;
+		}
+		HistoryMemory += It.Value().GetGpuMemorySize();
+	}
+
+	SET_MEMORY_STAT(STAT_CloudsViewHistoryMemory, HistoryMemory);
+	SET_MEMORY_STAT(STAT_CloudsLightingMemory, LightingCache.GetGpuMemorySize());
+	SET_MEMORY_STAT(STAT_CloudsPanoramaMemory, PanoramaCache.GetGpuMemorySize());
+	SET_DWORD_STAT(STAT_CloudsViewHistories, ViewHistories.Num());
 }
 
 // ================================================================================================
@@ -53,51 +1023,392 @@ void FCloudSceneViewExtension::SubscribeToPostProcessingPass(EPostProcessingPass
 
 FScreenPassTexture FCloudSceneViewExtension::TrianglePass_RenderThread(FRDGBuilder& GraphBuilder, const FSceneView& View, const FPostProcessMaterialInputs& InOutInputs)
 {
+	SCOPE_CYCLE_COUNTER(STAT_CloudsPostProcessPass);
+	CSV_SCOPED_TIMING_STAT(Clouds, PostProcessPass);
+	LLM_SCOPE_BYTAG(Clouds);
+
 	FScreenPassTexture SceneColor(InOutInputs.GetInput(EPostProcessMaterialInput::SceneColor));
 
-	FScreenPassRenderTarget Output = InOutInputs.OverrideOutput;
+	FCloudViewState* ViewState = ViewStates.Find(&View);
+
+	// Families that skipped PreRenderViewFamily_RenderThread, or were rendered with another graph,
+	// set up their shared state with their first view.
+	if (NoiseTextures.IsValid() && FamilyState.GraphBuilder != &GraphBuilder)
+	{
+		SetupFamilyState(
+			GraphBuilder,
+			static_cast<const FViewInfo&>(View).ShaderMap,
+			View.ViewMatrices.GetViewOrigin(),
+			View.Family ? View.Family->Views.Num() : 1,
+			View.Family ? View.Family->FrameNumber : 0);
+	}
 
-	// If the override output is provided, it means that this is the last pass in post processing.
-	// You need to do this since we cannot read from SceneColor and write to it (At least it's not supported by UE)
-	// OverrideOutput is also required to use so the Pass Sequence in PostProcessing.cpp knows this is the last pass so we don't get a bad texture from Scene Color on the next frame.
+	const bool bHasClouds = ViewState && (ViewState->VisibleVolumes.Num() > 0 || FamilyState.Panorama.CloudPanoramaEnabled != 0);
 
-	if (!Output.IsValid())
+	if (NoiseTextures.IsValid() && bHasClouds && EnumHasAllFlags(SceneColor.Texture->Desc.Flags, TexCreate_ShaderResource))
 	{
-		Output = FScreenPassRenderTarget::CreateFromInput(GraphBuilder, SceneColor, View.GetOverwriteLoadAction(), TEXT("OverrideSceneColorTexture"));
+		// Rebuilt only if the view rect differs from the one predicted in PreRenderView_RenderThread,
+		// or the state was set up with another graph.
+		if (ViewState->GraphBuilder != &GraphBuilder || ViewState->ViewSize != SceneColor.ViewRect.Size())
+		{
+			CreateViewUniformBuffer(GraphBuilder, View, SceneColor.ViewRect.Size(), *ViewState);
+		}
+
+		if (CVarCloudsDebug.GetValueOnRenderThread() > 0)
+		{
+			const TArray<uint32>& VisibleVolumes = ViewState->VisibleVolumes;
+
+			UE_LOG(LogClouds, Log, TEXT("View %u: rect %s, %d of %d cloud volumes visible, setup shared by %d views, settings of frame %llu"),
+				View.GetViewKey(), *SceneColor.ViewRect.ToString(), VisibleVolumes.Num(), CloudVolumes.Num(), FamilyState.NumViews, FamilyState.Snapshot.FrameNumber);
+			UE_LOG(LogClouds, Log, TEXT("  World to view: %s"), *View.ViewMatrices.GetViewMatrix().ToString());
+			UE_LOG(LogClouds, Log, TEXT("  View to proj: %s"), *View.ViewMatrices.GetProjectionMatrix().ToString());
+			const FCloudWeatherCacheStats& WeatherStats = WeatherClipmap.GetCache().GetStats();
+			UE_LOG(LogClouds, Log, TEXT("  Weather tile cache: %d resident, %llu hits, %llu misses, %llu evictions"),
+				WeatherStats.ResidentTiles, WeatherStats.Hits, WeatherStats.Misses, WeatherStats.Evictions);
+			UE_LOG(LogClouds, Log, TEXT("  Panorama: %s, near distance %.0f, %u bakes"),
+				PanoramaCache.IsValid() ? TEXT("valid") : TEXT("pending"), PanoramaCache.GetNearDistance(), PanoramaCache.GetNumBakes());
+			TArray<FCloudBrickVolumeStats> BrickStats;
+			BrickPool.GetVolumeStats(BrickStats);
+			for (const FCloudBrickVolumeStats& Stats : BrickStats)
+			{
+				UE_LOG(LogClouds, Log, TEXT("  Brick volume %u: %s voxels, %d bricks, %d empty, %d resident, %lld KB resident, %lld KB file, %lld KB dense"),
+					Stats.Id, *Stats.Resolution.ToString(), Stats.NumBricks, Stats.GetNumEmptyBricks(), Stats.NumResidentBricks,
+					Stats.ResidentBytes / 1024, Stats.FileBytes / 1024, Stats.DenseBytes / 1024);
+			}
+			if (BrickStats.Num() > 0)
+			{
+				UE_LOG(LogClouds, Log, TEXT("  Brick pool: %lld KB"), BrickPool.GetPoolBytes() / 1024);
+			}
+			if (VisibleVolumes.Num() > 0)
+			{
+				const FMatrix WorldToProjMatrix = View.ViewMatrices.GetViewProjectionMatrix();
+				const FVector4 CloudCenter(FVector(CloudVolumes.GetVolumes()[VisibleVolumes[0]].GetCenter()), 1.0);
+				const FVector4 ClipCenter = WorldToProjMatrix.TransformFVector4(CloudCenter);
+				UE_LOG(LogClouds, Log, TEXT("  First cloud center clip: %s ndc: %s"), *ClipCenter.ToString(), *(FVector(ClipCenter) / ClipCenter.W).ToString());
+			}
+		}
+
+		// If the override output is provided, this is the last pass in post processing and must write
+		// to it, so the pass sequence in PostProcessing.cpp does not read a stale scene color next frame.
+		// Scene color cannot be read and written by the same pass, so the composite always writes to
+		// a separate output.
+		FScreenPassRenderTarget Output = InOutInputs.OverrideOutput;
+		if (!Output.IsValid())
+		{
+			Output = FScreenPassRenderTarget::CreateFromInput(GraphBuilder, SceneColor, View.GetOverwriteLoadAction(), TEXT("Clouds.SceneColor"));
+		}
+
+		const FCloudSceneDepthParameters SceneDepth = GetCloudSceneDepthParameters(GraphBuilder, View, InOutInputs, SceneColor.ViewRect.Size());
+		RenderClouds(GraphBuilder, View, *ViewState, SceneColor, Output, SceneDepth);
+
+		return MoveTemp(Output);
 	}
 
-	if (EnumHasAllFlags(SceneColor.Texture->Desc.Flags, TexCreate_ShaderResource) && EnumHasAnyFlags(SceneColor.Texture->Desc.Flags, TexCreate_RenderTargetable | TexCreate_ResolveTargetable))
+	if (InOutInputs.OverrideOutput.IsValid())
 	{
-		const FIntRect ViewInfo = static_cast<const FViewInfo&>(View).ViewRect;
-		const FGlobalShaderMap* ViewShaderMap = static_cast<const FViewInfo&>(View).ShaderMap;
+		AddCloudPasses([&]
+		{
+			AddDrawTexturePass(GraphBuilder, static_cast<const FViewInfo&>(View), SceneColor, InOutInputs.OverrideOutput);
+		});
+		return InOutInputs.OverrideOutput;
+	}
+	return MoveTemp(SceneColor);
+}
 
-		FMatrix WorldToViewMatrix = View.ViewMatrices.GetViewMatrix();
-		FMatrix ViewToProjMatrix = View.ViewMatrices.GetProjectionMatrix();
-		FMatrix WorldToProjMatrix = WorldToViewMatrix * ViewToProjMatrix;
+// ================================================================================================
 
-		FVector4 v = WorldToViewMatrix.TransformFVector4(FVector4(3000.0, -1000.0, 70.0, 1.0));
-		FVector4 p3 = ViewToProjMatrix.TransformFVector4(v);
-		FVector p4(p3[0] / p3[3], p3[1] / p3[3], p3[2] / p3[3]);
+void FCloudSceneViewExtension::AddGpuTimestamp(FRDGBuilder& GraphBuilder)
+{
+	if (PendingGpuTimings.Num() == 0)
+	{
+		return;
+	}
+
+	AddCloudPasses([&]
+	{
+		if (!TimerQueryPool.IsValid())
+		{
+			TimerQueryPool = RHICreateRenderQueryPool(RQT_AbsoluteTime);
+		}
+
+		FRHIRenderQuery* Query = PendingGpuTimings.Last().Queries.Add_GetRef(TimerQueryPool->AllocateQuery()).GetQuery();
+		GraphBuilder.AddPass(
+			RDG_EVENT_NAME("CloudTimestamp"),
+			ERDGPassFlags::NeverCull,
+			[Query](FRHICommandListImmediate& RHICmdList)
+			{
+				RHICmdList.EndRenderQuery(Query);
+			});
+	});
+}
+
+void FCloudSceneViewExtension::ReadGpuTimings()
+{
+	// Timestamps usually arrive a frame or two later. Give up on frames that take too long, so a
+	// stalled readback cannot grow the queue.
+	static constexpr int32 MaxPendingTimings = 5;
+
+	// The timing of the current frame is still being recorded by its families.
+	while (PendingGpuTimings.Num() > 0 && PendingGpuTimings[0].Frame != GFrameCounterRenderThread)
+	{
+		const TArray<FRHIPooledRenderQuery>& Queries = PendingGpuTimings[0].Queries;
+
+		uint64 TotalMicroseconds = 0;
+		bool bReady = true;
+		for (int32 Index = 0; Index + 1 < Queries.Num(); Index += 2)
+		{
+			uint64 Begin = 0;
+			uint64 End = 0;
+			if (!RHIGetRenderQueryResult(Queries[Index].GetQuery(), Begin, false) || !RHIGetRenderQueryResult(Queries[Index + 1].GetQuery(), End, false))
+			{
+				bReady = false;
+				break;
+			}
+			TotalMicroseconds += End > Begin ? End - Begin : 0;
+		}
 
-		FVector4 p = WorldToProjMatrix.TransformFVector4(FVector4(3000.0, -1000.0, 70.0, 1.0));
-		FVector p2(p[0] / p[3], p[1] / p[3], p[2] / p[3]);
+		if (!bReady && PendingGpuTimings.Num() <= MaxPendingTimings)
+		{
+			break;
+		}
 
-		UE_LOG(LogTemp, Warning, TEXT("View to proj Matrix: %s"), *ViewToProjMatrix.ToString());
-		UE_LOG(LogTemp, Warning, TEXT("World to view: %s"), *WorldToViewMatrix.ToString());
+		// Frames that rendered no clouds say nothing about their cost.
+		if (bReady && PendingGpuTimings[0].bRenderedClouds)
+		{
+			const float GpuMs = float(TotalMicroseconds) / 1000.0f;
+			BudgetController.AddFrameTime(GpuMs);
 
-		UE_LOG(LogTemp, Warning, TEXT("P: %s"), *p.ToString());
-		UE_LOG(LogTemp, Warning, TEXT("P3: %s"), *p3.ToString());
+			INC_FLOAT_STAT_BY(STAT_CloudsMeasuredGpuMs, GpuMs);
+			CSV_CUSTOM_STAT(Clouds, MeasuredGpuMs, GpuMs, ECsvCustomStatOp::Set);
+		}
 
-		UE_LOG(LogTemp, Warning, TEXT("P2: %s"), *p2.ToString());
-		UE_LOG(LogTemp, Warning, TEXT("P4: %s"), *p4.ToString());
+		PendingGpuTimings.RemoveAt(0);
+	}
+}
 
-		UE_LOG(LogTemp, Warning, TEXT("V: %s"), *v.ToString());
-		UE_LOG(LogTemp, Warning, TEXT("==="));
+// ================================================================================================
 
-		RenderTriangle(GraphBuilder, ViewShaderMap, ViewInfo, SceneColor, WorldToProjMatrix);
+FRDGTextureRef FCloudSceneViewExtension::GetOrBuildOccupancyTexture(FRDGBuilder& GraphBuilder, const FGlobalShaderMap* ShaderMap)
+{
+	if (NoiseTextures.OccupancyTexture.IsValid())
+	{
+		return GraphBuilder.RegisterExternalTexture(NoiseTextures.OccupancyTexture);
 	}
 
-	return MoveTemp(SceneColor);
+	// The shape noise is static, so the pyramid is built once and kept for every later frame.
+	const int32 Resolution = NoiseTextures.ShapeTexture->GetSizeX();
+	const int32 NumMips = FMath::FloorLog2(Resolution) + 1;
+
+	FRDGTextureRef OccupancyTexture = GraphBuilder.CreateTexture(
+		FRDGTextureDesc::Create3D(FIntVector(Resolution), PF_G16R16F, FClearValueBinding::None, TexCreate_ShaderResource | TexCreate_UAV, NumMips),
+		TEXT("Clouds.Occupancy"));
+
+	// Kept for later frames only once the passes that build it were added.
+	AddCloudPasses([&]
+	{
+		RDG_EVENT_SCOPE(GraphBuilder, "CloudOccupancy");
+
+		{
+			FCloudOccupancyInitCS::FParameters* PassParameters = GraphBuilder.AllocParameters<FCloudOccupancyInitCS::FParameters>();
+			PassParameters->CloudShapeNoiseTexture = NoiseTextures.ShapeTexture;
+			PassParameters->OccupancyResolution = Resolution;
+			PassParameters->OccupancyOutput = GraphBuilder.CreateUAV(FRDGTextureUAVDesc(OccupancyTexture, 0));
+
+			TShaderMapRef<FCloudOccupancyInitCS> ComputeShader(ShaderMap);
+			FComputeShaderUtils::AddPass(
+				GraphBuilder,
+				RDG_EVENT_NAME("CloudOccupancyInit %d^3", Resolution),
+				ComputeShader,
+				PassParameters,
+				FComputeShaderUtils::GetGroupCount(FIntVector(Resolution), FCloudOccupancyInitCS::ThreadGroupSize));
+		}
+
+		for (int32 Mip = 1; Mip < NumMips; ++Mip)
+		{
+			const int32 MipResolution = FMath::Max(Resolution >> Mip, 1);
+
+			FCloudOccupancyDownsampleCS::FParameters* PassParameters = GraphBuilder.AllocParameters<FCloudOccupancyDownsampleCS::FParameters>();
+			PassParameters->OccupancyParentMip = GraphBuilder.CreateSRV(FRDGTextureSRVDesc::CreateForMipLevel(OccupancyTexture, Mip - 1));
+			PassParameters->OccupancyResolution = MipResolution;
+			PassParameters->OccupancyOutput = GraphBuilder.CreateUAV(FRDGTextureUAVDesc(OccupancyTexture, Mip));
+
+			TShaderMapRef<FCloudOccupancyDownsampleCS> ComputeShader(ShaderMap);
+			FComputeShaderUtils::AddPass(
+				GraphBuilder,
+				RDG_EVENT_NAME("CloudOccupancyDownsample %d^3", MipResolution),
+				ComputeShader,
+				PassParameters,
+				FComputeShaderUtils::GetGroupCount(FIntVector(MipResolution), FCloudOccupancyDownsampleCS::ThreadGroupSize));
+		}
+
+		GraphBuilder.QueueTextureExtraction(OccupancyTexture, &NoiseTextures.OccupancyTexture);
+	});
+	return OccupancyTexture;
+}
+
+// ================================================================================================
+
+void FCloudSceneViewExtension::RenderClouds(FRDGBuilder& GraphBuilder, const FSceneView& View, const FCloudViewState& ViewState, const FScreenPassTexture& SceneColor, const FScreenPassRenderTarget& Output, const FCloudSceneDepthParameters& SceneDepth)
+{
+	SCOPE_CYCLE_COUNTER(STAT_CloudsPassSetup);
+	RDG_EVENT_SCOPE(GraphBuilder, "Clouds");
+	RDG_GPU_STAT_SCOPE(GraphBuilder, Clouds);
+	AddGpuTimestamp(GraphBuilder);
+	if (PendingGpuTimings.Num() > 0)
+	{
+		PendingGpuTimings.Last().bRenderedClouds = true;
+	}
+
+	const FGlobalShaderMap* ShaderMap = static_cast<const FViewInfo&>(View).ShaderMap;
+	const FIntRect ViewRect = SceneColor.ViewRect;
+	const FIntPoint ViewSize = ViewRect.Size();
+
+	FCloudViewHistory* History = ViewHistories.Find(ViewState.HistoryKey);
+
+	INC_DWORD_STAT(STAT_CloudsViews);
+
+	// Without near volumes only the panorama is composited. The history would go stale meanwhile.
+	const bool bNearClouds = ViewState.VisibleVolumes.Num() > 0;
+	FRDGTextureRef NewHistory = nullptr;
+	if (bNearClouds)
+	{
+		NewHistory = RenderNearClouds(GraphBuilder, View, ViewState, ViewSize, SceneDepth);
+	}
+	else if (History)
+	{
+		History->Texture.SafeRelease();
+	}
+
+	// Output = Near.Luminance + (Far.Luminance + SceneColor * Far.Transmittance) * Near.Transmittance
+	{
+		FCloudCompositePS::FParameters* PassParameters = GraphBuilder.AllocParameters<FCloudCompositePS::FParameters>();
+		PassParameters->HistoryTexture = bNearClouds ? NewHistory : GSystemTextures.GetBlackDummy(GraphBuilder);
+		PassParameters->SceneColorTexture = SceneColor.Texture;
+		PassParameters->SceneDepth = SceneDepth;
+		PassParameters->Panorama = FamilyState.Panorama;
+		PassParameters->CloudView = ViewState.UniformBuffer;
+		PassParameters->SceneColorViewRectMin = ViewRect.Min;
+		PassParameters->OutputViewRectMin = Output.ViewRect.Min;
+		PassParameters->bNearClouds = bNearClouds ? 1 : 0;
+		PassParameters->RenderTargets[0] = Output.GetRenderTargetBinding();
+
+		AddCloudPasses([&]
+		{
+			TShaderMapRef<FCloudCompositePS> PixelShader(ShaderMap);
+			FPixelShaderUtils::AddFullscreenPass(
+				GraphBuilder,
+				ShaderMap,
+				RDG_EVENT_NAME("CloudComposite"),
+				PixelShader,
+				PassParameters,
+				Output.ViewRect);
+		});
+	}
+
+	AddGpuTimestamp(GraphBuilder);
+}
+
+FRDGTextureRef FCloudSceneViewExtension::RenderNearClouds(FRDGBuilder& GraphBuilder, const FSceneView& View, const FCloudViewState& ViewState, const FIntPoint& ViewSize, const FCloudSceneDepthParameters& SceneDepth)
+{
+	const FGlobalShaderMap* ShaderMap = static_cast<const FViewInfo&>(View).ShaderMap;
+
+	const uint32 Divisor = FamilyState.ResolutionDivisor;
+	const FIntPoint LowResSize = FIntPoint::DivideAndRoundUp(ViewSize, int32(Divisor));
+
+	FCloudViewHistory* History = ViewHistories.Find(ViewState.HistoryKey);
+
+	INC_DWORD_STAT_BY(STAT_CloudsMarchedPixels, LowResSize.X * LowResSize.Y);
+	CSV_CUSTOM_STAT(Clouds, MarchedPixels, LowResSize.X * LowResSize.Y, ECsvCustomStatOp::Accumulate);
+
+	const FMatrix WorldToClip = View.ViewMatrices.GetViewProjectionMatrix();
+	const FVector3f CameraOrigin(View.ViewMatrices.GetViewOrigin());
+
+	// Reduced resolution march.
+	const bool bTiles = CVarCloudsTileClassification.GetValueOnRenderThread() != 0;
+	const ETextureCreateFlags TargetFlags = bTiles ? TexCreate_ShaderResource | TexCreate_UAV : TexCreate_RenderTargetable | TexCreate_ShaderResource;
+	FRDGTextureRef CloudColor = GraphBuilder.CreateTexture(
+		FRDGTextureDesc::Create2D(LowResSize, CloudColorFormat, FClearValueBinding::Black, TargetFlags),
+		TEXT("Clouds.LowResColor"));
+	FRDGTextureRef CloudDepth = GraphBuilder.CreateTexture(
+		FRDGTextureDesc::Create2D(LowResSize, CloudDepthFormat, FClearValueBinding::Black, TargetFlags),
+		TEXT("Clouds.LowResDepth"));
+
+	// Visible volumes are blended back to front, ordered by the distance of their centers to the camera.
+	TConstArrayView<FCloudVolume> Volumes = CloudVolumes.GetVolumes();
+	TArray<uint32> DrawList(ViewState.VisibleVolumes);
+	DrawList.Sort([&Volumes, &CameraOrigin](uint32 A, uint32 B)
+	{
+		return FVector3f::DistSquared(Volumes[A].GetCenter(), CameraOrigin) > FVector3f::DistSquared(Volumes[B].GetCenter(), CameraOrigin);
+	});
+	FRDGBufferRef DrawListBuffer = CreateStructuredBuffer(GraphBuilder, TEXT("Clouds.DrawList"), DrawList);
+
+	FCloudPSParams MarchParams;
+	MarchParams.March = FamilyState.March;
+	MarchParams.SceneDepth = SceneDepth;
+	MarchParams.Panorama = FamilyState.Panorama;
+	MarchParams.CloudView = ViewState.UniformBuffer;
+
+	AddCloudPasses([&]
+	{
+		if (bTiles)
+		{
+			RenderTiles(GraphBuilder, ShaderMap, LowResSize, CloudColor, CloudDepth, GraphBuilder.CreateSRV(DrawListBuffer), DrawList.Num(), FamilyState.MarchPermutation, MarchParams);
+		}
+		else
+		{
+			RenderTriangle(GraphBuilder, ShaderMap, LowResSize, CloudColor, CloudDepth, GraphBuilder.CreateSRV(DrawListBuffer), DrawList.Num(), FamilyState.MarchPermutation, MarchParams);
+		}
+	});
+
+	// Temporal reconstruction at full resolution. Views with a history alternate between two targets
+	// they own, so the pool does not hand out a new pair every frame; others only need it for this frame.
+	const FRDGTextureDesc HistoryDesc = FRDGTextureDesc::Create2D(ViewSize, PF_FloatRGBA, FClearValueBinding::Black, TexCreate_ShaderResource | TexCreate_UAV);
+	FRDGTextureRef NewHistory = nullptr;
+	if (History && History->NextTexture.IsValid() && History->NextTexture->GetDesc().Extent == ViewSize)
+	{
+		NewHistory = GraphBuilder.RegisterExternalTexture(History->NextTexture);
+	}
+	else
+	{
+		NewHistory = GraphBuilder.CreateTexture(HistoryDesc, TEXT("Clouds.History"));
+		if (History)
+		{
+			History->NextTexture = GraphBuilder.ConvertToExternalTexture(NewHistory);
+		}
+	}
+
+	{
+		FCloudReprojectCS::FParameters* PassParameters = GraphBuilder.AllocParameters<FCloudReprojectCS::FParameters>();
+		PassParameters->CloudColorTexture = CloudColor;
+		PassParameters->CloudDepthTexture = CloudDepth;
+		PassParameters->HistoryTexture = ViewState.bHistoryValid ? GraphBuilder.RegisterExternalTexture(History->Texture) : GSystemTextures.GetBlackDummy(GraphBuilder);
+		PassParameters->SceneDepth = SceneDepth;
+		PassParameters->LinearClampSampler = TStaticSamplerState<SF_Bilinear, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+		PassParameters->CloudView = ViewState.UniformBuffer;
+		PassParameters->HistoryWeight = FMath::Clamp(CVarCloudsHistoryWeight.GetValueOnRenderThread(), 0.0f, 1.0f);
+		PassParameters->UpsampleDepthTolerance = FMath::Max(CVarCloudsUpsampleDepthTolerance.GetValueOnRenderThread(), 1e-3f);
+		PassParameters->HistoryOutput = GraphBuilder.CreateUAV(NewHistory);
+
+		AddCloudPasses([&]
+		{
+			TShaderMapRef<FCloudReprojectCS> ComputeShader(ShaderMap);
+			FComputeShaderUtils::AddPass(
+				GraphBuilder,
+				RDG_EVENT_NAME("CloudReprojection %dx%d", ViewSize.X, ViewSize.Y),
+				ComputeShader,
+				PassParameters,
+				FComputeShaderUtils::GetGroupCount(ViewSize, FCloudReprojectCS::ThreadGroupSize));
+		});
+	}
+
+	if (History)
+	{
+		Swap(History->Texture, History->NextTexture);
+		History->WorldToClip = FMatrix44f(WorldToClip);
+		History->ResolutionDivisor = Divisor;
+	}
+
+	return NewHistory;
 }
 
 // ================================================================================================
@@ -106,55 +1417,43 @@ void FCloudSceneViewExtension::RenderTriangle
 (
 	FRDGBuilder& GraphBuilder,
 	const FGlobalShaderMap* ShaderMap,
-	const FIntRect& ViewInfo,
-	const FScreenPassTexture& InSceneColor,
-	const FMatrix& WorldProjMatrix)
+	const FIntPoint& LowResSize,
+	FRDGTextureRef CloudColor,
+	FRDGTextureRef CloudDepth,
+	FRDGBufferSRVRef DrawList,
+	uint32 NumInstances,
+	const FCloudPS::FPermutationDomain& Permutation,
+	const FCloudPSParams& MarchParams)
 {
 	// Shader Parameter Setup
-	FCloudPSParams* PassParams = GraphBuilder.AllocParameters<FCloudPSParams>();
-	PassParams->RenderTargets[0] = FRenderTargetBinding(InSceneColor.Texture, ERenderTargetLoadAction::ELoad);
-	float GameTime = FApp::GetGameTime();
-	PassParams->Offset = FVector4f(GameTime, GameTime * 1.34, GameTime * 0.47, 0.0);
-
-	FCloudVSParams* VertexShaderParams = GraphBuilder.AllocParameters<FCloudVSParams>();
-	VertexShaderParams->Transform = FMatrix44f(WorldProjMatrix);
-
-	// Create Pixel Shader
-	TShaderMapRef<FCloudPS> PixelShader(ShaderMap);
+	FCloudMarchPassParams* PassParams = GraphBuilder.AllocParameters<FCloudMarchPassParams>();
+	PassParams->PS = MarchParams;
+	PassParams->VS.CloudView = MarchParams.CloudView;
+	PassParams->VS.CloudInstances = MarchParams.March.CloudInstances;
+	PassParams->VS.CloudDrawList = DrawList;
+	PassParams->RenderTargets[0] = FRenderTargetBinding(CloudColor, ERenderTargetLoadAction::EClear);
+	PassParams->RenderTargets[1] = FRenderTargetBinding(CloudDepth, ERenderTargetLoadAction::EClear);
 
+	TShaderMapRef<FCloudVS> VertexShader(ShaderMap);
+	TShaderMapRef<FCloudPS> PixelShader(ShaderMap, Permutation);
 	check(PixelShader.IsValid());
-	ClearUnusedGraphResources(PixelShader, PassParams);
+
+	FGraphicsPipelineStateInitializer GraphicsPSOInit;
+	GetMarchPipelineState(ShaderMap, Permutation, GraphicsPSOInit);
 
 	GraphBuilder.AddPass(
-		Forward<FRDGEventName>(RDG_EVENT_NAME("CloudPass")),
+		Forward<FRDGEventName>(RDG_EVENT_NAME("CloudMarch %dx%d %u volumes", LowResSize.X, LowResSize.Y, NumInstances)),
 		PassParams,
 		ERDGPassFlags::Raster,
-		[VertexShaderParams, PassParams, ShaderMap, PixelShader, ViewInfo](FRHICommandList& RHICmdList)
+		[PassParams, VertexShader, PixelShader, GraphicsPSOInit, LowResSize, NumInstances](FRHICommandList& RHICmdList) mutable
 		{
-			RHICmdList.SetViewport((float)ViewInfo.Min.X, (float)ViewInfo.Min.Y, 0.0f, (float)ViewInfo.Max.X, (float)ViewInfo.Max.Y, 1.0f);
-
-			FGraphicsPipelineStateInitializer GraphicsPSOInit;
-
-			TShaderMapRef<FCloudVS> VertexShader(ShaderMap);
+			RHICmdList.SetViewport(0.0f, 0.0f, 0.0f, (float)LowResSize.X, (float)LowResSize.Y, 1.0f);
 
 			RHICmdList.ApplyCachedRenderTargets(GraphicsPSOInit);
-			GraphicsPSOInit.BlendState = TStaticBlendState<>::GetRHI();
-			GraphicsPSOInit.RasterizerState = TStaticRasterizerState<>::GetRHI();
-			GraphicsPSOInit.DepthStencilState = TStaticDepthStencilState<false, CF_Always>::GetRHI();
-
-			GraphicsPSOInit.BoundShaderState.VertexDeclarationRHI = GCloudVertexDeclaration.VertexDeclarationRHI;
-			GraphicsPSOInit.BoundShaderState.VertexShaderRHI = VertexShader.GetVertexShader();
-			GraphicsPSOInit.BoundShaderState.PixelShaderRHI = PixelShader.GetPixelShader();
-			GraphicsPSOInit.PrimitiveType = PT_TriangleList;
-
-			//GraphicsPSOInit.BlendState = BlendState ? BlendState : GraphicsPSOInit.BlendState;
-			//GraphicsPSOInit.RasterizerState = RasterizerState ? RasterizerState : GraphicsPSOInit.RasterizerState;
-			//GraphicsPSOInit.DepthStencilState = DepthStencilState ? DepthStencilState : GraphicsPSOInit.DepthStencilState;
-
 			SetGraphicsPipelineState(RHICmdList, GraphicsPSOInit, 0);
 
-			SetShaderParameters(RHICmdList, PixelShader, PixelShader.GetPixelShader(), *PassParams);
-			SetShaderParameters(RHICmdList, VertexShader, VertexShader.GetVertexShader(), *VertexShaderParams);
+			SetShaderParameters(RHICmdList, PixelShader, PixelShader.GetPixelShader(), PassParams->PS);
+			SetShaderParameters(RHICmdList, VertexShader, VertexShader.GetVertexShader(), PassParams->VS);
 
 			RHICmdList.SetStreamSource(0, GCloudVertexBuffer.VertexBufferRHI, 0);
 
@@ -165,7 +1464,162 @@ void FCloudSceneViewExtension::RenderTriangle
 				/*NumVertices=*/ 8,
 				/*StartIndex=*/ 0,
 				/*NumPrimitives=*/ 12,
-				/*NumInstances=*/ 1);
+				/*NumInstances=*/ NumInstances);
 
 		});
 }
+
+// ================================================================================================
+
+void FCloudSceneViewExtension::RenderTiles
+(
+	FRDGBuilder& GraphBuilder,
+	const FGlobalShaderMap* ShaderMap,
+	const FIntPoint& LowResSize,
+	FRDGTextureRef CloudColor,
+	FRDGTextureRef CloudDepth,
+	FRDGBufferSRVRef DrawList,
+	uint32 NumInstances,
+	const FCloudPS::FPermutationDomain& Permutation,
+	const FCloudPSParams& MarchParams)
+{
+	const FIntPoint NumTiles = FIntPoint::DivideAndRoundUp(LowResSize, FCloudTileClassifyCS::ThreadGroupSize);
+	const uint32 NumTilesTotal = uint32(NumTiles.X * NumTiles.Y);
+
+	// Pixels of tiles that are not marched keep the values of an empty march: nothing in front of full transmittance.
+	AddClearUAVPass(GraphBuilder, GraphBuilder.CreateUAV(CloudColor), FLinearColor(0.0f, 0.0f, 0.0f, 1.0f));
+	AddClearUAVPass(GraphBuilder, GraphBuilder.CreateUAV(CloudDepth), 0.0f);
+
+	// (NumTiles, 1, 1) per marched class, counted up by the classification.
+	static const uint32 InitialArgs[CloudNumMarchedTileClasses * 3] = { 0, 1, 1, 0, 1, 1 };
+	FRDGBufferRef IndirectArgs = GraphBuilder.CreateBuffer(FRDGBufferDesc::CreateIndirectDesc<FRHIDispatchIndirectParameters>(CloudNumMarchedTileClasses), TEXT("Clouds.TileIndirectArgs"));
+	GraphBuilder.QueueBufferUpload(IndirectArgs, InitialArgs, sizeof(InitialArgs), ERDGInitialDataFlags::NoCopy);
+
+	FRDGBufferRef TileList = GraphBuilder.CreateBuffer(FRDGBufferDesc::CreateStructuredDesc(sizeof(uint32), NumTilesTotal * CloudNumMarchedTileClasses), TEXT("Clouds.TileList"));
+
+	FCloudTileParameters Tiles;
+	Tiles.CloudDrawList = DrawList;
+	Tiles.CloudNumDrawVolumes = NumInstances;
+	Tiles.CloudNumTiles = NumTilesTotal;
+	Tiles.PS = MarchParams;
+
+	{
+		FCloudTileClassifyCS::FParameters* PassParameters = GraphBuilder.AllocParameters<FCloudTileClassifyCS::FParameters>();
+		PassParameters->Tiles = Tiles;
+		PassParameters->TileIndirectArgsOutput = GraphBuilder.CreateUAV(IndirectArgs, PF_R32_UINT);
+		PassParameters->TileListOutput = GraphBuilder.CreateUAV(TileList);
+
+		TShaderMapRef<FCloudTileClassifyCS> ComputeShader(ShaderMap);
+		FComputeShaderUtils::AddPass(
+			GraphBuilder,
+			RDG_EVENT_NAME("CloudTileClassify %dx%d tiles", NumTiles.X, NumTiles.Y),
+			ComputeShader,
+			PassParameters,
+			FIntVector(NumTiles.X, NumTiles.Y, 1));
+	}
+
+	FRDGBufferSRVRef TileListSRV = GraphBuilder.CreateSRV(TileList);
+	FRDGTextureUAVRef CloudColorUAV = GraphBuilder.CreateUAV(CloudColor);
+	FRDGTextureUAVRef CloudDepthUAV = GraphBuilder.CreateUAV(CloudDepth);
+
+	for (int32 Class = 0; Class < CloudNumMarchedTileClasses; ++Class)
+	{
+		FCloudTileMarchCS::FParameters* PassParameters = GraphBuilder.AllocParameters<FCloudTileMarchCS::FParameters>();
+		PassParameters->Tiles = Tiles;
+		PassParameters->TileList = TileListSRV;
+		PassParameters->TileListOffset = uint32(Class) * NumTilesTotal;
+		PassParameters->CloudColorOutput = CloudColorUAV;
+		PassParameters->CloudDepthOutput = CloudDepthUAV;
+		PassParameters->TileIndirectArgs = IndirectArgs;
+
+		FCloudTileMarchCS::FPermutationDomain TilePermutation;
+		TilePermutation.Set<CloudPermutation::FDomain>(Permutation);
+		TilePermutation.Set<FCloudTileMarchCS::FSceneDepthDim>(ECloudTileClass(Class) == ECloudTileClass::Geometry);
+		TShaderMapRef<FCloudTileMarchCS> ComputeShader(ShaderMap, TilePermutation);
+
+		FComputeShaderUtils::AddPass(
+			GraphBuilder,
+			RDG_EVENT_NAME("CloudTileMarch %s %u volumes", ECloudTileClass(Class) == ECloudTileClass::Geometry ? TEXT("Geometry") : TEXT("Sky"), NumInstances),
+			ComputeShader,
+			PassParameters,
+			IndirectArgs,
+			uint32(Class) * sizeof(FRHIDispatchIndirectParameters));
+	}
+}
+
+// ================================================================================================
+
+void FCloudSceneViewExtension::GetMarchPipelineState(const FGlobalShaderMap* ShaderMap, const FCloudPS::FPermutationDomain& Permutation, FGraphicsPipelineStateInitializer& GraphicsPSOInit)
+{
+	TShaderMapRef<FCloudVS> VertexShader(ShaderMap);
+	TShaderMapRef<FCloudPS> PixelShader(ShaderMap, Permutation);
+
+	// Volumes are composited back to front. Color holds (luminance, transmittance):
+	// rgb = Src.rgb + Dst.rgb * Src.a, a = Dst.a * Src.a. Depth holds the opacity weighted
+	// distance and is attenuated by the transmittance the pixel shader writes to alpha.
+	GraphicsPSOInit.BlendState = TStaticBlendState<
+		CW_RGBA, BO_Add, BF_One, BF_SourceAlpha, BO_Add, BF_Zero, BF_SourceAlpha,
+		CW_RED, BO_Add, BF_One, BF_SourceAlpha, BO_Add, BF_Zero, BF_One>::GetRHI();
+	// Only rasterize the faces pointing away from the camera, so every covered pixel is marched
+	// exactly once and the march still works with the camera inside the volume.
+	GraphicsPSOInit.RasterizerState = TStaticRasterizerState<FM_Solid, CM_CW>::GetRHI();
+	GraphicsPSOInit.DepthStencilState = TStaticDepthStencilState<false, CF_Always>::GetRHI();
+
+	GraphicsPSOInit.BoundShaderState.VertexDeclarationRHI = GCloudVertexDeclaration.VertexDeclarationRHI;
+	GraphicsPSOInit.BoundShaderState.VertexShaderRHI = VertexShader.GetVertexShader();
+	GraphicsPSOInit.BoundShaderState.PixelShaderRHI = PixelShader.GetPixelShader();
+	GraphicsPSOInit.PrimitiveType = PT_TriangleList;
+}
+
+void FCloudSceneViewExtension::PrecachePipelineStates(const FGlobalShaderMap* ShaderMap)
+{
+	check(IsInRenderingThread());
+
+	if (!PipelineStateCache::IsPSOPrecachingEnabled())
+	{
+		return;
+	}
+
+	int32 NumRequests = 0;
+
+	for (int32 PermutationId = 0; PermutationId < FCloudPS::FPermutationDomain::PermutationCount; ++PermutationId)
+	{
+		const FCloudPS::FPermutationDomain Permutation(PermutationId);
+
+		FGraphicsPipelineStateInitializer GraphicsPSOInit;
+		GetMarchPipelineState(ShaderMap, Permutation, GraphicsPSOInit);
+
+		// Matches the targets RenderClouds creates and RenderTriangle binds.
+		const ETextureCreateFlags TargetFlags = TexCreate_RenderTargetable | TexCreate_ShaderResource;
+		GraphicsPSOInit.RenderTargetsEnabled = 2;
+		GraphicsPSOInit.RenderTargetFormats[0] = CloudColorFormat;
+		GraphicsPSOInit.RenderTargetFlags[0] = TargetFlags;
+		GraphicsPSOInit.RenderTargetFormats[1] = CloudDepthFormat;
+		GraphicsPSOInit.RenderTargetFlags[1] = TargetFlags;
+		GraphicsPSOInit.DepthStencilTargetFormat = PF_Unknown;
+		GraphicsPSOInit.NumSamples = 1;
+		GraphicsPSOInit.StatePrecachePSOHash = RHIComputeStatePrecachePSOHash(GraphicsPSOInit);
+
+		PipelineStateCache::PrecacheGraphicsPipelineState(GraphicsPSOInit);
+		++NumRequests;
+	}
+
+	auto PrecacheCompute = [&NumRequests](auto ComputeShader)
+	{
+		PipelineStateCache::PrecacheComputePipelineState(ComputeShader.GetComputeShader());
+		++NumRequests;
+	};
+	for (int32 PermutationId = 0; PermutationId < FCloudTileMarchCS::FPermutationDomain::PermutationCount; ++PermutationId)
+	{
+		PrecacheCompute(TShaderMapRef<FCloudTileMarchCS>(ShaderMap, FCloudTileMarchCS::FPermutationDomain(PermutationId)));
+	}
+	PrecacheCompute(TShaderMapRef<FCloudTileClassifyCS>(ShaderMap));
+	PrecacheCompute(TShaderMapRef<FCloudReprojectCS>(ShaderMap));
+	PrecacheCompute(TShaderMapRef<FCloudOccupancyInitCS>(ShaderMap));
+	PrecacheCompute(TShaderMapRef<FCloudOccupancyDownsampleCS>(ShaderMap));
+	PrecacheCompute(TShaderMapRef<FCloudLightVolumeCS>(ShaderMap));
+	PrecacheCompute(TShaderMapRef<FCloudShadowMapCS>(ShaderMap));
+	PrecacheCompute(TShaderMapRef<FCloudPanoramaCS>(ShaderMap));
+
+	UE_LOG(LogClouds, Log, TEXT("Precaching %d cloud pipeline states"), NumRequests);
+}
@@ -0,0 +1,285 @@
+#include "CloudVolumeBVH.h"
+#include "Algo/Sort.h"
+#include "Math/VectorRegister.h"
+
+// ================================================================================================
+
+/** Sorts Indices along the largest axis of their centroid bounds and returns the median. */
+static int32 SplitAtMedian(TArrayView<int32> Indices, TConstArrayView<FVector3f> Centers)
+{
+	FBox3f CentroidBounds(ForceInit);
+	for (int32 Index : Indices)
+	{
+		CentroidBounds += Centers[Index];
+	}
+
+	const FVector3f Size = CentroidBounds.GetSize();
+	const int32 Axis = (Size.X >= Size.Y && Size.X >= Size.Z) ? 0 : (Size.Y >= Size.Z ? 1 : 2);
+
+	Algo::Sort(Indices, [Centers, Axis](int32 A, int32 B)
+	{
+		return Centers[A][Axis] < Centers[B][Axis];
+	});
+
+	return Indices.Num() / 2;
+}
+
+void FCloudVolumeBVH::Build(TConstArrayView<FCloudVolume> Volumes)
+{
+	Nodes.Reset();
+	NodeParentSlots.Reset();
+	VolumeSlots.SetNumUninitialized(Volumes.Num());
+
+	if (Volumes.Num() == 0)
+	{
+		return;
+	}
+
+	TArray<int32> Indices;
+	TArray<FVector3f> Centers;
+	Indices.SetNumUninitialized(Volumes.Num());
+	Centers.SetNumUninitialized(Volumes.Num());
+	for (int32 Index = 0; Index < Volumes.Num(); ++Index)
+	{
+		Indices[Index] = Index;
+		Centers[Index] = Volumes[Index].GetCenter();
+	}
+
+	// A full four-wide tree has about a third as many nodes as leaves.
+	Nodes.Reserve(Volumes.Num() / 3 + 1);
+	NodeParentSlots.Reserve(Volumes.Num() / 3 + 1);
+
+	BuildNode(Indices, Volumes, Centers, EmptyChild);
+}
+
+int32 FCloudVolumeBVH::BuildNode(TArrayView<int32> Indices, TConstArrayView<FCloudVolume> Volumes, TConstArrayView<FVector3f> Centers, uint32 ParentSlot)
+{
+	const int32 NodeIndex = Nodes.AddUninitialized();
+	NodeParentSlots.Add(ParentSlot);
+
+	for (int32 Slot = 0; Slot < 4; ++Slot)
+	{
+		Nodes[NodeIndex].Children[Slot] = EmptyChild;
+		SetSlotBounds(NodeIndex * 4 + Slot, FVector3f(MAX_flt), FVector3f(-MAX_flt));
+	}
+
+	// Two levels of median splits give up to four children.
+	TArrayView<int32> Groups[4];
+	int32 NumGroups = 0;
+	if (Indices.Num() <= 4)
+	{
+		for (int32 Index = 0; Index < Indices.Num(); ++Index)
+		{
+			Groups[NumGroups++] = Indices.Slice(Index, 1);
+		}
+	}
+	else
+	{
+		const int32 Mid = SplitAtMedian(Indices, Centers);
+		const TArrayView<int32> Halves[2] = { Indices.Slice(0, Mid), Indices.Slice(Mid, Indices.Num() - Mid) };
+		for (const TArrayView<int32>& Half : Halves)
+		{
+			const int32 HalfMid = SplitAtMedian(Half, Centers);
+			Groups[NumGroups++] = Half.Slice(0, HalfMid);
+			Groups[NumGroups++] = Half.Slice(HalfMid, Half.Num() - HalfMid);
+		}
+	}
+
+	for (int32 Slot = 0; Slot < NumGroups; ++Slot)
+	{
+		const uint32 NodeSlot = NodeIndex * 4 + Slot;
+
+		if (Groups[Slot].Num() == 1)
+		{
+			const int32 VolumeIndex = Groups[Slot][0];
+			Nodes[NodeIndex].Children[Slot] = LeafFlag | uint32(VolumeIndex);
+			VolumeSlots[VolumeIndex] = NodeSlot;
+			SetSlotBounds(NodeSlot, Volumes[VolumeIndex].BoundsMin, Volumes[VolumeIndex].BoundsMax);
+		}
+		else
+		{
+			// Nodes may reallocate while building the child, so only index it afterwards.
+			const int32 ChildIndex = BuildNode(Groups[Slot], Volumes, Centers, NodeSlot);
+			Nodes[NodeIndex].Children[Slot] = uint32(ChildIndex);
+
+			FVector3f Min;
+			FVector3f Max;
+			GetNodeBounds(ChildIndex, Min, Max);
+			SetSlotBounds(NodeSlot, Min, Max);
+		}
+	}
+
+	return NodeIndex;
+}
+
+// ================================================================================================
+
+void FCloudVolumeBVH::SetSlotBounds(uint32 NodeSlot, const FVector3f& Min, const FVector3f& Max)
+{
+	FNode& Node = Nodes[NodeSlot / 4];
+	const uint32 Slot = NodeSlot % 4;
+	Node.MinX[Slot] = Min.X;
+	Node.MinY[Slot] = Min.Y;
+	Node.MinZ[Slot] = Min.Z;
+	Node.MaxX[Slot] = Max.X;
+	Node.MaxY[Slot] = Max.Y;
+	Node.MaxZ[Slot] = Max.Z;
+}
+
+void FCloudVolumeBVH::GetNodeBounds(int32 NodeIndex, FVector3f& OutMin, FVector3f& OutMax) const
+{
+	// Empty slots hold inverted bounds and drop out of the union.
+	const FNode& Node = Nodes[NodeIndex];
+	OutMin = FVector3f(
+		FMath::Min(FMath::Min(Node.MinX[0], Node.MinX[1]), FMath::Min(Node.MinX[2], Node.MinX[3])),
+		FMath::Min(FMath::Min(Node.MinY[0], Node.MinY[1]), FMath::Min(Node.MinY[2], Node.MinY[3])),
+		FMath::Min(FMath::Min(Node.MinZ[0], Node.MinZ[1]), FMath::Min(Node.MinZ[2], Node.MinZ[3])));
+	OutMax = FVector3f(
+		FMath::Max(FMath::Max(Node.MaxX[0], Node.MaxX[1]), FMath::Max(Node.MaxX[2], Node.MaxX[3])),
+		FMath::Max(FMath::Max(Node.MaxY[0], Node.MaxY[1]), FMath::Max(Node.MaxY[2], Node.MaxY[3])),
+		FMath::Max(FMath::Max(Node.MaxZ[0], Node.MaxZ[1]), FMath::Max(Node.MaxZ[2], Node.MaxZ[3])));
+}
+
+void FCloudVolumeBVH::Refit(int32 VolumeIndex, const FCloudVolume& Volume)
+{
+	uint32 NodeSlot = VolumeSlots[VolumeIndex];
+	SetSlotBounds(NodeSlot, Volume.BoundsMin, Volume.BoundsMax);
+
+	for (int32 NodeIndex = NodeSlot / 4; NodeParentSlots[NodeIndex] != EmptyChild; NodeIndex = NodeSlot / 4)
+	{
+		FVector3f Min;
+		FVector3f Max;
+		GetNodeBounds(NodeIndex, Min, Max);
+
+		NodeSlot = NodeParentSlots[NodeIndex];
+		SetSlotBounds(NodeSlot, Min, Max);
+	}
+}
+
+// ================================================================================================
+
+void FCloudVolumeBVH::Cull(TConstArrayView<FPlane> Planes, TArray<uint32>& OutVisible) const
+{
+	if (Nodes.Num() == 0)
+	{
+		return;
+	}
+
+	struct FPlaneRegisters
+	{
+		VectorRegister4Float NormalX;
+		VectorRegister4Float NormalY;
+		VectorRegister4Float NormalZ;
+		VectorRegister4Float AbsNormalX;
+		VectorRegister4Float AbsNormalY;
+		VectorRegister4Float AbsNormalZ;
+		VectorRegister4Float W;
+	};
+
+	TArray<FPlaneRegisters, TInlineAllocator<8>> PlaneRegisters;
+	PlaneRegisters.Reserve(Planes.Num());
+	for (const FPlane& Plane : Planes)
+	{
+		FPlaneRegisters& Registers = PlaneRegisters.AddDefaulted_GetRef();
+		Registers.NormalX = VectorSetFloat1(float(Plane.X));
+		Registers.NormalY = VectorSetFloat1(float(Plane.Y));
+		Registers.NormalZ = VectorSetFloat1(float(Plane.Z));
+		Registers.AbsNormalX = VectorAbs(Registers.NormalX);
+		Registers.AbsNormalY = VectorAbs(Registers.NormalY);
+		Registers.AbsNormalZ = VectorAbs(Registers.NormalZ);
+		Registers.W = VectorSetFloat1(float(Plane.W));
+	}
+
+	const VectorRegister4Float Half = VectorSetFloat1(0.5f);
+	const VectorRegister4Float Zero = VectorZeroFloat();
+
+	TArray<uint32, TInlineAllocator<64>> Stack;
+	Stack.Add(0);
+
+	while (Stack.Num() > 0)
+	{
+		const FNode& Node = Nodes[Stack.Pop(false)];
+
+		const VectorRegister4Float MinX = VectorLoadAligned(Node.MinX);
+		const VectorRegister4Float MinY = VectorLoadAligned(Node.MinY);
+		const VectorRegister4Float MinZ = VectorLoadAligned(Node.MinZ);
+		const VectorRegister4Float MaxX = VectorLoadAligned(Node.MaxX);
+		const VectorRegister4Float MaxY = VectorLoadAligned(Node.MaxY);
+		const VectorRegister4Float MaxZ = VectorLoadAligned(Node.MaxZ);
+
+		const VectorRegister4Float CenterX = VectorMultiply(VectorAdd(MinX, MaxX), Half);
+		const VectorRegister4Float CenterY = VectorMultiply(VectorAdd(MinY, MaxY), Half);
+		const VectorRegister4Float CenterZ = VectorMultiply(VectorAdd(MinZ, MaxZ), Half);
+		const VectorRegister4Float ExtentX = VectorMultiply(VectorSubtract(MaxX, MinX), Half);
+		const VectorRegister4Float ExtentY = VectorMultiply(VectorSubtract(MaxY, MinY), Half);
+		const VectorRegister4Float ExtentZ = VectorMultiply(VectorSubtract(MaxZ, MinZ), Half);
+
+		// A box is outside if its nearest corner is in front of any plane, and entirely inside if its
+		// farthest corner is behind all of them.
+		VectorRegister4Float Outside = Zero;
+		VectorRegister4Float Crossing = Zero;
+		for (const FPlaneRegisters& Plane : PlaneRegisters)
+		{
+			const VectorRegister4Float Distance = VectorSubtract(
+				VectorMultiplyAdd(CenterX, Plane.NormalX, VectorMultiplyAdd(CenterY, Plane.NormalY, VectorMultiply(CenterZ, Plane.NormalZ))),
+				Plane.W);
+			const VectorRegister4Float Radius =
+				VectorMultiplyAdd(ExtentX, Plane.AbsNormalX, VectorMultiplyAdd(ExtentY, Plane.AbsNormalY, VectorMultiply(ExtentZ, Plane.AbsNormalZ)));
+
+			Outside = VectorBitwiseOr(Outside, VectorCompareGT(VectorSubtract(Distance, Radius), Zero));
+			Crossing = VectorBitwiseOr(Crossing, VectorCompareGT(VectorAdd(Distance, Radius), Zero));
+		}
+
+		const uint32 OutsideMask = uint32(VectorMaskBits(Outside));
+		const uint32 CrossingMask = uint32(VectorMaskBits(Crossing));
+
+		for (uint32 Slot = 0; Slot < 4; ++Slot)
+		{
+			const uint32 Child = Node.Children[Slot];
+			if (Child == EmptyChild || (OutsideMask & (1u << Slot)))
+			{
+				continue;
+			}
+
+			if (Child & LeafFlag)
+			{
+				OutVisible.Add(Child & ~LeafFlag);
+			}
+			else if (CrossingMask & (1u << Slot))
+			{
+				Stack.Add(Child);
+			}
+			else
+			{
+				AppendSubtree(Child, OutVisible);
+			}
+		}
+	}
+}
+
+void FCloudVolumeBVH::AppendSubtree(uint32 NodeIndex, TArray<uint32>& OutVisible) const
+{
+	TArray<uint32, TInlineAllocator<64>> Stack;
+	Stack.Add(NodeIndex);
+
+	while (Stack.Num() > 0)
+	{
+		const FNode& Node = Nodes[Stack.Pop(false)];
+		for (uint32 Child : Node.Children)
+		{
+			if (Child == EmptyChild)
+			{
+				continue;
+			}
+
+			if (Child & LeafFlag)
+			{
+				OutVisible.Add(Child & ~LeafFlag);
+			}
+			else
+			{
+				Stack.Add(Child);
+			}
+		}
+	}
+}
@@ -0,0 +1,115 @@
+#include "CloudVolumeComponent.h"
+#include "CloudSceneViewExtension.h"
+#include "Foo.h"
+#include "Engine/World.h"
+#include "Misc/Paths.h"
+
+
+UCloudVolumeComponent::UCloudVolumeComponent(const FObjectInitializer& ObjectInitializer)
+	: Super(ObjectInitializer)
+{
+	bWantsOnUpdateTransform = true;
+}
+
+FCloudVolume UCloudVolumeComponent::GetCloudVolume() const
+{
+	const FBox Bounds = FBox(-Extent, Extent).TransformBy(GetComponentTransform());
+
+	FCloudVolume Volume;
+	Volume.BoundsMin = FVector3f(Bounds.Min);
+	Volume.BoundsMax = FVector3f(Bounds.Max);
+	Volume.DensityScale = DensityScale;
+	Volume.Coverage = Coverage;
+	Volume.BrickVolume = BrickVolumeId;
+	return Volume;
+}
+
+void UCloudVolumeComponent::AddBrickVolume()
+{
+	FCloudSceneViewExtension* Extension = FFooModule::Get().GetCloudSceneViewExtension();
+	if (Extension && !BrickVolumePath.IsEmpty() && BrickVolumeId == 0)
+	{
+		BrickVolumeId = Extension->AddBrickVolume_GameThread(FPaths::ConvertRelativePathToFull(FPaths::ProjectDir(), BrickVolumePath), this);
+	}
+}
+
+void UCloudVolumeComponent::RemoveBrickVolume()
+{
+	if (BrickVolumeId != 0)
+	{
+		if (FCloudSceneViewExtension* Extension = FFooModule::Get().GetCloudSceneViewExtension())
+		{
+			Extension->RemoveBrickVolume_GameThread(BrickVolumeId);
+		}
+		BrickVolumeId = 0;
+	}
+}
+
+FBoxSphereBounds UCloudVolumeComponent::CalcBounds(const FTransform& LocalToWorld) const
+{
+	return FBoxSphereBounds(FBox(-Extent, Extent).TransformBy(LocalToWorld));
+}
+
+// ================================================================================================
+
+void UCloudVolumeComponent::OnRegister()
+{
+	Super::OnRegister();
+
+	// Worlds without a scene (e.g. dedicated servers) never render clouds.
+	FCloudSceneViewExtension* Extension = FFooModule::Get().GetCloudSceneViewExtension();
+	if (Extension && GetWorld() && GetWorld()->Scene && CloudVolumeId == 0)
+	{
+		AddBrickVolume();
+		CloudVolumeId = Extension->AddCloudVolume_GameThread(GetCloudVolume());
+	}
+}
+
+void UCloudVolumeComponent::OnUnregister()
+{
+	if (CloudVolumeId != 0)
+	{
+		if (FCloudSceneViewExtension* Extension = FFooModule::Get().GetCloudSceneViewExtension())
+		{
+			Extension->RemoveCloudVolume_GameThread(CloudVolumeId);
+		}
+		CloudVolumeId = 0;
+	}
+	RemoveBrickVolume();
+
+	Super::OnUnregister();
+}
+
+void UCloudVolumeComponent::OnUpdateTransform(EUpdateTransformFlags UpdateTransformFlags, ETeleportType Teleport)
+{
+	Super::OnUpdateTransform(UpdateTransformFlags, Teleport);
+	MarkCloudVolumeDirty();
+}
+
+void UCloudVolumeComponent::MarkCloudVolumeDirty()
+{
+	UpdateBounds();
+
+	if (CloudVolumeId != 0)
+	{
+		if (FCloudSceneViewExtension* Extension = FFooModule::Get().GetCloudSceneViewExtension())
+		{
+			Extension->UpdateCloudVolume_GameThread(CloudVolumeId, GetCloudVolume());
+		}
+	}
+}
+
+#if WITH_EDITOR
+void UCloudVolumeComponent::PostEditChangeProperty(FPropertyChangedEvent& PropertyChangedEvent)
+{
+	Super::PostEditChangeProperty(PropertyChangedEvent);
+
+	if (PropertyChangedEvent.GetPropertyName() == GET_MEMBER_NAME_CHECKED(UCloudVolumeComponent, BrickVolumePath) && CloudVolumeId != 0)
+	{
+		// Render commands run in order, so the new file replaces the old one before the volume is updated.
+		RemoveBrickVolume();
+		AddBrickVolume();
+	}
+	MarkCloudVolumeDirty();
+}
+#endif
@@ -0,0 +1,115 @@
+#include "CloudVolumes.h"
+#include "RenderGraphBuilder.h"
+#include "ConvexVolume.h"
+
+// ================================================================================================
+
+void FCloudVolumeRegistry::Add(uint32 Id, const FCloudVolume& Volume)
+{
+	check(!IdToIndex.Contains(Id));
+
+	const int32 Index = Volumes.Add(Volume);
+	VolumeIds.Add(Id);
+	IdToIndex.Add(Id, Index);
+	MarkDirty(Index);
+	bBvhNeedsBuild = true;
+}
+
+void FCloudVolumeRegistry::Update(uint32 Id, const FCloudVolume& Volume)
+{
+	if (const int32* Index = IdToIndex.Find(Id))
+	{
+		if (!(Volumes[*Index] == Volume))
+		{
+			Volumes[*Index] = Volume;
+			MarkDirty(*Index);
+
+			if (!bBvhNeedsBuild)
+			{
+				Bvh.Refit(*Index, Volume);
+				++NumRefitsSinceBuild;
+			}
+		}
+	}
+}
+
+void FCloudVolumeRegistry::Remove(uint32 Id)
+{
+	int32 Index;
+	if (!IdToIndex.RemoveAndCopyValue(Id, Index))
+	{
+		return;
+	}
+
+	// Keep the array dense by moving the last volume into the hole.
+	const int32 LastIndex = Volumes.Num() - 1;
+	if (Index != LastIndex)
+	{
+		Volumes[Index] = Volumes[LastIndex];
+		VolumeIds[Index] = VolumeIds[LastIndex];
+		IdToIndex[VolumeIds[Index]] = Index;
+		MarkDirty(Index);
+	}
+
+	Volumes.RemoveAt(LastIndex, 1, false);
+	VolumeIds.RemoveAt(LastIndex, 1, false);
+	bBvhNeedsBuild = true;
+}
+
+void FCloudVolumeRegistry::MarkDirty(int32 Index)
+{
+	if (DirtyFlags.Num() <= Index)
+	{
+		DirtyFlags.Add(false, Index + 1 - DirtyFlags.Num());
+	}
+
+	if (!DirtyFlags[Index])
+	{
+		DirtyFlags[Index] = true;
+		DirtyIndices.Add(Index);
+	}
+}
+
+// ================================================================================================
+
+void FCloudVolumeRegistry::Cull(const FConvexVolume& Frustum, TArray<uint32>& OutVisible)
+{
+	// Refitting keeps the tree correct but loosens it as volumes drift apart. Rebuild once on average
+	// every volume has moved.
+	if (bBvhNeedsBuild || NumRefitsSinceBuild > Volumes.Num())
+	{
+		Bvh.Build(Volumes);
+		bBvhNeedsBuild = false;
+		NumRefitsSinceBuild = 0;
+	}
+
+	Bvh.Cull(Frustum.Planes, OutVisible);
+}
+
+// ================================================================================================
+
+FRDGBufferRef FCloudVolumeRegistry::UpdateInstanceBuffer(FRDGBuilder& GraphBuilder)
+{
+	// Grow in powers of two so adding volumes rarely reallocates; the resize keeps the old contents.
+	const uint32 NumInstances = FMath::RoundUpToPowerOfTwo(FMath::Max(Volumes.Num(), 16));
+	FRDGBufferRef Buffer = ResizeStructuredBufferIfNeeded(GraphBuilder, InstanceBuffer, NumInstances * sizeof(FCloudVolumeInstance), TEXT("Clouds.Instances"));
+
+	// Indices past the end belong to removed volumes and are never read.
+	DirtyIndices.RemoveAllSwap([this](int32 Index) { return Index >= Volumes.Num(); }, false);
+
+	if (DirtyIndices.Num() > 0)
+	{
+		InstanceUploader.Init(GraphBuilder, DirtyIndices.Num(), sizeof(FCloudVolumeInstance), true, TEXT("Clouds.InstanceUpload"));
+		for (int32 Index : DirtyIndices)
+		{
+			const FCloudVolumeInstance Instance(Volumes[Index]);
+			InstanceUploader.Add(Index, &Instance);
+		}
+		InstanceUploader.ResourceUploadTo(GraphBuilder, Buffer);
+	}
+
+	DirtyIndices.Reset();
+	DirtyFlags.Init(false, DirtyFlags.Num());
+
+	return Buffer;
+}
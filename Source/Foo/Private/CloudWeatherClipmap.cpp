@@ -0,0 +1,140 @@
+#include "CloudWeatherClipmap.h"
+#include "CloudStats.h"
+
+#include "RenderUtils.h"
+#include "RHIStaticStates.h"
+
+/** Marks slots that hold no tile; never matches a tile of the map. */
+static const FIntPoint EmptyWeatherSlot(MIN_int32, MIN_int32);
+
+// ================================================================================================
+
+void FCloudWeatherClipmap::Initialize(FRHICommandListImmediate& RHICmdList, const FString& Path, int32 InClipmapTiles, int32 CacheTiles)
+{
+	ClipmapTiles = FMath::Clamp(InClipmapTiles, 2, 32);
+	SlotTiles.Init(EmptyWeatherSlot, ClipmapTiles * ClipmapTiles);
+
+	if (Path.IsEmpty() || !Cache.Open(Path, FMath::Max(CacheTiles, ClipmapTiles * ClipmapTiles)))
+	{
+		return;
+	}
+
+	const FCloudWeatherMapDesc& Desc = Cache.GetDesc();
+
+	UpdateOrder.Reset();
+	for (int32 Y = 0; Y < ClipmapTiles; ++Y)
+	{
+		for (int32 X = 0; X < ClipmapTiles; ++X)
+		{
+			UpdateOrder.Add(FIntPoint(X, Y) - ClipmapTiles / 2);
+		}
+	}
+	UpdateOrder.Sort([](const FIntPoint& A, const FIntPoint& B)
+	{
+		return A.SizeSquared() < B.SizeSquared();
+	});
+
+	// FColor is laid out as BGRA in memory.
+	const int32 ClipmapSize = ClipmapTiles * Desc.TileResolution;
+	ClipmapTexture = RHICreateTexture(FRHITextureCreateDesc::Create2D(TEXT("Clouds.WeatherClipmap"), ClipmapSize, ClipmapSize, PF_B8G8R8A8)
+		.SetFlags(ETextureCreateFlags::ShaderResource)
+		.SetInitialState(ERHIAccess::SRVMask));
+
+	OverviewTexture = RHICreateTexture(FRHITextureCreateDesc::Create2D(TEXT("Clouds.WeatherOverview"), Desc.OverviewResolution, Desc.OverviewResolution, PF_B8G8R8A8)
+		.SetFlags(ETextureCreateFlags::ShaderResource)
+		.SetInitialState(ERHIAccess::SRVMask));
+
+	RHICmdList.UpdateTexture2D(
+		OverviewTexture,
+		0,
+		FUpdateTextureRegion2D(0, 0, 0, 0, Desc.OverviewResolution, Desc.OverviewResolution),
+		Desc.OverviewResolution * sizeof(FColor),
+		reinterpret_cast<const uint8*>(Cache.GetOverview().GetData()));
+
+	UE_LOG(LogClouds, Log, TEXT("Streaming cloud weather map %s: %dx%d tiles of %d^2, %dx%d tile clipmap"),
+		*Path, Desc.NumTiles.X, Desc.NumTiles.Y, Desc.TileResolution, ClipmapTiles, ClipmapTiles);
+}
+
+int32 FCloudWeatherClipmap::GetSlot(const FIntPoint& Tile) const
+{
+	const int32 SlotX = (Tile.X % ClipmapTiles + ClipmapTiles) % ClipmapTiles;
+	const int32 SlotY = (Tile.Y % ClipmapTiles + ClipmapTiles) % ClipmapTiles;
+	return SlotY * ClipmapTiles + SlotX;
+}
+
+void FCloudWeatherClipmap::Update(FRHICommandListImmediate& RHICmdList, const FVector& CameraOrigin, int32 MaxUploads, int32 CacheTiles)
+{
+	if (!IsValid())
+	{
+		return;
+	}
+
+	// The cache must at least hold the window, or tiles would be evicted before they were uploaded.
+	Cache.SetCapacity(FMath::Max(CacheTiles, ClipmapTiles * ClipmapTiles));
+
+	const FCloudWeatherMapDesc& Desc = Cache.GetDesc();
+	const FIntPoint CameraTile = Desc.GetTile(FVector2f(float(CameraOrigin.X), float(CameraOrigin.Y)));
+
+	int32 NumUploads = 0;
+	for (const FIntPoint& Offset : UpdateOrder)
+	{
+		const FIntPoint Tile = CameraTile + Offset;
+		if (!Desc.IsValidTile(Tile))
+		{
+			continue;
+		}
+
+		const int32 Slot = GetSlot(Tile);
+		if (SlotTiles[Slot] == Tile)
+		{
+			continue;
+		}
+
+		if (NumUploads >= MaxUploads)
+		{
+			break;
+		}
+
+		const FColor* Texels = Cache.GetTile(Tile);
+		if (!Texels)
+		{
+			continue;
+		}
+
+		const int32 Resolution = Desc.TileResolution;
+		RHICmdList.UpdateTexture2D(
+			ClipmapTexture,
+			0,
+			FUpdateTextureRegion2D((Slot % ClipmapTiles) * Resolution, (Slot / ClipmapTiles) * Resolution, 0, 0, Resolution, Resolution),
+			Resolution * sizeof(FColor),
+			reinterpret_cast<const uint8*>(Texels));
+
+		SlotTiles[Slot] = Tile;
+		++NumUploads;
+	}
+
+	INC_DWORD_STAT_BY(STAT_CloudsWeatherTileUploads, NumUploads);
+	SET_DWORD_STAT(STAT_CloudsWeatherResidentTiles, Cache.GetStats().ResidentTiles);
+	CSV_CUSTOM_STAT(Clouds, WeatherTileUploads, NumUploads, ECsvCustomStatOp::Accumulate);
+}
+
+// ================================================================================================
+
+void FCloudWeatherClipmap::SetupParameters(FRDGBuilder& GraphBuilder, FCloudWeatherShaderParameters& OutParameters) const
+{
+	const FCloudWeatherMapDesc& Desc = Cache.GetDesc();
+
+	OutParameters.CloudWeatherClipmap = IsValid() ? ClipmapTexture.GetReference() : GWhiteTexture->TextureRHI.GetReference();
+	OutParameters.CloudWeatherOverview = IsValid() ? OverviewTexture.GetReference() : GWhiteTexture->TextureRHI.GetReference();
+	OutParameters.CloudWeatherClipmapSampler = TStaticSamplerState<SF_Bilinear, AM_Wrap, AM_Wrap, AM_Wrap>::GetRHI();
+	OutParameters.CloudWeatherOverviewSampler = TStaticSamplerState<SF_Bilinear, AM_Clamp, AM_Clamp, AM_Clamp>::GetRHI();
+	OutParameters.CloudWeatherSlotTiles = GraphBuilder.CreateSRV(CreateStructuredBuffer(
+		GraphBuilder,
+		TEXT("Clouds.WeatherSlotTiles"),
+		SlotTiles.Num() > 0 ? SlotTiles : TArray<FIntPoint>({ EmptyWeatherSlot })));
+	OutParameters.CloudWeatherMapOrigin = Desc.Origin;
+	OutParameters.CloudWeatherTileSize = Desc.TileWorldSize;
+	OutParameters.CloudWeatherNumTiles = Desc.NumTiles;
+	OutParameters.CloudWeatherClipmapTiles = FMath::Max(ClipmapTiles, 1);
+	OutParameters.CloudWeatherEnabled = IsValid() ? 1 : 0;
+}
@@ -0,0 +1,409 @@
+#include "CloudWeatherMap.h"
+#include "CloudStats.h"
+
+#include "Async/ParallelFor.h"
+#include "Async/MappedFileHandle.h"
+#include "HAL/FileManager.h"
+#include "HAL/PlatformFileManager.h"
+#include "Misc/Paths.h"
+
+/** Bump whenever the file layout or the procedural weather changes. */
+static constexpr uint32 CloudWeatherMapVersion = 1;
+static constexpr uint32 CloudWeatherMapMagic = 0x48545743; // "CWTH"
+
+/** Header, padded so the overview starts at a fixed offset. */
+static constexpr int64 CloudWeatherHeaderBytes = 64;
+
+/** Tiles start on 64 KB boundaries, the coarsest mapping granularity of the supported platforms. */
+static constexpr int64 CloudWeatherTileDataAlignment = 65536;
+static constexpr int64 CloudWeatherTileAlignment = 4096;
+
+struct FCloudWeatherMapHeader
+{
+	uint32 Magic;
+	uint32 Version;
+	int32 TileResolution;
+	int32 NumTilesX;
+	int32 NumTilesY;
+	float TileWorldSize;
+	float OriginX;
+	float OriginY;
+	int32 OverviewResolution;
+};
+
+static_assert(sizeof(FCloudWeatherMapHeader) <= CloudWeatherHeaderBytes, "Weather map header does not fit.");
+
+// ================================================================================================
+
+int64 FCloudWeatherMapDesc::GetOverviewOffset() const
+{
+	return CloudWeatherHeaderBytes;
+}
+
+int64 FCloudWeatherMapDesc::GetTileOffset(const FIntPoint& Tile) const
+{
+	const int64 OverviewBytes = int64(OverviewResolution) * OverviewResolution * sizeof(FColor);
+	const int64 TileDataOffset = Align(GetOverviewOffset() + OverviewBytes, CloudWeatherTileDataAlignment);
+	const int64 TileStride = Align(GetTileBytes(), CloudWeatherTileAlignment);
+	return TileDataOffset + (int64(Tile.Y) * NumTiles.X + Tile.X) * TileStride;
+}
+
+FIntPoint FCloudWeatherMapDesc::GetTile(const FVector2f& WorldXY) const
+{
+	const FVector2f TilePos = (WorldXY - Origin) / TileWorldSize;
+	return FIntPoint(FMath::FloorToInt(TilePos.X), FMath::FloorToInt(TilePos.Y));
+}
+
+// ================================================================================================
+
+FCloudWeatherTileCache::FCloudWeatherTileCache()
+	: Tiles(1)
+{
+}
+
+FCloudWeatherTileCache::~FCloudWeatherTileCache()
+{
+	Close();
+}
+
+bool FCloudWeatherTileCache::Open(const FString& Path, int32 CapacityTiles)
+{
+	Close();
+
+	FileHandle.Reset(FPlatformFileManager::Get().GetPlatformFile().OpenMapped(*Path));
+	if (!FileHandle)
+	{
+		UE_LOG(LogClouds, Warning, TEXT("Failed to memory map cloud weather map %s"), *Path);
+		return false;
+	}
+
+	FCloudWeatherMapHeader Header;
+	if (FileHandle->GetFileSize() < CloudWeatherHeaderBytes)
+	{
+		UE_LOG(LogClouds, Warning, TEXT("Cloud weather map %s is truncated"), *Path);
+		Close();
+		return false;
+	}
+
+	{
+		TUniquePtr<IMappedFileRegion> HeaderRegion(FileHandle->MapRegion(0, CloudWeatherHeaderBytes));
+		if (!HeaderRegion)
+		{
+			Close();
+			return false;
+		}
+		FMemory::Memcpy(&Header, HeaderRegion->GetMappedPtr(), sizeof(Header));
+	}
+
+	Desc.TileResolution = Header.TileResolution;
+	Desc.NumTiles = FIntPoint(Header.NumTilesX, Header.NumTilesY);
+	Desc.TileWorldSize = Header.TileWorldSize;
+	Desc.Origin = FVector2f(Header.OriginX, Header.OriginY);
+	Desc.OverviewResolution = Header.OverviewResolution;
+
+	const bool bValid = Header.Magic == CloudWeatherMapMagic
+		&& Header.Version == CloudWeatherMapVersion
+		&& Desc.TileResolution > 0 && Desc.NumTiles.X > 0 && Desc.NumTiles.Y > 0 && Desc.OverviewResolution > 0
+		&& FileHandle->GetFileSize() >= Desc.GetTileOffset(Desc.NumTiles - 1) + Desc.GetTileBytes();
+
+	if (!bValid)
+	{
+		UE_LOG(LogClouds, Warning, TEXT("Ignoring invalid or outdated cloud weather map %s"), *Path);
+		Close();
+		return false;
+	}
+
+	OverviewRegion.Reset(FileHandle->MapRegion(Desc.GetOverviewOffset(), int64(Desc.OverviewResolution) * Desc.OverviewResolution * sizeof(FColor)));
+	SetCapacity(CapacityTiles);
+	return true;
+}
+
+void FCloudWeatherTileCache::Close()
+{
+	Tiles.Empty(Tiles.Max());
+	OverviewRegion.Reset();
+	FileHandle.Reset();
+	Stats.ResidentTiles = 0;
+}
+
+TConstArrayView<FColor> FCloudWeatherTileCache::GetOverview() const
+{
+	if (!OverviewRegion)
+	{
+		return {};
+	}
+	return MakeArrayView(reinterpret_cast<const FColor*>(OverviewRegion->GetMappedPtr()), Desc.OverviewResolution * Desc.OverviewResolution);
+}
+
+void FCloudWeatherTileCache::SetCapacity(int32 CapacityTiles)
+{
+	CapacityTiles = FMath::Max(CapacityTiles, 1);
+	if (CapacityTiles != Tiles.Max())
+	{
+		Stats.Evictions += Tiles.Num();
+		Tiles.Empty(CapacityTiles);
+		Stats.ResidentTiles = 0;
+	}
+}
+
+const FColor* FCloudWeatherTileCache::GetTile(const FIntPoint& Tile)
+{
+	if (!FileHandle || !Desc.IsValidTile(Tile))
+	{
+		return nullptr;
+	}
+
+	if (TSharedPtr<IMappedFileRegion>* Region = Tiles.FindAndTouch(Tile))
+	{
+		++Stats.Hits;
+		INC_DWORD_STAT(STAT_CloudsWeatherTileHits);
+		return reinterpret_cast<const FColor*>((*Region)->GetMappedPtr());
+	}
+
+	++Stats.Misses;
+	INC_DWORD_STAT(STAT_CloudsWeatherTileMisses);
+
+	if (Tiles.Num() == Tiles.Max())
+	{
+		Tiles.RemoveLeastRecent();
+		++Stats.Evictions;
+		INC_DWORD_STAT(STAT_CloudsWeatherTileEvictions);
+	}
+
+	TSharedPtr<IMappedFileRegion> Region(FileHandle->MapRegion(Desc.GetTileOffset(Tile), Desc.GetTileBytes()));
+	if (!Region)
+	{
+		return nullptr;
+	}
+
+	Tiles.Add(Tile, Region);
+	Stats.ResidentTiles = Tiles.Num();
+
+	return reinterpret_cast<const FColor*>(Region->GetMappedPtr());
+}
+
+FCloudWeatherSample FCloudWeatherTileCache::Sample(const FVector2f& WorldXY)
+{
+	FCloudWeatherSample Result;
+
+	const FIntPoint MapSize = Desc.NumTiles * Desc.TileResolution;
+	const FVector2f TexelPos = (WorldXY - Desc.Origin) / Desc.TileWorldSize * float(Desc.TileResolution) - 0.5f;
+	if (!FileHandle || TexelPos.X < -0.5f || TexelPos.Y < -0.5f || TexelPos.X > MapSize.X - 0.5f || TexelPos.Y > MapSize.Y - 0.5f)
+	{
+		return Result;
+	}
+
+	const int32 X0 = FMath::FloorToInt(TexelPos.X);
+	const int32 Y0 = FMath::FloorToInt(TexelPos.Y);
+	const float FracX = TexelPos.X - X0;
+	const float FracY = TexelPos.Y - Y0;
+
+	FVector4f Texels[4];
+	for (int32 Corner = 0; Corner < 4; ++Corner)
+	{
+		const int32 X = FMath::Clamp(X0 + (Corner & 1), 0, MapSize.X - 1);
+		const int32 Y = FMath::Clamp(Y0 + (Corner >> 1), 0, MapSize.Y - 1);
+		const FColor* TileTexels = GetTile(FIntPoint(X / Desc.TileResolution, Y / Desc.TileResolution));
+		if (!TileTexels)
+		{
+			return Result;
+		}
+		const FColor Texel = TileTexels[(Y % Desc.TileResolution) * Desc.TileResolution + X % Desc.TileResolution];
+		Texels[Corner] = FVector4f(Texel.R, Texel.G, Texel.B, Texel.A) / 255.0f;
+	}
+
+	const FVector4f Weather = FMath::Lerp(
+		FMath::Lerp(Texels[0], Texels[1], FracX),
+		FMath::Lerp(Texels[2], Texels[3], FracX),
+		FracY);
+
+	Result.Coverage = Weather.X;
+	Result.Type = Weather.Y;
+	Result.Precipitation = Weather.Z;
+	return Result;
+}
+
+FCloudWeatherSample FCloudWeatherTileCache::SampleOverview(const FVector2f& WorldXY) const
+{
+	FCloudWeatherSample Result;
+
+	const FVector2f MapPos = (WorldXY - Desc.Origin) / (FVector2f(Desc.NumTiles) * Desc.TileWorldSize);
+	if (!OverviewRegion || MapPos.X < 0.0f || MapPos.Y < 0.0f || MapPos.X > 1.0f || MapPos.Y > 1.0f)
+	{
+		return Result;
+	}
+
+	const TConstArrayView<FColor> Overview = GetOverview();
+	const int32 Resolution = Desc.OverviewResolution;
+	const FVector2f TexelPos = MapPos * float(Resolution) - 0.5f;
+	const int32 X0 = FMath::FloorToInt(TexelPos.X);
+	const int32 Y0 = FMath::FloorToInt(TexelPos.Y);
+	const float FracX = TexelPos.X - X0;
+	const float FracY = TexelPos.Y - Y0;
+
+	FVector4f Texels[4];
+	for (int32 Corner = 0; Corner < 4; ++Corner)
+	{
+		const int32 X = FMath::Clamp(X0 + (Corner & 1), 0, Resolution - 1);
+		const int32 Y = FMath::Clamp(Y0 + (Corner >> 1), 0, Resolution - 1);
+		const FColor Texel = Overview[Y * Resolution + X];
+		Texels[Corner] = FVector4f(Texel.R, Texel.G, Texel.B, Texel.A) / 255.0f;
+	}
+
+	const FVector4f Weather = FMath::Lerp(
+		FMath::Lerp(Texels[0], Texels[1], FracX),
+		FMath::Lerp(Texels[2], Texels[3], FracX),
+		FracY);
+
+	Result.Coverage = Weather.X;
+	Result.Type = Weather.Y;
+	Result.Precipitation = Weather.Z;
+	return Result;
+}
+
+// ================================================================================================
+
+namespace CloudWeather
+{
+
+bool WriteWeatherMap(const FString& Path, const FCloudWeatherMapDesc& Desc, TFunctionRef<FColor(int32 X, int32 Y)> Texel)
+{
+	const FString TempPath = Path + TEXT(".tmp");
+	{
+		TUniquePtr<FArchive> Writer(IFileManager::Get().CreateFileWriter(*TempPath));
+		if (!Writer)
+		{
+			UE_LOG(LogClouds, Warning, TEXT("Failed to write cloud weather map %s"), *TempPath);
+			return false;
+		}
+
+		auto PadTo = [&Writer](int64 Offset)
+		{
+			static const uint8 Zeros[4096] = {};
+			while (Writer->Tell() < Offset)
+			{
+				Writer->Serialize(const_cast<uint8*>(Zeros), FMath::Min<int64>(Offset - Writer->Tell(), sizeof(Zeros)));
+			}
+		};
+
+		FCloudWeatherMapHeader Header;
+		Header.Magic = CloudWeatherMapMagic;
+		Header.Version = CloudWeatherMapVersion;
+		Header.TileResolution = Desc.TileResolution;
+		Header.NumTilesX = Desc.NumTiles.X;
+		Header.NumTilesY = Desc.NumTiles.Y;
+		Header.TileWorldSize = Desc.TileWorldSize;
+		Header.OriginX = Desc.Origin.X;
+		Header.OriginY = Desc.Origin.Y;
+		Header.OverviewResolution = Desc.OverviewResolution;
+		Writer->Serialize(&Header, sizeof(Header));
+
+		// The overview averages a 4x4 grid of texels in the footprint of each overview texel.
+		const FIntPoint MapSize = Desc.NumTiles * Desc.TileResolution;
+		TArray<FColor> Overview;
+		Overview.SetNumUninitialized(Desc.OverviewResolution * Desc.OverviewResolution);
+		ParallelFor(Desc.OverviewResolution, [&](int32 Y)
+		{
+			for (int32 X = 0; X < Desc.OverviewResolution; ++X)
+			{
+				FVector4f Sum = FVector4f::Zero();
+				for (int32 SampleIndex = 0; SampleIndex < 16; ++SampleIndex)
+				{
+					const int32 SX = int32((X + ((SampleIndex & 3) + 0.5f) / 4.0f) * MapSize.X / Desc.OverviewResolution);
+					const int32 SY = int32((Y + ((SampleIndex >> 2) + 0.5f) / 4.0f) * MapSize.Y / Desc.OverviewResolution);
+					const FColor Sample = Texel(SX, SY);
+					Sum += FVector4f(Sample.R, Sample.G, Sample.B, Sample.A);
+				}
+				Sum /= 16.0f;
+				Overview[Y * Desc.OverviewResolution + X] = FColor(FMath::RoundToInt(Sum.X), FMath::RoundToInt(Sum.Y), FMath::RoundToInt(Sum.Z), FMath::RoundToInt(Sum.W));
+			}
+		});
+
+		PadTo(Desc.GetOverviewOffset());
+		Writer->Serialize(Overview.GetData(), Overview.Num() * sizeof(FColor));
+
+		// Tiles are generated one row at a time to bound the memory use on large maps.
+		const int32 TexelsPerTile = Desc.TileResolution * Desc.TileResolution;
+		TArray<FColor> RowTexels;
+		RowTexels.SetNumUninitialized(Desc.NumTiles.X * TexelsPerTile);
+
+		for (int32 TileY = 0; TileY < Desc.NumTiles.Y; ++TileY)
+		{
+			ParallelFor(Desc.NumTiles.X, [&](int32 TileX)
+			{
+				FColor* TileTexels = &RowTexels[TileX * TexelsPerTile];
+				for (int32 Y = 0; Y < Desc.TileResolution; ++Y)
+				{
+					for (int32 X = 0; X < Desc.TileResolution; ++X)
+					{
+						TileTexels[Y * Desc.TileResolution + X] = Texel(TileX * Desc.TileResolution + X, TileY * Desc.TileResolution + Y);
+					}
+				}
+			});
+
+			for (int32 TileX = 0; TileX < Desc.NumTiles.X; ++TileX)
+			{
+				PadTo(Desc.GetTileOffset(FIntPoint(TileX, TileY)));
+				Writer->Serialize(&RowTexels[TileX * TexelsPerTile], TexelsPerTile * sizeof(FColor));
+			}
+		}
+
+		if (Writer->IsError())
+		{
+			UE_LOG(LogClouds, Warning, TEXT("Failed to write cloud weather map %s"), *TempPath);
+			return false;
+		}
+	}
+
+	return IFileManager::Get().Move(*Path, *TempPath);
+}
+
+static float WeatherFbm(const FVector2D& Position, int32 NumOctaves)
+{
+	float Sum = 0.0f;
+	float Amplitude = 0.5f;
+	FVector2D P = Position;
+	for (int32 Octave = 0; Octave < NumOctaves; ++Octave)
+	{
+		Sum += FMath::PerlinNoise2D(P) * Amplitude;
+		Amplitude *= 0.5f;
+		P *= 2.0;
+	}
+	return Sum;
+}
+
+FString BakeOrFindProceduralWeatherMap()
+{
+	const FString Path = FPaths::Combine(FPaths::ProjectSavedDir(), TEXT("Clouds"), TEXT("Weather"), FString::Printf(TEXT("Procedural_v%u.cwm"), CloudWeatherMapVersion));
+	if (IFileManager::Get().FileExists(*Path))
+	{
+		return Path;
+	}
+
+	const double StartTime = FPlatformTime::Seconds();
+
+	const FCloudWeatherMapDesc Desc;
+	const float TexelWorldSize = Desc.TileWorldSize / Desc.TileResolution;
+
+	// Coverage varies over ~20 km, cloud type over ~40 km, and it rains under dense towering clouds.
+	const bool bWritten = WriteWeatherMap(Path, Desc, [TexelWorldSize](int32 X, int32 Y)
+	{
+		const FVector2D Position(X * TexelWorldSize, Y * TexelWorldSize);
+		const float Coverage = FMath::Clamp(0.55f + 1.2f * WeatherFbm(Position / 2000000.0, 4), 0.0f, 1.0f);
+		const float Type = FMath::Clamp(0.5f + 1.4f * WeatherFbm(Position / 4000000.0 + FVector2D(17.3, 41.9), 2), 0.0f, 1.0f);
+		const float Precipitation = FMath::Clamp((Coverage - 0.7f) * 3.0f, 0.0f, 1.0f) * Type;
+		return FColor(
+			uint8(FMath::RoundToInt(Coverage * 255.0f)),
+			uint8(FMath::RoundToInt(Type * 255.0f)),
+			uint8(FMath::RoundToInt(Precipitation * 255.0f)),
+			255);
+	});
+
+	if (bWritten)
+	{
+		UE_LOG(LogClouds, Log, TEXT("Baked %dx%d tile procedural cloud weather map in %.2f s"), Desc.NumTiles.X, Desc.NumTiles.Y, FPlatformTime::Seconds() - StartTime);
+	}
+	return bWritten ? Path : FString();
+}
+
+} // namespace CloudWeather
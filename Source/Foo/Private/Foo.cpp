@@ -2,7 +2,9 @@
 
 #include "Foo.h"
 #include "Interfaces/IPluginManager.h"
+#include "Async/Async.h"
 #include "CloudSceneViewExtension.h"
+#include "CloudStats.h"
 
 #define LOCTEXT_NAMESPACE "FFooModule"
 
@@ -17,7 +19,15 @@ void FFooModule::StartupModule()
 	{
 		check(GEngine);
 		CloudSceneViewExtension = FSceneViewExtensions::NewExtension<FCloudSceneViewExtension>();
-		UE_LOG(LogTemp, Warning, TEXT("Init done ========"));
+		UE_LOG(LogClouds, Log, TEXT("Cloud scene view extension registered"));
+
+		// The global shaders are only available once the engine is up. Precaching every permutation
+		// now keeps pipeline state compiles off the first frames that render clouds.
+		ENQUEUE_RENDER_COMMAND(PrecacheCloudPipelineStates)(
+			[](FRHICommandListImmediate&)
+			{
+				FCloudSceneViewExtension::PrecachePipelineStates(GetGlobalShaderMap(GMaxRHIFeatureLevel));
+			});
 	});
 #endif
 }
@@ -29,6 +39,72 @@ void FFooModule::ShutdownModule()
 	//CloudSceneViewExtension.Reset();
 }
 
+// ================================================================================================
+
+TSharedPtr<const FCloudQueryScene> FFooModule::GetCloudQueryScene() const
+{
+	check(IsInGameThread());
+	return CloudSceneViewExtension.IsValid() ? CloudSceneViewExtension->GetQueryScene_GameThread() : TSharedPtr<const FCloudQueryScene>();
+}
+
+void FFooModule::QueryCloudDensity(TConstArrayView<FVector> Points, TArrayView<float> OutDensity) const
+{
+	check(Points.Num() == OutDensity.Num());
+	if (TSharedPtr<const FCloudQueryScene> Scene = GetCloudQueryScene())
+	{
+		Scene->QueryDensity(Points, OutDensity);
+	}
+	else
+	{
+		FMemory::Memzero(OutDensity.GetData(), OutDensity.Num() * sizeof(float));
+	}
+}
+
+void FFooModule::QueryCloudTransmittance(TConstArrayView<FCloudQuerySegment> Segments, TArrayView<float> OutTransmittance) const
+{
+	check(Segments.Num() == OutTransmittance.Num());
+	if (TSharedPtr<const FCloudQueryScene> Scene = GetCloudQueryScene())
+	{
+		Scene->QueryTransmittance(Segments, OutTransmittance);
+	}
+	else
+	{
+		for (float& Transmittance : OutTransmittance)
+		{
+			Transmittance = 1.0f;
+		}
+	}
+}
+
+TFuture<TArray<float>> FFooModule::QueryCloudDensityAsync(TArray<FVector> Points) const
+{
+	// The scene is captured now, so the game thread can keep changing the clouds meanwhile.
+	return Async(EAsyncExecution::TaskGraph, [Scene = GetCloudQueryScene(), Points = MoveTemp(Points)]()
+	{
+		TArray<float> Density;
+		Density.SetNumZeroed(Points.Num());
+		if (Scene.IsValid())
+		{
+			Scene->QueryDensity(Points, Density);
+		}
+		return Density;
+	});
+}
+
+TFuture<TArray<float>> FFooModule::QueryCloudTransmittanceAsync(TArray<FCloudQuerySegment> Segments) const
+{
+	return Async(EAsyncExecution::TaskGraph, [Scene = GetCloudQueryScene(), Segments = MoveTemp(Segments)]()
+	{
+		TArray<float> Transmittance;
+		Transmittance.Init(1.0f, Segments.Num());
+		if (Scene.IsValid())
+		{
+			Scene->QueryTransmittance(Segments, Transmittance);
+		}
+		return Transmittance;
+	});
+}
+
 #undef LOCTEXT_NAMESPACE
 	
 IMPLEMENT_MODULE(FFooModule, Foo)
\ No newline at end of file
@@ -16,3 +16,18 @@ void UFooBlueprintLibrary::DrawToRenderTarget(
 		WorldContextObject->GetWorld(),
 		OutputRenderTarget);
 }
+
+
+// static
+void UFooBlueprintLibrary::DrawToRenderTargets(
+	const UObject* WorldContextObject,
+	const TArray<FDrawToTargetParams>& Params,
+	const TArray<class UTextureRenderTarget2D*>& OutputRenderTargets,
+	bool bSkipUnchanged)
+{
+	FDrawToTargetParams::DrawToRenderTargets(
+		WorldContextObject->GetWorld(),
+		Params,
+		OutputRenderTargets,
+		bSkipUnchanged);
+}
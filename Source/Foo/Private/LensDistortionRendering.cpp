@@ -1,19 +1,23 @@
 // ================================================================================================
 
 #include "LensDistortionAPI.h"
+#include "CloudStats.h"
 
 #include "Engine/TextureRenderTarget2D.h"
 #include "Engine/World.h"
 #include "GlobalShader.h"
-#include "PipelineStateCache.h"
+#include "PixelShaderUtils.h"
 #include "ProfilingDebugging/RealtimeGPUProfiler.h"
+#include "RenderGraphBuilder.h"
+#include "RenderGraphUtils.h"
 #include "RHIStaticStates.h"
 #include "SceneInterface.h"
-#include "ShaderParameterUtils.h"
+#include "ShaderParameterStruct.h"
 #include "Logging/MessageLog.h"
 #include "TextureResource.h"
 #include "DataDrivenShaderPlatformInfo.h"
 #include "RenderingThread.h"
+#include "UObject/ObjectKey.h"
 
 
 #define LOCTEXT_NAMESPACE "FooPlugin"
@@ -28,15 +32,58 @@ struct FCompiledParams
 {
 	FDrawToTargetParams OriginalParams;
 
-	//
+	/** Game time seen by the shader, sampled on the game thread when the draw was issued. */
+	float Time = 0.0f;
 };
 
+/** A single target of a batched draw. */
+struct FDrawToTargetItem
+{
+	FCompiledParams CompiledParams;
+	FTextureRenderTargetResource* RenderTargetResource = nullptr;
+};
+
+// ================================================================================================
+
+static TAutoConsoleVariable<int32> CVarDrawToRenderTargetAsyncCompute(
+	TEXT("r.Clouds.DrawToRenderTarget.AsyncCompute"),
+	1,
+	TEXT("Whether DrawToRenderTarget runs on the async compute queue for render targets that support UAVs."),
+	ECVF_RenderThreadSafe);
+
+// ================================================================================================
+
+BEGIN_SHADER_PARAMETER_STRUCT(FFullScreenParameters,)
+	SHADER_PARAMETER(FVector2f, PixelUVSize)
+	SHADER_PARAMETER(FVector2f, Scale)
+	SHADER_PARAMETER(float, SystemTime)
+END_SHADER_PARAMETER_STRUCT()
+
+static void SetupFullScreenParameters(
+	FFullScreenParameters& OutParameters,
+	const FCompiledParams& CompiledParams,
+	const FIntPoint& TargetResolution)
+{
+	OutParameters.PixelUVSize = FVector2f(1.0f / float(TargetResolution.X), 1.0f / float(TargetResolution.Y));
+	OutParameters.Scale = FVector2f(CompiledParams.OriginalParams.Scale);
+	OutParameters.SystemTime = CompiledParams.Time;
+}
+
 // ================================================================================================
 
-class FFullScreenShader : public FGlobalShader
+class FFullScreenCS : public FGlobalShader
 {
-	DECLARE_INLINE_TYPE_LAYOUT(FFullScreenShader, NonVirtual);
 public:
+	DECLARE_GLOBAL_SHADER(FFullScreenCS);
+	SHADER_USE_PARAMETER_STRUCT(FFullScreenCS, FGlobalShader);
+
+	static constexpr int32 ThreadGroupSize = 8;
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+		SHADER_PARAMETER_STRUCT_INCLUDE(FFullScreenParameters, Common)
+		SHADER_PARAMETER(FIntPoint, TargetResolution)
+		SHADER_PARAMETER_RDG_TEXTURE_UAV(RWTexture2D<float4>, Output)
+	END_SHADER_PARAMETER_STRUCT()
 
 	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
 	{
@@ -46,155 +93,194 @@ public:
 	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
 	{
 		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("THREADGROUP_SIZE"), ThreadGroupSize);
 	}
-
-	FFullScreenShader() {}
-
-	FFullScreenShader(const ShaderMetaType::CompiledShaderInitializerType& Initializer)
-		: FGlobalShader(Initializer)
-	{
-		PixelUVSize.Bind(Initializer.ParameterMap, TEXT("PixelUVSize"));
-		Scale.Bind(Initializer.ParameterMap, TEXT("Scale"));
-		SystemTime.Bind(Initializer.ParameterMap, TEXT("SystemTime"));
-	}
-
-	void SetParameters(
-		FRHIBatchedShaderParameters& BatchedParameters,
-		const FCompiledParams& CompiledParams,
-		const FIntPoint& TargetResolution)
-	{
-		FVector2f PixelUVSizeValue(1.0f / float(TargetResolution.X), 1.0f / float(TargetResolution.Y));
-
-		FVector2f ScaleValue(CompiledParams.OriginalParams.Scale);
-
-		float SystemTimeValue = FApp::GetGameTime();
-		UE_LOG(LogTemp, Warning, TEXT("time %f"), SystemTimeValue);
-
-		SetShaderValue(BatchedParameters, PixelUVSize, PixelUVSizeValue);
-		SetShaderValue(BatchedParameters, Scale, ScaleValue);
-		SetShaderValue(BatchedParameters, SystemTime, SystemTimeValue);
-	}
-
-private:
-
-	LAYOUT_FIELD(FShaderParameter, PixelUVSize);
-	LAYOUT_FIELD(FShaderParameter, Scale);
-	LAYOUT_FIELD(FShaderParameter, SystemTime);
 };
 
-
 // ================================================================================================
 
-class FFullScreenVS : public FFullScreenShader
+/** Raster fallback for render targets created without UAV support. */
+class FFullScreenPS : public FGlobalShader
 {
-	DECLARE_SHADER_TYPE(FFullScreenVS, Global);
 public:
+	DECLARE_GLOBAL_SHADER(FFullScreenPS);
+	SHADER_USE_PARAMETER_STRUCT(FFullScreenPS, FGlobalShader);
 
-	FFullScreenVS() {}
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+		SHADER_PARAMETER_STRUCT_INCLUDE(FFullScreenParameters, Common)
+		RENDER_TARGET_BINDING_SLOTS()
+	END_SHADER_PARAMETER_STRUCT()
 
-	FFullScreenVS(const ShaderMetaType::CompiledShaderInitializerType& Initializer)
-		: FFullScreenShader(Initializer)
+	static bool ShouldCompilePermutation(const FGlobalShaderPermutationParameters& Parameters)
 	{
+		return IsFeatureLevelSupported(Parameters.Platform, ERHIFeatureLevel::SM5);
 	}
 };
 
 // ================================================================================================
 
-class FFullScreenPS : public FFullScreenShader
-{
-	DECLARE_SHADER_TYPE(FFullScreenPS, Global);
-public:
+IMPLEMENT_GLOBAL_SHADER(FFullScreenCS, "/Plugin/Foo/Private/MyShader.usf", "MainCS", SF_Compute);
+IMPLEMENT_GLOBAL_SHADER(FFullScreenPS, "/Plugin/Foo/Private/MyShader.usf", "MainPS", SF_Pixel);
 
-	FFullScreenPS() {}
+// ================================================================================================
 
-	FFullScreenPS(const ShaderMetaType::CompiledShaderInitializerType& Initializer)
-		: FFullScreenShader(Initializer)
+static void AddDrawToRenderTargetPass(
+	FRDGBuilder& GraphBuilder,
+	const FGlobalShaderMap* GlobalShaderMap,
+	const FDrawToTargetItem& Item,
+	bool bAsyncCompute)
+{
+	const FCompiledParams& CompiledParams = Item.CompiledParams;
+
+	if (CVarCloudsDebug.GetValueOnRenderThread() > 1)
 	{
+		UE_LOG(LogClouds, Log, TEXT("DrawToRenderTarget %s: Blah %f Scale %s"),
+			*Item.RenderTargetResource->GetFriendlyName(), CompiledParams.OriginalParams.Blah, *CompiledParams.OriginalParams.Scale.ToString());
 	}
-};
 
-// ================================================================================================
+	FRDGTextureRef RenderTarget = GraphBuilder.RegisterExternalTexture(
+		CreateRenderTarget(Item.RenderTargetResource->GetRenderTargetTexture(), TEXT("DrawToRenderTarget")));
 
-IMPLEMENT_SHADER_TYPE(, FFullScreenVS, TEXT("/Plugin/Foo/Private/MyShader.usf"), TEXT("MainVS"), SF_Vertex)
-IMPLEMENT_SHADER_TYPE(, FFullScreenPS, TEXT("/Plugin/Foo/Private/MyShader.usf"), TEXT("MainPS"), SF_Pixel)
+	const FIntPoint TargetResolution = RenderTarget->Desc.Extent;
+
+	if (EnumHasAnyFlags(RenderTarget->Desc.Flags, TexCreate_UAV))
+	{
+		FFullScreenCS::FParameters* PassParameters = GraphBuilder.AllocParameters<FFullScreenCS::FParameters>();
+		SetupFullScreenParameters(PassParameters->Common, CompiledParams, TargetResolution);
+		PassParameters->TargetResolution = TargetResolution;
+		PassParameters->Output = GraphBuilder.CreateUAV(RenderTarget);
+
+		TShaderMapRef<FFullScreenCS> ComputeShader(GlobalShaderMap);
+		FComputeShaderUtils::AddPass(
+			GraphBuilder,
+			RDG_EVENT_NAME("DrawToRenderTarget(Compute) %dx%d", TargetResolution.X, TargetResolution.Y),
+			bAsyncCompute ? ERDGPassFlags::AsyncCompute : ERDGPassFlags::Compute,
+			ComputeShader,
+			PassParameters,
+			FComputeShaderUtils::GetGroupCount(TargetResolution, FFullScreenCS::ThreadGroupSize));
+	}
+	else
+	{
+		FFullScreenPS::FParameters* PassParameters = GraphBuilder.AllocParameters<FFullScreenPS::FParameters>();
+		SetupFullScreenParameters(PassParameters->Common, CompiledParams, TargetResolution);
+		PassParameters->RenderTargets[0] = FRenderTargetBinding(RenderTarget, ERenderTargetLoadAction::ENoAction);
+
+		TShaderMapRef<FFullScreenPS> PixelShader(GlobalShaderMap);
+		FPixelShaderUtils::AddFullscreenPass(
+			GraphBuilder,
+			GlobalShaderMap,
+			RDG_EVENT_NAME("DrawToRenderTarget(Raster) %dx%d", TargetResolution.X, TargetResolution.Y),
+			PixelShader,
+			PassParameters,
+			FIntRect(FIntPoint::ZeroValue, TargetResolution));
+	}
+
+	// Render targets are sampled as textures by whoever consumes them.
+	GraphBuilder.SetTextureAccessFinal(RenderTarget, ERHIAccess::SRVMask);
+}
 
 // ================================================================================================
 
-static void DrawToRenderTarget_RenderThread(
+static void DrawToRenderTargets_RenderThread(
 	FRHICommandListImmediate& RHICmdList,
-	const FCompiledParams& CompiledParams,
-	FTextureRenderTargetResource* OutTextureRenderTargetResource,
+	TConstArrayView<FDrawToTargetItem> Items,
 	ERHIFeatureLevel::Type FeatureLevel)
 {
 	check(IsInRenderingThread());
 
-	SCOPED_DRAW_EVENT(RHICmdList, DrawToRenderTarget_RenderThread);
+	SCOPE_CYCLE_COUNTER(STAT_CloudsDrawToRenderTarget);
 
-	FRHITexture2D* RenderTargetTexture = OutTextureRenderTargetResource->GetRenderTargetTexture();
+	const bool bAsyncCompute = GSupportsEfficientAsyncCompute && CVarDrawToRenderTargetAsyncCompute.GetValueOnRenderThread() != 0;
+	const FGlobalShaderMap* GlobalShaderMap = GetGlobalShaderMap(FeatureLevel);
 
-	RHICmdList.Transition(FRHITransitionInfo(RenderTargetTexture, ERHIAccess::SRVMask, ERHIAccess::RTV));
-
-	FRHIRenderPassInfo RPInfo(RenderTargetTexture, ERenderTargetActions::DontLoad_Store);
-	RHICmdList.BeginRenderPass(RPInfo, TEXT("Draw"));
+	// All targets go through one graph, so RDG batches their barriers and can overlap the async compute passes with graphics work.
+	FRDGBuilder GraphBuilder(RHICmdList, RDG_EVENT_NAME("DrawToRenderTargets %d", Items.Num()));
 	{
-		FIntPoint TargetResolution(OutTextureRenderTargetResource->GetSizeX(), OutTextureRenderTargetResource->GetSizeY());
+		RDG_GPU_STAT_SCOPE(GraphBuilder, CloudsDrawToRenderTarget);
 
-		// Update viewport.
-		RHICmdList.SetViewport(0, 0, 0.f, TargetResolution.X, TargetResolution.Y, 1.0f);
+		for (const FDrawToTargetItem& Item : Items)
+		{
+			AddDrawToRenderTargetPass(GraphBuilder, GlobalShaderMap, Item, bAsyncCompute);
+		}
+	}
+	GraphBuilder.Execute();
+}
 
-		// Get shaders.
-		FGlobalShaderMap* GlobalShaderMap = GetGlobalShaderMap(FeatureLevel);
-		TShaderMapRef< FFullScreenVS > VertexShader(GlobalShaderMap);
-		TShaderMapRef< FFullScreenPS > PixelShader(GlobalShaderMap);
+// ================================================================================================
 
-		// Set the graphic pipeline state.
-		FGraphicsPipelineStateInitializer GraphicsPSOInit;
-		RHICmdList.ApplyCachedRenderTargets(GraphicsPSOInit);
+/**
+ * Game thread record of the inputs each render target was last drawn with, so that draws
+ * that would produce the same content can be skipped.
+ */
+class FDrawToTargetHistory
+{
+public:
+	/** Records the draw and returns false if the target already holds the result of these inputs. */
+	bool Update(UTextureRenderTarget2D* RenderTarget, uint32 DrawHash)
+	{
+		uint32& LastHash = LastDrawHashes.FindOrAdd(RenderTarget, ~DrawHash);
+		const bool bChanged = LastHash != DrawHash;
+		LastHash = DrawHash;
+		return bChanged;
+	}
 
-		GraphicsPSOInit.DepthStencilState = TStaticDepthStencilState<false, CF_Always>::GetRHI();
-		GraphicsPSOInit.BlendState = TStaticBlendState<>::GetRHI();
-		GraphicsPSOInit.RasterizerState = TStaticRasterizerState<>::GetRHI();
-		GraphicsPSOInit.PrimitiveType = PT_TriangleList;
-		GraphicsPSOInit.BoundShaderState.VertexDeclarationRHI = GetVertexDeclarationFVector4();
-		GraphicsPSOInit.BoundShaderState.VertexShaderRHI = VertexShader.GetVertexShader();
-		GraphicsPSOInit.BoundShaderState.PixelShaderRHI = PixelShader.GetPixelShader();
+	/** Forgets render targets that were garbage collected, amortized over the growth of the map. */
+	void Prune()
+	{
+		if (LastDrawHashes.Num() < PruneThreshold)
+		{
+			return;
+		}
 
-		SetGraphicsPipelineState(RHICmdList, GraphicsPSOInit, 0);
+		for (auto It = LastDrawHashes.CreateIterator(); It; ++It)
+		{
+			if (!It.Key().ResolveObjectPtr())
+			{
+				It.RemoveCurrent();
+			}
+		}
+		PruneThreshold = FMath::Max(MinPruneThreshold, LastDrawHashes.Num() * 2);
+	}
 
-		// Update viewport.
-		RHICmdList.SetViewport(
-			0, 0, 0.0f,
-			OutTextureRenderTargetResource->GetSizeX(), OutTextureRenderTargetResource->GetSizeY(), 1.0f);
+private:
+	static constexpr int32 MinPruneThreshold = 256;
 
-		// Update shader uniform parameters.
-		SetShaderParametersLegacyVS(RHICmdList, VertexShader, CompiledParams, TargetResolution);
-		SetShaderParametersLegacyPS(RHICmdList, PixelShader, CompiledParams, TargetResolution);
+	TMap<TObjectKey<UTextureRenderTarget2D>, uint32> LastDrawHashes;
+	int32 PruneThreshold = MinPruneThreshold;
+};
 
-		// Draw grid.
-		RHICmdList.DrawPrimitive(0, 2, 1);
-	}
-	RHICmdList.EndRenderPass();
+static FDrawToTargetHistory GDrawToTargetHistory;
 
-	RHICmdList.Transition(FRHITransitionInfo(RenderTargetTexture, ERHIAccess::RTV, ERHIAccess::SRVMask));
+static uint32 GetDrawHash(const FCompiledParams& CompiledParams, const FTextureRenderTargetResource* Resource)
+{
+	uint32 Hash = GetTypeHash(CompiledParams.OriginalParams);
+	Hash = HashCombine(Hash, GetTypeHash(CompiledParams.Time));
+	Hash = HashCombine(Hash, PointerHash(Resource));
+	Hash = HashCombine(Hash, GetTypeHash(Resource->GetSizeXY()));
+	return Hash;
 }
 
 // ================================================================================================
 
 void FDrawToTargetParams::DrawToRenderTarget(UWorld* World, UTextureRenderTarget2D* OutputRenderTarget) const
+{
+	DrawToRenderTargets(World, MakeArrayView(this, 1), MakeArrayView(&OutputRenderTarget, 1), false);
+}
+
+void FDrawToTargetParams::DrawToRenderTargets(
+	UWorld* World,
+	TArrayView<const FDrawToTargetParams> Params,
+	TArrayView<UTextureRenderTarget2D* const> OutputRenderTargets,
+	bool bSkipUnchanged)
 {
 	check(IsInGameThread());
 
-	if (!OutputRenderTarget)
+	if (Params.Num() != 1 && Params.Num() != OutputRenderTargets.Num())
 	{
-		FMessageLog("Blueprint").Warning(LOCTEXT("OutputTargetRequired", "DrawToRenderTarget: Output render target is required."));
+		FMessageLog("Blueprint").Warning(LOCTEXT("ParamsCountMismatch", "DrawToRenderTargets: Expected one params entry per render target, or a single shared one."));
 		return;
 	}
 
-	FCompiledParams CompiledParams;
-	CompiledParams.OriginalParams = *this;
-
-	FTextureRenderTargetResource* TextureRenderTargetResource = OutputRenderTarget->GameThread_GetRenderTargetResource();
-
 	ERHIFeatureLevel::Type FeatureLevel = World->Scene->GetFeatureLevel();
 
 	if (FeatureLevel < ERHIFeatureLevel::SM5)
@@ -203,13 +289,51 @@ void FDrawToTargetParams::DrawToRenderTarget(UWorld* World, UTextureRenderTarget
 		return;
 	}
 
+	const float GameTime = FApp::GetGameTime();
+
+	TArray<FDrawToTargetItem> Items;
+	Items.Reserve(OutputRenderTargets.Num());
+
+	for (int32 Index = 0; Index < OutputRenderTargets.Num(); ++Index)
+	{
+		UTextureRenderTarget2D* OutputRenderTarget = OutputRenderTargets[Index];
+		if (!OutputRenderTarget)
+		{
+			FMessageLog("Blueprint").Warning(LOCTEXT("OutputTargetRequired", "DrawToRenderTarget: Output render target is required."));
+			continue;
+		}
+
+		FTextureRenderTargetResource* TextureRenderTargetResource = OutputRenderTarget->GameThread_GetRenderTargetResource();
+		if (!TextureRenderTargetResource)
+		{
+			continue;
+		}
+
+		FDrawToTargetItem& Item = Items.AddDefaulted_GetRef();
+		Item.CompiledParams.OriginalParams = Params[Params.Num() == 1 ? 0 : Index];
+		Item.CompiledParams.Time = Item.CompiledParams.OriginalParams.bAnimated ? GameTime : 0.0f;
+		Item.RenderTargetResource = TextureRenderTargetResource;
+
+		const bool bChanged = GDrawToTargetHistory.Update(OutputRenderTarget, GetDrawHash(Item.CompiledParams, TextureRenderTargetResource));
+		if (bSkipUnchanged && !bChanged)
+		{
+			Items.Pop(false);
+		}
+	}
+
+	GDrawToTargetHistory.Prune();
+
+	if (Items.IsEmpty())
+	{
+		return;
+	}
+
 	ENQUEUE_RENDER_COMMAND(CaptureCommand)(
-		[CompiledParams, TextureRenderTargetResource, FeatureLevel](FRHICommandListImmediate& RHICmdList)
+		[Items = MoveTemp(Items), FeatureLevel](FRHICommandListImmediate& RHICmdList)
 		{
-			DrawToRenderTarget_RenderThread(
+			DrawToRenderTargets_RenderThread(
 				RHICmdList,
-				CompiledParams,
-				TextureRenderTargetResource,
+				Items,
 				FeatureLevel);
 		}
 	);
@@ -0,0 +1,177 @@
+#include "CloudBudgetController.h"
+
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace CloudBudgetControllerTests
+{
+
+static FCloudBudgetSettings MakeSettings()
+{
+	FCloudBudgetSettings Settings;
+	Settings.BudgetMs = 2.0f;
+	Settings.Hysteresis = 0.15f;
+	Settings.Smoothing = 0.2f;
+	Settings.SettleFrames = 8;
+	return Settings;
+}
+
+/**
+ * Synthetic GPU timing trace: the scene costs SceneMs at the best level and the others scale with their
+ * relative cost, like the controller predicts, plus uniform noise of +-Noise as a fraction of the time.
+ * Returns the level after every frame.
+ */
+static TArray<int32> RunTrace(FCloudBudgetController& Controller, float SceneMs, int32 NumFrames, float Noise = 0.0f, int32 Seed = 0)
+{
+	FRandomStream Random(Seed);
+	const float BestCost = Controller.GetLevels()[0].RelativeCost;
+
+	TArray<int32> Levels;
+	for (int32 Frame = 0; Frame < NumFrames; ++Frame)
+	{
+		const float GpuMs = SceneMs * Controller.GetQuality().RelativeCost / BestCost * (1.0f + Random.FRandRange(-Noise, Noise));
+		Levels.Add(Controller.AddFrameTime(GpuMs));
+	}
+	return Levels;
+}
+
+static int32 CountLevelChanges(TConstArrayView<int32> Levels, int32 PreviousLevel)
+{
+	int32 NumChanges = 0;
+	for (int32 Level : Levels)
+	{
+		NumChanges += Level != PreviousLevel ? 1 : 0;
+		PreviousLevel = Level;
+	}
+	return NumChanges;
+}
+
+/** Time the scene takes at a level of the controller. */
+static float GetLevelMs(const FCloudBudgetController& Controller, float SceneMs, int32 Level)
+{
+	return SceneMs * Controller.GetLevels()[Level].RelativeCost / Controller.GetLevels()[0].RelativeCost;
+}
+
+} // namespace CloudBudgetControllerTests
+
+// ================================================================================================
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FCloudBudgetStepTest, "Plugins.Foo.Clouds.Budget.StepOverBudget", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FCloudBudgetStepTest::RunTest(const FString& Parameters)
+{
+	using namespace CloudBudgetControllerTests;
+
+	FCloudBudgetController Controller;
+	Controller.SetSettings(MakeSettings());
+
+	const TArray<int32> Before = RunTrace(Controller, 1.5f, 30);
+	TestEqual(TEXT("Under budget the best level is kept"), CountLevelChanges(Before, 0), 0);
+
+	// The scene gets four times as expensive, e.g. the camera flies into the clouds.
+	static constexpr float SceneMs = 6.0f;
+	const TArray<int32> After = RunTrace(Controller, SceneMs, 200);
+
+	const int32 FirstDrop = After.IndexOfByPredicate([](int32 Level) { return Level > 0; });
+	TestTrue(TEXT("Over budget a cheaper level is picked within a few frames"), FirstDrop != INDEX_NONE && FirstDrop < 4);
+
+	const int32 FinalLevel = After.Last();
+	const FCloudBudgetSettings& Settings = Controller.GetSettings();
+	TestTrue(TEXT("The final level fits the budget"), GetLevelMs(Controller, SceneMs, FinalLevel) <= Settings.BudgetMs * (1.0f + Settings.Hysteresis));
+	TestTrue(TEXT("The final level is the best one that fits"), FinalLevel == 0 || GetLevelMs(Controller, SceneMs, FinalLevel - 1) > Settings.BudgetMs * (1.0f - Settings.Hysteresis));
+
+	for (int32 Frame = 1; Frame < After.Num(); ++Frame)
+	{
+		if (After[Frame] < After[Frame - 1])
+		{
+			AddError(FString::Printf(TEXT("Frame %d climbed back to level %d while over budget"), Frame, After[Frame]));
+			break;
+		}
+	}
+
+	TestEqual(TEXT("The level is stable once settled"), CountLevelChanges(MakeArrayView(After).Right(100), FinalLevel), 0);
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FCloudBudgetNoiseTest, "Plugins.Foo.Clouds.Budget.NoisyTrace", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FCloudBudgetNoiseTest::RunTest(const FString& Parameters)
+{
+	using namespace CloudBudgetControllerTests;
+
+	// Within the hysteresis band the level never moves, even with every frame off by up to 10%.
+	{
+		FCloudBudgetController Controller;
+		Controller.SetSettings(MakeSettings());
+		Controller.Reset(2);
+
+		const float SceneMs = Controller.GetSettings().BudgetMs / GetLevelMs(Controller, 1.0f, 2);
+		const TArray<int32> Levels = RunTrace(Controller, SceneMs, 500, 0.1f, 1);
+		TestEqual(TEXT("Noise inside the band changes no level"), CountLevelChanges(Levels, 2), 0);
+	}
+
+	// A scene between two levels, one above the band and the next one well below it, must not flip
+	// between them.
+	{
+		FCloudBudgetController Controller;
+		Controller.SetSettings(MakeSettings());
+
+		static constexpr float SceneMs = 5.0f;
+		const TArray<int32> Levels = RunTrace(Controller, SceneMs, 500, 0.1f, 2);
+
+		const int32 FinalLevel = Levels.Last();
+		TestTrue(TEXT("The noisy trace ends within the budget"), GetLevelMs(Controller, SceneMs, FinalLevel) <= Controller.GetSettings().BudgetMs);
+		TestTrue(TEXT("The noisy trace settles after a few changes"), CountLevelChanges(Levels, 0) <= 3);
+		TestEqual(TEXT("The noisy trace does not oscillate once settled"), CountLevelChanges(MakeArrayView(Levels).Right(400), FinalLevel), 0);
+	}
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FCloudBudgetRecoveryTest, "Plugins.Foo.Clouds.Budget.Recovery", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FCloudBudgetRecoveryTest::RunTest(const FString& Parameters)
+{
+	using namespace CloudBudgetControllerTests;
+
+	FCloudBudgetController Controller;
+	Controller.SetSettings(MakeSettings());
+
+	RunTrace(Controller, 40.0f, 100);
+	const int32 SpikeLevel = Controller.GetLevel();
+	TestTrue(TEXT("A heavy spike drops several levels"), SpikeLevel >= 3);
+
+	// The scene gets cheap again: the controller climbs one level at a time, each after settling.
+	const TArray<int32> Levels = RunTrace(Controller, 1.0f, 200);
+	const int32 SettleFrames = Controller.GetSettings().SettleFrames;
+
+	// The spike level had long settled before the scene got cheap.
+	int32 PreviousLevel = SpikeLevel;
+	int32 FramesAtLevel = SettleFrames;
+	for (int32 Frame = 0; Frame < Levels.Num(); ++Frame)
+	{
+		++FramesAtLevel;
+		if (Levels[Frame] == PreviousLevel)
+		{
+			continue;
+		}
+
+		if (Levels[Frame] != PreviousLevel - 1)
+		{
+			AddError(FString::Printf(TEXT("Frame %d went from level %d to %d instead of one level up"), Frame, PreviousLevel, Levels[Frame]));
+		}
+		if (FramesAtLevel < SettleFrames)
+		{
+			AddError(FString::Printf(TEXT("Frame %d left level %d after %d frames, before settling"), Frame, PreviousLevel, FramesAtLevel));
+		}
+		PreviousLevel = Levels[Frame];
+		FramesAtLevel = 0;
+	}
+
+	TestEqual(TEXT("The best level is reached again"), Levels.Last(), 0);
+	TestTrue(TEXT("The best level is reached within the settle time of every level"), Levels.IndexOfByKey(0) != INDEX_NONE && Levels.IndexOfByKey(0) < (SpikeLevel + 1) * SettleFrames);
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
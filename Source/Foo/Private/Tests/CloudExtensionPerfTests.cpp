@@ -0,0 +1,374 @@
+#include "CloudBenchmark.h"
+#include "CloudSceneViewExtension.h"
+
+#include "Misc/AutomationTest.h"
+#include "PostProcess/PostProcessMaterial.h"
+#include "RenderGraphBuilder.h"
+#include "RenderingThread.h"
+#include "SceneRendering.h"
+#include "SystemTextures.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace CloudExtensionPerfTests
+{
+
+using CloudBenchmark::FResult;
+
+static constexpr int32 VolumeCounts[] = { 16, 256, 4096 };
+static constexpr int32 ViewCounts[] = { 1, 2, 4 };
+
+/**
+ * Options from the command line of the session running the tests:
+ *   -CloudsPerfMinTime=0.25      seconds to run every case for at least
+ *   -CloudsPerfBaseline=<Path>   results to compare against, default Saved/Clouds/Benchmark/RenderThreadBaseline.json
+ *   -CloudsPerfUpdateBaseline    writes the results to the baseline instead of checking them
+ *   -CloudsPerfRegression=0.2    fraction a case may be slower than its baseline
+ */
+struct FOptions
+{
+	double MinTime = 0.25;
+	FString BaselinePath = CloudBenchmark::GetDefaultPath(TEXT("RenderThreadBaseline"));
+	float MaxRegression = 0.2f;
+	bool bUpdateBaseline = false;
+
+	FOptions()
+	{
+		FParse::Value(FCommandLine::Get(), TEXT("CloudsPerfMinTime="), MinTime);
+		FParse::Value(FCommandLine::Get(), TEXT("CloudsPerfBaseline="), BaselinePath);
+		FParse::Value(FCommandLine::Get(), TEXT("CloudsPerfRegression="), MaxRegression);
+		bUpdateBaseline = FParse::Param(FCommandLine::Get(), TEXT("CloudsPerfUpdateBaseline"));
+	}
+};
+
+/**
+ * Adds the results to Saved/Clouds/Benchmark/RenderThread.json and .csv for trend tracking, and fails
+ * the test if the baseline is missing or a result is slower than it, see CloudBenchmark::CheckBaseline.
+ */
+static void CheckResults(FAutomationTestBase& Test, const FOptions& Options, TConstArrayView<FResult> Results)
+{
+	for (const FResult& Result : Results)
+	{
+		Test.AddInfo(FString::Printf(TEXT("%s: %.1f ns/sample over %lld samples"), *Result.GetKey(), Result.GetNsPerSample(), Result.NumSamples));
+	}
+
+	if (!CloudBenchmark::MergeResults(CloudBenchmark::GetDefaultPath(TEXT("RenderThread")), Results))
+	{
+		Test.AddError(TEXT("Failed to write the results"));
+	}
+
+	if (Options.bUpdateBaseline)
+	{
+		if (!CloudBenchmark::MergeResults(Options.BaselinePath, Results))
+		{
+			Test.AddError(FString::Printf(TEXT("Failed to write the baseline %s"), *Options.BaselinePath));
+		}
+		return;
+	}
+
+	TArray<FString> Errors;
+	TArray<FString> Warnings;
+	CloudBenchmark::CheckBaseline(Results, Options.BaselinePath, Options.MaxRegression, Errors, Warnings);
+	for (const FString& Warning : Warnings)
+	{
+		Test.AddWarning(Warning);
+	}
+	for (const FString& Error : Errors)
+	{
+		Test.AddError(Error);
+	}
+}
+
+/**
+ * Records the resources and parameters of the cloud passes into the graph but adds none of the passes,
+ * as there are no shaders to dispatch under -nullrhi.
+ */
+class FCloudPerfSceneViewExtension : public FCloudSceneViewExtension
+{
+public:
+	using FCloudSceneViewExtension::FCloudSceneViewExtension;
+
+protected:
+	virtual void AddCloudPasses(TFunctionRef<void()> AddPasses) override
+	{
+	}
+};
+
+/**
+ * Volumes spread over 400 km, seeded by their count so every run sees the same ones. The first one is
+ * in front of the first view, so every case marches clouds.
+ */
+static TArray<FCloudVolume> MakeVolumes(int32 NumVolumes)
+{
+	FRandomStream Random(NumVolumes);
+
+	TArray<FCloudVolume> Volumes;
+	for (int32 Index = 0; Index < NumVolumes; ++Index)
+	{
+		const FVector3f Center = Index == 0 ? FVector3f(20000.0f, 0.0f, 4000.0f)
+			: FVector3f(Random.FRandRange(-200000.0f, 200000.0f), Random.FRandRange(-200000.0f, 200000.0f), Random.FRandRange(2000.0f, 8000.0f));
+		const FVector3f Extent(Random.FRandRange(2000.0f, 10000.0f), Random.FRandRange(2000.0f, 10000.0f), Random.FRandRange(500.0f, 2000.0f));
+
+		FCloudVolume& Volume = Volumes.AddDefaulted_GetRef();
+		Volume.BoundsMin = Center - Extent;
+		Volume.BoundsMax = Center + Extent;
+	}
+	return Volumes;
+}
+
+/** Views of a family are spread around the camera like split screen views. */
+static FSceneViewInitOptions MakeViewInitOptions(FSceneViewFamily& ViewFamily, int32 ViewIndex, int32 NumViews)
+{
+	static constexpr int32 Width = 1280;
+	static constexpr int32 Height = 720;
+	const FRotator Rotation(10.0, 360.0 * ViewIndex / NumViews, 0.0);
+
+	FSceneViewInitOptions InitOptions;
+	InitOptions.ViewFamily = &ViewFamily;
+	InitOptions.SetViewRectangle(FIntRect(0, 0, Width, Height));
+	InitOptions.ViewOrigin = FVector(0.0, 0.0, 200.0);
+
+	// View matrix convention of FSceneView: X forward, Y right, Z up in world space.
+	InitOptions.ViewRotationMatrix = FInverseRotationMatrix(Rotation) * FMatrix(
+		FPlane(0.0, 0.0, 1.0, 0.0),
+		FPlane(1.0, 0.0, 0.0, 0.0),
+		FPlane(0.0, 1.0, 0.0, 0.0),
+		FPlane(0.0, 0.0, 0.0, 1.0));
+	InitOptions.ProjectionMatrix = FReversedZPerspectiveMatrix(UE_HALF_PI * 0.5, double(Width), double(Height), 10.0);
+	return InitOptions;
+}
+
+static void GetViewAndVolumeTests(TArray<FString>& OutBeautifiedNames, TArray<FString>& OutTestCommands)
+{
+	for (int32 NumVolumes : VolumeCounts)
+	{
+		for (int32 NumViews : ViewCounts)
+		{
+			OutBeautifiedNames.Add(FString::Printf(TEXT("Views%d.Volumes%d"), NumViews, NumVolumes));
+			OutTestCommands.Add(FString::Printf(TEXT("%d %d"), NumViews, NumVolumes));
+		}
+	}
+}
+
+} // namespace CloudExtensionPerfTests
+
+// ================================================================================================
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FCloudPerfConstructTest, "Plugins.Foo.Clouds.Perf.ExtensionConstruct", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FCloudPerfConstructTest::RunTest(const FString& Parameters)
+{
+	using namespace CloudExtensionPerfTests;
+
+	const FOptions Options;
+
+	// The first extension bakes the noise cache and the procedural weather map if they are missing, and
+	// brings both into the file cache, so the timed ones do not wait on the disk.
+	{
+		TSharedRef<FCloudSceneViewExtension, ESPMode::ThreadSafe> Extension = FSceneViewExtensions::NewExtension<FCloudSceneViewExtension>();
+		Extension->WaitForBakes_GameThread();
+		FlushRenderingCommands();
+	}
+
+	const FResult Result = CloudBenchmark::Run(TEXT("ExtensionConstruct"), 1, 1, Options.MinTime, [](int32 Begin, int32 End)
+	{
+		TSharedRef<FCloudSceneViewExtension, ESPMode::ThreadSafe> Extension = FSceneViewExtensions::NewExtension<FCloudSceneViewExtension>();
+		Extension->WaitForBakes_GameThread();
+
+		// The render commands of the constructor reference the extension.
+		FlushRenderingCommands();
+		return 0.0f;
+	});
+
+	CheckResults(*this, Options, MakeArrayView(&Result, 1));
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FCloudPerfSubscribeTest, "Plugins.Foo.Clouds.Perf.SubscribeToPostProcessingPass", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FCloudPerfSubscribeTest::RunTest(const FString& Parameters)
+{
+	using namespace CloudExtensionPerfTests;
+
+	const FOptions Options;
+
+	TSharedRef<FCloudSceneViewExtension, ESPMode::ThreadSafe> Extension = FSceneViewExtensions::NewExtension<FCloudSceneViewExtension>();
+	FlushRenderingCommands();
+
+	ISceneViewExtension::FAfterPassCallbackDelegateArray Callbacks;
+	const FResult Result = CloudBenchmark::Run(TEXT("SubscribeToPostProcessingPass"), 1, 1024, Options.MinTime, [&Extension, &Callbacks](int32 Begin, int32 End)
+	{
+		for (int32 Index = Begin; Index < End; ++Index)
+		{
+			Callbacks.Reset();
+			Extension->SubscribeToPostProcessingPass(ISceneViewExtension::EPostProcessingPass::Tonemap, Callbacks, true);
+		}
+		return float(Callbacks.Num());
+	});
+
+	TestEqual(TEXT("The tonemap pass gets one callback"), Callbacks.Num(), 1);
+	CheckResults(*this, Options, MakeArrayView(&Result, 1));
+	return true;
+}
+
+IMPLEMENT_COMPLEX_AUTOMATION_TEST(FCloudPerfVolumeUpdateTest, "Plugins.Foo.Clouds.Perf.VolumeUpdate", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+void FCloudPerfVolumeUpdateTest::GetTests(TArray<FString>& OutBeautifiedNames, TArray<FString>& OutTestCommands) const
+{
+	for (int32 NumVolumes : CloudExtensionPerfTests::VolumeCounts)
+	{
+		OutBeautifiedNames.Add(FString::Printf(TEXT("Volumes%d"), NumVolumes));
+		OutTestCommands.Add(FString::FromInt(NumVolumes));
+	}
+}
+
+bool FCloudPerfVolumeUpdateTest::RunTest(const FString& Parameters)
+{
+	using namespace CloudExtensionPerfTests;
+
+	const FOptions Options;
+	const int32 NumVolumes = FCString::Atoi(*Parameters);
+
+	// The registry the render commands of UpdateCloudVolume_GameThread apply the changes to.
+	TArray<FCloudVolume> Volumes = MakeVolumes(NumVolumes);
+	FCloudVolumeRegistry Registry;
+	for (int32 Index = 0; Index < Volumes.Num(); ++Index)
+	{
+		Registry.Add(Index, Volumes[Index]);
+	}
+
+	// Every volume drifts a little per update, which refits the BVH and rebuilds it now and then.
+	int32 UpdateCount = 0;
+	const FResult Result = CloudBenchmark::Run(*FString::Printf(TEXT("VolumeUpdate/Volumes%d"), NumVolumes), 1, NumVolumes, Options.MinTime, [&Volumes, &Registry, &UpdateCount](int32 Begin, int32 End)
+	{
+		const FVector3f Offset(UpdateCount++ % 2 ? 10.0f : -10.0f, 0.0f, 0.0f);
+		for (int32 Index = Begin; Index < End; ++Index)
+		{
+			Volumes[Index].BoundsMin += Offset;
+			Volumes[Index].BoundsMax += Offset;
+			Registry.Update(Index, Volumes[Index]);
+		}
+		return 0.0f;
+	});
+
+	CheckResults(*this, Options, MakeArrayView(&Result, 1));
+	return true;
+}
+
+IMPLEMENT_COMPLEX_AUTOMATION_TEST(FCloudPerfRenderThreadTest, "Plugins.Foo.Clouds.Perf.RenderThread", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+void FCloudPerfRenderThreadTest::GetTests(TArray<FString>& OutBeautifiedNames, TArray<FString>& OutTestCommands) const
+{
+	CloudExtensionPerfTests::GetViewAndVolumeTests(OutBeautifiedNames, OutTestCommands);
+}
+
+/**
+ * Renders families of NumViews views over NumVolumes volumes through the hooks the renderer calls, and
+ * times the culling and view setup of PreRenderView_RenderThread and the pass setup of
+ * TrianglePass_RenderThread per view. The extension adds none of its passes, so this runs under -nullrhi.
+ */
+bool FCloudPerfRenderThreadTest::RunTest(const FString& Parameters)
+{
+	using namespace CloudExtensionPerfTests;
+
+	const FOptions Options;
+
+	FString ViewsParameter;
+	FString VolumesParameter;
+	Parameters.Split(TEXT(" "), &ViewsParameter, &VolumesParameter);
+	const int32 NumViews = FMath::Max(FCString::Atoi(*ViewsParameter), 1);
+	const int32 NumVolumes = FCString::Atoi(*VolumesParameter);
+
+	TSharedRef<FCloudSceneViewExtension, ESPMode::ThreadSafe> Extension = FSceneViewExtensions::NewExtension<FCloudPerfSceneViewExtension>();
+	Extension->WaitForBakes_GameThread();
+	for (const FCloudVolume& Volume : MakeVolumes(NumVolumes))
+	{
+		Extension->AddCloudVolume_GameThread(Volume);
+	}
+
+	FSceneViewFamily ViewFamily(FSceneViewFamily::ConstructionValues(nullptr, nullptr, FEngineShowFlags(ESFIM_Game)));
+	TArray<TUniquePtr<FViewInfo>> Views;
+	for (int32 ViewIndex = 0; ViewIndex < NumViews; ++ViewIndex)
+	{
+		FViewInfo& View = *Views.Add_GetRef(MakeUnique<FViewInfo>(MakeViewInitOptions(ViewFamily, ViewIndex, NumViews)));
+
+		// The renderer sets this up from the screen percentage, which is 100% here.
+		View.ViewRect = View.UnscaledViewRect;
+		ViewFamily.Views.Add(&View);
+	}
+
+	// Publishes the settings of the frame, like the game thread does before the family renders.
+	Extension->BeginRenderViewFamily(ViewFamily);
+
+	FResult PreRenderView;
+	PreRenderView.Name = FString::Printf(TEXT("PreRenderView/Views%d/Volumes%d"), NumViews, NumVolumes);
+	PreRenderView.NumThreads = 1;
+
+	FResult TrianglePass;
+	TrianglePass.Name = FString::Printf(TEXT("TrianglePass/Views%d/Volumes%d"), NumViews, NumVolumes);
+	TrianglePass.NumThreads = 1;
+
+	int32 NumRenderedViews = 0;
+
+	ENQUEUE_RENDER_COMMAND(CloudPerfRenderThread)(
+		[&](FRHICommandListImmediate& RHICmdList)
+		{
+			GSystemTextures.InitializeTextures(RHICmdList, ViewFamily.GetFeatureLevel());
+
+			// The first family builds the volume BVH and the instance buffer, so it is not timed.
+			const double StartTime = FPlatformTime::Seconds();
+			for (int32 FamilyIndex = 0; FamilyIndex == 0 || FPlatformTime::Seconds() - StartTime < Options.MinTime; ++FamilyIndex)
+			{
+				FRDGBuilder GraphBuilder(RHICmdList);
+				Extension->PreRenderViewFamily_RenderThread(GraphBuilder, ViewFamily);
+
+				double PassStartTime = FPlatformTime::Seconds();
+				for (const TUniquePtr<FViewInfo>& View : Views)
+				{
+					Extension->PreRenderView_RenderThread(GraphBuilder, *View);
+				}
+				const double PreRenderViewSeconds = FPlatformTime::Seconds() - PassStartTime;
+
+				// Scene color as the tonemapper hands it to the extension.
+				TArray<FPostProcessMaterialInputs> Inputs;
+				for (const TUniquePtr<FViewInfo>& View : Views)
+				{
+					FRDGTextureRef SceneColor = GraphBuilder.CreateTexture(
+						FRDGTextureDesc::Create2D(View->ViewRect.Size(), PF_FloatRGBA, FClearValueBinding::Black, TexCreate_ShaderResource | TexCreate_RenderTargetable),
+						TEXT("CloudsPerf.SceneColor"));
+					Inputs.AddDefaulted_GetRef().SetInput(EPostProcessMaterialInput::SceneColor, FScreenPassTexture(SceneColor, View->ViewRect));
+				}
+
+				PassStartTime = FPlatformTime::Seconds();
+				for (int32 ViewIndex = 0; ViewIndex < Views.Num(); ++ViewIndex)
+				{
+					const FScreenPassTexture Output = Extension->TrianglePass_RenderThread(GraphBuilder, *Views[ViewIndex], Inputs[ViewIndex]);
+					NumRenderedViews += Output.Texture != Inputs[ViewIndex].GetInput(EPostProcessMaterialInput::SceneColor).Texture ? 1 : 0;
+				}
+				const double TrianglePassSeconds = FPlatformTime::Seconds() - PassStartTime;
+
+				Extension->PostRenderViewFamily_RenderThread(GraphBuilder, ViewFamily);
+
+				// Only what was recorded is allocated and released: no cloud pass was added to the graph.
+				GraphBuilder.Execute();
+
+				if (FamilyIndex > 0)
+				{
+					PreRenderView.Seconds += PreRenderViewSeconds;
+					PreRenderView.NumSamples += NumViews;
+					TrianglePass.Seconds += TrianglePassSeconds;
+					TrianglePass.NumSamples += NumViews;
+				}
+			}
+		});
+	FlushRenderingCommands();
+
+	// Views without visible volumes pass scene color through untouched.
+	TestTrue(TEXT("Views render clouds"), NumRenderedViews > 0);
+
+	const FResult Results[] = { PreRenderView, TrianglePass };
+	CheckResults(*this, Options, Results);
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
@@ -0,0 +1,148 @@
+#include "CloudOfflineRenderer.h"
+#include "CloudNoiseBaker.h"
+#include "CloudRaymarch.h"
+
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace CloudOfflineRendererTests
+{
+
+/** Random shape and detail noise, so neighbouring pixels and tiles differ. */
+static FCloudMarchSettings MakeSettings()
+{
+	FRandomStream Random(17);
+
+	auto MakeNoise = [&Random](int32 Resolution)
+	{
+		TSharedRef<FCloudNoiseVolume> Noise = MakeShared<FCloudNoiseVolume>();
+		Noise->Resolution = Resolution;
+		Noise->Texels.SetNumUninitialized(Resolution * Resolution * Resolution);
+		for (FColor& Texel : Noise->Texels)
+		{
+			Texel = FColor(uint8(Random.RandRange(0, 255)), uint8(Random.RandRange(0, 255)), uint8(Random.RandRange(0, 255)), uint8(Random.RandRange(0, 255)));
+		}
+		return Noise;
+	};
+
+	FCloudMarchSettings Settings;
+	Settings.ShapeNoise = MakeNoise(16);
+	Settings.DetailNoise = MakeNoise(4);
+	Settings.ShapeFrequency = 1.0f / 1000.0f;
+	Settings.DetailFrequency = 1.0f / 250.0f;
+	Settings.Extinction = 0.002f;
+	return Settings;
+}
+
+/** Two slabs in front of the camera, covering part of the image so tiles differ in cost. */
+static TArray<FCloudVolume> MakeVolumes()
+{
+	TArray<FCloudVolume> Volumes;
+	FCloudVolume& Near = Volumes.AddDefaulted_GetRef();
+	Near.BoundsMin = FVector3f(500.0f, -1500.0f, -200.0f);
+	Near.BoundsMax = FVector3f(1500.0f, 300.0f, 800.0f);
+	FCloudVolume& Far = Volumes.AddDefaulted_GetRef();
+	Far.BoundsMin = FVector3f(1000.0f, -400.0f, -1200.0f);
+	Far.BoundsMax = FVector3f(2500.0f, 2000.0f, 100.0f);
+	return Volumes;
+}
+
+/** A size the tile sizes of the test do not divide, so the last row and column of tiles are partial. */
+static FCloudReferenceCamera MakeCamera()
+{
+	FCloudReferenceCamera Camera;
+	Camera.Size = FIntPoint(67, 41);
+	return Camera;
+}
+
+} // namespace CloudOfflineRendererTests
+
+// ================================================================================================
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FCloudOfflineRendererMatchesReferenceTest, "Plugins.Foo.Clouds.Offline.MatchesReference", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+/**
+ * The first pass of FCloudOfflineRenderer against RenderCloudImage, for one worker, several workers
+ * stealing tiles from each other and one per core, with tiles that divide the image unevenly. Later
+ * passes of several workers are checked against those of a single one.
+ */
+bool FCloudOfflineRendererMatchesReferenceTest::RunTest(const FString& Parameters)
+{
+	using namespace CloudOfflineRendererTests;
+
+	const FCloudMarchSettings Settings = MakeSettings();
+	const TArray<FCloudVolume> Volumes = MakeVolumes();
+	const FCloudReferenceCamera Camera = MakeCamera();
+	const int32 NumPixels = Camera.Size.X * Camera.Size.Y;
+
+	TArray<FLinearColor> Reference;
+	Reference.SetNumUninitialized(NumPixels);
+	CloudRaymarch::RenderCloudImage(Settings, Volumes, Camera, Reference);
+
+	static constexpr int32 NumPasses = 3;
+	static constexpr int32 TileSizes[] = { 7, 32 };
+	static constexpr int32 ThreadCounts[] = { 1, 4, 0 };
+
+	for (int32 TileSize : TileSizes)
+	{
+		TArray<FLinearColor> SingleThreaded;
+		for (int32 NumThreads : ThreadCounts)
+		{
+			const FString Case = FString::Printf(TEXT("Tiles of %d, %d threads"), TileSize, NumThreads);
+
+			FCloudOfflineRenderer Renderer(Settings, Volumes, Camera, TileSize);
+			TArray<FLinearColor> Pixels;
+			Pixels.SetNumUninitialized(NumPixels);
+
+			Renderer.RenderPass(NumThreads);
+			Renderer.Resolve(Pixels);
+
+			// Resolve returns the opacity, RenderCloudImage the transmittance.
+			int32 NumMismatches = 0;
+			for (int32 Index = 0; Index < NumPixels; ++Index)
+			{
+				const FLinearColor& Expected = Reference[Index];
+				const FLinearColor& Actual = Pixels[Index];
+				if (!FMath::IsNearlyEqual(Actual.R, Expected.R, 1e-6f) || !FMath::IsNearlyEqual(Actual.G, Expected.G, 1e-6f)
+					|| !FMath::IsNearlyEqual(Actual.B, Expected.B, 1e-6f) || !FMath::IsNearlyEqual(Actual.A, 1.0f - Expected.A, 1e-6f))
+				{
+					if (++NumMismatches <= 8)
+					{
+						AddError(FString::Printf(TEXT("%s: pixel (%d, %d) is (%f, %f), expected (%f, %f)"), *Case,
+							Index % Camera.Size.X, Index / Camera.Size.X, Actual.R, Actual.A, Expected.R, 1.0f - Expected.A));
+					}
+				}
+			}
+			TestEqual(FString::Printf(TEXT("%s: pixels differing from RenderCloudImage"), *Case), NumMismatches, 0);
+
+			// Every pixel is sampled once per pass whichever worker renders its tile.
+			for (int32 Pass = 1; Pass < NumPasses; ++Pass)
+			{
+				Renderer.RenderPass(NumThreads);
+			}
+			Renderer.Resolve(Pixels);
+
+			if (NumThreads == 1)
+			{
+				SingleThreaded = Pixels;
+				continue;
+			}
+
+			NumMismatches = 0;
+			for (int32 Index = 0; Index < NumPixels; ++Index)
+			{
+				if (Pixels[Index] != SingleThreaded[Index] && ++NumMismatches <= 8)
+				{
+					AddError(FString::Printf(TEXT("%s: pixel (%d, %d) after %d passes differs from a single thread"), *Case,
+						Index % Camera.Size.X, Index / Camera.Size.X, NumPasses));
+				}
+			}
+			TestEqual(FString::Printf(TEXT("%s: pixels differing from a single thread after %d passes"), *Case, NumPasses), NumMismatches, 0);
+		}
+	}
+
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
@@ -0,0 +1,262 @@
+#include "CloudQuery.h"
+#include "CloudNoiseBaker.h"
+#include "CloudRaymarch.h"
+
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace CloudQueryTests
+{
+
+/** Random shape and detail noise, so the density varies along every segment. */
+static FCloudMarchSettings MakeSettings()
+{
+	FRandomStream Random(7);
+
+	auto MakeNoise = [&Random](int32 Resolution)
+	{
+		TSharedRef<FCloudNoiseVolume> Noise = MakeShared<FCloudNoiseVolume>();
+		Noise->Resolution = Resolution;
+		Noise->Texels.SetNumUninitialized(Resolution * Resolution * Resolution);
+		for (FColor& Texel : Noise->Texels)
+		{
+			Texel = FColor(uint8(Random.RandRange(0, 255)), uint8(Random.RandRange(0, 255)), uint8(Random.RandRange(0, 255)), uint8(Random.RandRange(0, 255)));
+		}
+		return Noise;
+	};
+
+	FCloudMarchSettings Settings;
+	Settings.ShapeNoise = MakeNoise(16);
+	Settings.DetailNoise = MakeNoise(4);
+	Settings.ShapeFrequency = 1.0f / 1000.0f;
+	Settings.DetailFrequency = 1.0f / 250.0f;
+	Settings.Extinction = 0.002f;
+	return Settings;
+}
+
+/** Three overlapping volumes and one apart from them. */
+static TArray<FCloudVolume> MakeVolumes()
+{
+	static const FVector3f Bounds[][2] = {
+		{ FVector3f(0.0f, 0.0f, 0.0f), FVector3f(1000.0f, 1000.0f, 1000.0f) },
+		{ FVector3f(500.0f, -200.0f, 300.0f), FVector3f(1500.0f, 800.0f, 900.0f) },
+		{ FVector3f(-400.0f, 600.0f, -100.0f), FVector3f(300.0f, 1400.0f, 500.0f) },
+		{ FVector3f(3000.0f, 3000.0f, 0.0f), FVector3f(3500.0f, 3200.0f, 2000.0f) },
+	};
+
+	TArray<FCloudVolume> Volumes;
+	for (const auto& VolumeBounds : Bounds)
+	{
+		FCloudVolume& Volume = Volumes.AddDefaulted_GetRef();
+		Volume.BoundsMin = VolumeBounds[0];
+		Volume.BoundsMax = VolumeBounds[1];
+	}
+	return Volumes;
+}
+
+static FVector RandomPoint(FRandomStream& Random, const FVector& Min, const FVector& Max)
+{
+	return FVector(Random.FRandRange(Min.X, Max.X), Random.FRandRange(Min.Y, Max.Y), Random.FRandRange(Min.Z, Max.Z));
+}
+
+/** Density summed over every volume containing the point, one point and volume at a time. */
+static float GetReferenceDensity(const FCloudMarchSettings& Settings, TConstArrayView<FCloudVolume> Volumes, const FVector& Point)
+{
+	const FVector3f Pos(Point);
+	float Density = 0.0f;
+	for (const FCloudVolume& Volume : Volumes)
+	{
+		if (Pos.X >= Volume.BoundsMin.X && Pos.X <= Volume.BoundsMax.X
+			&& Pos.Y >= Volume.BoundsMin.Y && Pos.Y <= Volume.BoundsMax.Y
+			&& Pos.Z >= Volume.BoundsMin.Z && Pos.Z <= Volume.BoundsMax.Z)
+		{
+			Density += CloudRaymarch::SampleCloudDensity(Settings, Volume, Pos);
+		}
+	}
+	return Density;
+}
+
+/** Transmittance of one segment, clipped to every volume with the scalar IntersectCloudBounds. */
+static float GetReferenceTransmittance(const FCloudMarchSettings& Settings, TConstArrayView<FCloudVolume> Volumes, const FCloudQuerySegment& Segment, int32 NumSteps)
+{
+	const FVector3f Start(Segment.Start);
+	const FVector3f Step(Segment.End - Segment.Start);
+
+	float OpticalDepth = 0.0f;
+	for (const FCloudVolume& Volume : Volumes)
+	{
+		float Near = 0.0f;
+		float Far = 0.0f;
+		if (!CloudRaymarch::IntersectCloudBounds(Volume, Start, Step, Near, Far) || Near >= 1.0f)
+		{
+			continue;
+		}
+
+		Near = FMath::Max(Near, 0.0f);
+		Far = FMath::Min(Far, 1.0f);
+		const float StepT = (Far - Near) / float(NumSteps);
+		float Sum = 0.0f;
+		for (int32 StepIndex = 0; StepIndex < NumSteps; ++StepIndex)
+		{
+			Sum += CloudRaymarch::SampleCloudDensity(Settings, Volume, Start + Step * (Near + StepT * (float(StepIndex) + 0.5f)));
+		}
+		OpticalDepth += Sum * StepT * Step.Size();
+	}
+	return FMath::Exp(-OpticalDepth * Settings.Extinction);
+}
+
+} // namespace CloudQueryTests
+
+// ================================================================================================
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FCloudQuerySlabTest, "Plugins.Foo.Clouds.Query.SlabTest", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+/**
+ * The four wide slab test of the transmittance queries against the scalar IntersectCloudBounds of the
+ * march, for random segments, segments parallel to one or two axes and segments starting inside.
+ */
+bool FCloudQuerySlabTest::RunTest(const FString& Parameters)
+{
+	using namespace CloudQueryTests;
+
+	const TArray<FCloudVolume> Volumes = MakeVolumes();
+	FRandomStream Random(11);
+
+	TArray<TPair<FString, FCloudQuerySegment>> Cases;
+	for (int32 Index = 0; Index < 64; ++Index)
+	{
+		FCloudQuerySegment Segment;
+		Segment.Start = RandomPoint(Random, FVector(-3000.0f), FVector(4000.0f));
+		Segment.End = RandomPoint(Random, FVector(-3000.0f), FVector(4000.0f));
+		Cases.Emplace(FString::Printf(TEXT("Random %d"), Index), Segment);
+	}
+	for (int32 Index = 0; Index < 48; ++Index)
+	{
+		// Along one axis, or in a plane of two, from inside and outside the slabs of the others.
+		const int32 Axis = Index % 3;
+		const bool bPlane = Index % 2 == 1;
+		FCloudQuerySegment Segment;
+		Segment.Start = RandomPoint(Random, FVector(-1000.0f), FVector(2000.0f));
+		Segment.End = Segment.Start;
+		Segment.End[Axis] += Random.FRandRange(-4000.0f, 4000.0f);
+		if (bPlane)
+		{
+			Segment.End[(Axis + 1) % 3] += Random.FRandRange(-4000.0f, 4000.0f);
+		}
+		Cases.Emplace(FString::Printf(TEXT("Axis parallel %d"), Index), Segment);
+	}
+	for (int32 Index = 0; Index < 32; ++Index)
+	{
+		const FCloudVolume& Volume = Volumes[Index % Volumes.Num()];
+		FCloudQuerySegment Segment;
+		Segment.Start = RandomPoint(Random, FVector(Volume.BoundsMin), FVector(Volume.BoundsMax));
+
+		// Half of them also end inside.
+		Segment.End = Index % 2 ? RandomPoint(Random, FVector(Volume.BoundsMin), FVector(Volume.BoundsMax)) : RandomPoint(Random, FVector(-3000.0f), FVector(4000.0f));
+		Cases.Emplace(FString::Printf(TEXT("Inside %d"), Index), Segment);
+	}
+
+	for (int32 First = 0; First < Cases.Num(); First += 4)
+	{
+		const int32 Num = FMath::Min(Cases.Num() - First, 4);
+		FCloudQuerySegment Segments[4];
+		for (int32 Lane = 0; Lane < Num; ++Lane)
+		{
+			Segments[Lane] = Cases[First + Lane].Value;
+		}
+		const FCloudQuerySegmentPacket Packet(Segments, Num);
+
+		for (const FCloudVolume& Volume : Volumes)
+		{
+			float PacketNear[4];
+			float PacketFar[4];
+			const uint32 Mask = Packet.IntersectBounds(Volume, PacketNear, PacketFar);
+
+			for (int32 Lane = 0; Lane < Num; ++Lane)
+			{
+				const FString& Name = Cases[First + Lane].Key;
+				const FCloudQuerySegment& Segment = Segments[Lane];
+
+				float Near = 0.0f;
+				float Far = 0.0f;
+				const bool bHit = CloudRaymarch::IntersectCloudBounds(Volume, FVector3f(Segment.Start), FVector3f(Segment.End - Segment.Start), Near, Far) && Near < 1.0f;
+
+				if (!TestTrue(FString::Printf(TEXT("%s hits like IntersectCloudBounds"), *Name), ((Mask & (1u << Lane)) != 0) == bHit) || !bHit)
+				{
+					continue;
+				}
+				TestEqual(FString::Printf(TEXT("%s near"), *Name), PacketNear[Lane], FMath::Max(Near, 0.0f), 1e-5f);
+				TestEqual(FString::Printf(TEXT("%s far"), *Name), PacketFar[Lane], FMath::Min(Far, 1.0f), 1e-5f);
+			}
+		}
+	}
+
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FCloudQueryBatchedTest, "Plugins.Foo.Clouds.Query.Batched", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+/**
+ * FCloudQueryScene against the same queries evaluated one at a time. The counts cover an empty batch,
+ * a partial packet, and batches split across tasks with a partial packet at the end.
+ */
+bool FCloudQueryBatchedTest::RunTest(const FString& Parameters)
+{
+	using namespace CloudQueryTests;
+
+	const FCloudMarchSettings Settings = MakeSettings();
+	const FCloudQueryScene Scene(Settings, MakeVolumes());
+	FRandomStream Random(13);
+
+	static constexpr int32 NumSteps = 8;
+	static constexpr int32 QueryCounts[] = { 0, 3, 4, 1031 };
+
+	for (int32 NumQueries : QueryCounts)
+	{
+		TArray<FVector> Points;
+		TArray<FCloudQuerySegment> Segments;
+		for (int32 Index = 0; Index < NumQueries; ++Index)
+		{
+			Points.Add(RandomPoint(Random, FVector(-500.0f), FVector(1600.0f)));
+
+			// Every fourth segment misses the clouds entirely.
+			FCloudQuerySegment& Segment = Segments.AddDefaulted_GetRef();
+			Segment.Start = Index % 4 == 3 ? FVector(-5000.0f, -5000.0f, Index) : RandomPoint(Random, FVector(-1000.0f), FVector(2000.0f));
+			Segment.End = Index % 4 == 3 ? FVector(-5000.0f, 5000.0f, Index) : RandomPoint(Random, FVector(-1000.0f), FVector(2000.0f));
+		}
+
+		TArray<float> Density;
+		Density.SetNumUninitialized(NumQueries);
+		Scene.QueryDensity(Points, Density);
+
+		TArray<float> Transmittance;
+		Transmittance.SetNumUninitialized(NumQueries);
+		Scene.QueryTransmittance(Segments, Transmittance, NumSteps);
+
+		int32 NumMismatches = 0;
+		for (int32 Index = 0; Index < NumQueries; ++Index)
+		{
+			const float ReferenceDensity = GetReferenceDensity(Settings, Scene.GetVolumes(), Points[Index]);
+			const float ReferenceTransmittance = GetReferenceTransmittance(Settings, Scene.GetVolumes(), Segments[Index], NumSteps);
+			if (!FMath::IsNearlyEqual(Density[Index], ReferenceDensity, 1e-5f) || !FMath::IsNearlyEqual(Transmittance[Index], ReferenceTransmittance, 1e-4f))
+			{
+				if (++NumMismatches <= 8)
+				{
+					AddError(FString::Printf(TEXT("Query %d of %d: density %f, expected %f, transmittance %f, expected %f"),
+						Index, NumQueries, Density[Index], ReferenceDensity, Transmittance[Index], ReferenceTransmittance));
+				}
+			}
+		}
+		TestEqual(FString::Printf(TEXT("Mismatches of %d queries"), NumQueries), NumMismatches, 0);
+
+		if (NumQueries > 3)
+		{
+			TestEqual(TEXT("A segment missing the clouds"), Transmittance[3], 1.0f);
+		}
+	}
+
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
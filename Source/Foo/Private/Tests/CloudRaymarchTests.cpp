@@ -0,0 +1,129 @@
+#include "CloudNoiseBaker.h"
+#include "CloudOccupancy.h"
+#include "CloudRaymarch.h"
+
+#include "Misc/AutomationTest.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace CloudRaymarchTests
+{
+
+enum class EOccupancy
+{
+	Empty,
+	Partial,
+	Full,
+};
+
+/**
+ * Shape noise whose shape term is 0 (R 0, FBM 1) in empty texels and 1 (R 1) in occupied ones. Partial
+ * fills the half of the tile with X below the middle.
+ */
+static TSharedRef<FCloudNoiseVolume> MakeShapeNoise(EOccupancy Occupancy)
+{
+	static constexpr int32 Resolution = 16;
+
+	TSharedRef<FCloudNoiseVolume> Noise = MakeShared<FCloudNoiseVolume>();
+	Noise->Resolution = Resolution;
+	Noise->Texels.SetNumUninitialized(Resolution * Resolution * Resolution);
+	for (int32 Index = 0; Index < Noise->Texels.Num(); ++Index)
+	{
+		const int32 X = Index % Resolution;
+		const bool bOccupied = Occupancy == EOccupancy::Full || (Occupancy == EOccupancy::Partial && X < Resolution / 2);
+		Noise->Texels[Index] = FColor(bOccupied ? 255 : 0, 255, 255, 255);
+	}
+	return Noise;
+}
+
+/** A 1000 unit cube that holds exactly one tile of the noise, with no detail erosion. */
+static FCloudMarchSettings MakeSettings(EOccupancy Occupancy)
+{
+	TSharedRef<FCloudNoiseVolume> DetailNoise = MakeShared<FCloudNoiseVolume>();
+	DetailNoise->Resolution = 4;
+	DetailNoise->Texels.SetNumZeroed(4 * 4 * 4);
+
+	FCloudMarchSettings Settings;
+	Settings.ShapeNoise = MakeShapeNoise(Occupancy);
+	Settings.DetailNoise = DetailNoise;
+	Settings.ShapeFrequency = 1.0f / 1000.0f;
+	Settings.DetailFrequency = 1.0f / 1000.0f;
+	Settings.NumSteps = 64;
+	Settings.NumLightSteps = 0;
+	Settings.TransmittanceThreshold = 0.0f;
+	return Settings;
+}
+
+static FCloudVolume MakeVolume()
+{
+	FCloudVolume Volume;
+	Volume.BoundsMin = FVector3f(0.0f, 0.0f, 0.0f);
+	Volume.BoundsMax = FVector3f(1000.0f, 1000.0f, 1000.0f);
+	return Volume;
+}
+
+} // namespace CloudRaymarchTests
+
+// ================================================================================================
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FCloudEmptySpaceSkippingTest, "Plugins.Foo.Clouds.Raymarch.EmptySpaceSkipping", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+bool FCloudEmptySpaceSkippingTest::RunTest(const FString& Parameters)
+{
+	using namespace CloudRaymarchTests;
+
+	const FCloudVolume Volume = MakeVolume();
+
+	static constexpr EOccupancy Occupancies[] = { EOccupancy::Empty, EOccupancy::Partial, EOccupancy::Full };
+	static const TCHAR* OccupancyNames[] = { TEXT("Empty"), TEXT("Partial"), TEXT("Full") };
+
+	for (int32 OccupancyIndex = 0; OccupancyIndex < UE_ARRAY_COUNT(Occupancies); ++OccupancyIndex)
+	{
+		const EOccupancy Occupancy = Occupancies[OccupancyIndex];
+		const TCHAR* Name = OccupancyNames[OccupancyIndex];
+
+		const FCloudMarchSettings PlainSettings = MakeSettings(Occupancy);
+		FCloudMarchSettings SkipSettings = PlainSettings;
+		SkipSettings.Occupancy = FCloudOccupancyPyramid::Build(*PlainSettings.ShapeNoise);
+
+		int32 NumPlainSteps = 0;
+		int32 NumSkipSteps = 0;
+		int32 NumSkippedCells = 0;
+
+		// Rays along X cross the occupied half of the partial tile and the empty one, the diagonal ones
+		// also cross cell boundaries on every axis.
+		static constexpr int32 NumRays = 8;
+		for (int32 Ray = 0; Ray < NumRays; ++Ray)
+		{
+			const float Offset = 200.0f + 600.0f * Ray / (NumRays - 1);
+			const FVector3f Origin = Ray % 2 ? FVector3f(-100.0f, Offset, 500.0f) : FVector3f(-100.0f, -100.0f, Offset);
+			const FVector3f Dir = Ray % 2 ? FVector3f(1.0f, 0.0f, 0.0f) : FVector3f(1.0f, 1.0f, 0.0f).GetSafeNormal();
+
+			const FCloudMarchResult Plain = CloudRaymarch::MarchCloud(PlainSettings, Volume, Origin, Dir, MAX_flt, 0.5f);
+			const FCloudMarchResult Skip = CloudRaymarch::MarchCloud(SkipSettings, Volume, Origin, Dir, MAX_flt, 0.5f);
+
+			// Skipped samples stay on the step grid, so only the float rounding of the step positions differs.
+			TestEqual(FString::Printf(TEXT("%s ray %d transmittance"), Name, Ray), Skip.Transmittance, Plain.Transmittance, 1e-3f);
+
+			NumPlainSteps += Plain.NumDensitySteps;
+			NumSkipSteps += Skip.NumDensitySteps;
+			NumSkippedCells += Skip.NumSkippedCells;
+		}
+
+		AddInfo(FString::Printf(TEXT("%s: %d density steps plain, %d skipping, %d cells skipped"), Name, NumPlainSteps, NumSkipSteps, NumSkippedCells));
+
+		if (Occupancy == EOccupancy::Full)
+		{
+			TestTrue(FString::Printf(TEXT("%s takes no more steps when skipping"), Name), NumSkipSteps <= NumPlainSteps);
+		}
+		else
+		{
+			TestTrue(FString::Printf(TEXT("%s takes fewer steps when skipping"), Name), NumSkipSteps < NumPlainSteps);
+			TestTrue(FString::Printf(TEXT("%s skips cells"), Name), NumSkippedCells > 0);
+		}
+	}
+
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
@@ -0,0 +1,234 @@
+#include "CloudTrace.h"
+
+#include "HAL/FileManager.h"
+#include "Misc/AutomationTest.h"
+#include "Misc/FileHelper.h"
+#include "Misc/Paths.h"
+
+#if WITH_DEV_AUTOMATION_TESTS
+
+namespace CloudTraceTests
+{
+
+/** Near distance of the panorama in every frame, found again in the file to corrupt the view count behind it. */
+static constexpr float PanoramaNearDistance = 4321.5f;
+
+static FString GetTracePath(const TCHAR* Name)
+{
+	return FPaths::Combine(FPaths::AutomationTransientDir(), TEXT("Clouds"), FString(Name) + TEXT(".ctr"));
+}
+
+static FCloudVolume MakeVolume(float Offset, float Coverage = 0.6f)
+{
+	FCloudVolume Volume;
+	Volume.BoundsMin = FVector3f(Offset, -500.0f, 1000.0f);
+	Volume.BoundsMax = FVector3f(Offset + 1000.0f, 500.0f, 2000.0f);
+	Volume.Coverage = Coverage;
+	return Volume;
+}
+
+static FCloudTraceFrame MakeFrame(uint64 FrameNumber, int32 NumViews)
+{
+	FCloudTraceFrame Frame;
+	Frame.Snapshot.FrameNumber = FrameNumber;
+	Frame.Snapshot.GameTime = double(FrameNumber) / 60.0;
+	Frame.ResolutionDivisor = 2;
+	Frame.NumSteps = 64;
+	Frame.NumLightSteps = 6;
+	Frame.PanoramaNearDistance = PanoramaNearDistance;
+	for (int32 Index = 0; Index < NumViews; ++Index)
+	{
+		FCloudTraceView& View = Frame.Views.AddDefaulted_GetRef();
+		View.ViewKey = uint32(Index + 1);
+		View.Origin = FVector(100.0 * Index, 0.0, double(FrameNumber));
+		View.CloudViewSize = FIntPoint(1920, 1080);
+		View.bIsCapture = Index == 1;
+	}
+	return Frame;
+}
+
+/** Writes one frame per entry of Scenes, each with every volume of the scene by id. */
+static bool WriteTrace(const FString& Path, TConstArrayView<TMap<uint32, FCloudVolume>> Scenes)
+{
+	FCloudTraceWriter Writer;
+	if (!Writer.Open(Path))
+	{
+		return false;
+	}
+
+	for (int32 Index = 0; Index < Scenes.Num(); ++Index)
+	{
+		TArray<uint32> Ids;
+		TArray<FCloudVolume> Volumes;
+		Scenes[Index].GenerateKeyArray(Ids);
+		Scenes[Index].GenerateValueArray(Volumes);
+		Writer.WriteFrame(MakeFrame(Index + 1, Index % 2 + 1), Ids, Volumes);
+	}
+	return true;
+}
+
+static TArray<uint32> GetSortedIds(const FCloudTraceFrame& Frame)
+{
+	TArray<uint32> Ids;
+	for (const TPair<uint32, FCloudVolume>& Entry : Frame.ChangedVolumes)
+	{
+		Ids.Add(Entry.Key);
+	}
+	Ids.Sort();
+	return Ids;
+}
+
+} // namespace CloudTraceTests
+
+// ================================================================================================
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FCloudTraceRoundTripTest, "Plugins.Foo.Clouds.Trace.RoundTrip", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+/**
+ * Writes a trace whose frames add, change and remove volumes, and re-add a removed id, and checks
+ * that every frame reads back with only its changes and that the deltas add up to the scene.
+ */
+bool FCloudTraceRoundTripTest::RunTest(const FString& Parameters)
+{
+	using namespace CloudTraceTests;
+
+	TArray<TMap<uint32, FCloudVolume>> Scenes;
+	Scenes.AddDefaulted(5);
+	Scenes[0] = { { 1, MakeVolume(0.0f) }, { 2, MakeVolume(2000.0f) }, { 3, MakeVolume(4000.0f) } };
+	Scenes[1] = { { 1, MakeVolume(0.0f) }, { 2, MakeVolume(2500.0f) }, { 3, MakeVolume(4000.0f) }, { 4, MakeVolume(6000.0f) } };
+	Scenes[2] = { { 2, MakeVolume(2500.0f) }, { 4, MakeVolume(6000.0f) } };
+	Scenes[3] = { { 4, MakeVolume(6000.0f, 0.3f) }, { 2, MakeVolume(2500.0f) }, { 1, MakeVolume(-2000.0f) } };
+	Scenes[4] = Scenes[3];
+
+	const TArray<uint32> ExpectedChanged[] = { { 1, 2, 3 }, { 2, 4 }, {}, { 1, 4 }, {} };
+	const TArray<uint32> ExpectedRemoved[] = { {}, {}, { 1, 3 }, {}, {} };
+
+	const FString Path = GetTracePath(TEXT("RoundTrip"));
+	if (!TestTrue(TEXT("Trace written"), WriteTrace(Path, Scenes)))
+	{
+		return false;
+	}
+
+	FCloudTraceReader Reader;
+	if (!TestTrue(TEXT("Trace opened"), Reader.Open(Path)))
+	{
+		return false;
+	}
+
+	for (int32 Index = 0; Index < Scenes.Num(); ++Index)
+	{
+		FCloudTraceFrame Frame;
+		if (!TestTrue(FString::Printf(TEXT("Frame %d read"), Index), Reader.ReadFrame(Frame)))
+		{
+			return false;
+		}
+
+		const FCloudTraceFrame Expected = MakeFrame(Index + 1, Index % 2 + 1);
+		TestEqual(FString::Printf(TEXT("Frame %d number"), Index), Frame.Snapshot.FrameNumber, Expected.Snapshot.FrameNumber);
+		TestEqual(FString::Printf(TEXT("Frame %d game time"), Index), Frame.Snapshot.GameTime, Expected.Snapshot.GameTime);
+		TestEqual(FString::Printf(TEXT("Frame %d panorama near distance"), Index), Frame.PanoramaNearDistance, PanoramaNearDistance);
+		if (TestEqual(FString::Printf(TEXT("Frame %d views"), Index), Frame.Views.Num(), Expected.Views.Num()))
+		{
+			for (int32 ViewIndex = 0; ViewIndex < Frame.Views.Num(); ++ViewIndex)
+			{
+				const FCloudTraceView& View = Frame.Views[ViewIndex];
+				const FCloudTraceView& ExpectedView = Expected.Views[ViewIndex];
+				TestTrue(FString::Printf(TEXT("Frame %d view %d"), Index, ViewIndex), View.ViewKey == ExpectedView.ViewKey && View.Origin == ExpectedView.Origin
+					&& View.CloudViewSize == ExpectedView.CloudViewSize && View.bIsCapture == ExpectedView.bIsCapture);
+			}
+		}
+
+		// Only the volumes added or changed since the previous frame are written.
+		TestTrue(FString::Printf(TEXT("Frame %d changed volumes"), Index), GetSortedIds(Frame) == ExpectedChanged[Index]);
+		for (const TPair<uint32, FCloudVolume>& Entry : Frame.ChangedVolumes)
+		{
+			TestTrue(FString::Printf(TEXT("Frame %d volume %u"), Index, Entry.Key), Entry.Value == Scenes[Index].FindChecked(Entry.Key));
+		}
+
+		TArray<uint32> Removed = Frame.RemovedVolumes;
+		Removed.Sort();
+		TestTrue(FString::Printf(TEXT("Frame %d removed volumes"), Index), Removed == ExpectedRemoved[Index]);
+
+		const TMap<uint32, FCloudVolume>& Volumes = Reader.GetVolumes();
+		TestTrue(FString::Printf(TEXT("Frame %d scene"), Index), Volumes.Num() == Scenes[Index].Num() && Volumes.OrderIndependentCompareEqual(Scenes[Index]));
+	}
+
+	FCloudTraceFrame Frame;
+	TestFalse(TEXT("Read past the last frame"), Reader.ReadFrame(Frame));
+
+	IFileManager::Get().Delete(*Path);
+	return true;
+}
+
+IMPLEMENT_SIMPLE_AUTOMATION_TEST(FCloudTraceTruncatedTest, "Plugins.Foo.Clouds.Trace.Truncated", EAutomationTestFlags::ApplicationContextMask | EAutomationTestFlags::EngineFilter)
+
+/**
+ * A trace cut off within its last frame reads up to the frame before, and a frame whose view count is
+ * corrupt is rejected before the views are allocated.
+ */
+bool FCloudTraceTruncatedTest::RunTest(const FString& Parameters)
+{
+	using namespace CloudTraceTests;
+
+	TArray<TMap<uint32, FCloudVolume>> Scenes;
+	Scenes.AddDefaulted(2);
+	Scenes[0] = { { 1, MakeVolume(0.0f) }, { 2, MakeVolume(2000.0f) } };
+	Scenes[1] = { { 2, MakeVolume(2500.0f) } };
+
+	const FString Path = GetTracePath(TEXT("Truncated"));
+	TArray<uint8> Bytes;
+	if (!TestTrue(TEXT("Trace written"), WriteTrace(Path, Scenes) && FFileHelper::LoadFileToArray(Bytes, *Path)))
+	{
+		return false;
+	}
+
+	// Cut within the second frame, as a crash while recording would.
+	{
+		TArray<uint8> Truncated = Bytes;
+		Truncated.SetNum(Truncated.Num() - 5);
+		FFileHelper::SaveArrayToFile(Truncated, *Path);
+
+		AddExpectedError(TEXT("truncated frame"), EAutomationExpectedErrorFlags::Contains, 1);
+
+		FCloudTraceReader Reader;
+		FCloudTraceFrame Frame;
+		TestTrue(TEXT("Truncated trace opened"), Reader.Open(Path));
+		TestTrue(TEXT("First frame of the truncated trace read"), Reader.ReadFrame(Frame));
+		TestFalse(TEXT("Truncated frame rejected"), Reader.ReadFrame(Frame));
+		TestTrue(TEXT("Scene of the first frame kept"), Reader.GetVolumes().OrderIndependentCompareEqual(Scenes[0]));
+	}
+
+	// The view count directly follows the panorama near distance.
+	{
+		int32 CountOffset = INDEX_NONE;
+		for (int32 Offset = 0; Offset + int32(sizeof(float)) * 2 <= Bytes.Num() && CountOffset == INDEX_NONE; ++Offset)
+		{
+			if (FMemory::Memcmp(&Bytes[Offset], &PanoramaNearDistance, sizeof(float)) == 0)
+			{
+				CountOffset = Offset + int32(sizeof(float));
+			}
+		}
+		if (!TestTrue(TEXT("View count found"), CountOffset != INDEX_NONE))
+		{
+			return false;
+		}
+
+		TArray<uint8> Corrupt = Bytes;
+		const int32 NumViews = 0x10000000;
+		FMemory::Memcpy(&Corrupt[CountOffset], &NumViews, sizeof(NumViews));
+		FFileHelper::SaveArrayToFile(Corrupt, *Path);
+
+		AddExpectedError(TEXT("corrupt frame"), EAutomationExpectedErrorFlags::Contains, 1);
+
+		FCloudTraceReader Reader;
+		FCloudTraceFrame Frame;
+		TestTrue(TEXT("Corrupt trace opened"), Reader.Open(Path));
+		TestFalse(TEXT("Frame with a corrupt view count rejected"), Reader.ReadFrame(Frame));
+		TestEqual(TEXT("Views allocated for the corrupt frame"), Frame.Views.Num(), 0);
+	}
+
+	IFileManager::Get().Delete(*Path);
+	return true;
+}
+
+#endif // WITH_DEV_AUTOMATION_TESTS
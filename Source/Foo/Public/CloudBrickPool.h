@@ -0,0 +1,149 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/LruCache.h"
+#include "RenderGraphUtils.h"
+#include "ShaderParameterMacros.h"
+#include "UnifiedBuffer.h"
+#include "CloudBrickVolume.h"
+
+class FRHIGPUBufferReadback;
+
+// ================================================================================================
+
+BEGIN_SHADER_PARAMETER_STRUCT(FCloudBrickShaderParameters,)
+	SHADER_PARAMETER_TEXTURE(Texture3D<float>, CloudBrickPool)
+	SHADER_PARAMETER_SAMPLER(SamplerState, CloudBrickPoolSampler)
+	SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<uint>, CloudBrickPageTable)
+	SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<uint4>, CloudBrickVolumes)
+	SHADER_PARAMETER_RDG_BUFFER_UAV(RWStructuredBuffer<uint>, CloudBrickFeedback)
+	SHADER_PARAMETER(FVector3f, CloudBrickPoolInvSize)
+	SHADER_PARAMETER(uint32, CloudBrickPoolSlotsPerAxis)
+	SHADER_PARAMETER(uint32, CloudBrickSize)
+END_SHADER_PARAMETER_STRUCT()
+
+/** Memory of a brick volume, see FCloudBrickPool::GetVolumeStats. */
+struct FCloudBrickVolumeStats
+{
+	uint32 Id = 0;
+	FIntVector Resolution = FIntVector::ZeroValue;
+	int32 NumBricks = 0;
+	int32 NumStoredBricks = 0;
+	int32 NumResidentBricks = 0;
+
+	/** Size of the file, of its bricks in the pool and of the same volume as a dense texture. */
+	int64 FileBytes = 0;
+	int64 ResidentBytes = 0;
+	int64 DenseBytes = 0;
+
+	int32 GetNumEmptyBricks() const { return NumBricks - NumStoredBricks; }
+};
+
+/**
+ * GPU side of the authored cloud volumes, owned by the render thread. Bricks of every volume are
+ * streamed from their memory mapped FCloudBrickVolumeFile into slots of a single 3D pool texture,
+ * addressed through a page table with an entry per brick of every volume.
+ *
+ * The march writes the pages it reads to a feedback buffer, which is read back a few frames later
+ * and decides what to stream: missing bricks are uploaded, at most MaxUploads per frame, and the
+ * bricks that were not read for the longest are evicted once the pool is full. Until a brick is
+ * resident the march uses its average density. Empty bricks are neither stored nor requested, so they
+ * cost nothing but their page table entry.
+ */
+class FCloudBrickPool
+{
+public:
+	FCloudBrickPool();
+	~FCloudBrickPool();
+
+	/** Sets the size of the pool texture, created once the first volume is added. */
+	void Initialize(int32 InSlotsPerAxis);
+
+	/**
+	 * Maps a brick volume file under the id the game thread allocated, the lowest one not in use. The
+	 * march looks it up as GPU index Id - 1. Returns false if the file is invalid or its brick size
+	 * differs from the volumes already in the pool; the id then keeps an empty entry, which the march
+	 * reads no density from, until it is removed. OwnerName identifies the volume in the log.
+	 */
+	bool AddVolume(uint32 Id, const FString& Path, const FString& OwnerName);
+	void RemoveVolume(uint32 Id);
+
+	int32 NumVolumes() const { return NumMappedVolumes; }
+
+	/** Streams the bricks requested by the feedback that arrived, at most MaxUploads of them. */
+	void Update(FRHICommandListImmediate& RHICmdList, int32 MaxUploads);
+
+	/** Binds the pool and a cleared feedback buffer for the passes of GraphBuilder. */
+	void SetupParameters(FRDGBuilder& GraphBuilder, FCloudBrickShaderParameters& OutParameters);
+
+	/** Reads the feedback of the passes of GraphBuilder back, once they all ran. */
+	void EnqueueFeedbackReadback(FRDGBuilder& GraphBuilder);
+
+	void GetVolumeStats(TArray<FCloudBrickVolumeStats>& OutStats) const;
+
+	/** Bytes of the pool texture. */
+	int64 GetPoolBytes() const;
+
+private:
+	struct FBrickVolume
+	{
+		FCloudBrickVolumeFile File;
+
+		/** First entry of the volume in PageTable, INDEX_NONE until the layout includes it. */
+		int32 PageTableOffset = INDEX_NONE;
+		int32 NumResidentBricks = 0;
+	};
+
+	/** Feedback of a family on its way back from the GPU. */
+	struct FPendingFeedback
+	{
+		TUniquePtr<FRHIGPUBufferReadback> Readback;
+		uint32 LayoutGeneration = 0;
+		int32 NumPages = 0;
+	};
+
+	static uint64 GetBrickKey(uint32 Id, int32 BrickIndex) { return (uint64(Id) << 32) | uint32(BrickIndex); }
+
+	/** Reassigns the page table ranges after volumes were added or removed. */
+	void RebuildLayout();
+
+	/** Frees the slot of a resident brick and points its page back at the average density. */
+	void EvictBrick(uint64 Key, int32 Slot);
+
+	void UploadBrick(FRHICommandListImmediate& RHICmdList, const FBrickVolume& Volume, int32 StoredIndex, int32 Slot);
+
+	void SetPage(int32 PageIndex, uint32 Page);
+
+	FBrickVolume* FindVolume(uint32 Id);
+
+	int32 SlotsPerAxis = 0;
+	int32 BrickSize = 0;
+	FTextureRHIRef PoolTexture;
+
+	// Indexed by Id - 1 up to the highest id added, null for ids not in use or whose file failed.
+	TArray<TUniquePtr<FBrickVolume>> Volumes;
+	int32 NumMappedVolumes = 0;
+
+	// Page table of all volumes, see CloudBrickPage. Pages hold the pool slot + 1 of resident bricks.
+	TArray<uint32> PageTable;
+	TRefCountPtr<FRDGPooledBuffer> PageTableBuffer;
+	FRDGScatterUploadBuffer PageTableUploader;
+	TArray<int32> DirtyPages;
+	bool bLayoutDirty = true;
+
+	// Bumped whenever the page table ranges move, so feedback of an older layout is ignored.
+	uint32 LayoutGeneration = 0;
+
+	// Resident bricks by GetBrickKey(), least recently touched first to be evicted.
+	TLruCache<uint64, int32> ResidentBricks;
+	TArray<int32> FreeSlots;
+
+	// Feedback of the family being rendered.
+	const FRDGBuilder* FeedbackGraphBuilder = nullptr;
+	FRDGBufferRef FeedbackBuffer = nullptr;
+	int32 FeedbackNumPages = 0;
+
+	// Oldest first. Readbacks whose feedback was processed are reused.
+	TArray<FPendingFeedback> PendingFeedback;
+	TArray<TUniquePtr<FRHIGPUBufferReadback>> FreeReadbacks;
+};
@@ -0,0 +1,98 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+class IMappedFileHandle;
+class IMappedFileRegion;
+
+// ================================================================================================
+
+/**
+ * Layout of a sparse brick volume file (.cbv) holding authored cloud density. The Resolution voxels are
+ * split into bricks of BrickSize^3 voxels. Every brick is stored with a one voxel apron copied from its
+ * neighbors, so trilinear lookups inside a brick never need another brick.
+ *
+ * The file holds a header, a page table with one entry per brick, and then the non-empty bricks,
+ * GetStoredBrickBytes() each, starting at a page aligned offset. Empty bricks take no space. The
+ * whole file is memory mapped, so only the bricks that are read are paged in.
+ */
+struct FCloudBrickVolumeDesc
+{
+	FIntVector Resolution = FIntVector(64);
+	int32 BrickSize = 8;
+	int32 NumStoredBricks = 0;
+
+	FIntVector GetNumBricks() const { return FIntVector::DivideAndRoundUp(Resolution, BrickSize); }
+	int32 GetNumPages() const { const FIntVector NumBricks = GetNumBricks(); return NumBricks.X * NumBricks.Y * NumBricks.Z; }
+
+	/** Voxels per axis of a stored brick, including the apron. */
+	int32 GetStoredBrickSize() const { return BrickSize + 2; }
+	int64 GetStoredBrickBytes() const { const int64 Size = GetStoredBrickSize(); return Size * Size * Size; }
+
+	int64 GetPageTableOffset() const;
+	int64 GetBrickOffset(int32 StoredIndex) const;
+	int64 GetFileSize() const { return GetBrickOffset(NumStoredBricks); }
+
+	/** Bytes of the same volume as a dense 8 bit texture. */
+	int64 GetDenseBytes() const { return int64(Resolution.X) * Resolution.Y * Resolution.Z; }
+};
+
+/**
+ * Page table entries, in the file and on the GPU: the average density of the brick in bits 0-7, 0 for
+ * empty bricks and at least 1 for all others, and in bits 8-31 the stored brick index + 1 in the file,
+ * or the pool slot + 1 on the GPU. 0 means not stored or not resident.
+ */
+namespace CloudBrickPage
+{
+	inline uint32 Make(uint32 Index, uint32 AverageDensity) { return ((Index + 1) << 8) | (AverageDensity & 0xFF); }
+	inline uint32 GetAverageDensity(uint32 Page) { return Page & 0xFF; }
+	inline bool IsEmpty(uint32 Page) { return GetAverageDensity(Page) == 0; }
+	inline bool HasIndex(uint32 Page) { return (Page >> 8) != 0; }
+	inline uint32 GetIndex(uint32 Page) { return (Page >> 8) - 1; }
+}
+
+// ================================================================================================
+
+/** Read only access to a memory mapped brick volume file. Thread safe once opened. */
+class FCloudBrickVolumeFile
+{
+public:
+	FOO_API FCloudBrickVolumeFile();
+	FOO_API ~FCloudBrickVolumeFile();
+
+	/** Maps the file. Returns false if it is missing or invalid, including pages past the stored bricks. */
+	FOO_API bool Open(const FString& Path);
+	FOO_API void Close();
+
+	bool IsOpen() const { return Region.IsValid(); }
+	const FCloudBrickVolumeDesc& GetDesc() const { return Desc; }
+
+	/** Page table entry of a brick, see CloudBrickPage. Bricks are X major. */
+	FOO_API uint32 GetPage(int32 BrickIndex) const;
+
+	/** GetStoredBrickBytes() voxels of a stored brick, X major, including the apron. */
+	FOO_API const uint8* GetStoredBrick(int32 StoredIndex) const;
+
+	/** Trilinear density at a position in [0, 1]^3 of the volume, like the GPU lookup of a resident brick. */
+	FOO_API float SampleDensity(const FVector3f& Local) const;
+
+private:
+	FCloudBrickVolumeDesc Desc;
+
+	TUniquePtr<IMappedFileHandle> FileHandle;
+	TUniquePtr<IMappedFileRegion> Region;
+};
+
+// ================================================================================================
+
+namespace CloudBricks
+{
+	/**
+	 * Writes a brick volume file, evaluating Voxel(X, Y, Z) for every voxel of the volume. Bricks whose
+	 * voxels and apron are all 0 are left out.
+	 */
+	FOO_API bool WriteBrickVolume(const FString& Path, const FIntVector& Resolution, int32 BrickSize, TFunctionRef<uint8(int32 X, int32 Y, int32 Z)> Voxel);
+
+	/** Converts a dense 8 bit raw volume of Resolution voxels, X major, to a brick volume file. */
+	FOO_API bool ImportRawVolume(const FString& RawPath, const FIntVector& Resolution, const FString& Path, int32 BrickSize = 8);
+}
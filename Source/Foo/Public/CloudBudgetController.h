@@ -0,0 +1,82 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+// ================================================================================================
+
+/** One rung of the quality ladder of FCloudBudgetController. */
+struct FCloudQualityLevel
+{
+	/** r.Clouds.ResolutionDivisor: shrinks the march target and spreads its samples over Divisor^2 frames. */
+	int32 ResolutionDivisor = 2;
+
+	/** Primary march steps, one of the step count permutations. */
+	int32 NumSteps = 64;
+
+	/** Expected GPU cost relative to the other levels, used to predict the time after a switch. */
+	float RelativeCost = 1.0f;
+};
+
+struct FCloudBudgetSettings
+{
+	/** Target GPU time of the clouds per frame. */
+	float BudgetMs = 2.0f;
+
+	/**
+	 * Width of the band around the budget the controller does not react to, as a fraction of the
+	 * budget. A cheaper level is chosen above BudgetMs * (1 + Hysteresis); a better one only if its
+	 * predicted time stays below BudgetMs * (1 - Hysteresis).
+	 */
+	float Hysteresis = 0.15f;
+
+	/** Weight of a new measurement in the moving average of the GPU time, 0-1. */
+	float Smoothing = 0.2f;
+
+	/** Frames to measure at a level before changing it again. */
+	int32 SettleFrames = 8;
+};
+
+/**
+ * Picks the cloud quality that fits a GPU time budget from measured frame times. Has no dependency
+ * on the renderer, so it can be driven by synthetic timing traces.
+ *
+ * Levels run from the best to the cheapest quality. Over budget the controller jumps straight to the
+ * best level predicted to fit, so spikes are absorbed within a frame or two; under budget it only
+ * climbs one level at a time. Both use the smoothed time scaled by the relative costs of the levels.
+ */
+class FCloudBudgetController
+{
+public:
+	/** Divisor 1 to 4 and 32 to 128 steps, ordered by cost. */
+	FOO_API static TArray<FCloudQualityLevel> GetDefaultLevels();
+
+	FOO_API FCloudBudgetController();
+	FOO_API explicit FCloudBudgetController(TArray<FCloudQualityLevel> InLevels);
+
+	void SetSettings(const FCloudBudgetSettings& InSettings) { Settings = InSettings; }
+	const FCloudBudgetSettings& GetSettings() const { return Settings; }
+
+	/** Feeds the measured GPU time of a frame rendered at the current level. Returns the level to use. */
+	FOO_API int32 AddFrameTime(float GpuMs);
+
+	/** Forgets the measurements, e.g. after the clouds were not rendered for a while. */
+	FOO_API void Reset(int32 InLevel = 0);
+
+	int32 GetLevel() const { return Level; }
+	const FCloudQualityLevel& GetQuality() const { return Levels[Level]; }
+	TConstArrayView<FCloudQualityLevel> GetLevels() const { return Levels; }
+
+	/** Moving average of the GPU time at the current level, 0 before the first measurement. */
+	float GetSmoothedMs() const { return SmoothedMs; }
+
+private:
+	float PredictMs(int32 NewLevel) const;
+	void SetLevel(int32 NewLevel);
+
+	TArray<FCloudQualityLevel> Levels;
+	FCloudBudgetSettings Settings;
+
+	int32 Level = 0;
+	float SmoothedMs = 0.0f;
+	int32 FramesAtLevel = 0;
+};
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RenderGraphUtils.h"
+#include "ShaderParameterMacros.h"
+
+struct FCloudVolume;
+struct FCloudMarchShaderParameters;
+
+// ================================================================================================
+
+BEGIN_SHADER_PARAMETER_STRUCT(FCloudLightingShaderParameters,)
+	SHADER_PARAMETER_RDG_TEXTURE(Texture3D<float>, CloudLightVolume)
+	SHADER_PARAMETER_RDG_TEXTURE(Texture2D<float>, CloudShadowMap)
+	SHADER_PARAMETER_SAMPLER(SamplerState, CloudLightingSampler)
+	SHADER_PARAMETER(FVector3f, CloudLightVolumeMin)
+	SHADER_PARAMETER(FVector3f, CloudLightVolumeInvSize)
+	SHADER_PARAMETER(float, CloudShadowMapHeight)
+	SHADER_PARAMETER(uint32, CloudLightVolumeEnabled)
+	SHADER_PARAMETER(uint32, CloudShadowMapEnabled)
+END_SHADER_PARAMETER_STRUCT()
+
+struct FCloudLightingSettings
+{
+	/** Texels of the light volume in X and Y, and its number of slices in Z. */
+	int32 VolumeResolution = 128;
+	int32 VolumeSlices = 32;
+
+	int32 ShadowMapResolution = 512;
+
+	/** World size in X and Y covered around the camera. Z covers the cloud volumes. */
+	float Extent = 200000.0f;
+
+	/** Steps of the sun march per volume crossed. */
+	int32 NumSteps = 16;
+
+	/** Light volume slices baked per frame; the shadow map is baked in as many row bands alongside. */
+	int32 SlicesPerFrame = 4;
+};
+
+/**
+ * Transmittance towards the sun through all cloud volumes, baked into a low resolution light volume
+ * that replaces the secondary march of the clouds, and into a shadow map for opaque geometry below
+ * them. Owned by the render thread.
+ *
+ * The bake is time sliced: the first Update of every frame renders SlicesPerFrame of the VolumeSlices
+ * slices (and as many bands of shadow map rows) into a pending copy, which replaces the visible copy
+ * once it is complete. The per frame cost is therefore bounded by SlicesPerFrame however many families
+ * render, at a latency of VolumeSlices / SlicesPerFrame frames. The placement around the camera is
+ * frozen for a whole bake.
+ *
+ * The volumes are binned into BakeTilesPerAxis^2 columns of the bake first, and a texel only marches
+ * those its ray towards the sun can reach.
+ */
+class FCloudLightingCache
+{
+public:
+	/** Bakes the next slices, once per frame. March provides the noise, weather, sun and instances of the bake. */
+	void Update(
+		FRDGBuilder& GraphBuilder,
+		const FGlobalShaderMap* ShaderMap,
+		const FCloudLightingSettings& Settings,
+		const FVector& CameraOrigin,
+		TConstArrayView<FCloudVolume> Volumes,
+		const FCloudMarchShaderParameters& March);
+
+	/** Binds the last complete bake, or disables the lookups until there is one. */
+	void SetupParameters(FRDGBuilder& GraphBuilder, FCloudLightingShaderParameters& OutParameters, bool bUseLightVolume, bool bUseShadowMap) const;
+
+	/** Parameters with both lookups disabled. */
+	static void SetupDisabledParameters(FRDGBuilder& GraphBuilder, FCloudLightingShaderParameters& OutParameters);
+
+	bool IsValid() const { return Visible.LightVolume.IsValid(); }
+
+	/** Size of the pooled targets of both copies. */
+	uint64 GetGpuMemorySize() const;
+
+	/** Number of completed bakes, for diagnostics. */
+	uint32 GetNumBakes() const { return NumBakes; }
+
+	static constexpr int32 BakeTilesPerAxis = 16;
+
+	/**
+	 * Bins the volumes into the BakeTilesPerAxis^2 columns of a bake at BakeMin of BakeSize. A volume goes
+	 * into every column under its bounds swept away from the sun, down to the bottom of the bake, and
+	 * into all of them when the sun is at or below the horizon. OutTileRanges holds the (offset, count)
+	 * of the indices of every column in OutTileVolumes, row major.
+	 */
+	static void BinVolumes(
+		TConstArrayView<FCloudVolume> Volumes,
+		const FVector3f& SunDirection,
+		const FVector3f& BakeMin,
+		const FVector3f& BakeSize,
+		TArray<FUintVector2>& OutTileRanges,
+		TArray<uint32>& OutTileVolumes);
+
+private:
+	struct FCloudLightingBake
+	{
+		TRefCountPtr<IPooledRenderTarget> LightVolume;
+		TRefCountPtr<IPooledRenderTarget> ShadowMap;
+		FVector3f Min = FVector3f::ZeroVector;
+		FVector3f Size = FVector3f::OneVector;
+	};
+
+	FCloudLightingBake Visible;
+	FCloudLightingBake Pending;
+
+	// Next slice of the pending bake, 0 when a new one starts.
+	int32 NextSlice = 0;
+	uint32 NumBakes = 0;
+
+	// GFrameCounterRenderThread of the last Update that baked.
+	uint64 LastUpdateFrame = MAX_uint64;
+};
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+// ================================================================================================
+
+/** Parameters of a baked tileable cloud noise volume. Every field contributes to the cache key. */
+struct FCloudNoiseBakeSettings
+{
+	/** Number of voxels along each axis. */
+	int32 Resolution = 128;
+
+	/** Lattice cells of the Worley noise along each axis for the first channel, doubled for every following channel. */
+	int32 WorleyFrequency = 4;
+
+	/** Lattice cells of the Perlin noise along each axis at the first octave. */
+	int32 PerlinFrequency = 4;
+	int32 PerlinOctaves = 4;
+
+	/** Whether the red channel holds Perlin-Worley (shape noise) instead of Worley FBM (detail noise). */
+	bool bPerlinWorley = true;
+
+	uint32 Seed = 0;
+
+	/** 128^3 RGBA: R Perlin-Worley, GBA Worley FBM at increasing frequencies. */
+	static FCloudNoiseBakeSettings Shape();
+
+	/** 32^3 RGBA: Worley FBM at increasing frequencies. */
+	static FCloudNoiseBakeSettings Detail();
+
+	uint32 GetHash() const;
+};
+
+/** A baked cubic RGBA8 noise volume that tiles along all three axes. */
+struct FCloudNoiseVolume
+{
+	int32 Resolution = 0;
+
+	/** Resolution^3 texels, X major. FColor is BGRA in memory, so the GPU texture is PF_B8G8R8A8. */
+	TArray<FColor> Texels;
+
+	/** Trilinearly filtered, wrapped lookup matching a bilinear wrap sampler on the GPU texture. */
+	FOO_API FVector4f SampleTrilinear(const FVector3f& UVW) const;
+};
+
+// ================================================================================================
+
+namespace CloudNoise
+{
+	/** Bakes the volume on all cores, one slice per task. */
+	FOO_API TSharedRef<FCloudNoiseVolume> Bake(const FCloudNoiseBakeSettings& Settings);
+
+	/** Returns the volume from the on-disk cache, baking and caching it when missing or stale. */
+	FOO_API TSharedRef<FCloudNoiseVolume> BakeOrLoadCached(const FCloudNoiseBakeSettings& Settings);
+
+	FOO_API FString GetCachePath(const FCloudNoiseBakeSettings& Settings);
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include "CoreMinimal.h"
+
+struct FCloudNoiseVolume;
+
+// ================================================================================================
+
+/**
+ * Min/max pyramid of the shape term of the cloud density, CloudRemap(R, FBM(GBA) - 1, 1, 0, 1), over
+ * the tiling shape noise volume. Level 0 has one cell per noise texel, bounding every trilinear lookup
+ * that falls into the cell; every further level halves the resolution. The march skips cells whose
+ * maximum cannot pass the coverage threshold.
+ *
+ * CPU mirror of the occupancy pre-pass in CloudOccupancy.usf.
+ */
+struct FCloudOccupancyPyramid
+{
+	int32 Resolution = 0;
+
+	/** (Min, Max) per cell, X major, one array per level. */
+	TArray<TArray<FVector2f>> Levels;
+
+	int32 GetNumLevels() const { return Levels.Num(); }
+
+	/** Looks up a cell, wrapping the coordinates like the noise. */
+	FOO_API FVector2f Load(const FIntVector& Cell, int32 Level) const;
+
+	FOO_API static TSharedRef<FCloudOccupancyPyramid> Build(const FCloudNoiseVolume& ShapeNoise);
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "CloudRaymarch.h"
+
+// ================================================================================================
+
+/** Timing of a pass of FCloudOfflineRenderer. */
+struct FCloudOfflinePassStats
+{
+	double Seconds = 0.0;
+	int32 NumThreads = 0;
+
+	/** Tiles workers took from other workers once their own ran out. */
+	int32 NumStolenTiles = 0;
+
+	/** Tiles rendered by the busiest and the idlest worker. */
+	int32 MaxWorkerTiles = 0;
+	int32 MinWorkerTiles = 0;
+};
+
+/**
+ * Renders the CPU reference of the clouds progressively, without a GPU, e.g. for thumbnails and stills
+ * on build machines. Every pass adds one sample per pixel: the first one matches
+ * CloudRaymarch::RenderCloudImage, later ones jitter the sample within the pixel and along the march,
+ * so the average converges to an antialiased, noise free image.
+ *
+ * The image is split into square tiles. Every worker of a pass starts with a contiguous range of them
+ * and takes tiles from its front; once it runs out it steals half of the tiles left at the back of
+ * another worker, so expensive tiles full of clouds do not leave the other cores idle.
+ */
+class FCloudOfflineRenderer
+{
+public:
+	FOO_API FCloudOfflineRenderer(const FCloudMarchSettings& InSettings, TArray<FCloudVolume> InVolumes, const FCloudReferenceCamera& InCamera, int32 InTileSize = 32);
+
+	/** Adds a sample to every pixel, with NumThreads workers or one per core for 0. */
+	FOO_API FCloudOfflinePassStats RenderPass(int32 NumThreads = 0);
+
+	/** Discards the samples of all passes. */
+	FOO_API void Reset();
+
+	/**
+	 * Average of the passes so far as premultiplied (Luminance, 1 - Transmittance), ready to be
+	 * composited over a background. OutPixels has Camera.Size pixels, row major.
+	 */
+	FOO_API void Resolve(TArrayView<FLinearColor> OutPixels) const;
+
+	int32 GetNumPasses() const { return NumPasses; }
+	int32 GetNumTiles() const { return NumTiles.X * NumTiles.Y; }
+	const FCloudReferenceCamera& GetCamera() const { return Camera; }
+
+private:
+	void RenderTile(int32 TileIndex);
+
+	FCloudMarchSettings Settings;
+	TArray<FCloudVolume> Volumes;
+	FCloudReferenceCamera Camera;
+	int32 TileSize = 0;
+	FIntPoint NumTiles = FIntPoint::ZeroValue;
+
+	// Sum of (Luminance, Transmittance) over the passes.
+	TArray<FLinearColor> Accumulation;
+	int32 NumPasses = 0;
+};
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RenderGraphUtils.h"
+#include "ShaderParameterMacros.h"
+
+struct FCloudVolume;
+struct FCloudMarchShaderParameters;
+
+// ================================================================================================
+
+BEGIN_SHADER_PARAMETER_STRUCT(FCloudPanoramaShaderParameters,)
+	SHADER_PARAMETER_RDG_TEXTURE(TextureCube, CloudPanorama)
+	SHADER_PARAMETER_RDG_TEXTURE(TextureCube, CloudPanoramaDepth)
+	SHADER_PARAMETER_SAMPLER(SamplerState, CloudPanoramaSampler)
+	SHADER_PARAMETER(FVector3f, CloudPanoramaOrigin)
+	SHADER_PARAMETER(float, CloudPanoramaNearDistance)
+	SHADER_PARAMETER(uint32, CloudPanoramaEnabled)
+END_SHADER_PARAMETER_STRUCT()
+
+struct FCloudPanoramaSettings
+{
+	/** Texels of every cube face in X and Y. */
+	int32 Resolution = 128;
+
+	/** Distance from the camera beyond which the clouds come from the cache instead of the per view march. */
+	float NearDistance = 100000.0f;
+
+	/** Bands of rows every face is split into, and bands baked per frame. */
+	int32 TilesPerFace = 4;
+	int32 TilesPerFrame = 2;
+};
+
+/**
+ * Luminance and transmittance of the clouds beyond NearDistance in every direction around the camera,
+ * baked into a low resolution cubemap, with the distance to the clouds in a second one so views only
+ * composite them in front of the opaque scene. Owned by the render thread.
+ *
+ * Distant clouds barely change between frames, so views only march the clouds up to NearDistance and
+ * composite the rest from the cache. Reflection and sky light captures can sample it instead of
+ * marching the clouds, see CloudPanorama.ush.
+ *
+ * Like FCloudLightingCache the bake is time sliced: every Update renders TilesPerFrame of the 6 *
+ * TilesPerFace bands into a pending copy, which replaces the visible copy once complete. The origin
+ * is the camera position when the bake started.
+ */
+class FCloudPanoramaCache
+{
+public:
+	/**
+	 * Bakes the next tiles. March provides the noise, weather, lighting and instances of the bake.
+	 * Without volumes both copies are dropped, so views composite no panorama.
+	 */
+	void Update(
+		FRDGBuilder& GraphBuilder,
+		const FGlobalShaderMap* ShaderMap,
+		const FCloudPanoramaSettings& Settings,
+		const FVector& CameraOrigin,
+		TConstArrayView<FCloudVolume> Volumes,
+		const FCloudMarchShaderParameters& March);
+
+	/** Binds the last complete bake, or disables the lookups until there is one. */
+	void SetupParameters(FRDGBuilder& GraphBuilder, FCloudPanoramaShaderParameters& OutParameters) const;
+
+	/** Parameters with the cache disabled: views march all of the clouds. */
+	static void SetupDisabledParameters(FRDGBuilder& GraphBuilder, FCloudPanoramaShaderParameters& OutParameters);
+
+	bool IsValid() const { return Visible.Texture.IsValid(); }
+
+	/** Drops both copies, e.g. when the cache is disabled. */
+	void Reset();
+
+	/** Distance from the camera beyond which the last complete bake covers the clouds. */
+	float GetNearDistance() const { return Visible.NearDistance; }
+
+	/** Size of the pooled targets of both copies. */
+	uint64 GetGpuMemorySize() const;
+
+	/** Number of completed bakes, for diagnostics. */
+	uint32 GetNumBakes() const { return NumBakes; }
+
+private:
+	struct FCloudPanoramaBake
+	{
+		TRefCountPtr<IPooledRenderTarget> Texture;
+		TRefCountPtr<IPooledRenderTarget> DepthTexture;
+		FVector3f Origin = FVector3f::ZeroVector;
+		float NearDistance = 0.0f;
+	};
+
+	FCloudPanoramaBake Visible;
+	FCloudPanoramaBake Pending;
+
+	// Next tile of the pending bake, 0 when a new one starts.
+	int32 NextTile = 0;
+	uint32 NumBakes = 0;
+};
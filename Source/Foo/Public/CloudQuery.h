@@ -0,0 +1,72 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "CloudRaymarch.h"
+
+// ================================================================================================
+
+/** A straight segment through the clouds, e.g. a line of sight. */
+struct FCloudQuerySegment
+{
+	FVector Start = FVector::ZeroVector;
+	FVector End = FVector::ZeroVector;
+};
+
+/**
+ * Four segments of a transmittance query, parameterized over [0, 1] and laid out per axis for the SIMD
+ * slab test. Lanes past the segments given repeat the last one.
+ */
+struct FCloudQuerySegmentPacket
+{
+	alignas(16) float Origin[3][4];
+	alignas(16) float Delta[3][4];
+
+	/** 1 / Delta, BIG_NUMBER where Delta is 0 like IntersectCloudBounds. */
+	alignas(16) float InvDelta[3][4];
+
+	FOO_API FCloudQuerySegmentPacket(const FCloudQuerySegment* Segments, int32 Num);
+
+	/**
+	 * Tests all four lanes against the bounds of Volume at once. Returns the mask of the lanes that cross
+	 * them within [0, 1], as IntersectCloudBounds would, with the crossed range of every lane.
+	 */
+	FOO_API uint32 IntersectBounds(const FCloudVolume& Volume, float OutNear[4], float OutFar[4]) const;
+};
+
+/**
+ * Snapshot of the clouds of a game frame for gameplay queries on the CPU, see
+ * FCloudSceneViewExtension::GetQueryScene_GameThread. Evaluates the density model of the march
+ * (CloudRaymarch::SampleCloudDensity) over the volumes, settings and wind of that frame. Immutable,
+ * so it can be queried from any thread, and it keeps everything it samples alive.
+ *
+ * Queries are evaluated four at a time: every volume is tested against the four points or segments
+ * at once, and only the queries it contains are sampled. Large batches are split across the task graph.
+ *
+ * The weather comes from the overview of the weather map, the fallback of the GPU for tiles that are
+ * not streamed in. Authored brick volumes are sampled at full resolution.
+ */
+class FCloudQueryScene
+{
+public:
+	FOO_API FCloudQueryScene(const FCloudMarchSettings& InSettings, TArray<FCloudVolume> InVolumes);
+
+	/** Density at every point, summed over the volumes containing it. */
+	FOO_API void QueryDensity(TConstArrayView<FVector> Points, TArrayView<float> OutDensity) const;
+
+	/**
+	 * Transmittance along every segment through all volumes, 1 for segments missing the clouds. Every
+	 * volume a segment crosses is sampled NumSteps times, like MarchCloudSunTransmittance.
+	 */
+	FOO_API void QueryTransmittance(TConstArrayView<FCloudQuerySegment> Segments, TArrayView<float> OutTransmittance, int32 NumSteps = 16) const;
+
+	const FCloudMarchSettings& GetSettings() const { return Settings; }
+	TConstArrayView<FCloudVolume> GetVolumes() const { return Volumes; }
+
+private:
+	/** Up to four queries, evaluated together. */
+	void QueryDensityPacket(const FVector* Points, float* OutDensity, int32 Num) const;
+	void QueryTransmittancePacket(const FCloudQuerySegment* Segments, float* OutTransmittance, int32 Num, int32 NumSteps) const;
+
+	FCloudMarchSettings Settings;
+	TArray<FCloudVolume> Volumes;
+};
@@ -0,0 +1,170 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "CloudWeatherMap.h"
+
+struct FCloudNoiseVolume;
+struct FCloudOccupancyPyramid;
+
+// ================================================================================================
+
+/** A single axis aligned cloud volume. Matches FCloudVolume in CloudCommon.ush. */
+struct FCloudVolume
+{
+	/** World space bounds. */
+	FVector3f BoundsMin = FVector3f::ZeroVector;
+	FVector3f BoundsMax = FVector3f::ZeroVector;
+
+	float DensityScale = 1.0f;
+
+	/** Fraction of the volume covered by clouds, 0-1. */
+	float Coverage = 0.6f;
+
+	/**
+	 * Id of an authored brick volume whose density replaces the procedural clouds, 0 for none. See
+	 * FCloudSceneViewExtension::AddBrickVolume_GameThread.
+	 */
+	uint32 BrickVolume = 0;
+
+	FVector3f GetCenter() const { return (BoundsMin + BoundsMax) * 0.5f; }
+
+	bool operator==(const FCloudVolume& Other) const
+	{
+		return BoundsMin == Other.BoundsMin && BoundsMax == Other.BoundsMax && DensityScale == Other.DensityScale && Coverage == Other.Coverage
+			&& BrickVolume == Other.BrickVolume;
+	}
+};
+
+/**
+ * Parameters of the cloud density and lighting model shared by all volumes. Feeds the Cloud* shader
+ * parameters declared in CloudCommon.ush and the CPU reference of the march below.
+ */
+struct FCloudMarchSettings
+{
+	/** Baked shape (Perlin-Worley) and detail (Worley FBM) noise, see CloudNoiseBaker.h. No clouds without them. */
+	TSharedPtr<const FCloudNoiseVolume> ShapeNoise;
+	TSharedPtr<const FCloudNoiseVolume> DetailNoise;
+
+	/** Min/max pyramid of the shape noise for empty space skipping, see CloudOccupancy.h. No skipping without it. */
+	TSharedPtr<const FCloudOccupancyPyramid> Occupancy;
+
+	/** Coarsest occupancy level the march tests, a cell of 2^Level noise texels. */
+	int32 MaxOccupancyLevel = 5;
+
+	/**
+	 * Weather at a world XY position, e.g. FCloudWeatherTileCache::Sample. Neutral weather when unset.
+	 * The GPU falls back to the map overview for tiles that are not streamed in yet, the CPU does not.
+	 */
+	TFunction<FCloudWeatherSample(const FVector2f& WorldXY)> SampleWeather;
+
+	/**
+	 * Authored density of a brick volume at a position in [0, 1]^3 of its bounds, e.g.
+	 * FCloudBrickVolumeFile::SampleDensity. Brick volumes are empty when unset. The GPU uses the
+	 * average density of bricks that are not streamed in yet, the CPU does not.
+	 */
+	TFunction<float(uint32 BrickVolume, const FVector3f& Local)> SampleBrickDensity;
+
+	/** World space offset of the noise lookups, usually WindVelocity times time. */
+	FVector3f WindOffset = FVector3f::ZeroVector;
+
+	/** Wind velocity in world units per second. */
+	FVector3f WindVelocity = FVector3f(100.0f, 30.0f, 0.0f);
+
+	/** Tiling frequencies of the noise volumes in 1 / world units. */
+	float ShapeFrequency = 1.0f / 800.0f;
+	float DetailFrequency = 1.0f / 150.0f;
+
+	/** How much the detail noise erodes the edges of the shape, 0-1. */
+	float DetailStrength = 0.35f;
+
+	/** Extinction per world unit at density 1. */
+	float Extinction = 0.02f;
+
+	FVector3f SunDirection = FVector3f(0.5f, 0.3f, 0.8f).GetSafeNormal();
+
+	/** Henyey-Greenstein asymmetry parameter. */
+	float PhaseG = 0.5f;
+
+	FVector3f SunIlluminance = FVector3f(3.0f, 2.85f, 2.7f);
+	FVector3f AmbientIlluminance = FVector3f(0.25f, 0.3f, 0.4f);
+
+	int32 NumSteps = 64;
+	int32 NumLightSteps = 4;
+
+	/** The march stops once the transmittance falls below this. */
+	float TransmittanceThreshold = 0.01f;
+};
+
+struct FCloudMarchResult
+{
+	FVector3f Luminance = FVector3f::ZeroVector;
+	float Transmittance = 1.0f;
+
+	/** Transmittance weighted distance to the cloud along the ray, 0 if nothing was hit. */
+	float Depth = 0.0f;
+
+	/** Density evaluations and occupancy cells skipped, only tracked by the CPU reference. */
+	int32 NumDensitySteps = 0;
+	int32 NumSkippedCells = 0;
+};
+
+/** Pinhole camera for rendering the CPU reference to an image. */
+struct FCloudReferenceCamera
+{
+	FVector3f Origin = FVector3f::ZeroVector;
+	FRotator3f Rotation = FRotator3f::ZeroRotator;
+
+	/** Horizontal field of view in degrees. */
+	float FieldOfView = 90.0f;
+
+	FIntPoint Size = FIntPoint(256, 144);
+
+	/** Normalized world space direction through a pixel position, (0, 0) being the top left corner. */
+	FOO_API FVector3f GetRayDirection(const FVector2f& PixelPos) const;
+};
+
+// ================================================================================================
+
+/**
+ * CPU reference of the cloud math in CloudCommon.ush, so the shader can be checked without a GPU.
+ * Every function mirrors the HLSL function of the same name; keep both in sync.
+ */
+namespace CloudRaymarch
+{
+	FOO_API float CloudRemap(float Value, float OldMin, float OldMax, float NewMin, float NewMax);
+	FOO_API float CloudHeightGradient(float Height, float Type);
+	FOO_API FCloudWeatherSample SampleCloudWeather(const FCloudMarchSettings& Settings, const FVector3f& WorldPos);
+
+	FOO_API float SampleCloudDensity(const FCloudMarchSettings& Settings, const FCloudVolume& Volume, const FVector3f& WorldPos);
+	FOO_API float HenyeyGreenstein(float CosTheta, float G);
+	FOO_API bool IntersectCloudBounds(const FCloudVolume& Volume, const FVector3f& Origin, const FVector3f& Dir, float& OutNear, float& OutFar);
+
+	FOO_API float CloudMaxHeightGradient(float MinHeight, float MaxHeight, float Type);
+	FOO_API bool IsCloudCellEmpty(const FCloudMarchSettings& Settings, const FCloudVolume& Volume, const FVector3f& WorldPos, const FIntVector& Cell, int32 Level, float CellWorldSize);
+	FOO_API float CloudCellExitDistance(const FVector3f& NoisePos, const FVector3f& NoiseDir, const FVector3f& CellMin, float CellSize);
+
+	FOO_API float MarchLightTransmittance(const FCloudMarchSettings& Settings, const FCloudVolume& Volume, const FVector3f& WorldPos);
+
+	/** Optical depth towards the sun through a single volume, in NumSteps samples. */
+	FOO_API float MarchCloudSunOpticalDepth(const FCloudMarchSettings& Settings, const FCloudVolume& Volume, const FVector3f& WorldPos, int32 NumSteps);
+
+	/**
+	 * Transmittance towards the sun through every volume, NumSteps per volume. This is what the light
+	 * volume and shadow map of FCloudLightingCache hold; the CPU march always uses MarchLightTransmittance.
+	 */
+	FOO_API float MarchCloudSunTransmittance(const FCloudMarchSettings& Settings, TConstArrayView<FCloudVolume> Volumes, const FVector3f& WorldPos, int32 NumSteps);
+
+	FOO_API FCloudMarchResult MarchCloud(const FCloudMarchSettings& Settings, const FCloudVolume& Volume, const FVector3f& Origin, const FVector3f& Dir, float MaxDistance, float Jitter);
+
+	/**
+	 * Marches every volume and composites them back to front, like the instanced march pass blends them.
+	 * Volumes are sorted by the distance of their center to Origin.
+	 */
+	FOO_API FCloudMarchResult MarchCloudVolumes(const FCloudMarchSettings& Settings, TConstArrayView<FCloudVolume> Volumes, const FVector3f& Origin, const FVector3f& Dir, float MaxDistance, float Jitter);
+
+	/**
+	 * Marches every pixel center of the camera with a fixed jitter, in parallel over rows. Pixels hold
+	 * (Luminance, Transmittance) like the reduced resolution color target of the march pass.
+	 */
+	FOO_API void RenderCloudImage(const FCloudMarchSettings& Settings, TConstArrayView<FCloudVolume> Volumes, const FCloudReferenceCamera& Camera, TArrayView<FLinearColor> OutPixels, float Jitter = 0.5f);
+}
@@ -1,11 +1,22 @@
 #pragma once
 
 #include "CoreMinimal.h"
+#include "Async/Future.h"
 #include "Engine/Engine.h"
 #include "RenderGraphUtils.h"
 #include "ScreenPass.h"
 #include "PipelineStateCache.h"
 #include "SceneViewExtension.h"
+#include "CloudBrickPool.h"
+#include "CloudBudgetController.h"
+#include "CloudLighting.h"
+#include "CloudPanorama.h"
+#include "CloudQuery.h"
+#include "CloudRaymarch.h"
+#include "CloudSettings.h"
+#include "CloudTrace.h"
+#include "CloudVolumes.h"
+#include "CloudWeatherClipmap.h"
 
 // ================================================================================================
 
@@ -23,16 +34,16 @@ class FTriangleVertexBuffer : public FVertexBuffer
 public:
 	void InitRHI(FRHICommandListBase& RHICmcList) override {
 
-		// Cube Vertices
+		// Unit cube, scaled to the bounds of each cloud volume instance in the vertex shader.
 		TArray<FVector3f> VertexPositions = {
-			FVector3f(-200, -200, -200), // 0: Bottom-left-back
-			FVector3f( 200, -200, -200), // 1: Bottom-right-back
-			FVector3f( 200,  200, -200), // 2: Top-right-back
-			FVector3f(-200,  200, -200), // 3: Top-left-back
-			FVector3f(-200, -200,  200), // 4: Bottom-left-front
-			FVector3f( 200, -200,  200), // 5: Bottom-right-front
-			FVector3f( 200,  200,  200), // 6: Top-right-front
-			FVector3f(-200,  200,  200)  // 7: Top-left-front
+			FVector3f(0, 0, 0), // 0: Bottom-left-back
+			FVector3f(1, 0, 0), // 1: Bottom-right-back
+			FVector3f(1, 1, 0), // 2: Top-right-back
+			FVector3f(0, 1, 0), // 3: Top-left-back
+			FVector3f(0, 0, 1), // 4: Bottom-left-front
+			FVector3f(1, 0, 1), // 5: Bottom-right-front
+			FVector3f(1, 1, 1), // 6: Top-right-front
+			FVector3f(0, 1, 1)  // 7: Top-left-front
 		};
 
 		uint32 NumVertices = VertexPositions.Num();
@@ -41,7 +52,7 @@ public:
 
 		for (size_t i = 0; i < NumVertices; i++)
 		{
-			Vertices[i].Position = VertexPositions[i] + FVector3f(3000.0, -1000.0, 70.0);
+			Vertices[i].Position = VertexPositions[i];
 			Vertices[i].Color = FVector4f(1.0, 0.0, 0.0, 1.0);
 		}
 
@@ -105,7 +116,7 @@ public:
 	{
 		FVertexDeclarationElementList Elements;
 		uint32 Stride = sizeof(FColorVertex);
-		Elements.Add(FVertexElement(0, STRUCT_OFFSET(FColorVertex, Position), VET_Float2, 0, Stride));
+		Elements.Add(FVertexElement(0, STRUCT_OFFSET(FColorVertex, Position), VET_Float3, 0, Stride));
 		Elements.Add(FVertexElement(0, STRUCT_OFFSET(FColorVertex, Color), VET_Float4, 1, Stride));
 		VertexDeclarationRHI = PipelineStateCache::GetOrCreateVertexDeclaration(Elements);
 	}
@@ -120,10 +131,29 @@ extern TGlobalResource<FTriangleVertexDeclaration> GCloudVertexDeclaration;
 
 // ================================================================================================
 
+/**
+ * Everything about a view the cloud passes share, as CloudView in the shaders (see CloudView.ush).
+ * Built once per view in PreRenderView_RenderThread; pixel positions are relative to the view rect.
+ */
+BEGIN_GLOBAL_SHADER_PARAMETER_STRUCT(FCloudViewUniformParameters,)
+	SHADER_PARAMETER(FMatrix44f, WorldToClip)
+	SHADER_PARAMETER(FMatrix44f, ClipToWorld)
+	SHADER_PARAMETER(FMatrix44f, PrevWorldToClip)
+	SHADER_PARAMETER(FVector3f, CameraOrigin)
+	SHADER_PARAMETER(FVector2f, ViewSize)
+	SHADER_PARAMETER(FUintVector2, LowResSize)
+	SHADER_PARAMETER(FUintVector2, SampleOffset)
+	SHADER_PARAMETER(uint32, ResolutionDivisor)
+	SHADER_PARAMETER(uint32, FrameIndex)
+	SHADER_PARAMETER(uint32, bHistoryValid)
+END_GLOBAL_SHADER_PARAMETER_STRUCT()
+
 BEGIN_SHADER_PARAMETER_STRUCT(FCloudVSParams,)
 	//SHADER_PARAMETER_STRUCT_ARRAY(FCloudVertParams,Verticies)
 	//RENDER_TARGET_BINDING_SLOTS()
-	SHADER_PARAMETER(FMatrix44f, Transform)
+	SHADER_PARAMETER_RDG_UNIFORM_BUFFER(FCloudViewUniformParameters, CloudView)
+	SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<float4>, CloudInstances)
+	SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<uint>, CloudDrawList)
 END_SHADER_PARAMETER_STRUCT()
 
 class FCloudVS : public FGlobalShader
@@ -141,18 +171,380 @@ public:
 
 // ================================================================================================
 
+BEGIN_SHADER_PARAMETER_STRUCT(FCloudMarchShaderParameters,)
+	SHADER_PARAMETER(FVector3f, CloudWindOffset)
+	SHADER_PARAMETER(float, CloudShapeFrequency)
+	SHADER_PARAMETER(float, CloudDetailFrequency)
+	SHADER_PARAMETER(float, CloudDetailStrength)
+	SHADER_PARAMETER(float, CloudExtinction)
+	SHADER_PARAMETER(FVector3f, CloudSunDirection)
+	SHADER_PARAMETER(float, CloudPhaseG)
+	SHADER_PARAMETER(FVector3f, CloudSunIlluminance)
+	SHADER_PARAMETER(FVector3f, CloudAmbientIlluminance)
+	SHADER_PARAMETER(uint32, CloudNumSteps)
+	SHADER_PARAMETER(uint32, CloudNumLightSteps)
+	SHADER_PARAMETER(float, CloudTransmittanceThreshold)
+	SHADER_PARAMETER_TEXTURE(Texture3D, CloudShapeNoiseTexture)
+	SHADER_PARAMETER_TEXTURE(Texture3D, CloudDetailNoiseTexture)
+	SHADER_PARAMETER_SAMPLER(SamplerState, CloudNoiseSampler)
+	SHADER_PARAMETER_RDG_TEXTURE(Texture3D<float2>, CloudOccupancyTexture)
+	SHADER_PARAMETER(uint32, CloudOccupancyResolution)
+	SHADER_PARAMETER(uint32, CloudOccupancyMaxLevel)
+	SHADER_PARAMETER(uint32, CloudEmptySpaceSkipping)
+	SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<float4>, CloudInstances)
+	SHADER_PARAMETER_STRUCT_INCLUDE(FCloudWeatherShaderParameters, Weather)
+	SHADER_PARAMETER_STRUCT_INCLUDE(FCloudLightingShaderParameters, Lighting)
+	SHADER_PARAMETER_STRUCT_INCLUDE(FCloudBrickShaderParameters, Bricks)
+END_SHADER_PARAMETER_STRUCT()
+
+/** GPU copies of the baked cloud noise volumes, see CloudNoiseBaker.h. */
+struct FCloudNoiseTextures
+{
+	FTextureRHIRef ShapeTexture;
+	FTextureRHIRef DetailTexture;
+
+	// Min/max pyramid of the shape noise, built on the GPU by the first frame that renders clouds.
+	TRefCountPtr<IPooledRenderTarget> OccupancyTexture;
+
+	bool IsValid() const { return ShapeTexture.IsValid() && DetailTexture.IsValid(); }
+};
+
+void SetupCloudMarchParameters(FCloudMarchShaderParameters& OutParameters, const FCloudMarchSettings& Settings, const FCloudNoiseTextures& NoiseTextures);
+
+// ================================================================================================
+
+/** Level 0 of the occupancy pyramid, see FCloudOccupancyPyramid. */
+class FCloudOccupancyInitCS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FCloudOccupancyInitCS);
+	SHADER_USE_PARAMETER_STRUCT(FCloudOccupancyInitCS, FGlobalShader)
+
+	static constexpr int32 ThreadGroupSize = 4;
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+		SHADER_PARAMETER_TEXTURE(Texture3D, CloudShapeNoiseTexture)
+		SHADER_PARAMETER(uint32, OccupancyResolution)
+		SHADER_PARAMETER_RDG_TEXTURE_UAV(RWTexture3D<float2>, OccupancyOutput)
+	END_SHADER_PARAMETER_STRUCT()
+
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("THREADGROUP_SIZE"), ThreadGroupSize);
+	}
+};
+
+/** Every further level of the occupancy pyramid, from the level below. */
+class FCloudOccupancyDownsampleCS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FCloudOccupancyDownsampleCS);
+	SHADER_USE_PARAMETER_STRUCT(FCloudOccupancyDownsampleCS, FGlobalShader)
+
+	static constexpr int32 ThreadGroupSize = 4;
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+		SHADER_PARAMETER_RDG_TEXTURE_SRV(Texture3D<float2>, OccupancyParentMip)
+		SHADER_PARAMETER(uint32, OccupancyResolution)
+		SHADER_PARAMETER_RDG_TEXTURE_UAV(RWTexture3D<float2>, OccupancyOutput)
+	END_SHADER_PARAMETER_STRUCT()
+
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("THREADGROUP_SIZE"), ThreadGroupSize);
+	}
+};
+
+// ================================================================================================
+
+BEGIN_SHADER_PARAMETER_STRUCT(FCloudLightingBakeParameters,)
+	SHADER_PARAMETER_STRUCT_INCLUDE(FCloudMarchShaderParameters, March)
+	SHADER_PARAMETER(FVector3f, BakeVolumeMin)
+	SHADER_PARAMETER(FVector3f, BakeVolumeSize)
+	SHADER_PARAMETER(FUintVector3, BakeResolution)
+	SHADER_PARAMETER(uint32, BakeFirstSlice)
+	SHADER_PARAMETER(uint32, BakeNumSlices)
+	SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<FUintVector2>, BakeTileRanges)
+	SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<uint>, BakeTileVolumes)
+	SHADER_PARAMETER(uint32, BakeTilesPerAxis)
+	SHADER_PARAMETER(uint32, BakeNumSteps)
+END_SHADER_PARAMETER_STRUCT()
+
+/** Slices of the light volume of FCloudLightingCache. */
+class FCloudLightVolumeCS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FCloudLightVolumeCS);
+	SHADER_USE_PARAMETER_STRUCT(FCloudLightVolumeCS, FGlobalShader)
+
+	static constexpr int32 ThreadGroupSize = 8;
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+		SHADER_PARAMETER_STRUCT_INCLUDE(FCloudLightingBakeParameters, Bake)
+		SHADER_PARAMETER_RDG_TEXTURE_UAV(RWTexture3D<float>, LightVolumeOutput)
+	END_SHADER_PARAMETER_STRUCT()
+
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("THREADGROUP_SIZE"), ThreadGroupSize);
+	}
+};
+
+/** Rows of the shadow map of FCloudLightingCache. */
+class FCloudShadowMapCS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FCloudShadowMapCS);
+	SHADER_USE_PARAMETER_STRUCT(FCloudShadowMapCS, FGlobalShader)
+
+	static constexpr int32 ThreadGroupSize = 8;
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+		SHADER_PARAMETER_STRUCT_INCLUDE(FCloudLightingBakeParameters, Bake)
+		SHADER_PARAMETER_RDG_TEXTURE_UAV(RWTexture2D<float>, ShadowMapOutput)
+	END_SHADER_PARAMETER_STRUCT()
+
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("THREADGROUP_SIZE"), ThreadGroupSize);
+	}
+};
+
+/** Bands of the distant cloud cubemap of FCloudPanoramaCache. */
+class FCloudPanoramaCS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FCloudPanoramaCS);
+	SHADER_USE_PARAMETER_STRUCT(FCloudPanoramaCS, FGlobalShader)
+
+	static constexpr int32 ThreadGroupSize = 8;
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+		SHADER_PARAMETER_STRUCT_INCLUDE(FCloudMarchShaderParameters, March)
+		SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<uint>, PanoramaDrawList)
+		SHADER_PARAMETER(FVector3f, PanoramaOrigin)
+		SHADER_PARAMETER(float, PanoramaNearDistance)
+		SHADER_PARAMETER(uint32, PanoramaResolution)
+		SHADER_PARAMETER(uint32, PanoramaRowsPerTile)
+		SHADER_PARAMETER(uint32, PanoramaTilesPerFace)
+		SHADER_PARAMETER(uint32, PanoramaFirstTile)
+		SHADER_PARAMETER(uint32, PanoramaNumTiles)
+		SHADER_PARAMETER(uint32, PanoramaNumVolumes)
+		SHADER_PARAMETER_RDG_TEXTURE_UAV(RWTexture2DArray<float4>, PanoramaOutput)
+		SHADER_PARAMETER_RDG_TEXTURE_UAV(RWTexture2DArray<float>, PanoramaDepthOutput)
+	END_SHADER_PARAMETER_STRUCT()
+
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("THREADGROUP_SIZE"), ThreadGroupSize);
+	}
+};
+
+// ================================================================================================
+
+/** How the march lights its samples, see GetCloudLightTransmittance in CloudCommon.ush. */
+enum class ECloudLightingMode : uint8
+{
+	/** Sun light is not shadowed, only the ambient term varies. */
+	Unshadowed,
+	/** Light volume of FCloudLightingCache, with the secondary march outside of it. */
+	LightVolume,
+	/** Secondary march towards the sun per sample. */
+	SecondaryMarch,
+	MAX
+};
+
+/**
+ * Quality tiers of the march pixel shader, so its loops and branches are specialized at compile time.
+ * Every combination is precached at startup, see FCloudSceneViewExtension::PrecachePipelineStates.
+ */
+namespace CloudPermutation
+{
+	class FStepCountDim : SHADER_PERMUTATION_SPARSE_INT("CLOUD_NUM_STEPS", 32, 64, 128);
+	class FDetailNoiseDim : SHADER_PERMUTATION_BOOL("CLOUD_DETAIL_NOISE");
+	class FLightingModeDim : SHADER_PERMUTATION_ENUM_CLASS("CLOUD_LIGHTING_MODE", ECloudLightingMode);
+
+	using FDomain = TShaderPermutationDomain<FStepCountDim, FDetailNoiseDim, FLightingModeDim>;
+
+	/** The smallest step count tier of at least NumSteps, or the largest. */
+	int32 GetStepCountTier(int32 NumSteps);
+}
+
+/**
+ * Scene depth of a view, read by CloudSceneDepth.ush so the march stops at opaque geometry and the
+ * upsample does not blend clouds across geometry edges. Pixel positions are relative to the view rect
+ * of the clouds, which may be scaled relative to the rect the scene depth was rendered at.
+ */
+BEGIN_SHADER_PARAMETER_STRUCT(FCloudSceneDepthParameters,)
+	SHADER_PARAMETER_RDG_TEXTURE(Texture2D<float>, CloudSceneDepthTexture)
+	SHADER_PARAMETER(FIntPoint, CloudSceneDepthViewMin)
+	SHADER_PARAMETER(FIntPoint, CloudSceneDepthViewMax)
+	SHADER_PARAMETER(FVector2f, CloudSceneDepthScale)
+	SHADER_PARAMETER(FVector4f, CloudInvDeviceZToWorldZ)
+	SHADER_PARAMETER(FVector3f, CloudViewForward)
+	SHADER_PARAMETER(uint32, CloudSceneDepthEnabled)
+END_SHADER_PARAMETER_STRUCT()
+
 BEGIN_SHADER_PARAMETER_STRUCT(FCloudPSParams,)
-	RENDER_TARGET_BINDING_SLOTS()
-	SHADER_PARAMETER(FVector4f, Offset)
+	SHADER_PARAMETER_STRUCT_INCLUDE(FCloudMarchShaderParameters, March)
+	SHADER_PARAMETER_STRUCT_INCLUDE(FCloudSceneDepthParameters, SceneDepth)
+	SHADER_PARAMETER_STRUCT_INCLUDE(FCloudPanoramaShaderParameters, Panorama)
+	SHADER_PARAMETER_RDG_UNIFORM_BUFFER(FCloudViewUniformParameters, CloudView)
 END_SHADER_PARAMETER_STRUCT()
 
 class FCloudPS : public FGlobalShader
 {
+public:
 	DECLARE_GLOBAL_SHADER(FCloudPS);
 	using FParameters = FCloudPSParams;
+	using FPermutationDomain = CloudPermutation::FDomain;
 	SHADER_USE_PARAMETER_STRUCT(FCloudPS, FGlobalShader)
 };
 
+BEGIN_SHADER_PARAMETER_STRUCT(FCloudMarchPassParams,)
+	SHADER_PARAMETER_STRUCT_INCLUDE(FCloudVSParams, VS)
+	SHADER_PARAMETER_STRUCT_INCLUDE(FCloudPSParams, PS)
+	RENDER_TARGET_BINDING_SLOTS()
+END_SHADER_PARAMETER_STRUCT()
+
+// ================================================================================================
+
+/** Classes of the screen tiles of the reduced resolution march, see CloudTiles.usf. */
+enum class ECloudTileClass : uint8
+{
+	/** A volume is in front of the opaque scene and no geometry clips the march. */
+	Sky,
+	/** A volume is in front of the opaque scene, which clips the march of some pixels. */
+	Geometry,
+	/** Volumes only cover the tile behind opaque geometry. */
+	Occluded,
+	/** No volume covers the tile. */
+	Empty,
+	MAX
+};
+
+/** Tile classes that are marched, each with an indirect dispatch of its tiles. */
+static constexpr int32 CloudNumMarchedTileClasses = int32(ECloudTileClass::Geometry) + 1;
+
+BEGIN_SHADER_PARAMETER_STRUCT(FCloudTileParameters,)
+	SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<uint>, CloudDrawList)
+	SHADER_PARAMETER(uint32, CloudNumDrawVolumes)
+	SHADER_PARAMETER(uint32, CloudNumTiles)
+	SHADER_PARAMETER_STRUCT_INCLUDE(FCloudPSParams, PS)
+END_SHADER_PARAMETER_STRUCT()
+
+/**
+ * Sorts every tile of ThreadGroupSize^2 reduced resolution pixels into an ECloudTileClass by
+ * intersecting the rays of its pixels with the bounds of the draw list, and appends the tiles that are
+ * marched to the list and the indirect dispatch of their class.
+ */
+class FCloudTileClassifyCS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FCloudTileClassifyCS);
+	SHADER_USE_PARAMETER_STRUCT(FCloudTileClassifyCS, FGlobalShader)
+
+	static constexpr int32 ThreadGroupSize = 8;
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+		SHADER_PARAMETER_STRUCT_INCLUDE(FCloudTileParameters, Tiles)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWBuffer<uint>, TileIndirectArgsOutput)
+		SHADER_PARAMETER_RDG_BUFFER_UAV(RWStructuredBuffer<uint>, TileListOutput)
+	END_SHADER_PARAMETER_STRUCT()
+
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("THREADGROUP_SIZE"), ThreadGroupSize);
+	}
+};
+
+/**
+ * Marches every volume of the draw list for the pixels of the tiles of a class and composites them like
+ * the blend state of the raster march. Sky tiles use the permutation without scene depth.
+ */
+class FCloudTileMarchCS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FCloudTileMarchCS);
+	SHADER_USE_PARAMETER_STRUCT(FCloudTileMarchCS, FGlobalShader)
+
+	static constexpr int32 ThreadGroupSize = FCloudTileClassifyCS::ThreadGroupSize;
+
+	class FSceneDepthDim : SHADER_PERMUTATION_BOOL("CLOUD_TILE_SCENE_DEPTH");
+	using FPermutationDomain = TShaderPermutationDomain<CloudPermutation::FDomain, FSceneDepthDim>;
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+		SHADER_PARAMETER_STRUCT_INCLUDE(FCloudTileParameters, Tiles)
+		SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<uint>, TileList)
+		SHADER_PARAMETER(uint32, TileListOffset)
+		SHADER_PARAMETER_RDG_TEXTURE_UAV(RWTexture2D<float4>, CloudColorOutput)
+		SHADER_PARAMETER_RDG_TEXTURE_UAV(RWTexture2D<float>, CloudDepthOutput)
+		RDG_BUFFER_ACCESS(TileIndirectArgs, ERHIAccess::IndirectArgs)
+	END_SHADER_PARAMETER_STRUCT()
+
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("THREADGROUP_SIZE"), ThreadGroupSize);
+	}
+};
+
+// ================================================================================================
+
+class FCloudReprojectCS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FCloudReprojectCS);
+	SHADER_USE_PARAMETER_STRUCT(FCloudReprojectCS, FGlobalShader)
+
+	static constexpr int32 ThreadGroupSize = 8;
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+		SHADER_PARAMETER_RDG_TEXTURE(Texture2D<float4>, CloudColorTexture)
+		SHADER_PARAMETER_RDG_TEXTURE(Texture2D<float>, CloudDepthTexture)
+		SHADER_PARAMETER_RDG_TEXTURE(Texture2D<float4>, HistoryTexture)
+		SHADER_PARAMETER_STRUCT_INCLUDE(FCloudSceneDepthParameters, SceneDepth)
+		SHADER_PARAMETER_SAMPLER(SamplerState, LinearClampSampler)
+		SHADER_PARAMETER_RDG_UNIFORM_BUFFER(FCloudViewUniformParameters, CloudView)
+		SHADER_PARAMETER(float, HistoryWeight)
+		SHADER_PARAMETER(float, UpsampleDepthTolerance)
+		SHADER_PARAMETER_RDG_TEXTURE_UAV(RWTexture2D<float4>, HistoryOutput)
+	END_SHADER_PARAMETER_STRUCT()
+
+	static void ModifyCompilationEnvironment(const FGlobalShaderPermutationParameters& Parameters, FShaderCompilerEnvironment& OutEnvironment)
+	{
+		FGlobalShader::ModifyCompilationEnvironment(Parameters, OutEnvironment);
+		OutEnvironment.SetDefine(TEXT("THREADGROUP_SIZE"), ThreadGroupSize);
+	}
+};
+
+// ================================================================================================
+
+class FCloudCompositePS : public FGlobalShader
+{
+public:
+	DECLARE_GLOBAL_SHADER(FCloudCompositePS);
+	SHADER_USE_PARAMETER_STRUCT(FCloudCompositePS, FGlobalShader)
+
+	BEGIN_SHADER_PARAMETER_STRUCT(FParameters,)
+		SHADER_PARAMETER_RDG_TEXTURE(Texture2D<float4>, HistoryTexture)
+		SHADER_PARAMETER_RDG_TEXTURE(Texture2D<float4>, SceneColorTexture)
+		SHADER_PARAMETER_STRUCT_INCLUDE(FCloudSceneDepthParameters, SceneDepth)
+		SHADER_PARAMETER_STRUCT_INCLUDE(FCloudPanoramaShaderParameters, Panorama)
+		SHADER_PARAMETER_RDG_UNIFORM_BUFFER(FCloudViewUniformParameters, CloudView)
+		SHADER_PARAMETER(FIntPoint, SceneColorViewRectMin)
+		SHADER_PARAMETER(FIntPoint, OutputViewRectMin)
+		SHADER_PARAMETER(uint32, bNearClouds)
+		RENDER_TARGET_BINDING_SLOTS()
+	END_SHADER_PARAMETER_STRUCT()
+};
+
 // ================================================================================================
 
 class FCloudSceneViewExtension : public FSceneViewExtensionBase
@@ -163,10 +555,11 @@ public:
 
 	virtual void SetupViewFamily(FSceneViewFamily& InViewFamily) override {}
 	virtual void SetupView(FSceneViewFamily& InViewFamily, FSceneView& InView) override {};
-	virtual void BeginRenderViewFamily(FSceneViewFamily& InViewFamily) override {};
-	virtual void PreRenderViewFamily_RenderThread(FRDGBuilder& GraphBuilder, FSceneViewFamily& InViewFamily) override {};
+	virtual void BeginRenderViewFamily(FSceneViewFamily& InViewFamily) override;
+	virtual void PreRenderViewFamily_RenderThread(FRDGBuilder& GraphBuilder, FSceneViewFamily& InViewFamily) override;
 	virtual void PreRenderView_RenderThread(FRDGBuilder& GraphBuilder, FSceneView& InView) override;
 	virtual void PostRenderBasePass_RenderThread(FRHICommandListImmediate& RHICmdList, FSceneView& InView) override {};
+	virtual void PostRenderViewFamily_RenderThread(FRDGBuilder& GraphBuilder, FSceneViewFamily& InViewFamily) override;
 	virtual void PrePostProcessPass_RenderThread(FRDGBuilder& GraphBuilder, const FSceneView& View, const FPostProcessingInputs& Inputs) override;
 
 	//~ End FSceneViewExtensionBase Interface
@@ -176,11 +569,296 @@ public:
 	FScreenPassTexture TrianglePass_RenderThread(FRDGBuilder& GraphBuilder, const FSceneView& View, const FPostProcessMaterialInputs& Inputs);
 
 public:
+	/**
+	 * Cloud volumes rendered by every view. Ids are allocated on the game thread and the changes are
+	 * applied to the render thread registry in order, so a volume can be updated or removed right
+	 * after it was added.
+	 */
+	uint32 AddCloudVolume_GameThread(const FCloudVolume& Volume);
+	void UpdateCloudVolume_GameThread(uint32 VolumeId, const FCloudVolume& Volume);
+	void RemoveCloudVolume_GameThread(uint32 VolumeId);
+
+	/**
+	 * Authored density for cloud volumes, streamed from a brick volume file (see CloudBrickVolume.h)
+	 * through FCloudBrickPool. Set the returned id as FCloudVolume::BrickVolume. Ids are the lowest
+	 * ones not in use, so they stay small enough to index the volume table of the march. A file that
+	 * fails to load is logged against Owner, and its id renders as an empty volume until removed.
+	 */
+	uint32 AddBrickVolume_GameThread(const FString& Path, const UObject* Owner = nullptr);
+	void RemoveBrickVolume_GameThread(uint32 BrickVolumeId);
+
+	/**
+	 * Settings of the clouds from the game, see UCloudSettingsComponent. They reach the render thread
+	 * with the snapshot of the next frame, see FCloudSettingsMailbox. Owner is only compared, so that
+	 * resetting an owner whose settings were replaced by another one keeps the other's.
+	 */
+	void SetCloudSettings_GameThread(const UObject* Owner, const FCloudSettings& Settings);
+	void ResetCloudSettings_GameThread(const UObject* Owner);
+
+	/**
+	 * Snapshot of the volumes, settings and wind of the current game frame for gameplay queries on the
+	 * CPU. Built on first use in a frame and shared until the clouds change; the snapshot itself can
+	 * be queried from any thread, see FCloudQueryScene.
+	 */
+	TSharedRef<const FCloudQueryScene> GetQueryScene_GameThread();
+
+	/**
+	 * Sun transmittance of the clouds, for passes that shadow opaque geometry with them: bind
+	 * FCloudLightingShaderParameters with SetupParameters and call GetCloudShadow() from CloudCommon.ush.
+	 */
+	const FCloudLightingCache& GetLightingCache_RenderThread() const { return LightingCache; }
+
+	/**
+	 * Distant clouds around the camera, for sky light and reflection passes that should not march the
+	 * clouds: bind FCloudPanoramaShaderParameters with SetupParameters and call SampleCloudPanorama()
+	 * from CloudPanorama.ush.
+	 */
+	const FCloudPanoramaCache& GetPanoramaCache_RenderThread() const { return PanoramaCache; }
+
+	/**
+	 * The noise and the procedural weather map are baked in the background after the extension is
+	 * created. There are no clouds until the noise is done, and the weather is neutral until the map
+	 * is. Blocks until both are and hands them to the render thread, for tests and commandlets that
+	 * render right away. Frames do the same without blocking in BeginRenderViewFamily.
+	 */
+	void WaitForBakes_GameThread() { FinishBakes_GameThread(true); }
+
+	/**
+	 * Marches the cloud volume proxies into the reduced resolution color (luminance, transmittance) and
+	 * depth targets. Draws one instance of the proxy per entry of DrawList, which must be sorted back to front.
+	 */
 	static void RenderTriangle
 	(
 		FRDGBuilder& GraphBuilder,
 		const FGlobalShaderMap* ViewShaderMap,
-		const FIntRect& View,
-		const FScreenPassTexture& InSceneColor,
-		const FMatrix& WorldProjMatrix);
+		const FIntPoint& LowResSize,
+		FRDGTextureRef CloudColor,
+		FRDGTextureRef CloudDepth,
+		FRDGBufferSRVRef DrawList,
+		uint32 NumInstances,
+		const FCloudPS::FPermutationDomain& Permutation,
+		const FCloudPSParams& MarchParams);
+
+	/**
+	 * Same output as RenderTriangle, but classifies the screen tiles first and only marches the tiles
+	 * a volume covers in front of the opaque scene, with indirect dispatches. The targets need
+	 * TexCreate_UAV.
+	 */
+	static void RenderTiles
+	(
+		FRDGBuilder& GraphBuilder,
+		const FGlobalShaderMap* ViewShaderMap,
+		const FIntPoint& LowResSize,
+		FRDGTextureRef CloudColor,
+		FRDGTextureRef CloudDepth,
+		FRDGBufferSRVRef DrawList,
+		uint32 NumInstances,
+		const FCloudPS::FPermutationDomain& Permutation,
+		const FCloudPSParams& MarchParams);
+
+	/**
+	 * Sets OutVisible to the indices of the volumes a view at CameraOrigin marches: those intersecting
+	 * the frustum, minus those entirely beyond PanoramaNearDistance, which the panorama covers. A near
+	 * distance of 0 means there is no panorama. Shared with UCloudReplayCommandlet, so replays cull
+	 * like frames do.
+	 */
+	static void CullVolumes(FCloudVolumeRegistry& Registry, const FConvexVolume& Frustum, const FVector& CameraOrigin, float PanoramaNearDistance, TArray<uint32>& OutVisible);
+
+	/** Formats of the reduced resolution targets of the march pass. */
+	static constexpr EPixelFormat CloudColorFormat = PF_FloatRGBA;
+	static constexpr EPixelFormat CloudDepthFormat = PF_R32_FLOAT;
+
+	/** Pipeline state of the march pass except for its render targets. */
+	static void GetMarchPipelineState(const FGlobalShaderMap* ShaderMap, const FCloudPS::FPermutationDomain& Permutation, FGraphicsPipelineStateInitializer& GraphicsPSOInit);
+
+	/**
+	 * Requests the pipeline states of every march permutation and of the cloud compute passes, so none
+	 * is compiled on first use. Called once the global shaders are available.
+	 */
+	static void PrecachePipelineStates(const FGlobalShaderMap* ShaderMap);
+
+protected:
+	/**
+	 * Every pass of the clouds, and the lighting and panorama bakes, are added to the graph through
+	 * here. The resources and parameters of the passes are recorded either way, so the performance
+	 * tests override it to add nothing and time the render thread under -nullrhi.
+	 */
+	virtual void AddCloudPasses(TFunctionRef<void()> AddPasses) { AddPasses(); }
+
+private:
+	/** Result of the background noise bake of the constructor. */
+	struct FCloudNoiseBake
+	{
+		TSharedPtr<const FCloudNoiseVolume> ShapeNoise;
+		TSharedPtr<const FCloudNoiseVolume> DetailNoise;
+		TSharedPtr<const FCloudOccupancyPyramid> Occupancy;
+	};
+
+	/** Hands the background bakes that finished to the game thread queries and the render thread, optionally waiting for them. */
+	void FinishBakes_GameThread(bool bWait);
+
+	/** Opens the weather map at Path for the queries and streams it into WeatherClipmap. */
+	void OpenWeatherMap_GameThread(const FString& Path);
+
+	/**
+	 * Persistent state of the clouds for a single view, keyed by FSceneView::GetViewKey(). Owns the
+	 * pooled targets of the view across frames and is released once the view has not rendered for
+	 * r.Clouds.ViewState.IdleFrames frames.
+	 */
+	struct FCloudViewHistory
+	{
+		/** Reconstruction of the last frame, read by the reprojection. */
+		TRefCountPtr<IPooledRenderTarget> Texture;
+
+		/** Reconstruction of the frame before, overwritten by the next one while its size matches. */
+		TRefCountPtr<IPooledRenderTarget> NextTexture;
+
+		FMatrix44f WorldToClip;
+		uint32 ResolutionDivisor = 0;
+		uint32 FrameIndex = 0;
+
+		/** GFrameCounterRenderThread of the last frame the view rendered clouds in. */
+		uint64 LastUsedFrame = 0;
+
+		/** Size of the pooled targets of the view. */
+		uint64 GetGpuMemorySize() const;
+	};
+
+	/** Releases the state of views that have gone idle, and updates the memory stats of the persistent targets. */
+	void ReleaseIdleViewHistories();
+
+	/**
+	 * View independent inputs of the march for the family being rendered: settings from the cvars,
+	 * the instance buffer, the occupancy pyramid and the weather. Views of the family only add their
+	 * own draw list and matrices. The RDG resources belong to GraphBuilder.
+	 */
+	struct FCloudFamilyState
+	{
+		const FRDGBuilder* GraphBuilder = nullptr;
+		FCloudMarchShaderParameters March;
+		FCloudPS::FPermutationDomain MarchPermutation;
+		FCloudPanoramaShaderParameters Panorama;
+		uint32 ResolutionDivisor = 1;
+		int32 NumViews = 0;
+
+		/** Settings snapshot the family renders with, see FCloudFrameSnapshot. */
+		FCloudFrameSnapshot Snapshot;
+	};
+
+	/**
+	 * Sets up FamilyState, once for every family, before any of its views render clouds. Also bakes the
+	 * next slices of the cloud lighting and tiles of the distant cloud panorama around CameraOrigin.
+	 * The settings are the snapshot published for the family's FSceneViewFamily::FrameNumber.
+	 */
+	void SetupFamilyState(FRDGBuilder& GraphBuilder, const FGlobalShaderMap* ShaderMap, const FVector& CameraOrigin, int32 NumViews, uint32 FamilyFrameNumber);
+
+	/**
+	 * Per view state of the family being rendered, set up in PreRenderView_RenderThread. The uniform
+	 * buffer belongs to GraphBuilder and assumes a post process view rect of ViewSize.
+	 */
+	struct FCloudViewState
+	{
+		/** Indices of the volumes in the view frustum. */
+		TArray<uint32> VisibleVolumes;
+
+		const FRDGBuilder* GraphBuilder = nullptr;
+		TRDGUniformBufferRef<FCloudViewUniformParameters> UniformBuffer;
+		FIntPoint ViewSize = FIntPoint::ZeroValue;
+
+		/** Key into ViewHistories, 0 for views without a history. */
+		uint32 HistoryKey = 0;
+		uint32 FrameIndex = 0;
+		bool bHistoryValid = false;
+	};
+
+	/** Appends the inputs of the family to the trace of r.Clouds.Trace, opening or closing it as the cvar changes. */
+	void RecordTraceFrame(const FSceneViewFamily& ViewFamily);
+
+	/** Advances the history of the view and builds its uniform buffer for a post process view rect of ViewSize. */
+	void SetupViewState(FRDGBuilder& GraphBuilder, const FSceneView& View, const FIntPoint& ViewSize, FCloudViewState& State);
+
+	/** Rebuilds the uniform buffer of a view without advancing its history, e.g. for another view rect size. */
+	void CreateViewUniformBuffer(FRDGBuilder& GraphBuilder, const FSceneView& View, const FIntPoint& ViewSize, FCloudViewState& State);
+
+	/**
+	 * GPU timestamps around the cloud passes of every family of one frame, a begin and end pair per
+	 * view and per lighting update.
+	 */
+	struct FCloudGpuTiming
+	{
+		TArray<FRHIPooledRenderQuery> Queries;
+
+		/** GFrameCounterRenderThread of the frame. */
+		uint64 Frame = 0;
+
+		/** Whether a view of the frame marched clouds, rather than only the lighting being updated. */
+		bool bRenderedClouds = false;
+	};
+
+	/** Feeds the GPU time of the frames whose timestamps are available to BudgetController, one measurement per frame. */
+	void ReadGpuTimings();
+
+	/** Writes a timestamp to the timing of the current family, if r.Clouds.BudgetMs is set. */
+	void AddGpuTimestamp(FRDGBuilder& GraphBuilder);
+
+	/** Returns the occupancy pyramid of the shape noise, building it on first use. */
+	FRDGTextureRef GetOrBuildOccupancyTexture(FRDGBuilder& GraphBuilder, const FGlobalShaderMap* ShaderMap);
+
+	/**
+	 * Marches the visible volumes up to the near distance of the panorama and composites them and the
+	 * panorama over SceneColor into Output, which has the same view rect size.
+	 */
+	void RenderClouds(FRDGBuilder& GraphBuilder, const FSceneView& View, const FCloudViewState& ViewState, const FScreenPassTexture& SceneColor, const FScreenPassRenderTarget& Output, const FCloudSceneDepthParameters& SceneDepth);
+
+	/** Marches the visible volumes and reconstructs them at full resolution. Returns the new history of the view. */
+	FRDGTextureRef RenderNearClouds(FRDGBuilder& GraphBuilder, const FSceneView& View, const FCloudViewState& ViewState, const FIntPoint& ViewSize, const FCloudSceneDepthParameters& SceneDepth);
+
+	FCloudMarchSettings MarchSettings;
+
+	// Created on the render thread once the noise volumes are baked or loaded from the cache.
+	FCloudNoiseTextures NoiseTextures;
+
+	// Game thread only.
+	TFuture<FCloudNoiseBake> NoiseBake;
+	TFuture<FString> WeatherMapBake;
+	uint32 NextCloudVolumeId = 1;
+	TBitArray<> BrickVolumeIds;
+	FCloudSettings GameSettings;
+	const UObject* GameSettingsOwner = nullptr;
+	uint64 LastSnapshotFrame = MAX_uint64;
+	uint32 LastPublishedFamilyFrame = 0;
+	FCloudFrameSnapshot GameSnapshot;
+
+	// Game thread copies of what the render thread marches, for GetQueryScene_GameThread.
+	TMap<uint32, FCloudVolume> GameVolumes;
+	TMap<uint32, TSharedPtr<const FCloudBrickVolumeFile>> GameBrickVolumes;
+	TSharedPtr<const FCloudWeatherTileCache> GameWeatherMap;
+	FCloudMarchSettings GameMarchSettings;
+	TSharedPtr<const FCloudQueryScene> QueryScene;
+	uint64 QuerySceneFrame = MAX_uint64;
+
+	// Written on the game thread, read on the render thread.
+	FCloudSettingsMailbox SettingsMailbox;
+
+	// Only accessed on the render thread.
+	FCloudVolumeRegistry CloudVolumes;
+	FCloudWeatherClipmap WeatherClipmap;
+	FCloudBrickPool BrickPool;
+	FCloudLightingCache LightingCache;
+	FCloudPanoramaCache PanoramaCache;
+	FCloudBudgetController BudgetController;
+	FRenderQueryPoolRHIRef TimerQueryPool;
+
+	// Oldest first; the last one belongs to the family being rendered.
+	TArray<FCloudGpuTiming> PendingGpuTimings;
+
+	FCloudFamilyState FamilyState;
+
+	// Views are only valid while their family renders, so this is reset for every family.
+	TMap<const FSceneView*, FCloudViewState> ViewStates;
+	TMap<uint32, FCloudViewHistory> ViewHistories;
+
+	// Trace being recorded, see r.Clouds.Trace.
+	TUniquePtr<FCloudTraceWriter> TraceWriter;
+	FString TracePath;
 };
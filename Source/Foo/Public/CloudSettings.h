@@ -0,0 +1,114 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "HAL/CriticalSection.h"
+#include "Misc/ScopeLock.h"
+
+struct FCloudMarchSettings;
+
+// ================================================================================================
+
+/** Game side settings of the clouds, see UCloudSettingsComponent. Defaults match FCloudMarchSettings. */
+struct FCloudSettings
+{
+	/** Wind velocity in world units per second. */
+	FVector3f WindVelocity = FVector3f(100.0f, 30.0f, 0.0f);
+
+	/** Tiling frequencies of the noise volumes in 1 / world units. */
+	float ShapeFrequency = 1.0f / 800.0f;
+	float DetailFrequency = 1.0f / 150.0f;
+
+	/** How much the detail noise erodes the edges of the shape, 0-1. */
+	float DetailStrength = 0.35f;
+
+	/** Extinction per world unit at density 1. */
+	float Extinction = 0.02f;
+
+	FVector3f SunDirection = FVector3f(0.5f, 0.3f, 0.8f).GetSafeNormal();
+
+	/** Henyey-Greenstein asymmetry parameter. */
+	float PhaseG = 0.5f;
+
+	FVector3f SunIlluminance = FVector3f(3.0f, 2.85f, 2.7f);
+	FVector3f AmbientIlluminance = FVector3f(0.25f, 0.3f, 0.4f);
+
+	/** Copies the settings into the matching fields of the march, leaving the others alone. */
+	FOO_API void ApplyTo(FCloudMarchSettings& OutSettings) const;
+};
+
+/** Everything the render thread takes from the game thread for a frame of clouds. */
+struct FCloudFrameSnapshot
+{
+	FCloudSettings Settings;
+
+	/** FApp::GetGameTime() of the game frame, which drives the wind. */
+	double GameTime = 0.0;
+
+	/** GFrameCounter of the game frame, 0 before the first snapshot. */
+	uint64 FrameNumber = 0;
+};
+
+/**
+ * Hands FCloudFrameSnapshot from the game thread to the render thread. Snapshots are published for
+ * every view family, keyed by FSceneViewFamily::FrameNumber, and the render thread consumes the one of
+ * the family it renders. The game thread can be frames ahead, so the latest snapshot would render,
+ * and trace, a family with the settings of a later frame.
+ *
+ * The last NumEntries snapshots are kept in a ring, which covers the frames the game thread can be
+ * ahead with a few families each. The lock is only held to copy a snapshot, and neither side
+ * allocates or enqueues render commands.
+ *
+ * Single producer (game thread), single consumer (render thread).
+ */
+class FCloudSettingsMailbox
+{
+public:
+	/** Game thread: publishes the snapshot of the family with FrameNumber, replacing the oldest one. */
+	void Publish(uint32 FrameNumber, const FCloudFrameSnapshot& Snapshot)
+	{
+		FScopeLock Lock(&CriticalSection);
+		FEntry& Entry = Entries[NextEntry];
+		Entry.Snapshot = Snapshot;
+		Entry.FrameNumber = FrameNumber;
+		Entry.bValid = true;
+		NextEntry = (NextEntry + 1) % NumEntries;
+	}
+
+	/**
+	 * Render thread: the snapshot published for the family with FrameNumber. Families without one,
+	 * e.g. because it was already replaced, keep the previous snapshot. Valid until the next call.
+	 */
+	const FCloudFrameSnapshot& Consume(uint32 FrameNumber)
+	{
+		FScopeLock Lock(&CriticalSection);
+
+		// Newest first, in case a frame number was published twice.
+		for (int32 Age = 1; Age <= NumEntries; ++Age)
+		{
+			const FEntry& Entry = Entries[(NextEntry + NumEntries - Age) % NumEntries];
+			if (Entry.bValid && Entry.FrameNumber == FrameNumber)
+			{
+				Consumed = Entry.Snapshot;
+				break;
+			}
+		}
+		return Consumed;
+	}
+
+private:
+	static constexpr int32 NumEntries = 8;
+
+	struct FEntry
+	{
+		FCloudFrameSnapshot Snapshot;
+		uint32 FrameNumber = 0;
+		bool bValid = false;
+	};
+
+	FCriticalSection CriticalSection;
+	FEntry Entries[NumEntries];
+	int32 NextEntry = 0;
+
+	// Render thread only.
+	FCloudFrameSnapshot Consumed;
+};
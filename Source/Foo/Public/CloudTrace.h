@@ -0,0 +1,110 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "CloudRaymarch.h"
+#include "CloudSettings.h"
+
+struct FConvexVolume;
+
+// ================================================================================================
+
+/** A view of a traced family, as FCloudSceneViewExtension saw it. */
+struct FCloudTraceView
+{
+	/** FSceneView::GetViewKey(), 0 for views without a persistent state. */
+	uint32 ViewKey = 0;
+
+	FVector Origin = FVector::ZeroVector;
+	FRotator3f Rotation = FRotator3f::ZeroRotator;
+	FMatrix44f ProjectionMatrix = FMatrix44f::Identity;
+
+	/** Unscaled view rect, and the size of the post process view rect the clouds are rendered at. */
+	FIntRect ViewRect;
+	FIntPoint CloudViewSize = FIntPoint::ZeroValue;
+
+	/** Scene captures and reflections that only composite the panorama, see r.Clouds.Panorama.Captures. */
+	bool bIsCapture = false;
+
+	/** World to clip of the view, from the same matrices FSceneView builds. */
+	FOO_API FMatrix GetWorldToClip() const;
+	FOO_API void GetViewFrustum(FConvexVolume& OutFrustum) const;
+
+	/** CPU reference camera of the view at 1 / ResolutionDivisor of the cloud view size. */
+	FOO_API FCloudReferenceCamera GetReferenceCamera(uint32 ResolutionDivisor) const;
+};
+
+/**
+ * Inputs of the clouds for one view family. Volumes are delta encoded against the previous frame of
+ * the trace, like the render commands that update FCloudVolumeRegistry.
+ */
+struct FCloudTraceFrame
+{
+	/** Game frame and time of the settings snapshot, see FCloudFrameSnapshot. */
+	FCloudFrameSnapshot Snapshot;
+
+	/** Quality the family rendered at, after r.Clouds.BudgetMs. */
+	uint32 ResolutionDivisor = 1;
+	int32 NumSteps = 0;
+	int32 NumLightSteps = 0;
+
+	/** Near distance of the panorama, 0 if views march all volumes. */
+	float PanoramaNearDistance = 0.0f;
+
+	TArray<FCloudTraceView> Views;
+
+	/** Volumes added or changed since the previous frame, by id. */
+	TArray<TPair<uint32, FCloudVolume>> ChangedVolumes;
+	TArray<uint32> RemovedVolumes;
+};
+
+/**
+ * Records a compact binary trace (.ctr) of the per frame inputs of the clouds, so spikes seen in the
+ * field can be replayed offline with the CloudReplay commandlet. Frames are appended as they come;
+ * a trace cut short by a crash is readable up to its last complete frame.
+ */
+class FCloudTraceWriter
+{
+public:
+	FOO_API ~FCloudTraceWriter();
+
+	/** Creates the file and writes its header. Returns false if it cannot be written. */
+	FOO_API bool Open(const FString& Path);
+
+	/**
+	 * Appends a frame with every volume of the scene, Ids[i] being the id of Volumes[i]. Only the changes
+	 * since the last frame are written; the volume deltas of Frame are ignored.
+	 */
+	FOO_API void WriteFrame(const FCloudTraceFrame& Frame, TConstArrayView<uint32> Ids, TConstArrayView<FCloudVolume> Volumes);
+
+	int32 GetNumFrames() const { return NumFrames; }
+	const FString& GetPath() const { return Path; }
+
+private:
+	TUniquePtr<FArchive> Writer;
+	FString Path;
+	TMap<uint32, FCloudVolume> LastVolumes;
+	int32 NumFrames = 0;
+};
+
+/** Reads the frames of a trace in order, tracking the volumes the deltas add up to. */
+class FCloudTraceReader
+{
+public:
+	/**
+	 * Opens the file and checks its header. Frames are streamed from it as they are read, so traces of
+	 * any length replay in the memory of a single frame. Returns false if it is missing or not a trace
+	 * of this version.
+	 */
+	FOO_API bool Open(const FString& Path);
+
+	/** Reads the next frame. Returns false at the end of the trace or at a truncated frame. */
+	FOO_API bool ReadFrame(FCloudTraceFrame& OutFrame);
+
+	/** Every volume after the frames read so far, by id. */
+	const TMap<uint32, FCloudVolume>& GetVolumes() const { return Volumes; }
+
+private:
+	TUniquePtr<FArchive> Reader;
+	TArray<uint8> FrameBytes;
+	TMap<uint32, FCloudVolume> Volumes;
+};
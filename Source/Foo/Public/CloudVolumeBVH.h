@@ -0,0 +1,64 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "CloudRaymarch.h"
+
+// ================================================================================================
+
+/**
+ * Four-wide bounding volume hierarchy over the cloud volume bounds, owned by the render thread.
+ *
+ * Every node stores the bounds of its four children in SoA layout, so frustum culling tests four
+ * boxes per SIMD instruction and descends only into intersecting children. Subtrees entirely inside
+ * the frustum are appended without further tests. Children are either nodes or single volumes.
+ *
+ * Adding or removing volumes requires a Build(); moving a volume only refits its ancestors.
+ */
+class FCloudVolumeBVH
+{
+public:
+	/** Rebuilds the tree over Volumes, splitting at the median of the largest centroid axis. */
+	FOO_API void Build(TConstArrayView<FCloudVolume> Volumes);
+
+	/** Updates the bounds of a volume the tree was built with and grows or shrinks its ancestors. */
+	FOO_API void Refit(int32 VolumeIndex, const FCloudVolume& Volume);
+
+	/**
+	 * Appends the indices of all volumes intersecting the convex volume to OutVisible, in no particular
+	 * order. Planes point outwards, as in FConvexVolume.
+	 */
+	FOO_API void Cull(TConstArrayView<FPlane> Planes, TArray<uint32>& OutVisible) const;
+
+	bool IsEmpty() const { return Nodes.Num() == 0; }
+	int32 GetNumNodes() const { return Nodes.Num(); }
+
+private:
+	static constexpr uint32 LeafFlag = 0x80000000u;
+	static constexpr uint32 EmptyChild = 0xffffffffu;
+
+	struct alignas(16) FNode
+	{
+		float MinX[4];
+		float MinY[4];
+		float MinZ[4];
+		float MaxX[4];
+		float MaxY[4];
+		float MaxZ[4];
+
+		/** Node index, LeafFlag | volume index, or EmptyChild. */
+		uint32 Children[4];
+	};
+
+	int32 BuildNode(TArrayView<int32> Indices, TConstArrayView<FCloudVolume> Volumes, TConstArrayView<FVector3f> Centers, uint32 ParentSlot);
+	void SetSlotBounds(uint32 NodeSlot, const FVector3f& Min, const FVector3f& Max);
+	void GetNodeBounds(int32 NodeIndex, FVector3f& OutMin, FVector3f& OutMax) const;
+	void AppendSubtree(uint32 NodeIndex, TArray<uint32>& OutVisible) const;
+
+	TArray<FNode> Nodes;
+
+	// Slot of the parent referencing each node, NodeIndex * 4 + child, EmptyChild for the root.
+	TArray<uint32> NodeParentSlots;
+
+	// Slot referencing each volume, NodeIndex * 4 + child.
+	TArray<uint32> VolumeSlots;
+};
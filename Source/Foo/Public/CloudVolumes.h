@@ -0,0 +1,79 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RenderGraphResources.h"
+#include "UnifiedBuffer.h"
+#include "CloudRaymarch.h"
+#include "CloudVolumeBVH.h"
+
+class FRDGBuilder;
+struct FConvexVolume;
+
+// ================================================================================================
+
+/** GPU layout of a cloud volume in the instance buffer, read by GetCloudVolume() in CloudCommon.ush. */
+struct FCloudVolumeInstance
+{
+	FVector4f BoundsMinDensityScale;
+	FVector4f BoundsMaxCoverage;
+	FVector4f BrickVolume;
+
+	explicit FCloudVolumeInstance(const FCloudVolume& Volume)
+		: BoundsMinDensityScale(Volume.BoundsMin, Volume.DensityScale)
+		, BoundsMaxCoverage(Volume.BoundsMax, Volume.Coverage)
+		, BrickVolume(float(Volume.BrickVolume), 0.0f, 0.0f, 0.0f)
+	{
+	}
+};
+
+static_assert(sizeof(FCloudVolumeInstance) == 3 * sizeof(FVector4f), "CloudCommon.ush reads three float4 per volume.");
+
+// ================================================================================================
+
+/**
+ * Render thread copy of all cloud volumes of the scene. Volumes are kept densely packed and mirrored
+ * into a persistent GPU instance buffer; only the entries changed since the last upload are
+ * scattered into it, so moving a single volume does not re-upload the others.
+ *
+ * A BVH over the volume bounds is rebuilt lazily after volumes were added or removed and refit when
+ * they move, see FCloudVolumeBVH.
+ */
+class FCloudVolumeRegistry
+{
+public:
+	void Add(uint32 Id, const FCloudVolume& Volume);
+	void Update(uint32 Id, const FCloudVolume& Volume);
+	void Remove(uint32 Id);
+
+	int32 Num() const { return Volumes.Num(); }
+
+	/** Densely packed volumes, indexed like the instance buffer. */
+	TConstArrayView<FCloudVolume> GetVolumes() const { return Volumes; }
+
+	/** Ids of the volumes, parallel to GetVolumes(). */
+	TConstArrayView<uint32> GetVolumeIds() const { return VolumeIds; }
+
+	/** Appends the indices of the volumes intersecting the frustum to OutVisible. */
+	void Cull(const FConvexVolume& Frustum, TArray<uint32>& OutVisible);
+
+	/** Uploads the pending changes and returns the instance buffer, see FCloudVolumeInstance. */
+	FRDGBufferRef UpdateInstanceBuffer(FRDGBuilder& GraphBuilder);
+
+private:
+	void MarkDirty(int32 Index);
+
+	TArray<FCloudVolume> Volumes;
+	TArray<uint32> VolumeIds;
+	TMap<uint32, int32> IdToIndex;
+
+	// Indices written since the last upload; DirtyFlags keeps the list free of duplicates.
+	TArray<int32> DirtyIndices;
+	TBitArray<> DirtyFlags;
+
+	FCloudVolumeBVH Bvh;
+	bool bBvhNeedsBuild = false;
+	int32 NumRefitsSinceBuild = 0;
+
+	TRefCountPtr<FRDGPooledBuffer> InstanceBuffer;
+	FRDGScatterUploadBuffer InstanceUploader;
+};
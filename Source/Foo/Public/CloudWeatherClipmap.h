@@ -0,0 +1,58 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "RenderGraphUtils.h"
+#include "ShaderParameterMacros.h"
+#include "CloudWeatherMap.h"
+
+// ================================================================================================
+
+BEGIN_SHADER_PARAMETER_STRUCT(FCloudWeatherShaderParameters,)
+	SHADER_PARAMETER_TEXTURE(Texture2D, CloudWeatherClipmap)
+	SHADER_PARAMETER_TEXTURE(Texture2D, CloudWeatherOverview)
+	SHADER_PARAMETER_SAMPLER(SamplerState, CloudWeatherClipmapSampler)
+	SHADER_PARAMETER_SAMPLER(SamplerState, CloudWeatherOverviewSampler)
+	SHADER_PARAMETER_RDG_BUFFER_SRV(StructuredBuffer<int2>, CloudWeatherSlotTiles)
+	SHADER_PARAMETER(FVector2f, CloudWeatherMapOrigin)
+	SHADER_PARAMETER(float, CloudWeatherTileSize)
+	SHADER_PARAMETER(FIntPoint, CloudWeatherNumTiles)
+	SHADER_PARAMETER(uint32, CloudWeatherClipmapTiles)
+	SHADER_PARAMETER(uint32, CloudWeatherEnabled)
+END_SHADER_PARAMETER_STRUCT()
+
+/**
+ * GPU side of the weather map streaming, owned by the render thread. Keeps the ClipmapTiles^2 tiles
+ * around the camera in a texture addressed toroidally, so when the camera crosses a tile border only
+ * the row or column of tiles that came into range is uploaded, read through an FCloudWeatherTileCache.
+ * The whole map overview is always resident and covers everything else.
+ */
+class FCloudWeatherClipmap
+{
+public:
+	/** Opens the weather map and creates the textures. Clouds use neutral weather if this fails. */
+	void Initialize(FRHICommandListImmediate& RHICmdList, const FString& Path, int32 InClipmapTiles, int32 CacheTiles);
+
+	bool IsValid() const { return ClipmapTexture.IsValid(); }
+
+	/** Uploads missing tiles around the camera, nearest first, at most MaxUploads per call. */
+	void Update(FRHICommandListImmediate& RHICmdList, const FVector& CameraOrigin, int32 MaxUploads, int32 CacheTiles);
+
+	void SetupParameters(FRDGBuilder& GraphBuilder, FCloudWeatherShaderParameters& OutParameters) const;
+
+	const FCloudWeatherTileCache& GetCache() const { return Cache; }
+
+private:
+	int32 GetSlot(const FIntPoint& Tile) const;
+
+	FCloudWeatherTileCache Cache;
+
+	FTextureRHIRef ClipmapTexture;
+	FTextureRHIRef OverviewTexture;
+	int32 ClipmapTiles = 0;
+
+	// Tile held by every slot of the clipmap texture.
+	TArray<FIntPoint> SlotTiles;
+
+	// Tile offsets of the clipmap window relative to the camera tile, nearest first.
+	TArray<FIntPoint> UpdateOrder;
+};
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "CoreMinimal.h"
+#include "Containers/LruCache.h"
+
+class IMappedFileHandle;
+class IMappedFileRegion;
+
+// ================================================================================================
+
+/**
+ * Layout of a tiled weather map file. The map covers NumTiles * TileWorldSize world units in X and Y
+ * starting at Origin. Every texel is an FColor: R coverage, G cloud type (0 flat, 1 towering),
+ * B precipitation.
+ *
+ * The file holds a header, an OverviewResolution^2 downsampled copy of the whole map, and then all
+ * tiles in row major order, each TileResolution^2 texels starting at a page aligned offset, so that
+ * every tile can be memory mapped on its own.
+ */
+struct FCloudWeatherMapDesc
+{
+	int32 TileResolution = 64;
+	FIntPoint NumTiles = FIntPoint(64, 64);
+	float TileWorldSize = 102400.0f;
+	FVector2f Origin = FVector2f(-3276800.0f, -3276800.0f);
+	int32 OverviewResolution = 256;
+
+	int64 GetTileBytes() const { return int64(TileResolution) * TileResolution * sizeof(FColor); }
+	int64 GetOverviewOffset() const;
+	int64 GetTileOffset(const FIntPoint& Tile) const;
+
+	bool IsValidTile(const FIntPoint& Tile) const
+	{
+		return Tile.X >= 0 && Tile.Y >= 0 && Tile.X < NumTiles.X && Tile.Y < NumTiles.Y;
+	}
+
+	/** Tile containing the world position, which may lie outside the map. */
+	FIntPoint GetTile(const FVector2f& WorldXY) const;
+};
+
+/** Weather at a point, see FCloudWeatherMapDesc. Defaults match the clouds without a weather map. */
+struct FCloudWeatherSample
+{
+	float Coverage = 1.0f;
+	float Type = 1.0f;
+	float Precipitation = 0.0f;
+};
+
+/** Lifetime totals of a tile cache, for sizing r.Clouds.Weather.CacheTiles. */
+struct FCloudWeatherCacheStats
+{
+	uint64 Hits = 0;
+	uint64 Misses = 0;
+	uint64 Evictions = 0;
+	int32 ResidentTiles = 0;
+};
+
+// ================================================================================================
+
+/**
+ * Least recently used cache of memory mapped weather map tiles. Only resident tiles are mapped, so
+ * the memory use is bounded by the capacity no matter how large the map is. Not thread safe.
+ */
+class FCloudWeatherTileCache
+{
+public:
+	FOO_API FCloudWeatherTileCache();
+	FOO_API ~FCloudWeatherTileCache();
+
+	/** Maps the header and overview of the file. Returns false if it is missing or invalid. */
+	FOO_API bool Open(const FString& Path, int32 CapacityTiles);
+	FOO_API void Close();
+
+	bool IsOpen() const { return FileHandle.IsValid(); }
+	const FCloudWeatherMapDesc& GetDesc() const { return Desc; }
+
+	/** OverviewResolution^2 texels covering the whole map. */
+	FOO_API TConstArrayView<FColor> GetOverview() const;
+
+	/** Returns the texels of a tile, mapping it and evicting the least recently used tile if needed. */
+	FOO_API const FColor* GetTile(const FIntPoint& Tile);
+
+	/** Bilinear lookup at full resolution, mapping tiles as needed. Neutral weather outside the map. */
+	FOO_API FCloudWeatherSample Sample(const FVector2f& WorldXY);
+
+	/**
+	 * Bilinear lookup in the overview, like the GPU for tiles that are not resident. Neutral weather
+	 * outside the map. Only reads the overview, so it is safe to call from any thread.
+	 */
+	FOO_API FCloudWeatherSample SampleOverview(const FVector2f& WorldXY) const;
+
+	FOO_API void SetCapacity(int32 CapacityTiles);
+
+	const FCloudWeatherCacheStats& GetStats() const { return Stats; }
+
+private:
+	FCloudWeatherMapDesc Desc;
+
+	TUniquePtr<IMappedFileHandle> FileHandle;
+	TUniquePtr<IMappedFileRegion> OverviewRegion;
+
+	// Declared after the file handle, since regions must be unmapped before the file is closed.
+	TLruCache<FIntPoint, TSharedPtr<IMappedFileRegion>> Tiles;
+
+	FCloudWeatherCacheStats Stats;
+};
+
+// ================================================================================================
+
+namespace CloudWeather
+{
+	/** Writes a weather map file, evaluating Texel(X, Y) for every texel of the map. */
+	FOO_API bool WriteWeatherMap(const FString& Path, const FCloudWeatherMapDesc& Desc, TFunctionRef<FColor(int32 X, int32 Y)> Texel);
+
+	/** Returns a procedural weather map of the default size, baking it on first use. */
+	FOO_API FString BakeOrFindProceduralWeatherMap();
+}
@@ -4,6 +4,11 @@
 
 #include "CoreMinimal.h"
 #include "Modules/ModuleManager.h"
+#include "Async/Future.h"
+
+class FCloudQueryScene;
+class FCloudSceneViewExtension;
+struct FCloudQuerySegment;
 
 class FFooModule : public IModuleInterface
 {
@@ -13,6 +18,29 @@ public:
 	virtual void StartupModule() override;
 	virtual void ShutdownModule() override;
 
+	static FFooModule& Get()
+	{
+		return FModuleManager::LoadModuleChecked<FFooModule>("Foo");
+	}
+
+	/** Null until the engine finished initializing. */
+	FCloudSceneViewExtension* GetCloudSceneViewExtension() const { return CloudSceneViewExtension.Get(); }
+
+	/**
+	 * Cloud density at points and transmittance along segments for gameplay, e.g. line of sight checks.
+	 * Evaluated on the CPU with the density model of the march, so they never wait for the GPU. Call
+	 * them on the game thread; they see the clouds of the current frame, see FCloudQueryScene. Before
+	 * the engine finished initializing there are no clouds.
+	 */
+	FOO_API void QueryCloudDensity(TConstArrayView<FVector> Points, TArrayView<float> OutDensity) const;
+	FOO_API void QueryCloudTransmittance(TConstArrayView<FCloudQuerySegment> Segments, TArrayView<float> OutTransmittance) const;
+
+	/** Same as above on the task graph, evaluated against the clouds of the frame they were issued in. */
+	FOO_API TFuture<TArray<float>> QueryCloudDensityAsync(TArray<FVector> Points) const;
+	FOO_API TFuture<TArray<float>> QueryCloudTransmittanceAsync(TArray<FCloudQuerySegment> Segments) const;
+
+	/** The clouds of the current frame, for callers that query them from their own tasks. Game thread only. */
+	FOO_API TSharedPtr<const FCloudQueryScene> GetCloudQueryScene() const;
 
 private:
 	TSharedPtr<FCloudSceneViewExtension> CloudSceneViewExtension;